@@ -0,0 +1,73 @@
+#include "arena.h"
+#include "exception_handling.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_FIRST_BLOCK_SIZE (64 * 1024)
+
+// C99 has no max_align_t, so this stands in for it
+typedef union {
+    long double ld;
+    long long ll;
+    void* p;
+    void (*fp)(void);
+} ArenaAlignment;
+
+struct ArenaBlock {
+    ArenaBlock* previous;
+    size_t size;
+    size_t used;
+    ArenaAlignment data[]; // allocations are handed out as bytes from here
+};
+
+static ArenaBlock* new_arena_block(ArenaBlock* previous, size_t at_least) {
+    size_t size = previous != NULL ? previous->size * 2 : ARENA_FIRST_BLOCK_SIZE;
+    while (size < at_least) size *= 2;
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+    if (block == NULL) {
+        raiseException(1,  "Failed to allocate %zu bytes of scratch memory\n", size);
+    }
+    block->previous = previous;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    const size_t alignment = sizeof(ArenaAlignment);
+    size = (size + alignment - 1) / alignment * alignment;
+    if (arena->current == NULL || arena->current->size - arena->current->used < size) {
+        arena->current = new_arena_block(arena->current, size);
+    }
+    void* allocation = (unsigned char*)arena->current->data + arena->current->used;
+    arena->current->used += size;
+    return allocation;
+}
+
+char* arena_strndup(Arena* arena, const char* str, size_t length) {
+    char* copy = arena_alloc(arena, length + 1);
+    memcpy(copy, str, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+ArenaMark arena_mark(Arena* arena) {
+    if (arena->current == NULL) { // so that releasing back to this mark keeps a block around to reuse
+        arena->current = new_arena_block(NULL, 0);
+    }
+    return (ArenaMark){arena->current, arena->current->used};
+}
+
+void arena_release(Arena* arena, ArenaMark mark) {
+    while (arena->current != NULL && arena->current != mark.block) {
+        ArenaBlock* previous = arena->current->previous;
+        free(arena->current);
+        arena->current = previous;
+    }
+    if (arena->current != NULL) arena->current->used = mark.used;
+}
+
+Arena* command_arena() {
+    static Arena arena = {NULL};
+    return &arena;
+}
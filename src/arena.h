@@ -0,0 +1,31 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// A bump allocator for memory that all goes away together, such as everything belonging to one REPL command.
+// Allocations are never freed individually; instead arena_release drops everything allocated since a mark.
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct Arena {
+    ArenaBlock* current;
+} Arena;
+
+typedef struct ArenaMark {
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+// Allocations are aligned for any type. Raises an exception if memory runs out, so never returns NULL.
+void* arena_alloc(Arena* arena, size_t size);
+char* arena_strndup(Arena* arena, const char* str, size_t length);
+
+ArenaMark arena_mark(Arena* arena);
+void arena_release(Arena* arena, ArenaMark mark);
+
+// Scratch memory for the command currently running. parseREPLCommand releases it when the command finishes
+// (and the REPL loops when one fails), so anything that has to outlive the command must be copied out of it.
+Arena* command_arena();
+
+#endif // ARENA_H
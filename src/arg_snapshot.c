@@ -0,0 +1,299 @@
+#include "arg_snapshot.h"
+#include "exception_handling.h"
+#include "invoke_handler.h"
+#include "output_buffer.h"
+#include "return_formatter.h"
+#include "structured_output.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SNAPSHOT_COPY_LIMIT (64 * 1024) // anything bigger is hashed per page instead of copied
+#define SNAPSHOT_PAGE_SIZE 4096
+#define MAX_PRINTED_CHANGED_RANGES 16
+#define CHANGED_RANGE_MERGE_GAP 4 // unchanged runs shorter than this don't split a range
+#define CHANGED_RANGE_MAX_ELEMS 16 // per side of each range, unless --max-elems says otherwise
+
+typedef struct ArgSnapshot {
+    bool tracked;            // false for args that aren't printed after the call at all
+    bool always_print;       // the arg leads on to memory the snapshot doesn't cover, eg a struct holding pointers
+    const unsigned char* memory;
+    size_t size;
+    unsigned char* copy;     // for blocks up to SNAPSHOT_COPY_LIMIT
+    uint64_t* page_hashes;   // for bigger ones
+} ArgSnapshot;
+
+struct CallSnapshot {
+    unsigned int arg_count;
+    ArgSnapshot* args;
+};
+
+static bool print_all_args = false;
+
+void set_print_all_args(bool print_all) {
+    print_all_args = print_all;
+}
+
+bool get_print_all_args() {
+    return print_all_args;
+}
+
+static bool is_printed_after_return(const ArgInfo* arg) {
+    return arg->is_array || arg->pointer_depth > 0;
+}
+
+// whether any of a struct's fields point outside of the struct's own bytes
+static bool struct_holds_pointers(const ArgInfo* struct_arg) {
+    StructInfo* struct_info = struct_arg->struct_info;
+    for (unsigned int i = 0; i < struct_info->info.arg_count; i++) {
+        const ArgInfo* field = struct_info->info.args[i];
+        if (field->pointer_depth > 0 || field->type == TYPE_STRING) return true;
+        if (field->is_array && field->array_value_pointer_depth > 0) return true;
+        if (field->type == TYPE_STRUCT && struct_holds_pointers(field)) return true;
+    }
+    return false;
+}
+
+// The bytes an array or pointer arg refers to, following the same pointers format_and_print_arg_value does.
+// Returns NULL (with size 0) if one of them is NULL.
+static const unsigned char* resolve_arg_memory(const ArgInfo* arg, size_t* size) {
+    *size = 0;
+    const void* value = arg->value;
+    for (int j = 0; j < arg->pointer_depth; j++) {
+        value = *(void**)value;
+        if (value == NULL) return NULL;
+    }
+    if (arg->is_array) {
+        value = *(void**)value; // because arrays are stored as pointers
+        *size = typeToSize(arg->type, arg->array_value_pointer_depth) * get_size_for_arginfo_sized_array(arg);
+    } else {
+        *size = typeToSize(arg->type, 0);
+    }
+    return value;
+}
+
+static uint64_t hash_page(const unsigned char* data, size_t length) {
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ length;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+    if (i < length) {
+        uint64_t word = 0;
+        memcpy(&word, data + i, length - i);
+        hash = (hash ^ word) * 0xFF51AFD7ED558CCDULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+static size_t page_count(size_t size) {
+    return (size + SNAPSHOT_PAGE_SIZE - 1) / SNAPSHOT_PAGE_SIZE;
+}
+
+static size_t page_length(size_t size, size_t page) {
+    size_t start = page * SNAPSHOT_PAGE_SIZE;
+    return size - start < SNAPSHOT_PAGE_SIZE ? size - start : SNAPSHOT_PAGE_SIZE;
+}
+
+static void capture_memory(ArgSnapshot* snap, const unsigned char* memory, size_t size) {
+    snap->memory = memory;
+    snap->size = size;
+    if (memory == NULL || size == 0) return;
+    if (size <= SNAPSHOT_COPY_LIMIT) {
+        snap->copy = malloc(size);
+        if (snap->copy == NULL) raiseException(1,  "Failed to allocate memory for an argument snapshot.\n");
+        memcpy(snap->copy, memory, size);
+    } else {
+        size_t pages = page_count(size);
+        snap->page_hashes = malloc(pages * sizeof(uint64_t));
+        if (snap->page_hashes == NULL) raiseException(1,  "Failed to allocate memory for an argument snapshot.\n");
+        for (size_t page = 0; page < pages; page++) {
+            snap->page_hashes[page] = hash_page(memory + page * SNAPSHOT_PAGE_SIZE, page_length(size, page));
+        }
+    }
+}
+
+CallSnapshot* snapshot_call_args(const FunctionCallInfo* call_info, void** struct_values) {
+    if (print_all_args || output_is_quiet() || is_structured_output_format()) return NULL;
+
+    CallSnapshot* snapshot = calloc(1, sizeof(CallSnapshot));
+    if (snapshot == NULL) raiseException(1,  "Failed to allocate memory for an argument snapshot.\n");
+    snapshot->arg_count = call_info->info.arg_count;
+    snapshot->args = calloc(call_info->info.arg_count > 0 ? call_info->info.arg_count : 1, sizeof(ArgSnapshot));
+    if (snapshot->args == NULL) raiseException(1,  "Failed to allocate memory for an argument snapshot.\n");
+
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        const ArgInfo* arg = call_info->info.args[i];
+        ArgSnapshot* snap = &snapshot->args[i];
+        if (!is_printed_after_return(arg)) continue;
+        snap->tracked = true;
+        if (arg->type == TYPE_STRUCT) {
+            if (struct_holds_pointers(arg)) {
+                snap->always_print = true;
+                continue;
+            }
+            const void* raw = struct_values[i];
+            for (int j = 0; j < arg->pointer_depth; j++) raw = *(void**)raw;
+            capture_memory(snap, raw, get_size_of_struct(arg));
+        } else if (arg->type == TYPE_STRING || (arg->is_array && arg->array_value_pointer_depth > 0)) {
+            snap->always_print = true; // the strings or pointed-to values could change without the pointers themselves changing
+        } else {
+            size_t size;
+            const unsigned char* memory = resolve_arg_memory(arg, &size);
+            capture_memory(snap, memory, size);
+        }
+    }
+    return snapshot;
+}
+
+void free_call_snapshot(CallSnapshot* snapshot) {
+    if (snapshot == NULL) return;
+    for (unsigned int i = 0; i < snapshot->arg_count; i++) {
+        free(snapshot->args[i].copy);
+        free(snapshot->args[i].page_hashes);
+    }
+    free(snapshot->args);
+    free(snapshot);
+}
+
+// A run of changed elements [start, end)
+typedef struct {
+    size_t start;
+    size_t end;
+} ChangedRange;
+
+typedef struct {
+    ChangedRange shown[MAX_PRINTED_CHANGED_RANGES];
+    size_t shown_count;
+    size_t total_count;
+    size_t last_end;
+    size_t changed_elements; // rounded out to whole pages for hashed snapshots
+} ChangedRanges;
+
+static void add_changed_elements(ChangedRanges* ranges, size_t start, size_t end) {
+    if (ranges->total_count > 0 && start < ranges->last_end) start = ranges->last_end; // an element can straddle two pages
+    if (start >= end) return;
+    ranges->changed_elements += end - start;
+    if (ranges->total_count > 0 && start <= ranges->last_end + CHANGED_RANGE_MERGE_GAP) {
+        ranges->last_end = end;
+        if (ranges->total_count <= MAX_PRINTED_CHANGED_RANGES) ranges->shown[ranges->shown_count - 1].end = end;
+        return;
+    }
+    ranges->total_count++;
+    ranges->last_end = end;
+    if (ranges->shown_count < MAX_PRINTED_CHANGED_RANGES) ranges->shown[ranges->shown_count++] = (ChangedRange){start, end};
+}
+
+static bool page_changed(const ArgSnapshot* snap, size_t page) {
+    size_t page_start = page * SNAPSHOT_PAGE_SIZE;
+    return hash_page(snap->memory + page_start, page_length(snap->size, page)) != snap->page_hashes[page];
+}
+
+static bool memory_changed(const ArgSnapshot* snap) {
+    if (snap->copy != NULL) return memcmp(snap->copy, snap->memory, snap->size) != 0;
+    for (size_t page = 0; page < page_count(snap->size); page++) {
+        if (page_changed(snap, page)) return true;
+    }
+    return false;
+}
+
+static void find_changed_ranges(const ArgSnapshot* snap, size_t element_size, ChangedRanges* ranges) {
+    memset(ranges, 0, sizeof(*ranges));
+    if (snap->copy != NULL) {
+        const size_t block = 64; // compare a block at a time to skip over the unchanged parts quickly
+        for (size_t offset = 0; offset < snap->size; offset += block) {
+            size_t length = snap->size - offset < block ? snap->size - offset : block;
+            if (memcmp(snap->copy + offset, snap->memory + offset, length) == 0) continue;
+            for (size_t element = offset / element_size; element * element_size < offset + length; element++) {
+                size_t element_start = element * element_size;
+                if (memcmp(snap->copy + element_start, snap->memory + element_start, element_size) != 0) {
+                    add_changed_elements(ranges, element, element + 1);
+                }
+            }
+        }
+    } else {
+        for (size_t page = 0; page < page_count(snap->size); page++) {
+            if (!page_changed(snap, page)) continue;
+            size_t page_start = page * SNAPSHOT_PAGE_SIZE;
+            add_changed_elements(ranges, page_start / element_size, (page_start + page_length(snap->size, page) + element_size - 1) / element_size);
+        }
+    }
+}
+
+static void print_arg_header(const ArgInfo* arg, int index) {
+    output_printf("Arg %d after function return: ", index);
+    format_and_print_arg_type(arg);
+    output_printf(" ");
+}
+
+static void print_whole_arg(const ArgInfo* arg, int index) {
+    print_arg_header(arg, index);
+    format_and_print_arg_value(arg);
+    output_printf("\n");
+}
+
+// [3] 4 -> 40, [10..12] { 1, 2, 3 } -> { 5, 6, 7 }, where the old values are only known for copied snapshots
+static void print_array_diff(const ArgInfo* arg, int index, const ArgSnapshot* snap, const ChangedRanges* ranges) {
+    size_t max_elems = get_output_limits().max_elems != 0 ? get_output_limits().max_elems : CHANGED_RANGE_MAX_ELEMS;
+    print_arg_header(arg, index);
+    output_puts("changed");
+    for (size_t r = 0; r < ranges->shown_count; r++) {
+        const ChangedRange* range = &ranges->shown[r];
+        output_puts(r == 0 ? " " : ", ");
+        if (range->end - range->start == 1) {
+            output_printf("[%zu] ", range->start);
+        } else {
+            output_printf("[%zu..%zu] ", range->start, range->end - 1);
+        }
+        if (snap->copy != NULL) {
+            print_array_slice(snap->copy, arg->type, range->start, range->end, max_elems);
+            output_puts(" -> ");
+        } else {
+            output_puts("now ");
+        }
+        print_array_slice(snap->memory, arg->type, range->start, range->end, max_elems);
+    }
+    if (ranges->total_count > ranges->shown_count) {
+        output_printf(", and %zu more changed ranges", ranges->total_count - ranges->shown_count);
+    }
+    output_printf("\n");
+}
+
+void print_args_after_return(const FunctionCallInfo* call_info, const CallSnapshot* snapshot) {
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        const ArgInfo* arg = call_info->info.args[i];
+        // if it could have been modified, print it
+        if (!is_printed_after_return(arg)) continue;
+        const ArgSnapshot* snap = snapshot == NULL ? NULL : &snapshot->args[i];
+        if (snap == NULL || !snap->tracked || snap->always_print) {
+            print_whole_arg(arg, i);
+            continue;
+        }
+
+        if (arg->type != TYPE_STRUCT) {
+            size_t size;
+            const unsigned char* memory = resolve_arg_memory(arg, &size);
+            if (memory != snap->memory || size != snap->size) { // repointed, or an array whose size comes from an output arg
+                print_whole_arg(arg, i);
+                continue;
+            }
+        }
+        if (snap->memory == NULL || snap->size == 0 || !memory_changed(snap)) continue;
+
+        if (!arg->is_array) {
+            print_whole_arg(arg, i);
+            continue;
+        }
+        ChangedRanges ranges;
+        find_changed_ranges(snap, typeToSize(arg->type, 0), &ranges);
+        if (ranges.changed_elements * 2 > get_size_for_arginfo_sized_array(arg)) { // mostly rewritten, so the whole thing is more compact than a diff
+            print_whole_arg(arg, i);
+        } else {
+            print_array_diff(arg, i, snap, &ranges);
+        }
+    }
+}
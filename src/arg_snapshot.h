@@ -0,0 +1,28 @@
+#ifndef ARG_SNAPSHOT_H
+#define ARG_SNAPSHOT_H
+
+#include "types_and_utils.h"
+#include <stdbool.h>
+
+// Before a call, the memory behind each array and pointer arg is captured so that afterwards only the args the callee
+// actually changed get printed, with arrays shown as a diff of the ranges that changed.
+// Small blocks are copied outright. Big ones only keep a hash per 4KB page, which is enough to say which parts changed
+// (though not what they used to be).
+
+typedef struct CallSnapshot CallSnapshot;
+
+// Whether to skip the snapshot and print every array and pointer arg after each call, as cliffi used to
+void set_print_all_args(bool print_all);
+bool get_print_all_args();
+
+// Returns NULL when no snapshot is needed, ie when nothing is printed, or every arg would be anyway.
+// struct_values are the raw struct values about to be passed to ffi_call, indexed by arg, since struct args aren't in their ArgInfo yet.
+CallSnapshot* snapshot_call_args(const FunctionCallInfo* call_info, void** struct_values);
+
+// Prints the "Arg N after function return" lines for each array or pointer arg, skipping any the snapshot shows are unchanged.
+// A NULL snapshot prints them all.
+void print_args_after_return(const FunctionCallInfo* call_info, const CallSnapshot* snapshot);
+
+void free_call_snapshot(CallSnapshot* snapshot);
+
+#endif // ARG_SNAPSHOT_H
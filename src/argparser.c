@@ -10,6 +10,7 @@
 #include <string.h>
 #include <stdio.h>
 #include "exception_handling.h"
+#include "output_buffer.h"
 
 // Function to allocate and initialize a new ArgInfo struct
 // ArgInfo* create_arg_info(ArgType type, const char* value) {
@@ -175,11 +176,11 @@ ArgInfo* parse_one_arg(int argc, char* argv[], int *extra_args_used, bool is_ret
             // if the value is a variable, we should cast it to the type specified in the flag and return
             ArgInfo* storedVar = getVar(argStr);
             if (storedVar != NULL) {
-                printf("Attempting cast from variable %s of type ", argStr);
+                output_printf("Attempting cast from variable %s of type ", argStr);
                 format_and_print_arg_type(storedVar);
-                printf(" to type ");
+                output_printf(" to type ");
                 format_and_print_arg_type(outArg);
-                printf("\n");
+                output_printf("\n");
                 castArgValueToType(outArg, storedVar);
                 goto set_args_used_and_return;
             }
@@ -198,7 +199,7 @@ ArgInfo* parse_one_arg(int argc, char* argv[], int *extra_args_used, bool is_ret
 void parse_all_from_argvs(ArgInfoContainer* info, int argc, char* argv[], int *extra_args_used, bool is_return, bool is_struct) {
     // ArgInfoContainer* arginfo = info->type == FUNCTION_INFO ? &info->function_info->info : &info->struct_info->info;
     #ifdef DEBUG
-    printf("Beginning to parse args (%d remaining)\n", argc);
+    output_printf("Beginning to parse args (%d remaining)\n", argc);
     #endif
     bool hit_struct_close = false;
     info->vararg_start = -1;
@@ -0,0 +1,296 @@
+#include "array_parser.h"
+#include "arena.h"
+#include "exception_handling.h"
+#include <ctype.h>
+#include <errno.h>
+#include <float.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The SWAR digit kernel reads 8 digits as one little endian 64 bit word
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined(_WIN32)
+#define use_swar_digits
+#endif
+
+// The exact float fast path relies on float and double arithmetic not being done at higher precision (eg on x87)
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define use_exact_float_fast_path
+#endif
+
+static bool is_separator(char c, bool from_file) {
+    return c == ',' || (from_file && isspace((unsigned char)c));
+}
+
+size_t count_array_literal_elements(const char* literal, size_t length, bool from_file) {
+    if (!from_file) {
+        size_t count = 1;
+        const char* end = literal + length;
+        for (const char* p = literal; (p = memchr(p, ',', (size_t)(end - p))) != NULL; p++) count++;
+        return count;
+    }
+    size_t count = 0;
+    bool in_element = false;
+    for (size_t i = 0; i < length; i++) {
+        bool separator = is_separator(literal[i], true);
+        if (!separator && !in_element) count++;
+        in_element = !separator;
+    }
+    return count;
+}
+
+#ifdef use_swar_digits
+static inline bool is_eight_digits(uint64_t v) {
+    return ((v & 0xF0F0F0F0F0F0F0F0ULL) | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+static inline uint32_t parse_eight_digits(uint64_t v) {
+    const uint64_t mask = 0x000000FF000000FFULL;
+    const uint64_t mul1 = 100 + (1000000ULL << 32);
+    const uint64_t mul2 = 1 + (10000ULL << 32);
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8); // pairs of digits
+    v = (((v & mask) * mul1) + (((v >> 16) & mask) * mul2)) >> 32;
+    return (uint32_t)v;
+}
+#endif
+
+// Accumulates a run of decimal digits into *value, returning how many there were.
+// Stops adding to *value (but keeps counting) once there are more than 19, since the result could then overflow.
+static size_t parse_digit_run(const char** cursor, const char* end, uint64_t* value) {
+    const char* p = *cursor;
+    size_t digits = 0;
+#ifdef use_swar_digits
+    while (end - p >= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, p, sizeof(chunk));
+        if (!is_eight_digits(chunk)) break;
+        if (digits + 8 <= 19) *value = *value * 100000000 + parse_eight_digits(chunk);
+        digits += 8;
+        p += 8;
+    }
+#endif
+    while (p < end && *p >= '0' && *p <= '9') {
+        if (digits < 19) *value = *value * 10 + (uint64_t)(*p - '0');
+        digits++;
+        p++;
+    }
+    *cursor = p;
+    return digits;
+}
+
+// Plain decimal integers only. Anything else (hex, octal, overflow) is left to strtol so the semantics stay the same as scalar args.
+static bool parse_decimal_integer_fast(const char* start, const char* end, bool* negative, uint64_t* magnitude) {
+    const char* p = start;
+    *negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        *negative = *p == '-';
+        p++;
+    }
+    if (p == end || (*p == '0' && end - p > 1)) return false; // leading 0 means octal or hex to strtol
+    *magnitude = 0;
+    size_t digits = parse_digit_run(&p, end, magnitude);
+    return digits > 0 && digits <= 19 && p == end;
+}
+
+#ifdef use_exact_float_fast_path
+static const double exact_powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                             1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+static const float exact_powers_of_ten_f[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+// Clinger's fast path: when the decimal significand and the power of ten are both exactly representable,
+// a single multiplication or division is correctly rounded, so the result matches strtod exactly.
+static bool parse_floating_point_fast(const char* start, const char* end, ArgType type, void* destination) {
+    const char* p = start;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    uint64_t significand = 0;
+    size_t digits = parse_digit_run(&p, end, &significand);
+    int exponent = 0;
+    if (p < end && *p == '.') {
+        p++;
+        size_t fraction_digits = parse_digit_run(&p, end, &significand);
+        digits += fraction_digits;
+        exponent -= (int)fraction_digits;
+    }
+    if (digits == 0 || digits > 19) return false;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            negative_exponent = *p == '-';
+            p++;
+        }
+        uint64_t explicit_exponent = 0;
+        size_t exponent_digits = parse_digit_run(&p, end, &explicit_exponent);
+        if (exponent_digits == 0 || exponent_digits > 3) return false;
+        exponent += negative_exponent ? -(int)explicit_exponent : (int)explicit_exponent;
+    }
+    if (p < end && (*p == 'f' || *p == 'F' || *p == 'd' || *p == 'D')) p++; // same suffixes as scalar args
+    if (p != end) return false;
+
+    if (type == TYPE_DOUBLE) {
+        if (significand > (1ULL << 53) || exponent < -22 || exponent > 22) return false;
+        double value = (double)significand;
+        value = exponent < 0 ? value / exact_powers_of_ten[-exponent] : value * exact_powers_of_ten[exponent];
+        *(double*)destination = negative ? -value : value;
+    } else {
+        if (significand > (1ULL << 24) || exponent < -10 || exponent > 10) return false;
+        float value = (float)significand;
+        value = exponent < 0 ? value / exact_powers_of_ten_f[-exponent] : value * exact_powers_of_ten_f[exponent];
+        *(float*)destination = negative ? -value : value;
+    }
+    return true;
+}
+#endif
+
+static void store_integer(ArgType type, bool negative, uint64_t magnitude, void* destination) {
+    // wraps the same way casting the result of strtol/strtoul does
+    uint64_t bits = negative ? (uint64_t)0 - magnitude : magnitude;
+    switch (type) {
+        case TYPE_SHORT: *(short*)destination = (short)bits; break;
+        case TYPE_INT: *(int*)destination = (int)bits; break;
+        case TYPE_LONG: *(long*)destination = (long)bits; break;
+        case TYPE_UCHAR: *(unsigned char*)destination = (unsigned char)bits; break;
+        case TYPE_USHORT: *(unsigned short*)destination = (unsigned short)bits; break;
+        case TYPE_UINT: *(unsigned int*)destination = (unsigned int)bits; break;
+        case TYPE_ULONG: *(unsigned long*)destination = (unsigned long)bits; break;
+        default: break;
+    }
+}
+
+static bool is_signed_integer_type(ArgType type) {
+    return type == TYPE_SHORT || type == TYPE_INT || type == TYPE_LONG;
+}
+
+static bool is_unsigned_integer_type(ArgType type) {
+    return type == TYPE_UCHAR || type == TYPE_USHORT || type == TYPE_UINT || type == TYPE_ULONG;
+}
+
+static bool is_numeric_type(ArgType type) {
+    return is_signed_integer_type(type) || is_unsigned_integer_type(type) || type == TYPE_FLOAT || type == TYPE_DOUBLE;
+}
+
+// *end may be temporarily overwritten with a terminator
+static bool parse_array_element(char* start, char* end, ArgType type, int array_value_pointer_depth, void* destination) {
+    if (array_value_pointer_depth == 0 && is_numeric_type(type)) { // whitespace around numbers is insignificant, unlike for chars and strings
+        while (start < end && isspace((unsigned char)*start)) start++;
+        while (end > start && isspace((unsigned char)end[-1])) end--;
+    }
+    if (array_value_pointer_depth == 0 && (is_signed_integer_type(type) || is_unsigned_integer_type(type))) {
+        bool negative;
+        uint64_t magnitude;
+        if (parse_decimal_integer_fast(start, end, &negative, &magnitude) && !(negative && is_unsigned_integer_type(type))) {
+            store_integer(type, negative, magnitude, destination);
+            return true;
+        }
+        char saved = *end;
+        *end = '\0';
+        char* parsed_until;
+        errno = 0;
+        if (is_signed_integer_type(type)) {
+            long value = strtol(start, &parsed_until, 0);
+            store_integer(type, value < 0, value < 0 ? (uint64_t)0 - (uint64_t)value : (uint64_t)value, destination);
+        } else {
+            store_integer(type, false, strtoul(start, &parsed_until, 0), destination);
+        }
+        *end = saved;
+        return parsed_until == end && parsed_until != start;
+    }
+
+    if (array_value_pointer_depth == 0 && (type == TYPE_FLOAT || type == TYPE_DOUBLE)) {
+#ifdef use_exact_float_fast_path
+        if (parse_floating_point_fast(start, end, type, destination)) return true;
+#endif
+        char saved = *end;
+        *end = '\0';
+        char* parsed_until;
+        if (type == TYPE_DOUBLE) *(double*)destination = strtod(start, &parsed_until);
+        else *(float*)destination = strtof(start, &parsed_until);
+        *end = saved;
+        if (parsed_until == start) return false;
+        if (parsed_until < end && strchr("fFdD", *parsed_until) != NULL) parsed_until++;
+        return parsed_until == end;
+    }
+
+    // everything else (chars, strings, bools, pointers and arrays of pointers) converts the same way scalar args do
+    char saved = *end;
+    *end = '\0';
+    void* converted_value = convert_to_type(type, start);
+    *end = saved;
+    if (converted_value == NULL) return false;
+    converted_value = makePointerLevel(converted_value, array_value_pointer_depth);
+    memcpy(destination, converted_value, typeToSize(type, array_value_pointer_depth));
+    free(converted_value);
+    return true;
+}
+
+void* parse_array_literal(const char* literal, size_t length, ArgType type, int array_value_pointer_depth, bool from_file, size_t* element_count) {
+    size_t size_of_type = typeToSize(type, array_value_pointer_depth);
+    if (size_of_type == 0) {
+        raiseException(1,  "Error: Unsupported type for array: %c\n with size of 0", typeToChar(type));
+    }
+    size_t count = count_array_literal_elements(literal, length, from_file);
+
+    // one mutable copy of the whole literal, so that elements can be terminated in place for the slow paths
+    char* text = malloc(length + 1);
+    char* array_values = calloc(count > 0 ? count : 1, size_of_type);
+    if (text == NULL || array_values == NULL) {
+        free(text);
+        free(array_values);
+        raiseException(1,  "Error: Failed to allocate memory for an array of %zu elements\n", count);
+    }
+    memcpy(text, literal, length);
+    text[length] = '\0';
+
+    char* p = text;
+    char* text_end = text + length;
+    for (size_t index = 0; index < count; index++) {
+        if (from_file) {
+            while (p < text_end && is_separator(*p, true)) p++;
+        }
+        char* element_end = p;
+        while (element_end < text_end && !is_separator(*element_end, from_file)) element_end++;
+        char* next = element_end + 1;
+
+        char* start = p;
+        if (!parse_array_element(start, element_end, type, array_value_pointer_depth, array_values + index * size_of_type)) {
+            *element_end = '\0';
+            char element[64];
+            snprintf(element, sizeof(element), "%s", start);
+            free(text);
+            free(array_values);
+            raiseException(1,  "Error: Could not parse element %zu \"%s\" of array as %s\n", index, element, typeToString(type));
+        }
+        p = next;
+    }
+    free(text);
+    *element_count = count;
+    return array_values;
+}
+
+char* read_array_literal_file(const char* path, size_t* length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        raiseException(1,  "Error: Could not open array file %s: %s\n", path, strerror(errno));
+    }
+    long file_size = -1;
+    if (fseek(file, 0, SEEK_END) == 0) file_size = ftell(file);
+    if (file_size < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        raiseException(1,  "Error: Could not determine the size of array file %s\n", path);
+    }
+    char* contents = arena_alloc(command_arena(), (size_t)file_size + 1);
+    size_t read = fread(contents, 1, (size_t)file_size, file);
+    fclose(file);
+    if (read != (size_t)file_size) {
+        raiseException(1,  "Error: Failed to read array file %s\n", path);
+    }
+    contents[read] = '\0';
+    *length = read;
+    return contents;
+}
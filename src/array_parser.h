@@ -0,0 +1,21 @@
+#ifndef ARRAY_PARSER_H
+#define ARRAY_PARSER_H
+
+#include "types_and_utils.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+// Counts the elements in an array literal. Literals given on the command line are separated by commas only,
+// while literals read from a file may also be separated by whitespace and newlines, with empty elements skipped.
+size_t count_array_literal_elements(const char* literal, size_t length, bool from_file);
+
+// Parses an array literal into a single newly allocated array of *element_count elements.
+// Numeric types are parsed in place without per element allocation, everything else goes through convert_to_type.
+// Raises an exception naming the element index if an element can't be parsed.
+void* parse_array_literal(const char* literal, size_t length, ArgType type, int array_value_pointer_depth, bool from_file, size_t* element_count);
+
+// Reads the contents of an @file array literal into a null terminated string in the command arena, so that it goes away
+// with the command even if parsing it raises
+char* read_array_literal_file(const char* path, size_t* length);
+
+#endif // ARRAY_PARSER_H
@@ -0,0 +1,172 @@
+#include "array_stats.h"
+#include <math.h>
+#include <string.h>
+
+// Floats and doubles are scanned two or four at a time with SSE2 or NEON, with NaNs masked out of min, max and sum in the same pass.
+// The integer loops are plain enough for the compiler to vectorize them itself.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define use_sse2_stats
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define use_neon_stats
+#endif
+
+// elements are read with memcpy since arrays coming back from foreign code aren't necessarily aligned
+#define INTEGER_ARRAY_STATS(ctype, member, accumulator_type)                  \
+    do {                                                                      \
+        const unsigned char* bytes = (const unsigned char*)values;            \
+        ctype lowest, highest;                                                \
+        memcpy(&lowest, bytes, sizeof(ctype));                                \
+        highest = lowest;                                                     \
+        accumulator_type total = 0;                                           \
+        for (size_t i = 0; i < count; i++) {                                  \
+            ctype element;                                                    \
+            memcpy(&element, bytes + i * sizeof(ctype), sizeof(ctype));       \
+            lowest = element < lowest ? element : lowest;                     \
+            highest = element > highest ? element : highest;                  \
+            total += element;                                                 \
+        }                                                                     \
+        stats.min.member = lowest;                                            \
+        stats.max.member = highest;                                           \
+        stats.sum = (double)total;                                            \
+    } while (0)
+
+typedef struct {
+    double lowest;
+    double highest;
+    double total;
+    size_t nan_count;
+} FloatingAccumulator;
+
+static inline void accumulate_scalar(FloatingAccumulator* acc, double element) {
+    if (isnan(element)) {
+        acc->nan_count++;
+        return;
+    }
+    if (element < acc->lowest) acc->lowest = element;
+    if (element > acc->highest) acc->highest = element;
+    acc->total += element;
+}
+
+#ifdef use_sse2_stats
+static const unsigned char bits_set_in_nibble[16] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4};
+
+static inline void accumulate_pair_sse2(__m128d element, __m128d* lowest, __m128d* highest, __m128d* total, size_t* nan_count) {
+    const __m128d unordered = _mm_cmpunord_pd(element, element);
+    const __m128d infinity = _mm_set1_pd(INFINITY);
+    *nan_count += bits_set_in_nibble[_mm_movemask_pd(unordered)];
+    *lowest = _mm_min_pd(*lowest, _mm_or_pd(_mm_andnot_pd(unordered, element), _mm_and_pd(unordered, infinity)));
+    *highest = _mm_max_pd(*highest, _mm_or_pd(_mm_andnot_pd(unordered, element), _mm_and_pd(unordered, _mm_set1_pd(-INFINITY))));
+    *total = _mm_add_pd(*total, _mm_andnot_pd(unordered, element));
+}
+
+static inline void reduce_sse2(FloatingAccumulator* acc, __m128d lowest, __m128d highest, __m128d total) {
+    double lanes[2];
+    _mm_storeu_pd(lanes, lowest);
+    acc->lowest = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    _mm_storeu_pd(lanes, highest);
+    acc->highest = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    _mm_storeu_pd(lanes, total);
+    acc->total = lanes[0] + lanes[1];
+}
+#endif
+
+#ifdef use_neon_stats
+static inline void accumulate_pair_neon(float64x2_t element, float64x2_t* lowest, float64x2_t* highest, float64x2_t* total, size_t* nan_count) {
+    const uint64x2_t ordered = vceqq_f64(element, element); // false only for nan
+    *nan_count += (size_t)vaddvq_u64(vaddq_u64(ordered, vdupq_n_u64(1))); // all ones + 1 wraps to 0
+    *lowest = vminq_f64(*lowest, vbslq_f64(ordered, element, vdupq_n_f64(INFINITY)));
+    *highest = vmaxq_f64(*highest, vbslq_f64(ordered, element, vdupq_n_f64(-INFINITY)));
+    *total = vaddq_f64(*total, vbslq_f64(ordered, element, vdupq_n_f64(0.0)));
+}
+
+static inline void reduce_neon(FloatingAccumulator* acc, float64x2_t lowest, float64x2_t highest, float64x2_t total) {
+    acc->lowest = vminvq_f64(lowest);
+    acc->highest = vmaxvq_f64(highest);
+    acc->total = vaddvq_f64(total);
+}
+#endif
+
+static FloatingAccumulator double_array_stats(const double* values, size_t count) {
+    FloatingAccumulator acc = {INFINITY, -INFINITY, 0.0, 0};
+    size_t i = 0;
+#if defined(use_sse2_stats)
+    __m128d lowest = _mm_set1_pd(INFINITY), highest = _mm_set1_pd(-INFINITY), total = _mm_setzero_pd();
+    for (; i + 2 <= count; i += 2) {
+        accumulate_pair_sse2(_mm_loadu_pd(values + i), &lowest, &highest, &total, &acc.nan_count);
+    }
+    reduce_sse2(&acc, lowest, highest, total);
+#elif defined(use_neon_stats)
+    float64x2_t lowest = vdupq_n_f64(INFINITY), highest = vdupq_n_f64(-INFINITY), total = vdupq_n_f64(0.0);
+    for (; i + 2 <= count; i += 2) {
+        accumulate_pair_neon(vreinterpretq_f64_u8(vld1q_u8((const uint8_t*)(values + i))), &lowest, &highest, &total, &acc.nan_count);
+    }
+    reduce_neon(&acc, lowest, highest, total);
+#endif
+    for (; i < count; i++) {
+        double element;
+        memcpy(&element, values + i, sizeof(double));
+        accumulate_scalar(&acc, element);
+    }
+    return acc;
+}
+
+// floats are widened to double as they're summed, so that a long array doesn't lose most of its sum to rounding
+static FloatingAccumulator float_array_stats(const float* values, size_t count) {
+    FloatingAccumulator acc = {INFINITY, -INFINITY, 0.0, 0};
+    size_t i = 0;
+#if defined(use_sse2_stats)
+    __m128d lowest = _mm_set1_pd(INFINITY), highest = _mm_set1_pd(-INFINITY), total = _mm_setzero_pd();
+    for (; i + 4 <= count; i += 4) {
+        const __m128 four = _mm_loadu_ps(values + i);
+        accumulate_pair_sse2(_mm_cvtps_pd(four), &lowest, &highest, &total, &acc.nan_count);
+        accumulate_pair_sse2(_mm_cvtps_pd(_mm_movehl_ps(four, four)), &lowest, &highest, &total, &acc.nan_count);
+    }
+    reduce_sse2(&acc, lowest, highest, total);
+#elif defined(use_neon_stats)
+    float64x2_t lowest = vdupq_n_f64(INFINITY), highest = vdupq_n_f64(-INFINITY), total = vdupq_n_f64(0.0);
+    for (; i + 4 <= count; i += 4) {
+        const float32x4_t four = vreinterpretq_f32_u8(vld1q_u8((const uint8_t*)(values + i)));
+        accumulate_pair_neon(vcvt_f64_f32(vget_low_f32(four)), &lowest, &highest, &total, &acc.nan_count);
+        accumulate_pair_neon(vcvt_high_f64_f32(four), &lowest, &highest, &total, &acc.nan_count);
+    }
+    reduce_neon(&acc, lowest, highest, total);
+#endif
+    for (; i < count; i++) {
+        float element;
+        memcpy(&element, values + i, sizeof(float));
+        accumulate_scalar(&acc, element);
+    }
+    return acc;
+}
+
+NumericArrayStats compute_numeric_array_stats(const void* values, ArgType type, size_t count) {
+    NumericArrayStats stats = {count, 0, {.d = NAN}, {.d = NAN}, 0.0};
+    if (count == 0) return stats;
+    switch (type) {
+        case TYPE_SHORT: INTEGER_ARRAY_STATS(short, i, int64_t); break;
+        case TYPE_INT: INTEGER_ARRAY_STATS(int, i, int64_t); break;
+        case TYPE_LONG: INTEGER_ARRAY_STATS(long, i, double); break; // could overflow a 64 bit total
+        case TYPE_UCHAR: INTEGER_ARRAY_STATS(unsigned char, u, uint64_t); break;
+        case TYPE_USHORT: INTEGER_ARRAY_STATS(unsigned short, u, uint64_t); break;
+        case TYPE_UINT: INTEGER_ARRAY_STATS(unsigned int, u, uint64_t); break;
+        case TYPE_ULONG: INTEGER_ARRAY_STATS(unsigned long, u, double); break;
+        case TYPE_FLOAT:
+        case TYPE_DOUBLE: {
+            FloatingAccumulator acc = type == TYPE_FLOAT ? float_array_stats((const float*)values, count)
+                                                         : double_array_stats((const double*)values, count);
+            stats.nan_count = acc.nan_count;
+            stats.sum = acc.total;
+            if (acc.nan_count < count) {
+                stats.min.d = acc.lowest;
+                stats.max.d = acc.highest;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+    return stats;
+}
@@ -0,0 +1,28 @@
+#ifndef ARRAY_STATS_H
+#define ARRAY_STATS_H
+
+#include "types_and_utils.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Summary statistics for a flat numeric array, gathered in one pass over it.
+// min and max use whichever member matches the element type: i for signed types, u for unsigned ones and d for float and double.
+// NaNs are counted but otherwise left out, so min, max and sum cover the remaining elements (min and max are nan if there aren't any).
+typedef union {
+    int64_t i;
+    uint64_t u;
+    double d;
+} NumericStatValue;
+
+typedef struct NumericArrayStats {
+    size_t count;
+    size_t nan_count;
+    NumericStatValue min;
+    NumericStatValue max;
+    double sum;
+} NumericArrayStats;
+
+// values must point to count elements of a numeric type (short, int, long, their unsigned versions, uchar, float or double)
+NumericArrayStats compute_numeric_array_stats(const void* values, ArgType type, size_t count);
+
+#endif // ARRAY_STATS_H
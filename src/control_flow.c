@@ -0,0 +1,625 @@
+#include "control_flow.h"
+#include "arena.h"
+#include "exception_handling.h"
+#include "main.h"
+#include "output_buffer.h"
+#include "prepared_call.h"
+#include "tokenize.h"
+#include "types_and_utils.h"
+#include "var_map.h"
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef enum {
+    STATEMENT_COMMAND,
+    STATEMENT_FOR,
+    STATEMENT_WHILE,
+    STATEMENT_IF,
+    STATEMENT_BREAK,
+    STATEMENT_CONTINUE,
+} StatementKind;
+
+typedef struct Statement Statement;
+
+typedef struct {
+    Statement* statements;
+    size_t count;
+} Block;
+
+typedef struct {
+    char* left;
+    char* op;    // NULL for a lone value, which is true if non-zero
+    char* right;
+} Condition;
+
+struct Statement {
+    StatementKind kind;
+    char* text;
+    int argc; // commands are tokenized once, when the block is parsed
+    char** argv;
+    struct PreparedCall* prepared;
+    char* variable; // for loops
+    ArgInfo* loop_var; // kept from one run of the loop to the next, so that the calls prepared with it still match
+    char* start;
+    char* end;
+    char* step; // NULL for the default of 1
+    Condition condition; // while and if
+    Block body;
+    Block else_body; // if
+};
+
+typedef enum {
+    FLOW_NEXT,
+    FLOW_BREAK,
+    FLOW_CONTINUE,
+    FLOW_QUIT,
+} Flow;
+
+// A number read from a variable or literal. Unsigned and pointer values keep their bits in i.
+typedef struct {
+    bool is_floating;
+    bool is_unsigned;
+    int64_t i;
+    double d;
+} Number;
+
+static const char* const arithmetic_operators[] = {"+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>"};
+static const char* const comparison_operators[] = {"==", "!=", "<", "<=", ">", ">="};
+
+static bool is_one_of(const char* token, const char* const* options, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(token, options[i]) == 0) return true;
+    }
+    return false;
+}
+
+#define IS_ONE_OF(token, options) is_one_of(token, options, sizeof(options) / sizeof(options[0]))
+
+bool is_control_flow_command(const char* name) {
+    return strcmp(name, "for") == 0 || strcmp(name, "while") == 0 || strcmp(name, "if") == 0;
+}
+
+int block_depth_change(const char* line) {
+    while (isspace((unsigned char)*line)) line++;
+    if (*line == '!') return 0;
+    int depth = 0;
+    char quote = '\0';
+    bool escape = false;
+    for (; *line != '\0'; line++) {
+        if (escape) {
+            escape = false;
+        } else if (*line == '\\') {
+            escape = true;
+        } else if (quote) {
+            if (*line == quote) quote = '\0';
+        } else if (*line == '\'' || *line == '"') {
+            quote = *line;
+        } else if (*line == '{') {
+            depth++;
+        } else if (*line == '}') {
+            depth--;
+        }
+    }
+    return depth;
+}
+
+static bool is_pointer_like(const ArgInfo* arg) {
+    return arg->is_array || arg->pointer_depth > 0 || arg->type == TYPE_STRING || arg->type == TYPE_VOIDPOINTER;
+}
+
+static Number number_from_arg(const ArgInfo* arg, const char* name) {
+    Number number = {false, false, 0, 0.0};
+    if (is_pointer_like(arg)) {
+        number.is_unsigned = true;
+        number.i = (int64_t)(uintptr_t)arg->value->ptr_val;
+        return number;
+    }
+    switch (arg->type) {
+        case TYPE_CHAR: number.i = arg->value->c_val; break;
+        case TYPE_SHORT: number.i = arg->value->s_val; break;
+        case TYPE_INT: number.i = arg->value->i_val; break;
+        case TYPE_LONG: number.i = arg->value->l_val; break;
+        case TYPE_BOOL: number.i = arg->value->b_val; break;
+        case TYPE_UCHAR: number.is_unsigned = true; number.i = arg->value->uc_val; break;
+        case TYPE_USHORT: number.is_unsigned = true; number.i = arg->value->us_val; break;
+        case TYPE_UINT: number.is_unsigned = true; number.i = arg->value->ui_val; break;
+        case TYPE_ULONG: number.is_unsigned = true; number.i = (int64_t)arg->value->ul_val; break;
+        case TYPE_FLOAT: number.is_floating = true; number.d = arg->value->f_val; break;
+        case TYPE_DOUBLE: number.is_floating = true; number.d = arg->value->d_val; break;
+        default:
+            raiseException(1,  "Error: %s is a %s, which can't be used as a number\n", name, typeToString(arg->type));
+    }
+    return number;
+}
+
+static bool parse_number_literal(const char* token, Number* number) {
+    char* end;
+    errno = 0;
+    *number = (Number){false, false, 0, 0.0};
+    if (isHexFormat(token)) {
+        number->is_unsigned = true;
+        number->i = (int64_t)strtoull(token, &end, 16);
+    } else {
+        number->i = strtoll(token, &end, 10);
+        if (*end != '\0' || end == token) {
+            number->is_floating = true;
+            number->d = strtod(token, &end);
+        }
+    }
+    return end != token && *end == '\0' && errno != ERANGE;
+}
+
+static bool is_operand(const char* token) {
+    Number ignored;
+    return getVar(token) != NULL || parse_number_literal(token, &ignored);
+}
+
+static Number evaluate_operand(const char* token) {
+    ArgInfo* var = getVar(token);
+    if (var != NULL) return number_from_arg(var, token);
+    Number number;
+    if (!parse_number_literal(token, &number)) {
+        raiseException(1,  "Error: %s is neither a number nor a variable\n", token);
+    }
+    return number;
+}
+
+static double as_double(Number number) {
+    if (number.is_floating) return number.d;
+    return number.is_unsigned ? (double)(uint64_t)number.i : (double)number.i;
+}
+
+static Number apply_operator(Number a, const char* op, Number b) {
+    Number result = {false, a.is_unsigned || b.is_unsigned, 0, 0.0};
+    if (a.is_floating || b.is_floating) {
+        double x = as_double(a), y = as_double(b);
+        result.is_floating = true;
+        if (strcmp(op, "+") == 0) result.d = x + y;
+        else if (strcmp(op, "-") == 0) result.d = x - y;
+        else if (strcmp(op, "*") == 0) result.d = x * y;
+        else if (strcmp(op, "/") == 0) result.d = x / y;
+        else raiseException(1,  "Error: %s only works on integers and pointers\n", op);
+        return result;
+    }
+    uint64_t x = (uint64_t)a.i, y = (uint64_t)b.i;
+    if ((strcmp(op, "/") == 0 || strcmp(op, "%") == 0) && y == 0) {
+        raiseException(1,  "Error: Division by zero\n");
+    }
+    if (strcmp(op, "+") == 0) result.i = (int64_t)(x + y);
+    else if (strcmp(op, "-") == 0) result.i = (int64_t)(x - y);
+    else if (strcmp(op, "*") == 0) result.i = (int64_t)(x * y);
+    else if (strcmp(op, "&") == 0) result.i = (int64_t)(x & y);
+    else if (strcmp(op, "|") == 0) result.i = (int64_t)(x | y);
+    else if (strcmp(op, "^") == 0) result.i = (int64_t)(x ^ y);
+    else if (strcmp(op, "<<") == 0) result.i = (int64_t)(x << (y & 63));
+    else if (result.is_unsigned) {
+        if (strcmp(op, "/") == 0) result.i = (int64_t)(x / y);
+        else if (strcmp(op, "%") == 0) result.i = (int64_t)(x % y);
+        else result.i = (int64_t)(x >> (y & 63));
+    } else {
+        // INT64_MIN / -1 traps, so dividing by -1 is negating (wrapping round like the rest), with nothing left over
+        if (strcmp(op, "/") == 0) result.i = b.i == -1 ? (int64_t)(0 - x) : a.i / b.i;
+        else if (strcmp(op, "%") == 0) result.i = b.i == -1 ? 0 : a.i % b.i;
+        else result.i = a.i >> (b.i & 63);
+    }
+    return result;
+}
+
+static bool compare(Number a, const char* op, Number b) {
+    int order;
+    if (a.is_floating || b.is_floating) {
+        double x = as_double(a), y = as_double(b);
+        if (x != x || y != y) return strcmp(op, "!=") == 0; // nan compares unequal to everything
+        order = x < y ? -1 : x > y;
+    } else if (a.is_unsigned || b.is_unsigned) {
+        order = (uint64_t)a.i < (uint64_t)b.i ? -1 : (uint64_t)a.i > (uint64_t)b.i;
+    } else {
+        order = a.i < b.i ? -1 : a.i > b.i;
+    }
+    if (strcmp(op, "==") == 0) return order == 0;
+    if (strcmp(op, "!=") == 0) return order != 0;
+    if (strcmp(op, "<") == 0) return order < 0;
+    if (strcmp(op, "<=") == 0) return order <= 0;
+    if (strcmp(op, ">") == 0) return order > 0;
+    return order >= 0;
+}
+
+static bool evaluate_condition(const Condition* condition) {
+    Number left = evaluate_operand(condition->left);
+    if (condition->op == NULL) {
+        return left.is_floating ? left.d != 0.0 : left.i != 0;
+    }
+    return compare(left, condition->op, evaluate_operand(condition->right));
+}
+
+static void store_number(ArgInfo* arg, Number number) {
+    if (is_pointer_like(arg)) {
+        arg->value->ptr_val = (void*)(uintptr_t)(number.is_floating ? (uint64_t)number.d : (uint64_t)number.i);
+        return;
+    }
+    if (arg->type == TYPE_FLOAT || arg->type == TYPE_DOUBLE) {
+        if (arg->type == TYPE_FLOAT) arg->value->f_val = (float)as_double(number);
+        else arg->value->d_val = as_double(number);
+        return;
+    }
+    int64_t i = number.is_floating ? (int64_t)number.d : number.i;
+    switch (arg->type) {
+        case TYPE_CHAR: arg->value->c_val = (char)i; break;
+        case TYPE_SHORT: arg->value->s_val = (short)i; break;
+        case TYPE_INT: arg->value->i_val = (int)i; break;
+        case TYPE_LONG: arg->value->l_val = (long)i; break;
+        case TYPE_BOOL: arg->value->b_val = i != 0; break;
+        case TYPE_UCHAR: arg->value->uc_val = (unsigned char)i; break;
+        case TYPE_USHORT: arg->value->us_val = (unsigned short)i; break;
+        case TYPE_UINT: arg->value->ui_val = (unsigned int)i; break;
+        case TYPE_ULONG: arg->value->ul_val = (unsigned long)i; break;
+        default: break;
+    }
+}
+
+static ArgInfo* new_number_var(ArgType type) {
+    ArgInfo* arg = calloc(1, sizeof(ArgInfo));
+    arg->value = calloc(1, sizeof(*arg->value));
+    arg->type = type;
+    arg->explicitType = true;
+    return arg;
+}
+
+static ArgType integer_type_for(Number number) {
+    if (number.is_unsigned) return (uint64_t)number.i <= UINT_MAX ? TYPE_UINT : TYPE_ULONG;
+    return number.i >= INT_MIN && number.i <= INT_MAX ? TYPE_INT : TYPE_LONG;
+}
+
+// the type a new variable gets from an arithmetic result: that of the first variable involved, otherwise whatever fits the value
+static ArgType result_type(Number result, const char* left, const char* right) {
+    if (result.is_floating) return TYPE_DOUBLE;
+    const char* operands[2] = {left, right};
+    for (int i = 0; i < 2; i++) {
+        ArgInfo* var = getVar(operands[i]);
+        if (var == NULL) continue;
+        if (is_pointer_like(var)) return TYPE_VOIDPOINTER;
+        if (var->type != TYPE_FLOAT && var->type != TYPE_DOUBLE) return var->type;
+    }
+    return integer_type_for(result);
+}
+
+bool try_arithmetic_assignment(int argc, char** argv) {
+    char* target = argv[0];
+    char* left;
+    char op[3] = "";
+    char* right;
+    if (argc == 5 && strcmp(argv[1], "=") == 0 && IS_ONE_OF(argv[3], arithmetic_operators) && is_operand(argv[2]) && is_operand(argv[4])) {
+        left = argv[2];
+        strcpy(op, argv[3]);
+        right = argv[4];
+    } else if (argc == 3 && strlen(argv[1]) >= 2 && strlen(argv[1]) <= 3 && argv[1][strlen(argv[1]) - 1] == '=') {
+        memcpy(op, argv[1], strlen(argv[1]) - 1); // "+=" -> "+"
+        if (!IS_ONE_OF(op, arithmetic_operators)) return false;
+        if (getVar(target) == NULL) {
+            raiseException(1,  "Error: Variable %s not found\n", target);
+        }
+        left = target;
+        right = argv[2];
+    } else {
+        return false;
+    }
+
+    Number result = apply_operator(evaluate_operand(left), op, evaluate_operand(right));
+    ArgInfo* var = getVar(target);
+    if (var != NULL && (var->is_array || var->type == TYPE_STRUCT)) {
+        raiseException(1,  "Error: Can't assign a number to %s, which is a %s\n", target, var->is_array ? "array" : "struct");
+    } else if (var == NULL) {
+        validateVariableName(target);
+        var = new_number_var(result_type(result, left, right));
+        setVar(target, var);
+    }
+    store_number(var, result); // in place, so calls that were prepared with this variable see the new value
+    if (!output_is_quiet()) printVariableWithArgInfo(target, var);
+    return true;
+}
+
+// Splits the text so that every { ends a line and every } is on a line of its own, which lets blocks be written
+// across lines or on one, then returns the lines that aren't blank or comments
+static char** logical_lines(const char* text, size_t* line_count) {
+    size_t length = strlen(text);
+    char* out = arena_alloc(command_arena(), length * 3 + 1);
+    size_t o = 0;
+    bool at_line_start = true, shell_line = false, escape = false;
+    char quote = '\0';
+    for (const char* c = text; *c != '\0'; c++) {
+        if (*c == '\n') {
+            out[o++] = '\n';
+            at_line_start = true;
+            shell_line = escape = false;
+            quote = '\0';
+            continue;
+        }
+        if (at_line_start && !isspace((unsigned char)*c)) {
+            at_line_start = false;
+            shell_line = *c == '!';
+        }
+        if (shell_line || escape) {
+            escape = false;
+        } else if (*c == '\\') {
+            escape = true;
+        } else if (quote) {
+            if (*c == quote) quote = '\0';
+        } else if (*c == '\'' || *c == '"') {
+            quote = *c;
+        } else if (*c == '{') {
+            out[o++] = '{';
+            out[o++] = '\n';
+            at_line_start = true;
+            continue;
+        } else if (*c == '}') {
+            out[o++] = '\n';
+            out[o++] = '}';
+            out[o++] = '\n';
+            at_line_start = true;
+            continue;
+        }
+        out[o++] = *c;
+    }
+    out[o] = '\0';
+
+    size_t count = 0;
+    for (size_t i = 0; i < o; i++) count += out[i] == '\n';
+    char** lines = arena_alloc(command_arena(), (count + 1) * sizeof(char*));
+    count = 0;
+    char* line = out;
+    while (line != NULL) {
+        char* newline = strchr(line, '\n');
+        if (newline != NULL) *newline = '\0';
+        char* trimmed = trim_whitespace(line);
+        if (trimmed[0] != '\0' && trimmed[0] != '#') lines[count++] = trimmed;
+        line = newline != NULL ? newline + 1 : NULL;
+    }
+    *line_count = count;
+    return lines;
+}
+
+typedef struct {
+    char** lines;
+    size_t count;
+    size_t next;
+    int loop_depth;
+} Parser;
+
+static void parse_block(Parser* parser, Block* block, const char* opened_by);
+
+static Statement* add_statement(Block* block, StatementKind kind, char* text) {
+    block->statements = realloc(block->statements, (block->count + 1) * sizeof(Statement));
+    Statement* statement = &block->statements[block->count++];
+    memset(statement, 0, sizeof(*statement));
+    statement->kind = kind;
+    statement->text = text;
+    return statement;
+}
+
+static void parse_condition(Condition* condition, int argc, char** argv, const char* text) {
+    // argv holds the condition and the { after it
+    if (argc == 2) {
+        *condition = (Condition){argv[0], NULL, NULL};
+    } else if (argc == 4 && IS_ONE_OF(argv[1], comparison_operators)) {
+        *condition = (Condition){argv[0], argv[1], argv[2]};
+    } else {
+        raiseException(1,  "Error: Expected <value> or <value> ==|!=|<|<=|>|>= <value> followed by {, in: %s\n", text);
+    }
+}
+
+static bool ends_with_open_brace(int argc, char** argv) {
+    return argc > 0 && strcmp(argv[argc - 1], "{") == 0;
+}
+
+static void parse_if(Parser* parser, Block* block, char* text, int argc, char** argv) {
+    // argv starts at the if
+    if (!ends_with_open_brace(argc, argv)) {
+        raiseException(1,  "Error: Expected if <condition> {, in: %s\n", text);
+    }
+    // the bodies are parsed straight into the statement, which stays put since nothing is added to this block meanwhile
+    Statement* statement = add_statement(block, STATEMENT_IF, text);
+    parse_condition(&statement->condition, argc - 1, argv + 1, text);
+    parse_block(parser, &statement->body, text);
+
+    if (parser->next < parser->count && strncmp(parser->lines[parser->next], "else", 4) == 0 &&
+        (parser->lines[parser->next][4] == '\0' || isspace((unsigned char)parser->lines[parser->next][4]))) {
+        char* else_text = parser->lines[parser->next++];
+        int else_argc;
+        char** else_argv;
+        tokenize(else_text, &else_argc, &else_argv);
+        if (else_argc == 2 && strcmp(else_argv[1], "{") == 0) {
+            parse_block(parser, &statement->else_body, else_text);
+        } else if (else_argc > 2 && strcmp(else_argv[1], "if") == 0) {
+            parse_if(parser, &statement->else_body, else_text, else_argc - 1, else_argv + 1);
+        } else {
+            raiseException(1,  "Error: Expected else { or else if <condition> {, in: %s\n", else_text);
+        }
+    }
+}
+
+static void parse_block(Parser* parser, Block* block, const char* opened_by) {
+    while (parser->next < parser->count) {
+        char* text = parser->lines[parser->next++];
+        if (strcmp(text, "}") == 0) {
+            if (opened_by == NULL) {
+                raiseException(1,  "Error: Unexpected }\n");
+            }
+            return;
+        }
+        int argc;
+        char** argv;
+        if (text[0] == '!') { // shell escapes aren't tokenized
+            add_statement(block, STATEMENT_COMMAND, text);
+            continue;
+        }
+        tokenize(text, &argc, &argv);
+
+        if (strcmp(argv[0], "for") == 0) {
+            char* range_separator = argc >= 5 ? strstr(argv[3], "..") : NULL;
+            if ((argc != 5 && argc != 6) || strcmp(argv[2], "in") != 0 || range_separator == NULL || !ends_with_open_brace(argc, argv)) {
+                raiseException(1,  "Error: Expected for <var> in <start>..<end> [<step>] {, in: %s\n", text);
+            }
+            validateVariableName(argv[1]);
+            *range_separator = '\0';
+            Statement* statement = add_statement(block, STATEMENT_FOR, text);
+            statement->variable = argv[1];
+            statement->start = argv[3];
+            statement->end = range_separator + 2;
+            statement->step = argc == 6 ? argv[4] : NULL;
+            parser->loop_depth++;
+            parse_block(parser, &statement->body, text);
+            parser->loop_depth--;
+        } else if (strcmp(argv[0], "while") == 0) {
+            if (!ends_with_open_brace(argc, argv)) {
+                raiseException(1,  "Error: Expected while <condition> {, in: %s\n", text);
+            }
+            Statement* statement = add_statement(block, STATEMENT_WHILE, text);
+            parse_condition(&statement->condition, argc - 1, argv + 1, text);
+            parser->loop_depth++;
+            parse_block(parser, &statement->body, text);
+            parser->loop_depth--;
+        } else if (strcmp(argv[0], "if") == 0) {
+            parse_if(parser, block, text, argc, argv);
+        } else if (strcmp(argv[0], "else") == 0) {
+            raiseException(1,  "Error: else without an if before it\n");
+        } else if (argc == 1 && (strcmp(argv[0], "break") == 0 || strcmp(argv[0], "continue") == 0)) {
+            if (parser->loop_depth == 0) {
+                raiseException(1,  "Error: %s outside of a loop\n", argv[0]);
+            }
+            add_statement(block, strcmp(argv[0], "break") == 0 ? STATEMENT_BREAK : STATEMENT_CONTINUE, text);
+        } else {
+            Statement* statement = add_statement(block, STATEMENT_COMMAND, text);
+            statement->argc = argc;
+            statement->argv = argv;
+        }
+    }
+    if (opened_by != NULL) {
+        raiseException(1,  "Error: Missing } to close the block opened by: %s\n", opened_by);
+    }
+}
+
+static void free_block(Block* block) {
+    for (size_t i = 0; i < block->count; i++) {
+        free_prepared_call(block->statements[i].prepared);
+        free_block(&block->statements[i].body);
+        free_block(&block->statements[i].else_body);
+    }
+    free(block->statements);
+}
+
+static Flow run_block(Block* block);
+
+static Flow run_command(Statement* statement) {
+    ArenaMark command_start = arena_mark(command_arena());
+    int quit = statement->argv == NULL ? parseREPLCommand(statement->text)
+                                       : runTokenizedREPLCommand(statement->text, statement->argc, statement->argv, &statement->prepared);
+    output_flush();
+    arena_release(command_arena(), command_start);
+    return quit ? FLOW_QUIT : FLOW_NEXT;
+}
+
+static int64_t evaluate_integer(const char* token, const char* what) {
+    Number number = evaluate_operand(token);
+    if (number.is_floating) {
+        raiseException(1,  "Error: The %s of a for loop must be an integer, not %s\n", what, token);
+    }
+    return number.i;
+}
+
+static Flow run_for(Statement* statement) {
+    int64_t start = evaluate_integer(statement->start, "start");
+    int64_t end = evaluate_integer(statement->end, "end");
+    int64_t step = statement->step != NULL ? evaluate_integer(statement->step, "step") : 1;
+    if (step == 0) {
+        raiseException(1,  "Error: The step of a for loop can't be 0\n");
+    }
+    bool fits_int = start >= INT_MIN && start <= INT_MAX && end >= INT_MIN && end <= INT_MAX;
+    ArgType type = fits_int ? TYPE_INT : TYPE_LONG;
+    if (statement->loop_var == NULL || statement->loop_var->type != type) statement->loop_var = new_number_var(type);
+    ArgInfo* var = statement->loop_var;
+    setVar(statement->variable, var);
+    if (step > 0 ? start >= end : start <= end) return FLOW_NEXT;
+    uint64_t stride = step > 0 ? (uint64_t)step : 0 - (uint64_t)step;
+    for (int64_t i = start; ; i = (int64_t)((uint64_t)i + (uint64_t)step)) {
+        if (getVar(statement->variable) != var) setVar(statement->variable, var); // the body reassigned it
+        store_number(var, (Number){false, false, i, 0.0});
+        Flow flow = run_block(&statement->body);
+        if (flow == FLOW_BREAK) break;
+        if (flow == FLOW_QUIT) return flow;
+        // How far is left to go, unsigned since the next value may be past what an int64_t holds
+        uint64_t left = step > 0 ? (uint64_t)end - (uint64_t)i : (uint64_t)i - (uint64_t)end;
+        if (left <= stride) break;
+    }
+    return FLOW_NEXT;
+}
+
+static Flow run_block(Block* block) {
+    for (size_t i = 0; i < block->count; i++) {
+        Statement* statement = &block->statements[i];
+        Flow flow = FLOW_NEXT;
+        switch (statement->kind) {
+            case STATEMENT_COMMAND:
+                flow = run_command(statement);
+                break;
+            case STATEMENT_FOR:
+                flow = run_for(statement);
+                break;
+            case STATEMENT_WHILE:
+                while (evaluate_condition(&statement->condition)) {
+                    flow = run_block(&statement->body);
+                    if (flow == FLOW_BREAK || flow == FLOW_QUIT) break;
+                }
+                if (flow != FLOW_QUIT) flow = FLOW_NEXT;
+                break;
+            case STATEMENT_IF:
+                flow = run_block(evaluate_condition(&statement->condition) ? &statement->body : &statement->else_body);
+                break;
+            case STATEMENT_BREAK:
+                return FLOW_BREAK;
+            case STATEMENT_CONTINUE:
+                return FLOW_CONTINUE;
+        }
+        if (flow != FLOW_NEXT) return flow;
+    }
+    return FLOW_NEXT;
+}
+
+int run_control_flow(const char* command) {
+    Parser parser = {NULL, 0, 0, 0};
+    parser.lines = logical_lines(command, &parser.count);
+    Block* volatile program = calloc(1, sizeof(Block));
+    volatile Flow flow = FLOW_NEXT;
+    // Anything raised while parsing or running it is caught, so that the block and the calls prepared in it are freed,
+    // and then raised again with its message and stack trace
+    sigjmp_buf* volatile outer_exception_buffer = current_exception_buffer;
+    volatile bool failed = false;
+    char* volatile failure = NULL;
+    char** volatile failure_stacktrace = NULL;
+    volatile size_t failure_stacktrace_size = 0;
+    TRY
+        parse_block(&parser, program, NULL);
+        flow = run_block(program);
+    CATCHALL
+        failed = true;
+        failure = current_exception_message;
+        failure_stacktrace = current_stacktrace_strings;
+        failure_stacktrace_size = current_stacktrace_size;
+        current_exception_message = NULL; // so that END_TRY leaves them be
+        current_stacktrace_strings = NULL;
+    END_TRY
+    // A TRY in a command the block ran will have left old_exception_buffer pointing at this one's
+    current_exception_buffer = outer_exception_buffer;
+    free_block(program);
+    free(program);
+    if (failed) {
+        current_exception_message = failure;
+        current_stacktrace_strings = failure_stacktrace;
+        current_stacktrace_size = failure_stacktrace_size;
+        siglongjmp(*current_exception_buffer, 1);
+    }
+    return flow == FLOW_QUIT;
+}
@@ -0,0 +1,30 @@
+#ifndef CONTROL_FLOW_H
+#define CONTROL_FLOW_H
+
+#include <stdbool.h>
+
+// Loops, conditionals and integer arithmetic for the REPL language:
+//
+//   for <var> in <start>..<end> [<step>] {     end is exclusive, and step defaults to 1 (it can be negative)
+//   while <condition> {
+//   if <condition> {  ...  } else if <condition> {  ...  } else {  ...  }
+//   break, continue
+//
+// where a condition is a single value (true if non-zero) or <value> ==|!=|<|<=|>|>= <value>, and values are numbers
+// or variables. Blocks run in-process: each command in them is tokenized once, and function calls are prepared
+// the first time they run (see prepared_call.h), so later iterations go more or less straight to the call.
+
+// How much a line of input changes the nesting of { } blocks, ignoring braces in quotes and in ! shell commands.
+// Input is collected until this adds back up to zero before being run as a single command.
+int block_depth_change(const char* line);
+
+bool is_control_flow_command(const char* name);
+
+// Runs a for, while or if command, given its full text including the lines of its blocks. Returns 1 if it ran quit or exit.
+int run_control_flow(const char* command);
+
+// Handles <var> = <value> <op> <value> and <var> <op>= <value>, for + - * / % & | ^ << >>, returning false for anything else.
+// An existing integer, floating point or pointer variable is updated in place and keeps its type.
+bool try_arithmetic_assignment(int argc, char** argv);
+
+#endif // CONTROL_FLOW_H
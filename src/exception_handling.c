@@ -22,6 +22,7 @@
 #endif
 #include "shims.h"
 #include "exception_handling.h"
+#include "output_buffer.h"
 
 
 bool isTestEnvExit1OnFail = false;
@@ -158,6 +159,7 @@ void raiseException(int status, char* formatstr, ...) {
 }
 
 void printException() {
+    output_flush(); // so that whatever was printed before the error shows up before it
     if (current_exception_message == NULL || strlen(current_exception_message) == 0){
         fprintf(stderr, "Error thrown with no message\n");
     } else {
@@ -178,6 +180,12 @@ void unsetCodeSectionForSegfaultHandler() {
     SEGFAULT_SECTION = SEGFAULT_SECTION_UNSET;
 }
 
+static volatile AccessFaultHandler access_fault_handler = NULL;
+
+void setAccessFaultHandler(AccessFaultHandler handler) {
+    access_fault_handler = handler;
+}
+
 
 
 pthread_t main_thread_id;
@@ -268,6 +276,9 @@ void* get_instruction_pointer(ucontext_t *context) {
 }
 
 void segfault_handler(int sig, siginfo_t *info, void *ucontext) {
+    AccessFaultHandler handler = access_fault_handler;
+    if ((sig == SIGSEGV || sig == SIGBUS) && handler != NULL && handler(info->si_addr)) return; // eg trackwrites
+    output_flush_from_signal_handler(); // don't lose what the command printed before it crashed
     // Cast ucontext to ucontext_t to get register info
     ucontext_t *context = (ucontext_t *)ucontext;
 
@@ -300,6 +311,7 @@ void segfault_handler(int sig, siginfo_t *info, void *ucontext) {
 }
 #else
 void segfault_handler(int signal) {
+    output_flush_from_signal_handler();
     if (!is_main_thread()) {
         fprintf(stderr, "Caught segfault on non-main thread. Terminating thread.\n");
         printStackTrace();
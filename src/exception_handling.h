@@ -83,6 +83,12 @@ void raiseException(int status, char* formatstr, ...);
 void setCodeSectionForSegfaultHandler(const char* section);
 void unsetCodeSectionForSegfaultHandler();
 
+// While set, a SIGSEGV or SIGBUS is first offered to this, which returns true if it made the access that faulted
+// possible (eg by making a write protected page writable again), so that it's simply retried. It's called from the
+// signal handler, so it can only do what's safe there. Not on Windows
+typedef bool (*AccessFaultHandler)(void* fault_address);
+void setAccessFaultHandler(AccessFaultHandler handler);
+
 void main_method_install_exception_handlers();
 
 #endif // EXCEPTION_HANDLING_H
@@ -0,0 +1,206 @@
+#include "hex_decoder.h"
+#include "exception_handling.h"
+#include <stdint.h>
+#include <string.h>
+
+// Runs of plain hex digits are decoded 32 characters at a time with SSE2 or NEON (64 with AVX2, when the cpu has it).
+// The scalar loop handles whatever is left over, the separators, and reporting errors.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define use_sse2_hex
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define use_avx2_hex // compiled for avx2 regardless of the build flags, and only used if the cpu supports it
+#endif
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define use_neon_hex
+#endif
+
+static inline int hex_value(unsigned char c) {
+    if ((unsigned)(c - '0') < 10) return c - '0';
+    c |= 0x20; // lowercase
+    if ((unsigned)(c - 'a') < 6) return c - 'a' + 10;
+    return -1;
+}
+
+static inline bool is_hex_separator(unsigned char c) {
+    return c == ' ' || c == ':' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool is_hex_array_literal(const char* str) {
+    if (str == NULL) return false;
+    const char* body;
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        body = str + 2;
+    } else if (str[0] == '\\' && str[1] == 'x') {
+        body = str; // the decoder skips \x itself
+    } else {
+        return false;
+    }
+    // after the prefix, only hex digits and separators, with any \x right before a digit, so that 0xx1 or 0x0x12 aren't taken
+    bool has_digit = false;
+    for (const char* c = body; *c != '\0'; c++) {
+        if (hex_value((unsigned char)*c) >= 0) {
+            has_digit = true;
+        } else if (*c == '\\' && c[1] == 'x' && hex_value((unsigned char)c[2]) >= 0) {
+            c++;
+        } else if (!is_hex_separator((unsigned char)*c)) {
+            return false;
+        }
+    }
+    return has_digit;
+}
+
+size_t hex_literal_max_decoded_length(size_t length) {
+    return length / 2;
+}
+
+#ifdef use_sse2_hex
+// converts 16 hex characters to their nibble values, or returns false if any of them isn't a hex digit
+static inline bool sse2_hex_nibbles(__m128i in, __m128i* nibbles) {
+    const __m128i digit = _mm_sub_epi8(in, _mm_set1_epi8('0'));
+    const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit); // unsigned digit <= 9
+    const __m128i letter = _mm_sub_epi8(_mm_or_si128(in, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    const __m128i is_letter = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), letter);
+    if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xFFFF) return false;
+    *nibbles = _mm_or_si128(_mm_and_si128(is_digit, digit), _mm_and_si128(is_letter, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+    return true;
+}
+
+// combines each pair of nibbles into a byte held in the low half of a 16 bit lane
+static inline __m128i sse2_join_nibble_pairs(__m128i nibbles) {
+    const __m128i high = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4);
+    const __m128i low = _mm_srli_epi16(nibbles, 8);
+    return _mm_or_si128(high, low);
+}
+
+static size_t decode_hex_block_sse2(const char* str, size_t length, unsigned char* output) {
+    size_t consumed = 0;
+    while (length - consumed >= 32) {
+        __m128i first, second;
+        if (!sse2_hex_nibbles(_mm_loadu_si128((const __m128i*)(str + consumed)), &first) ||
+            !sse2_hex_nibbles(_mm_loadu_si128((const __m128i*)(str + consumed + 16)), &second)) break;
+        _mm_storeu_si128((__m128i*)(output + consumed / 2), _mm_packus_epi16(sse2_join_nibble_pairs(first), sse2_join_nibble_pairs(second)));
+        consumed += 32;
+    }
+    return consumed;
+}
+#endif
+
+#ifdef use_avx2_hex
+__attribute__((target("avx2"))) static inline bool avx2_hex_nibbles(__m256i in, __m256i* nibbles) {
+    const __m256i digit = _mm256_sub_epi8(in, _mm256_set1_epi8('0'));
+    const __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit);
+    const __m256i letter = _mm256_sub_epi8(_mm256_or_si256(in, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    const __m256i is_letter = _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(5)), letter);
+    if (_mm256_movemask_epi8(_mm256_or_si256(is_digit, is_letter)) != -1) return false;
+    *nibbles = _mm256_or_si256(_mm256_and_si256(is_digit, digit), _mm256_and_si256(is_letter, _mm256_add_epi8(letter, _mm256_set1_epi8(10))));
+    return true;
+}
+
+__attribute__((target("avx2"))) static inline __m256i avx2_join_nibble_pairs(__m256i nibbles) {
+    const __m256i high = _mm256_slli_epi16(_mm256_and_si256(nibbles, _mm256_set1_epi16(0x00FF)), 4);
+    const __m256i low = _mm256_srli_epi16(nibbles, 8);
+    return _mm256_or_si256(high, low);
+}
+
+__attribute__((target("avx2"))) static size_t decode_hex_block_avx2(const char* str, size_t length, unsigned char* output) {
+    size_t consumed = 0;
+    while (length - consumed >= 64) {
+        __m256i first, second;
+        if (!avx2_hex_nibbles(_mm256_loadu_si256((const __m256i*)(str + consumed)), &first) ||
+            !avx2_hex_nibbles(_mm256_loadu_si256((const __m256i*)(str + consumed + 32)), &second)) break;
+        // packus works within each 128 bit lane, so put the quarters back in order afterwards
+        const __m256i packed = _mm256_packus_epi16(avx2_join_nibble_pairs(first), avx2_join_nibble_pairs(second));
+        _mm256_storeu_si256((__m256i*)(output + consumed / 2), _mm256_permute4x64_epi64(packed, 0xD8));
+        consumed += 64;
+    }
+    return consumed;
+}
+#endif
+
+#ifdef use_neon_hex
+static inline bool neon_hex_nibbles(uint8x16_t in, uint8x16_t* nibbles) {
+    const uint8x16_t digit = vsubq_u8(in, vdupq_n_u8('0'));
+    const uint8x16_t is_digit = vcltq_u8(digit, vdupq_n_u8(10));
+    const uint8x16_t letter = vsubq_u8(vorrq_u8(in, vdupq_n_u8(0x20)), vdupq_n_u8('a'));
+    const uint8x16_t is_letter = vcltq_u8(letter, vdupq_n_u8(6));
+    if (vminvq_u8(vorrq_u8(is_digit, is_letter)) != 0xFF) return false;
+    *nibbles = vbslq_u8(is_digit, digit, vaddq_u8(letter, vdupq_n_u8(10)));
+    return true;
+}
+
+static size_t decode_hex_block_neon(const char* str, size_t length, unsigned char* output) {
+    size_t consumed = 0;
+    while (length - consumed >= 32) {
+        uint8x16_t first, second;
+        if (!neon_hex_nibbles(vld1q_u8((const uint8_t*)str + consumed), &first) ||
+            !neon_hex_nibbles(vld1q_u8((const uint8_t*)str + consumed + 16), &second)) break;
+        const uint8x16_t high = vuzp1q_u8(first, second); // even characters
+        const uint8x16_t low = vuzp2q_u8(first, second);  // odd characters
+        vst1q_u8(output + consumed / 2, vorrq_u8(vshlq_n_u8(high, 4), low));
+        consumed += 32;
+    }
+    return consumed;
+}
+#endif
+
+// decodes as many whole blocks of hex digits as it can from the start of str, returning how many characters it consumed
+static size_t decode_hex_block(const char* str, size_t length, unsigned char* output) {
+    size_t consumed = 0;
+#ifdef use_avx2_hex
+    static int has_avx2 = -1;
+    if (has_avx2 < 0) has_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+    if (has_avx2) consumed = decode_hex_block_avx2(str, length, output);
+#endif
+#if defined(use_sse2_hex)
+    consumed += decode_hex_block_sse2(str + consumed, length - consumed, output + consumed / 2);
+#elif defined(use_neon_hex)
+    consumed += decode_hex_block_neon(str + consumed, length - consumed, output + consumed / 2);
+#else
+    (void)str;
+    (void)length;
+    (void)output;
+#endif
+    return consumed;
+}
+
+size_t decode_hex_literal(const char* str, size_t length, unsigned char* output) {
+    const char* p = str;
+    const char* end = str + length;
+    if (length >= 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) p += 2;
+
+    unsigned char* out = output;
+    int pending_nibble = -1;
+    while (p < end) {
+        if (pending_nibble < 0) { // only at a byte boundary
+            size_t consumed = decode_hex_block(p, (size_t)(end - p), out);
+            p += consumed;
+            out += consumed / 2;
+            if (p == end) break;
+        }
+        unsigned char c = (unsigned char)*p;
+        int value = hex_value(c);
+        if (value >= 0) {
+            if (pending_nibble < 0) {
+                pending_nibble = value;
+            } else {
+                *out++ = (unsigned char)(pending_nibble << 4 | value);
+                pending_nibble = -1;
+            }
+            p++;
+        } else if (pending_nibble < 0 && is_hex_separator(c)) {
+            p++;
+        } else if (pending_nibble < 0 && c == '\\' && p + 1 < end && p[1] == 'x') {
+            p += 2;
+        } else {
+            raiseException(1,  "Error: Invalid character '%c' at position %zu in hex literal\n", c, (size_t)(p - str));
+        }
+    }
+    if (pending_nibble >= 0) {
+        raiseException(1,  "Error: Hex literal has an odd number of hex digits\n");
+    }
+    return (size_t)(out - output);
+}
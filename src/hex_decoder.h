@@ -0,0 +1,18 @@
+#ifndef HEX_DECODER_H
+#define HEX_DECODER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Hex array literals start with 0x or \x. After that, bytes can optionally be separated by
+// spaces, tabs, newlines, colons or further \x prefixes, as in 0xdeadbeef, "0xde ad be ef", 0xde:ad:be:ef or \xde\xad\xbe\xef.
+bool is_hex_array_literal(const char* str);
+
+// An upper bound on the number of bytes a hex literal of this length decodes to, for sizing the destination up front
+size_t hex_literal_max_decoded_length(size_t length);
+
+// Validates and decodes a hex literal straight into output, which must have room for hex_literal_max_decoded_length(length) bytes.
+// Returns the number of bytes written, or raises an exception pointing at the first invalid character.
+size_t decode_hex_literal(const char* str, size_t length, unsigned char* output);
+
+#endif // HEX_DECODER_H
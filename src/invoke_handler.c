@@ -15,6 +15,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "exception_handling.h"
+#include "output_buffer.h"
+#include "arg_snapshot.h"
+#include "record_replay.h"
 
 
 ffi_type* arg_type_to_ffi_type(const ArgInfo* arg, bool is_inside_struct); // putting this declaration here instead of header since it's only used in this file
@@ -255,6 +258,15 @@ void* make_raw_value_for_struct(ArgInfo* struct_arginfo, bool is_return) { //, f
     return address_to_return; // if no pointers this is a pointer to the actual bytes
 }
 
+void get_struct_field_offsets(const ArgInfo* struct_arg, size_t* offsets) {
+    ffi_type* struct_type = make_ffi_type_for_struct(struct_arg);
+    ffi_status struct_status = struct_arg->struct_info->is_packed ? get_packed_offset(struct_arg, struct_type, offsets) : ffi_get_struct_offsets(FFI_DEFAULT_ABI, struct_type, offsets);
+    free_ffi_type(struct_type);
+    if (struct_status != FFI_OK) {
+        raiseException(1,  "Failed to get struct offsets.\n");
+    }
+}
+
 void fix_struct_pointers(ArgInfo* struct_arg, void* raw_memory) {
     StructInfo* struct_info = struct_arg->struct_info;
     size_t offsets[struct_info->info.arg_count];
@@ -336,6 +348,46 @@ void handle_promoting_vararg_if_necessary(ffi_type** arg_type_ptr, ArgInfo* arg,
     *arg_type_ptr = arg_type_to_ffi_type(arg, false);
 }
 
+// Some ABIs hand back small integer returns widened to a full register, which has to be narrowed back down into the return value
+static void narrow_small_integer_return(FunctionCallInfo* call_info, ffi_type* return_type) {
+#if defined(__s390x__)
+    if (return_type->size < ffi_type_slong.size) {
+        if (call_info->info.return_var->type == TYPE_CHAR) {
+            call_info->info.return_var->value->c_val = (char)call_info->info.return_var->value->l_val;
+        } else if (call_info->info.return_var->type == TYPE_SHORT) {
+            call_info->info.return_var->value->s_val = (short)call_info->info.return_var->value->l_val;
+        } else if (call_info->info.return_var->type == TYPE_UCHAR) {
+            call_info->info.return_var->value->uc_val = (unsigned char)call_info->info.return_var->value->ul_val;
+        } else if (call_info->info.return_var->type == TYPE_USHORT) {
+            call_info->info.return_var->value->us_val = (unsigned short)call_info->info.return_var->value->ul_val;
+        } else if (call_info->info.return_var->type == TYPE_INT) {
+            call_info->info.return_var->value->i_val = (int)call_info->info.return_var->value->l_val;
+        } else if (call_info->info.return_var->type == TYPE_UINT) {
+            call_info->info.return_var->value->ui_val = (unsigned int)call_info->info.return_var->value->ul_val;
+        } else if (call_info->info.return_var->type == TYPE_BOOL) {
+            call_info->info.return_var->value->b_val = (bool)call_info->info.return_var->value->l_val;
+        }
+    }
+#elif defined(__mips__)
+    if (return_type->size < ffi_type_sint.size && call_info->info.return_var->type != TYPE_VOID && call_info->info.return_var->type != TYPE_FLOAT) {
+        if (call_info->info.return_var->type == TYPE_CHAR) {
+            call_info->info.return_var->value->c_val = (char)call_info->info.return_var->value->i_val;
+        } else if (call_info->info.return_var->type == TYPE_SHORT) {
+            call_info->info.return_var->value->s_val = (short)call_info->info.return_var->value->i_val;
+        } else if (call_info->info.return_var->type == TYPE_UCHAR) {
+            call_info->info.return_var->value->uc_val = (unsigned char)call_info->info.return_var->value->ui_val;
+        } else if (call_info->info.return_var->type == TYPE_USHORT) {
+            call_info->info.return_var->value->us_val = (unsigned short)call_info->info.return_var->value->ui_val;
+        } else if (call_info->info.return_var->type == TYPE_BOOL) {
+            call_info->info.return_var->value->b_val = (bool)call_info->info.return_var->value->ui_val;
+        }
+    }
+#else
+    (void)call_info;
+    (void)return_type;
+#endif
+}
+
 // Main function to invoke a dynamic function call
 int invoke_dynamic_function(FunctionCallInfo* call_info, void* func) {
 
@@ -405,11 +457,20 @@ int invoke_dynamic_function(FunctionCallInfo* call_info, void* func) {
     #endif
 
 
+    free_call_snapshot(call_info->arg_snapshot); // from an earlier call with the same call_info
+    call_info->arg_snapshot = snapshot_call_args(call_info, values);
+
+    output_flush(); // anything the function itself prints should come after what we've printed so far
+    if (is_recording()) record_call_before(call_info);
     setCodeSectionForSegfaultHandler("invoke_dynamic_function:ffi_call");
 
     ffi_call(&cif, func, rvalue, values);
 
     setCodeSectionForSegfaultHandler("invoke_dynamic_function:after ffi_call");
+    if (call_info->info.return_var->type != TYPE_STRUCT) {
+        narrow_small_integer_return(call_info, return_type);
+    }
+    if (is_recording()) record_call_after(call_info);
 
     free_ffi_type(return_type);
     for (int i = 0; i < call_info->info.arg_count; ++i) {
@@ -429,42 +490,106 @@ int invoke_dynamic_function(FunctionCallInfo* call_info, void* func) {
     if (call_info->info.return_var->type == TYPE_STRUCT) {
         fix_struct_pointers(call_info->info.return_var, rvalue);
     }
-#if defined(__s390x__)
-    else if (return_type->size < ffi_type_slong.size) {
-        if (call_info->info.return_var->type == TYPE_CHAR) {
-            call_info->info.return_var->value->c_val = (char)call_info->info.return_var->value->l_val;
-        } else if (call_info->info.return_var->type == TYPE_SHORT) {
-            call_info->info.return_var->value->s_val = (short)call_info->info.return_var->value->l_val;
-        } else if (call_info->info.return_var->type == TYPE_UCHAR) {
-            call_info->info.return_var->value->uc_val = (unsigned char)call_info->info.return_var->value->ul_val;
-        } else if (call_info->info.return_var->type == TYPE_USHORT) {
-            call_info->info.return_var->value->us_val = (unsigned short)call_info->info.return_var->value->ul_val;
-        } else if (call_info->info.return_var->type == TYPE_INT) {
-            call_info->info.return_var->value->i_val = (int)call_info->info.return_var->value->l_val;
-        } else if (call_info->info.return_var->type == TYPE_UINT) {
-            call_info->info.return_var->value->ui_val = (unsigned int)call_info->info.return_var->value->ul_val;
-        } else if (call_info->info.return_var->type == TYPE_BOOL) {
-            call_info->info.return_var->value->b_val = (bool)call_info->info.return_var->value->l_val;
+    if (args != NULL) free(args);
+    if (values != NULL) free(values);
+    unsetCodeSectionForSegfaultHandler();
+
+    return 0;
+}
+
+struct PreparedCif {
+    ffi_cif cif;
+    unsigned int arg_count;
+    ffi_type** arg_types; // those of struct args were made for them, the rest are static
+    ffi_type* return_type;
+    void** values;
+    void** struct_values; // what the last invoke laid out for each struct arg, which the arg's fields point into
+};
+
+// The raw memory make_raw_value_for_struct laid out for a struct arg, and the pointers to it for its pointer_depth
+static void free_raw_struct_value(void* raw, int pointer_depth) {
+    for (int i = 0; i < pointer_depth; i++) {
+        void* pointed_to = *(void**)raw;
+        free(raw);
+        raw = pointed_to;
+    }
+    free(raw);
+}
+
+PreparedCif* prepare_cif(FunctionCallInfo* call_info) {
+    if (call_info->info.return_var->type == TYPE_STRUCT) return NULL;
+
+    PreparedCif* prepared = calloc(1, sizeof(PreparedCif));
+    prepared->arg_count = call_info->info.arg_count;
+    prepared->arg_types = malloc((call_info->info.arg_count + 1) * sizeof(ffi_type*));
+    prepared->values = malloc((call_info->info.arg_count + 1) * sizeof(void*));
+    prepared->struct_values = calloc(call_info->info.arg_count + 1, sizeof(void*));
+    for (int i = 0; i < call_info->info.arg_count; ++i) {
+        prepared->arg_types[i] = arg_type_to_ffi_type(call_info->info.args[i], false);
+        bool is_vararg = call_info->info.vararg_start != -1 && i >= call_info->info.vararg_start;
+        if (is_vararg) handle_promoting_vararg_if_necessary(&prepared->arg_types[i], call_info->info.args[i], i);
+        if (!prepared->arg_types[i]) {
+            prepared->arg_count = i;
+            free_prepared_cif(prepared);
+            raiseException(1,  "Failed to convert arg[%d].type = %c to ffi_type.\n", i, call_info->info.args[i]->type);
         }
     }
-#elif defined(__mips__)
-    else if (return_type->size < ffi_type_sint.size && call_info->info.return_var->type != TYPE_VOID && call_info->info.return_var->type != TYPE_FLOAT) {
-        if (call_info->info.return_var->type == TYPE_CHAR) {
-            call_info->info.return_var->value->c_val = (char)call_info->info.return_var->value->i_val;
-        } else if (call_info->info.return_var->type == TYPE_SHORT) {
-            call_info->info.return_var->value->s_val = (short)call_info->info.return_var->value->i_val;
-        } else if (call_info->info.return_var->type == TYPE_UCHAR) {
-            call_info->info.return_var->value->uc_val = (unsigned char)call_info->info.return_var->value->ui_val;
-        } else if (call_info->info.return_var->type == TYPE_USHORT) {
-            call_info->info.return_var->value->us_val = (unsigned short)call_info->info.return_var->value->ui_val;
-        } else if (call_info->info.return_var->type == TYPE_BOOL) {
-            call_info->info.return_var->value->b_val = (bool)call_info->info.return_var->value->ui_val;
+    prepared->return_type = arg_type_to_ffi_type(call_info->info.return_var, false);
+
+    ffi_status status;
+    if (call_info->info.vararg_start != -1) {
+        status = ffi_prep_cif_var(&prepared->cif, FFI_DEFAULT_ABI, call_info->info.vararg_start, call_info->info.arg_count, prepared->return_type, prepared->arg_types);
+    } else {
+        status = ffi_prep_cif(&prepared->cif, FFI_DEFAULT_ABI, call_info->info.arg_count, prepared->return_type, prepared->arg_types);
+    }
+    if (status != FFI_OK) {
+        free_prepared_cif(prepared);
+        raiseException(1,  "ffi_prep_cif failed. Return status = %s\n", ffi_status_to_string(status));
+    }
+    return prepared;
+}
+
+int invoke_prepared_cif(FunctionCallInfo* call_info, PreparedCif* prepared, void* func) {
+    // the values are gathered again each time, in case an arg's value buffer has been replaced since, and struct args
+    // get their raw memory laid out afresh from their fields, as invoke_dynamic_function does. That moves the fields
+    // into the new memory, so what the last invoke laid out is no longer needed
+    for (int i = 0; i < call_info->info.arg_count; ++i) {
+        if (call_info->info.args[i]->type == TYPE_STRUCT) {
+            void* previous = prepared->struct_values[i];
+            prepared->values[i] = prepared->struct_values[i] = make_raw_value_for_struct(call_info->info.args[i], false);
+            if (previous != NULL) free_raw_struct_value(previous, call_info->info.args[i]->pointer_depth);
+        } else {
+            prepared->values[i] = call_info->info.args[i]->value;
         }
     }
-#endif
-    if (args != NULL) free(args);
-    if (values != NULL) free(values);
-    unsetCodeSectionForSegfaultHandler();
 
+    free_call_snapshot(call_info->arg_snapshot);
+    call_info->arg_snapshot = snapshot_call_args(call_info, prepared->values);
+
+    output_flush();
+    if (is_recording()) record_call_before(call_info);
+    setCodeSectionForSegfaultHandler("invoke_prepared_cif:ffi_call");
+    ffi_call(&prepared->cif, func, call_info->info.return_var->value, prepared->values);
+    narrow_small_integer_return(call_info, prepared->return_type);
+    if (is_recording()) record_call_after(call_info);
+    for (int i = 0; i < call_info->info.arg_count; ++i) {
+        if (call_info->info.args[i]->type == TYPE_STRUCT) fix_struct_pointers(call_info->info.args[i], prepared->struct_values[i]);
+    }
+    unsetCodeSectionForSegfaultHandler();
     return 0;
 }
+
+void call_prepared_cif(FunctionCallInfo* call_info, PreparedCif* prepared, void* func, void** values) {
+    ffi_call(&prepared->cif, func, call_info->info.return_var->value, values);
+    narrow_small_integer_return(call_info, prepared->return_type);
+}
+
+void free_prepared_cif(PreparedCif* prepared) {
+    if (prepared == NULL) return;
+    for (unsigned int i = 0; i < prepared->arg_count; i++) free_ffi_type(prepared->arg_types[i]);
+    free(prepared->arg_types);
+    free(prepared->values);
+    // The memory the last invoke laid out stays, since the struct args' fields (which may be variables) point into it
+    free(prepared->struct_values);
+    free(prepared);
+}
@@ -8,5 +8,18 @@ int invoke_dynamic_function(FunctionCallInfo* call_info, void* func);
 void* make_raw_value_for_struct(ArgInfo* struct_arginfo, bool is_return);
 size_t get_size_of_struct(const ArgInfo* arg);
 void fix_struct_pointers(ArgInfo* struct_arg, void* raw_memory);
+void get_struct_field_offsets(const ArgInfo* struct_arg, size_t* offsets); // offsets must have room for one per field
+
+// A call interface worked out once and then reused for every call with the same signature, skipping the per call type
+// conversion and ffi_prep_cif. Struct args have their raw memory laid out afresh for each call, but calls with struct
+// returns aren't covered (prepare_cif returns NULL for them), since the return value gets rebuilt by every call.
+typedef struct PreparedCif PreparedCif;
+PreparedCif* prepare_cif(FunctionCallInfo* call_info);
+int invoke_prepared_cif(FunctionCallInfo* call_info, PreparedCif* prepared, void* func);
+// Just the ffi_call, for callers that fill in the arg values and deal with the output themselves, possibly on another thread.
+// values holds a pointer to each arg's value as for ffi_call, and the return value ends up in the return_var as usual.
+// Any struct args have to be laid out in values by the caller.
+void call_prepared_cif(FunctionCallInfo* call_info, PreparedCif* prepared, void* func, void** values);
+void free_prepared_cif(PreparedCif* prepared);
 
 #endif // INVOKE_HANDLER_H
@@ -0,0 +1,236 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for dlinfo and dl_iterate_phdr
+#endif
+#include "lib_checkpoint.h"
+#include "exception_handling.h"
+#include "library_manager.h"
+#include "output_buffer.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__ELF__) && !defined(_WIN32) && !defined(__ANDROID__)
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <link.h>
+#include <unistd.h>
+#define use_dl_iterate_phdr
+#endif
+
+#ifdef use_dl_iterate_phdr
+
+#define SOFT_DIRTY_BIT (1ULL << 55) // in each /proc/self/pagemap entry
+
+typedef struct {
+    unsigned char* start; // page aligned, as is the length
+    size_t length;
+    unsigned char* saved;
+    bool* dirty; // per page, gathered from the soft-dirty bits each time they're cleared
+} CheckpointSegment;
+
+typedef struct {
+    char* library_path;
+    unsigned int load_count; // the segments are only where they were while the library stays loaded
+    CheckpointSegment* segments;
+    size_t segment_count;
+} LibraryCheckpoint;
+
+static LibraryCheckpoint* checkpoints = NULL;
+static size_t checkpoint_count = 0;
+static size_t page_size = 0;
+
+static enum { SOFT_DIRTY_UNKNOWN, SOFT_DIRTY_AVAILABLE, SOFT_DIRTY_UNAVAILABLE } soft_dirty = SOFT_DIRTY_UNKNOWN;
+
+static uintptr_t page_down(uintptr_t address) { return address & ~(uintptr_t)(page_size - 1); }
+static uintptr_t page_up(uintptr_t address) { return page_down(address + page_size - 1); }
+
+static bool clear_soft_dirty_bits() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0) return false;
+    bool cleared = write(fd, "4", 1) == 1;
+    close(fd);
+    return cleared;
+}
+
+// Reads the pagemap entries for the pages of [start, start + length), returning false if it can't
+static bool read_pagemap(const unsigned char* start, size_t length, uint64_t* entries) {
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd < 0) return false;
+    size_t pages = length / page_size;
+    off_t offset = (off_t)((uintptr_t)start / page_size * sizeof(uint64_t));
+    bool ok = pread(fd, entries, pages * sizeof(uint64_t), offset) == (ssize_t)(pages * sizeof(uint64_t));
+    close(fd);
+    return ok;
+}
+
+// Not every kernel keeps soft-dirty bits (and where it doesn't they just read as 0), so check that a write shows up
+static bool soft_dirty_available() {
+    if (soft_dirty != SOFT_DIRTY_UNKNOWN) return soft_dirty == SOFT_DIRTY_AVAILABLE;
+    soft_dirty = SOFT_DIRTY_UNAVAILABLE;
+    unsigned char* probe = NULL;
+    if (posix_memalign((void**)&probe, page_size, page_size) != 0) return false;
+    probe[0] = 1;
+    uint64_t entry = 0;
+    if (clear_soft_dirty_bits() && read_pagemap(probe, page_size, &entry) && (entry & SOFT_DIRTY_BIT) == 0) {
+        ((volatile unsigned char*)probe)[0] = 2;
+        if (read_pagemap(probe, page_size, &entry) && (entry & SOFT_DIRTY_BIT) != 0) soft_dirty = SOFT_DIRTY_AVAILABLE;
+    }
+    free(probe);
+    return soft_dirty == SOFT_DIRTY_AVAILABLE;
+}
+
+// Clearing the soft-dirty bits clears them for the whole process, so before that the pages each checkpoint
+// covers that have been written are noted down
+static void gather_and_clear_soft_dirty_bits() {
+    for (size_t c = 0; c < checkpoint_count; c++) {
+        for (size_t s = 0; s < checkpoints[c].segment_count; s++) {
+            CheckpointSegment* segment = &checkpoints[c].segments[s];
+            size_t pages = segment->length / page_size;
+            uint64_t* entries = malloc(pages * sizeof(uint64_t));
+            bool read = entries != NULL && read_pagemap(segment->start, segment->length, entries);
+            for (size_t page = 0; page < pages; page++) {
+                if (!read || (entries[page] & SOFT_DIRTY_BIT) != 0) segment->dirty[page] = true;
+            }
+            free(entries);
+        }
+    }
+    clear_soft_dirty_bits();
+}
+
+typedef struct {
+    uintptr_t base;
+    LibraryCheckpoint* checkpoint;
+    bool found;
+} SegmentSearch;
+
+static int collect_writable_segments(struct dl_phdr_info* info, size_t size, void* context) {
+    (void)size;
+    SegmentSearch* search = context;
+    if (info->dlpi_addr != search->base) return 0;
+    search->found = true;
+
+    uintptr_t relro_end = 0;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* header = &info->dlpi_phdr[i];
+        if (header->p_type == PT_GNU_RELRO) relro_end = page_down(info->dlpi_addr + header->p_vaddr + header->p_memsz);
+    }
+    LibraryCheckpoint* checkpoint = search->checkpoint;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* header = &info->dlpi_phdr[i];
+        if (header->p_type != PT_LOAD || (header->p_flags & PF_W) == 0) continue;
+        uintptr_t start = page_down(info->dlpi_addr + header->p_vaddr);
+        uintptr_t end = page_up(info->dlpi_addr + header->p_vaddr + header->p_memsz);
+        if (start < relro_end && relro_end <= end) start = relro_end; // already read-only, so it can't have changed
+        if (start >= end) continue;
+        checkpoint->segments = realloc(checkpoint->segments, (checkpoint->segment_count + 1) * sizeof(CheckpointSegment));
+        CheckpointSegment* segment = &checkpoint->segments[checkpoint->segment_count++];
+        segment->start = (unsigned char*)start;
+        segment->length = end - start;
+        segment->saved = malloc(segment->length);
+        segment->dirty = calloc(segment->length / page_size, sizeof(bool));
+        if (segment->saved == NULL || segment->dirty == NULL) {
+            raiseException(1,  "Failed to allocate memory for a checkpoint.\n");
+        }
+        memcpy(segment->saved, segment->start, segment->length);
+    }
+    return 1;
+}
+
+static LibraryCheckpoint* find_checkpoint(const char* library_path) {
+    for (size_t i = 0; i < checkpoint_count; i++) {
+        if (strcmp(checkpoints[i].library_path, library_path) == 0) return &checkpoints[i];
+    }
+    return NULL;
+}
+
+static void free_checkpoint_segments(LibraryCheckpoint* checkpoint) {
+    for (size_t i = 0; i < checkpoint->segment_count; i++) {
+        free(checkpoint->segments[i].saved);
+        free(checkpoint->segments[i].dirty);
+    }
+    free(checkpoint->segments);
+    checkpoint->segments = NULL;
+    checkpoint->segment_count = 0;
+}
+
+void checkpoint_library(const char* library_path) {
+    if (page_size == 0) page_size = (size_t)sysconf(_SC_PAGESIZE);
+    void* handle = getOrLoadLibrary(library_path);
+    if (handle == NULL) {
+        raiseException(1,  "Failed to load library: %s\n", library_path);
+    }
+    struct link_map* map = NULL;
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0 || map == NULL) {
+        raiseException(1,  "Error: Could not find where %s is loaded: %s\n", library_path, dlerror());
+    }
+
+    bool tracking = soft_dirty_available();
+    if (tracking) gather_and_clear_soft_dirty_bits(); // before the checkpoint starts, so that what's gathered is only later writes
+
+    LibraryCheckpoint* checkpoint = find_checkpoint(library_path);
+    if (checkpoint != NULL) {
+        free_checkpoint_segments(checkpoint);
+    } else {
+        checkpoints = realloc(checkpoints, (checkpoint_count + 1) * sizeof(LibraryCheckpoint));
+        checkpoint = &checkpoints[checkpoint_count++];
+        checkpoint->library_path = strdup(library_path);
+        checkpoint->segments = NULL;
+        checkpoint->segment_count = 0;
+    }
+    checkpoint->load_count = getLibraryLoadCount(library_path);
+    SegmentSearch search = {(uintptr_t)map->l_addr, checkpoint, false};
+    dl_iterate_phdr(collect_writable_segments, &search);
+    if (!search.found) {
+        raiseException(1,  "Error: Could not find the segments of %s\n", library_path);
+    }
+
+    size_t bytes = 0;
+    for (size_t i = 0; i < checkpoint->segment_count; i++) bytes += checkpoint->segments[i].length;
+    output_printf("Checkpointed %zu bytes of writable segments in %s (%s)\n", bytes, library_path,
+                  tracking ? "tracking changes with soft-dirty bits" : "finding changes by comparing pages");
+}
+
+void reset_library(const char* library_path) {
+    LibraryCheckpoint* checkpoint = find_checkpoint(library_path);
+    if (checkpoint == NULL) {
+        raiseException(1,  "Error: %s has no checkpoint to reset to. Run checkpoint %s first\n", library_path, library_path);
+    }
+    if (getOrLoadLibrary(library_path) == NULL || getLibraryLoadCount(library_path) != checkpoint->load_count) {
+        raiseException(1,  "Error: %s has been closed or reloaded since its checkpoint. Run checkpoint %s again\n", library_path, library_path);
+    }
+    bool tracking = soft_dirty_available();
+    if (tracking) gather_and_clear_soft_dirty_bits();
+
+    size_t pages = 0;
+    size_t restored = 0;
+    for (size_t s = 0; s < checkpoint->segment_count; s++) {
+        CheckpointSegment* segment = &checkpoint->segments[s];
+        for (size_t page = 0; page < segment->length / page_size; page++, pages++) {
+            unsigned char* live = segment->start + page * page_size;
+            const unsigned char* saved = segment->saved + page * page_size;
+            bool changed = tracking ? segment->dirty[page] && memcmp(live, saved, page_size) != 0 : memcmp(live, saved, page_size) != 0;
+            if (changed) {
+                memcpy(live, saved, page_size);
+                restored++;
+            }
+            segment->dirty[page] = false;
+        }
+    }
+    // the copying back set soft-dirty bits of its own, which shouldn't count as changes since the reset
+    if (tracking && restored > 0) clear_soft_dirty_bits();
+    output_printf("Reset %s, copying back %zu of %zu pages\n", library_path, restored, pages);
+}
+
+#else
+
+void checkpoint_library(const char* library_path) {
+    raiseException(1,  "Error: checkpoint isn't supported on this platform, so %s can't be checkpointed\n", library_path);
+}
+
+void reset_library(const char* library_path) {
+    raiseException(1,  "Error: reset isn't supported on this platform, so %s can't be reset\n", library_path);
+}
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef LIB_CHECKPOINT_H
+#define LIB_CHECKPOINT_H
+
+// Puts a library's globals back the way they were, without closing and reopening it:
+//
+//   checkpoint <library>
+//   reset <library>
+//
+// checkpoint copies the library's writable segments (its .data and .bss, as found by dl_iterate_phdr, less the
+// part that's made read-only after relocation), and reset copies back the pages that have changed since.
+// Where the kernel tracks soft-dirty pages, those are what says which pages were written; elsewhere each page is
+// compared against the copy. Either way only the changed pages are written back, so resetting between iterations of
+// a benchmark or test costs next to nothing when the library only touched a few globals.
+// Memory the library allocated for itself isn't covered, only its own segments.
+// Only supported on ELF platforms with dl_iterate_phdr.
+
+void checkpoint_library(const char* library_path);
+void reset_library(const char* library_path);
+
+#endif // LIB_CHECKPOINT_H
@@ -0,0 +1,638 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for RTLD_DEEPBIND, dlinfo and dl_iterate_phdr
+#endif
+#include "lib_profile.h"
+#include "exception_handling.h"
+#include "library_manager.h"
+#include "library_path_resolver.h"
+#include "output_buffer.h"
+#include "types_and_utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <dlfcn.h>
+#if defined(__ELF__) && defined(__GLIBC__)
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define use_link_map
+#ifndef DT_RELR // older headers, from before packed relative relocations
+#define DT_RELRSZ 35
+#define DT_RELR 36
+#endif
+#endif
+#endif
+
+typedef struct {
+    char* name; // as the library names it in DT_NEEDED
+    uint64_t load_ns; // including any dependencies of its own that it brought in
+} DependencyLoad;
+
+typedef struct {
+    char* library_path;
+    unsigned int load_count; // of the load that was profiled
+    uint64_t self_ns; // to open the library itself, once its direct dependencies were in
+    DependencyLoad* dependencies;
+    size_t dependency_count;
+} LoadProfile;
+
+static bool loads_deferred = false;
+
+static LoadProfile* profiles = NULL;
+static size_t profile_count = 0;
+
+static LoadProfile* find_profile(const char* library_path) {
+    for (size_t i = 0; i < profile_count; i++) {
+        if (strcmp(profiles[i].library_path, library_path) == 0) return &profiles[i];
+    }
+    return NULL;
+}
+
+static LoadProfile* new_profile(const char* library_path) {
+    LoadProfile* profile = find_profile(library_path);
+    if (profile != NULL) {
+        for (size_t i = 0; i < profile->dependency_count; i++) free(profile->dependencies[i].name);
+        free(profile->dependencies);
+    } else {
+        profiles = realloc(profiles, (profile_count + 1) * sizeof(LoadProfile));
+        profile = &profiles[profile_count++];
+        profile->library_path = strdup(library_path);
+    }
+    profile->load_count = 0;
+    profile->self_ns = 0;
+    profile->dependencies = NULL;
+    profile->dependency_count = 0;
+    return profile;
+}
+
+static int parse_load_flags(int argc, char** argv) {
+#if defined(_WIN32) || defined(_WIN64)
+    if (argc > 0) {
+        raiseException(1,  "Error: Load flags like %s aren't supported on Windows\n", argv[0]);
+    }
+    return LIBRARY_DEFAULT_FLAGS;
+#else
+    int binding = RTLD_LAZY;
+    int flags = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--now") == 0) {
+            binding = RTLD_NOW;
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            binding = RTLD_LAZY;
+        } else if (strcmp(argv[i], "--global") == 0) {
+            flags = (flags & ~RTLD_LOCAL) | RTLD_GLOBAL;
+        } else if (strcmp(argv[i], "--local") == 0) {
+            flags = (flags & ~RTLD_GLOBAL) | RTLD_LOCAL;
+#ifdef RTLD_DEEPBIND
+        } else if (strcmp(argv[i], "--deepbind") == 0) {
+            flags |= RTLD_DEEPBIND;
+#endif
+#ifdef RTLD_NODELETE
+        } else if (strcmp(argv[i], "--nodelete") == 0) {
+            flags |= RTLD_NODELETE;
+#endif
+        } else {
+            raiseException(1,  "Error: Unknown or unsupported load flag %s. The flags are --now, --lazy, --global, --local, --deepbind and --nodelete\n", argv[i]);
+        }
+    }
+    return binding | flags;
+#endif
+}
+
+static const char* describe_flags(int flags) {
+#if defined(_WIN32) || defined(_WIN64)
+    (void)flags;
+    return "LoadLibrary";
+#else
+    static char description[64];
+    if (flags == LIBRARY_DEFAULT_FLAGS) flags = RTLD_LAZY;
+    snprintf(description, sizeof(description), "%s, %s%s%s", (flags & RTLD_NOW) == RTLD_NOW ? "now" : "lazy",
+             (flags & RTLD_GLOBAL) ? "global" : "local",
+#ifdef RTLD_DEEPBIND
+             (flags & RTLD_DEEPBIND) ? ", deepbind" : "",
+#else
+             "",
+#endif
+#ifdef RTLD_NODELETE
+             (flags & RTLD_NODELETE) ? ", nodelete" : ""
+#else
+             ""
+#endif
+    );
+    return description;
+#endif
+}
+
+#ifdef use_link_map
+
+// The DT_NEEDED entries of the library file at path, read from the file since it isn't loaded yet, along with its
+// DT_RPATH and DT_RUNPATH (NULL where it has none)
+static char** read_needed_from_file(const char* path, size_t* count, char** rpath, char** runpath) {
+    *count = 0;
+    *rpath = *runpath = NULL;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    char** needed = NULL;
+    ElfW(Ehdr) header;
+    ElfW(Phdr)* segments = NULL;
+    ElfW(Dyn)* dynamic = NULL;
+    char* strings = NULL;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.e_ident, ELFMAG, SELFMAG) != 0 ||
+        header.e_ident[EI_CLASS] != (sizeof(void*) == 8 ? ELFCLASS64 : ELFCLASS32) || header.e_phentsize != sizeof(ElfW(Phdr))) {
+        goto done;
+    }
+    size_t segments_size = (size_t)header.e_phnum * sizeof(ElfW(Phdr));
+    segments = malloc(segments_size > 0 ? segments_size : 1);
+    if (pread(fd, segments, segments_size, (off_t)header.e_phoff) != (ssize_t)segments_size) goto done;
+
+    size_t dynamic_count = 0;
+    for (int i = 0; i < header.e_phnum; i++) {
+        if (segments[i].p_type != PT_DYNAMIC) continue;
+        dynamic = malloc(segments[i].p_filesz > 0 ? segments[i].p_filesz : 1);
+        if (pread(fd, dynamic, segments[i].p_filesz, (off_t)segments[i].p_offset) != (ssize_t)segments[i].p_filesz) goto done;
+        dynamic_count = segments[i].p_filesz / sizeof(ElfW(Dyn));
+    }
+    ElfW(Addr) strings_address = 0;
+    size_t strings_size = 0;
+    for (size_t i = 0; i < dynamic_count && dynamic[i].d_tag != DT_NULL; i++) {
+        if (dynamic[i].d_tag == DT_STRTAB) strings_address = dynamic[i].d_un.d_ptr;
+        if (dynamic[i].d_tag == DT_STRSZ) strings_size = dynamic[i].d_un.d_val;
+    }
+    for (int i = 0; i < header.e_phnum && strings == NULL && strings_size > 0; i++) { // from where it's loaded to where it's in the file
+        if (segments[i].p_type != PT_LOAD || strings_address < segments[i].p_vaddr ||
+            strings_address + strings_size > segments[i].p_vaddr + segments[i].p_filesz) {
+            continue;
+        }
+        strings = malloc(strings_size + 1);
+        if (pread(fd, strings, strings_size, (off_t)(segments[i].p_offset + strings_address - segments[i].p_vaddr)) != (ssize_t)strings_size) goto done;
+        strings[strings_size] = '\0';
+    }
+    if (strings == NULL) goto done;
+    for (size_t i = 0; i < dynamic_count && dynamic[i].d_tag != DT_NULL; i++) {
+        if (dynamic[i].d_un.d_val >= strings_size) continue;
+        if (dynamic[i].d_tag == DT_RPATH && *rpath == NULL) *rpath = strdup(strings + dynamic[i].d_un.d_val);
+        if (dynamic[i].d_tag == DT_RUNPATH && *runpath == NULL) *runpath = strdup(strings + dynamic[i].d_un.d_val);
+        if (dynamic[i].d_tag != DT_NEEDED) continue;
+        needed = realloc(needed, (*count + 1) * sizeof(char*));
+        needed[(*count)++] = strdup(strings + dynamic[i].d_un.d_val);
+    }
+done:
+    free(strings);
+    free(dynamic);
+    free(segments);
+    close(fd);
+    return needed;
+}
+
+// Looks for name in each of the directories of a search path, with $ORIGIN (or ${ORIGIN}) being origin. Directories
+// with other tokens ($LIB, $PLATFORM) are left out, since only the loader knows what it makes of them
+static char* find_in_directories(const char* name, const char* directories, const char* origin) {
+    if (directories == NULL) return NULL;
+    char path[PATH_MAX];
+    const char* directory = directories;
+    while (true) {
+        size_t length = strcspn(directory, ":");
+        const char* rest = directory;
+        size_t written = 0;
+        bool usable = true;
+        while (rest < directory + length && usable && written < sizeof(path)) {
+            if (strncmp(rest, "$ORIGIN", 7) == 0 || strncmp(rest, "${ORIGIN}", 9) == 0) {
+                written += (size_t)snprintf(path + written, sizeof(path) - written, "%s", origin);
+                rest += rest[1] == '{' ? 9 : 7;
+            } else if (*rest == '$') {
+                usable = false;
+            } else {
+                path[written++] = *rest++;
+            }
+        }
+        if (usable && written + strlen(name) + 2 <= sizeof(path)) {
+            snprintf(path + written, sizeof(path) - written, "%s%s", written > 0 ? "/" : "", name);
+            if (access(path, R_OK) == 0) return strdup(path);
+        }
+        if (directory[length] == '\0') return NULL;
+        directory += length + 1;
+    }
+}
+
+// Whether cliffi itself has an RPATH or RUNPATH, which dlopen searches before the system directories for a bare name
+static bool has_own_search_path(void) {
+    struct link_map* map = NULL;
+    void* self = dlopen(NULL, RTLD_LAZY);
+    if (self == NULL || dlinfo(self, RTLD_DI_LINKMAP, &map) != 0 || map == NULL) return true;
+    for (const ElfW(Dyn)* entry = map->l_ld; entry != NULL && entry->d_tag != DT_NULL; entry++) {
+        if (entry->d_tag == DT_RPATH || entry->d_tag == DT_RUNPATH) return true;
+    }
+    return false;
+}
+
+// What to open a dependency as so that it's the same file the library's own load would find: the library's DT_RPATH
+// (if it has no DT_RUNPATH), LD_LIBRARY_PATH, then its DT_RUNPATH, then the system directories, which is where dlopen
+// looks for a bare name too, as long as cliffi has no search path of its own. NULL if that can't be told, in which case
+// the dependency is left to be opened (and timed) with the library.
+static char* resolve_dependency(const char* needed, const char* rpath, const char* runpath, const char* origin) {
+    if (strchr(needed, '/') != NULL) return strdup(needed);
+    char* found = runpath == NULL ? find_in_directories(needed, rpath, origin) : NULL;
+    if (found == NULL) found = find_in_directories(needed, getenv("LD_LIBRARY_PATH"), origin);
+    if (found == NULL) found = find_in_directories(needed, runpath, origin);
+    if (found == NULL && !has_own_search_path()) found = strdup(needed);
+    return found;
+}
+
+// Opens each direct dependency that isn't loaded yet on its own, timing each, and then the library itself
+static void *load_and_profile(const char* library_path, int flags) {
+    size_t needed_count;
+    char* rpath;
+    char* runpath;
+    char** needed = read_needed_from_file(library_path, &needed_count, &rpath, &runpath);
+    char origin[PATH_MAX]; // the directory the library is in
+    if (realpath(library_path, origin) == NULL) snprintf(origin, sizeof(origin), "%s", library_path);
+    char* last_slash = strrchr(origin, '/');
+    if (last_slash != NULL) *last_slash = '\0';
+    else snprintf(origin, sizeof(origin), ".");
+    LoadProfile* profile = new_profile(library_path);
+    void** dependency_handles = calloc(needed_count > 0 ? needed_count : 1, sizeof(void*));
+    // these only affect the library itself, and with its dependencies opened on their own would change how they bind
+    int dependency_flags = flags & ~(RTLD_DEEPBIND | RTLD_NODELETE);
+    if (dependency_flags == LIBRARY_DEFAULT_FLAGS) dependency_flags = RTLD_LAZY;
+    for (size_t i = 0; i < needed_count; i++) {
+        void* loaded = dlopen(needed[i], RTLD_LAZY | RTLD_NOLOAD);
+        if (loaded != NULL) {
+            dlclose(loaded);
+            continue;
+        }
+        char* dependency_path = resolve_dependency(needed[i], rpath, runpath, origin);
+        if (dependency_path == NULL) continue;
+        uint64_t started = now_ns();
+        dependency_handles[i] = dlopen(dependency_path, dependency_flags);
+        uint64_t took = now_ns() - started;
+        free(dependency_path);
+        if (dependency_handles[i] == NULL) continue; // it'll fail again with the library, and say why then
+        profile->dependencies = realloc(profile->dependencies, (profile->dependency_count + 1) * sizeof(DependencyLoad));
+        profile->dependencies[profile->dependency_count++] = (DependencyLoad){strdup(needed[i]), took};
+    }
+    void* handle = getOrLoadLibraryWithFlags(library_path, flags);
+    profile->load_count = getLibraryLoadCount(library_path);
+    profile->self_ns = getLibraryLoadNs(library_path);
+    for (size_t i = 0; i < needed_count; i++) {
+        if (dependency_handles[i] != NULL) dlclose(dependency_handles[i]); // the library holds on to them now
+        free(needed[i]);
+    }
+    free(dependency_handles);
+    free(needed);
+    free(rpath);
+    free(runpath);
+    return handle;
+}
+
+#endif
+
+// load <library> as <alias> [--namespace new] [flags..]
+static void load_library_as(const char* library_path, const char* alias, int argc, char** argv) {
+    bool new_namespace = false;
+    char** flag_args = malloc((argc > 0 ? argc : 1) * sizeof(char*));
+    int flag_count = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "--namespace") != 0) {
+            flag_args[flag_count++] = argv[i];
+        } else if (i + 1 < argc && strcmp(argv[i + 1], "new") == 0) {
+            new_namespace = true;
+            i++;
+        } else {
+            free(flag_args);
+            raiseException(1,  "Error: The only namespace a library can be loaded into is a new one, with --namespace new\n");
+        }
+    }
+    int flags = parse_load_flags(flag_count, flag_args);
+    free(flag_args);
+    if (isLibraryOpen(alias) || getLibraryLoadCount(alias) > 0) {
+        raiseException(1,  "Error: %s is already the name of a library\n", alias);
+    }
+    if (!new_namespace) { // just another name for the library
+        void* handle = getOrLoadLibraryWithFlags(library_path, flags);
+        if (handle == NULL) {
+            raiseException(1,  "Failed to load library: %s\n", library_path);
+        }
+        remember_resolved_library_path(alias, library_path);
+        output_printf("Loaded %s as %s (%s)\n", library_path, alias, describe_flags(flags));
+        return;
+    }
+    if (!canLoadInNewNamespace()) {
+        raiseException(1,  "Error: Loading a library into a namespace of its own isn't supported on this platform\n");
+    }
+#ifdef RTLD_GLOBAL
+    if (flags & RTLD_GLOBAL) {
+        raiseException(1,  "Error: A library in a namespace of its own can't be loaded --global\n");
+    }
+#endif
+    if (loadLibraryInNewNamespace(alias, library_path, flags) == NULL) {
+        raiseException(1,  "Failed to load library: %s\n", library_path);
+    }
+    remember_resolved_library_path(alias, alias);
+    output_printf("Loaded a copy of %s as %s (%s, in a namespace of its own) in %.3f ms\n", library_path, alias,
+                  describe_flags(flags), getLibraryLoadNs(alias) / 1e6);
+}
+
+void run_load_library_command(int argc, char** argv) {
+    // <library> [flags..]
+    char* library_path = resolve_library_path(argv[0]);
+    if (library_path == NULL) {
+        raiseException(1,  "Error: Unable to resolve library path for %s\n", argv[0]);
+    }
+    if (argc > 1 && strcmp(argv[1], "as") == 0) {
+        if (argc < 3) {
+            raiseException(1,  "Usage: load <library> as <alias> [--namespace new] [flags..]\n");
+        }
+        load_library_as(library_path, argv[2], argc - 3, argv + 3);
+        return;
+    }
+    int flags = parse_load_flags(argc - 1, argv + 1);
+    if (isLibraryOpen(library_path)) {
+        raiseException(1,  "Error: %s is already open. Close it first to load it with different flags\n", library_path);
+    }
+    if (loads_deferred) {
+        deferLibraryLoad(library_path, flags);
+        output_printf("Will load %s (%s) on first use\n", library_path, describe_flags(flags));
+        return;
+    }
+    bool already_loaded = isLibraryStillLoaded(library_path);
+#ifdef use_link_map
+    void* handle = already_loaded ? getOrLoadLibraryWithFlags(library_path, flags) : load_and_profile(library_path, flags);
+#else
+    void* handle = getOrLoadLibraryWithFlags(library_path, flags);
+#endif
+    if (handle == NULL) {
+        raiseException(1,  "Failed to load library: %s\n", library_path);
+    }
+    if (already_loaded) {
+        output_printf("Warning: %s was already loaded by something else, so only flags that can be added to a loaded library "
+                      "(--now, --global and --nodelete) take effect\n", library_path);
+    }
+    output_printf("Loaded %s (%s) in %.3f ms\n", library_path, describe_flags(flags), getLibraryLoadNs(library_path) / 1e6);
+    LoadProfile* profile = find_profile(library_path);
+    if (profile != NULL && profile->load_count == getLibraryLoadCount(library_path) && profile->dependency_count > 0) {
+        uint64_t dependencies_ns = 0;
+        for (size_t i = 0; i < profile->dependency_count; i++) dependencies_ns += profile->dependencies[i].load_ns;
+        output_printf("  plus %.3f ms for the %zu dependencies it brought in\n", dependencies_ns / 1e6, profile->dependency_count);
+    }
+}
+
+#ifdef use_link_map
+
+typedef struct {
+    uintptr_t start; // page aligned, as is the end
+    uintptr_t end;
+    bool readable;
+} MappedSegment;
+
+typedef struct {
+    struct link_map* map;
+    const char* soname;
+    MappedSegment* segments;
+    size_t segment_count;
+    bool listed;
+} LoadedObject;
+
+typedef struct {
+    LoadedObject* objects;
+    size_t count;
+    size_t page_size;
+} LoadedObjects;
+
+// Entries of the dynamic section that hold addresses are relocated by glibc on most platforms but not all
+static const void* dynamic_address(const struct link_map* map, ElfW(Addr) address) {
+    return (const void*)(address < map->l_addr ? map->l_addr + address : address);
+}
+
+static const char* dynamic_string(const struct link_map* map, ElfW(Xword) offset) {
+    for (const ElfW(Dyn)* entry = map->l_ld; entry != NULL && entry->d_tag != DT_NULL; entry++) {
+        if (entry->d_tag == DT_STRTAB) return (const char*)dynamic_address(map, entry->d_un.d_ptr) + offset;
+    }
+    return NULL;
+}
+
+static int collect_segments(struct dl_phdr_info* info, size_t size, void* context) {
+    (void)size;
+    LoadedObjects* objects = context;
+    for (size_t o = 0; o < objects->count; o++) {
+        LoadedObject* object = &objects->objects[o];
+        if (info->dlpi_addr != object->map->l_addr || strcmp(info->dlpi_name, object->map->l_name) != 0) continue;
+        for (int i = 0; i < info->dlpi_phnum; i++) {
+            const ElfW(Phdr)* header = &info->dlpi_phdr[i];
+            if (header->p_type != PT_LOAD || header->p_memsz == 0) continue;
+            uintptr_t start = (info->dlpi_addr + header->p_vaddr) & ~(uintptr_t)(objects->page_size - 1);
+            uintptr_t end = (info->dlpi_addr + header->p_vaddr + header->p_memsz + objects->page_size - 1) & ~(uintptr_t)(objects->page_size - 1);
+            object->segments = realloc(object->segments, (object->segment_count + 1) * sizeof(MappedSegment));
+            object->segments[object->segment_count++] = (MappedSegment){start, end, (header->p_flags & PF_R) != 0};
+        }
+        break;
+    }
+    return 0;
+}
+
+static LoadedObjects collect_loaded_objects(struct link_map* any) {
+    LoadedObjects objects = {NULL, 0, (size_t)sysconf(_SC_PAGESIZE)};
+    struct link_map* first = any;
+    while (first->l_prev != NULL) first = first->l_prev;
+    for (struct link_map* map = first; map != NULL; map = map->l_next) {
+        objects.objects = realloc(objects.objects, (objects.count + 1) * sizeof(LoadedObject));
+        LoadedObject* object = &objects.objects[objects.count++];
+        *object = (LoadedObject){map, NULL, NULL, 0, false};
+        for (const ElfW(Dyn)* entry = map->l_ld; entry != NULL && entry->d_tag != DT_NULL; entry++) {
+            if (entry->d_tag == DT_SONAME) object->soname = dynamic_string(map, entry->d_un.d_val);
+        }
+    }
+    dl_iterate_phdr(collect_segments, &objects);
+    return objects;
+}
+
+static LoadedObject* find_needed_object(LoadedObjects* objects, const char* needed) {
+    for (size_t i = 0; i < objects->count; i++) {
+        const char* name = objects->objects[i].map->l_name;
+        const char* base_name = strrchr(name, '/') != NULL ? strrchr(name, '/') + 1 : name;
+        if ((objects->objects[i].soname != NULL && strcmp(objects->objects[i].soname, needed) == 0) || strcmp(base_name, needed) == 0) {
+            return &objects->objects[i];
+        }
+    }
+    return NULL;
+}
+
+static size_t resident_pages(const LoadedObjects* objects, const MappedSegment* segment) {
+    size_t pages = (segment->end - segment->start) / objects->page_size;
+    unsigned char* residency = malloc(pages > 0 ? pages : 1);
+    size_t resident = 0;
+    if (mincore((void*)segment->start, segment->end - segment->start, residency) == 0) {
+        for (size_t i = 0; i < pages; i++) resident += residency[i] & 1;
+    }
+    free(residency);
+    return resident;
+}
+
+// A DT_RELR table packs relative relocations into words: an even one is the address of one, and an odd one is a bitmap
+// of which of the words after the last address get one, in its bits but the lowest
+static size_t count_relr_relocations(const void* table, size_t size) {
+    const ElfW(Addr)* entries = table;
+    size_t count = 0;
+    for (size_t i = 0; i < size / sizeof(ElfW(Addr)); i++) {
+        count += (entries[i] & 1) == 0 ? 1 : (size_t)__builtin_popcountll((unsigned long long)entries[i]) - 1;
+    }
+    return count;
+}
+
+static void print_object(LoadedObjects* objects, LoadedObject* object, const char* name, int depth) {
+    output_printf("%*s%s", depth * 2 + 2, "", name);
+    if (object == NULL) {
+        output_printf(" (not found among the loaded libraries)\n");
+        return;
+    }
+    if (object->listed) {
+        output_printf(" (listed above)\n");
+        return;
+    }
+    object->listed = true;
+
+    size_t rela = 0, rela_size = sizeof(ElfW(Rela)), rel = 0, rel_size = sizeof(ElfW(Rel)), plt = 0, plt_type = DT_RELA, relative = 0;
+    size_t relr = 0;
+    ElfW(Addr) relr_address = 0;
+    for (const ElfW(Dyn)* entry = object->map->l_ld; entry != NULL && entry->d_tag != DT_NULL; entry++) {
+        switch (entry->d_tag) {
+            case DT_RELASZ: rela = entry->d_un.d_val; break;
+            case DT_RELAENT: rela_size = entry->d_un.d_val; break;
+            case DT_RELSZ: rel = entry->d_un.d_val; break;
+            case DT_RELENT: rel_size = entry->d_un.d_val; break;
+            case DT_PLTRELSZ: plt = entry->d_un.d_val; break;
+            case DT_PLTREL: plt_type = entry->d_un.d_val; break;
+            case DT_RELACOUNT: case DT_RELCOUNT: relative += entry->d_un.d_val; break;
+            case DT_RELRSZ: relr = entry->d_un.d_val; break;
+            case DT_RELR: relr_address = entry->d_un.d_ptr; break;
+        }
+    }
+    size_t relr_relocations = relr_address != 0 ? count_relr_relocations(dynamic_address(object->map, relr_address), relr) : 0;
+    relative += relr_relocations;
+    size_t plt_relocations = plt / (plt_type == DT_RELA ? sizeof(ElfW(Rela)) : sizeof(ElfW(Rel)));
+    size_t relocations = (rela_size > 0 ? rela / rela_size : 0) + (rel_size > 0 ? rel / rel_size : 0) + plt_relocations + relr_relocations;
+    size_t mapped = 0, resident = 0;
+    for (size_t i = 0; i < object->segment_count; i++) {
+        mapped += (object->segments[i].end - object->segments[i].start) / objects->page_size;
+        resident += resident_pages(objects, &object->segments[i]);
+    }
+    output_printf(": %zu relocations (%zu relative, %zu PLT), %zu pages mapped, %zu resident\n", relocations, relative,
+                  plt_relocations, mapped, resident);
+
+    for (const ElfW(Dyn)* entry = object->map->l_ld; entry != NULL && entry->d_tag != DT_NULL; entry++) {
+        if (entry->d_tag != DT_NEEDED) continue;
+        const char* needed = dynamic_string(object->map, entry->d_un.d_val);
+        if (needed != NULL) print_object(objects, find_needed_object(objects, needed), needed, depth + 1);
+    }
+}
+
+// The segments of the library and everything it depends on, ie those that libstats listed
+static void for_each_listed_segment(LoadedObjects* objects, void (*visit)(const LoadedObjects* objects, const MappedSegment* segment, void* context), void* context) {
+    for (size_t o = 0; o < objects->count; o++) {
+        if (!objects->objects[o].listed) continue;
+        for (size_t i = 0; i < objects->objects[o].segment_count; i++) visit(objects, &objects->objects[o].segments[i], context);
+    }
+}
+
+static void advise_will_need(const LoadedObjects* objects, const MappedSegment* segment, void* context) {
+    (void)objects;
+    (void)context;
+    madvise((void*)segment->start, segment->end - segment->start, MADV_WILLNEED);
+}
+
+typedef struct {
+    size_t resident_before;
+    size_t touched;
+} Prefault;
+
+static void prefault_segment(const LoadedObjects* objects, const MappedSegment* segment, void* context) {
+    Prefault* prefault = context;
+    if (!segment->readable) return;
+    prefault->resident_before += resident_pages(objects, segment);
+    for (uintptr_t page = segment->start; page < segment->end; page += objects->page_size) {
+        (void)*(volatile const char*)page;
+        prefault->touched++;
+    }
+}
+
+static void print_library_tree(const char* library_path, void* handle, bool will_need, bool prefault) {
+    struct link_map* map = NULL;
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0 || map == NULL) {
+        raiseException(1,  "Error: Could not find where %s is loaded: %s\n", library_path, dlerror());
+    }
+    LoadedObjects objects = collect_loaded_objects(map);
+    LoadedObject* library = NULL;
+    for (size_t i = 0; i < objects.count && library == NULL; i++) {
+        if (objects.objects[i].map == map) library = &objects.objects[i];
+    }
+    output_printf("Relocations and pages of it and the libraries it depends on:\n");
+    print_object(&objects, library, library_path, 0);
+
+    if (will_need) {
+        for_each_listed_segment(&objects, advise_will_need, NULL);
+        output_printf("Asked for all of their pages to be read in\n");
+    }
+    if (prefault) {
+        Prefault result = {0, 0};
+        uint64_t started = now_ns();
+        for_each_listed_segment(&objects, prefault_segment, &result);
+        uint64_t took = now_ns() - started;
+        output_printf("Prefaulting took %.3f ms, paging in %zu of their %zu readable pages\n", took / 1e6,
+                      result.touched - result.resident_before, result.touched);
+    }
+    for (size_t i = 0; i < objects.count; i++) free(objects.objects[i].segments);
+    free(objects.objects);
+}
+
+#endif
+
+void set_library_loads_deferred(bool deferred) {
+    loads_deferred = deferred;
+}
+
+void run_libstats_command(int argc, char** argv) {
+    // <library> [--willneed] [--prefault]
+    bool will_need = false;
+    bool prefault = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--willneed") == 0) {
+            will_need = true;
+        } else if (strcmp(argv[i], "--prefault") == 0) {
+            prefault = true;
+        } else {
+            raiseException(1,  "Usage: libstats <library> [--willneed] [--prefault]\n");
+        }
+    }
+    char* library_path = resolve_library_path(argv[0]);
+    if (library_path == NULL) {
+        raiseException(1,  "Error: Unable to resolve library path for %s\n", argv[0]);
+    }
+    if (!isLibraryOpen(library_path)) {
+        raiseException(1,  "Error: %s isn't open. Open it with load, or by calling a function in it, first\n", library_path);
+    }
+    void* handle = getOrLoadLibrary(library_path);
+
+    output_printf("%s was opened (%s) in %.3f ms\n", library_path, describe_flags(getLibraryFlags(library_path)), getLibraryLoadNs(library_path) / 1e6);
+    LoadProfile* profile = find_profile(library_path);
+    if (profile != NULL && profile->load_count == getLibraryLoadCount(library_path)) { // rather than an earlier load
+        for (size_t i = 0; i < profile->dependency_count; i++) {
+            output_printf("  after loading %s, and any dependencies it brought in, in %.3f ms\n", profile->dependencies[i].name,
+                          profile->dependencies[i].load_ns / 1e6);
+        }
+    } else {
+        output_printf("  including any dependencies it brought in, which load times separately\n");
+    }
+#ifdef use_link_map
+    print_library_tree(library_path, handle, will_need, prefault);
+#else
+    (void)handle;
+    if (will_need || prefault) {
+        raiseException(1,  "Error: --willneed and --prefault aren't supported on this platform\n");
+    }
+#endif
+}
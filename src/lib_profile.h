@@ -0,0 +1,36 @@
+#ifndef LIB_PROFILE_H
+#define LIB_PROFILE_H
+
+#include <stdbool.h>
+
+// Controls how a library is opened, and measures what opening it cost:
+//
+//   load <library> [--now|--lazy] [--global|--local] [--deepbind] [--nodelete]
+//   load <library> as <alias> [--namespace new] [flags..]
+//   libstats <library> [--willneed] [--prefault]
+//
+// load opens a library with the given dlopen flags, rather than the RTLD_LAZY it's opened with on first use. With --now
+// every symbol is bound up front, so the first call to each function doesn't pay for lazy binding in whatever is being
+// timed. Loading it this way also times it piece by piece: each of its direct dependencies that isn't loaded yet is
+// opened on its own first (its time including any dependencies of its own that it brings in), then the library itself.
+// Each dependency is opened from where the library's own load would find it, going by its RPATH or RUNPATH (with
+// $ORIGIN) and LD_LIBRARY_PATH, and any that can't be told that way are left to be timed with the library.
+// libstats reports how long the library took to open, and for it and each library it depends on, how many relocations
+// it has (counting each packed DT_RELR one) and how many of its pages are mapped and resident. --willneed asks the kernel to start reading in their pages,
+// and --prefault touches every page and reports how long that took, ie the cost of paging them in, so that it can be
+// paid before measuring the steady state rather than by the first calls.
+// Everything but the load flags needs ELF and glibc's link maps; elsewhere libstats only reports the time to open.
+// Loading a library as an alias lets calls name it by the alias. With --namespace new, the alias is a separate copy of
+// the library, opened with dlmopen in a link map namespace of its own, with its own globals and its own copies of its
+// dependencies, so that libraries that keep global state can be run side by side, or their copies compared.
+// glibc only has room for 16 namespaces in all.
+
+// While deferred (as they are while the init files run), load only notes the flags, and the library is opened with
+// them on first use, so that startup doesn't pay for libraries that a one-shot call doesn't use
+void set_library_loads_deferred(bool deferred);
+
+// The REPL commands, given the args after load or libstats
+void run_load_library_command(int argc, char** argv);
+void run_libstats_command(int argc, char** argv);
+
+#endif // LIB_PROFILE_H
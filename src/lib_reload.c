@@ -0,0 +1,220 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for dlinfo
+#endif
+#include "lib_reload.h"
+#include "exception_handling.h"
+#include "library_manager.h"
+#include "library_path_resolver.h"
+#include "output_buffer.h"
+#include "parse_address.h"
+#include "script.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <dlfcn.h>
+#if defined(__GLIBC__) || defined(RTLD_DI_LINKMAP) // it's an enum rather than a macro in glibc
+#include <link.h>
+#define use_link_map
+#endif
+#endif
+
+#ifdef __linux__
+#include <errno.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#define use_inotify
+#endif
+
+typedef struct {
+    char* library_path;
+    char* init_script;
+} InitHook;
+
+static InitHook* init_hooks = NULL;
+static size_t init_hook_count = 0;
+
+static InitHook* find_init_hook(const char* library_path) {
+    for (size_t i = 0; i < init_hook_count; i++) {
+        if (strcmp(init_hooks[i].library_path, library_path) == 0) return &init_hooks[i];
+    }
+    return NULL;
+}
+
+static void set_init_hook(const char* library_path, const char* init_script) {
+    InitHook* hook = find_init_hook(library_path);
+    if (hook == NULL) {
+        init_hooks = realloc(init_hooks, (init_hook_count + 1) * sizeof(InitHook));
+        hook = &init_hooks[init_hook_count++];
+        hook->library_path = strdup(library_path);
+    } else {
+        free(hook->init_script);
+    }
+    hook->init_script = strdup(init_script);
+}
+
+// Where the library is loaded, for moving a stored offset along with it, or 0 if that can't be told
+static uintptr_t library_base(void* handle) {
+#ifdef use_link_map
+    struct link_map* map = NULL;
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) == 0 && map != NULL) return (uintptr_t)map->l_addr;
+#else
+    (void)handle;
+#endif
+    return 0;
+}
+
+void reload_library(const char* library_path) {
+    void* old_handle = getOrLoadLibrary(library_path);
+    if (old_handle == NULL) {
+        raiseException(1,  "Failed to load library: %s\n", library_path);
+    }
+    uintptr_t old_base = library_base(old_handle);
+    ArgInfo* offset = getStoredOffsetForLibLoadedAtAddress(old_handle);
+    void* offset_value = offset != NULL ? offset->value->ptr_val : NULL;
+
+    closeLibrary(library_path);
+    bool unloaded = !isLibraryStillLoaded(library_path);
+    void* handle = getOrLoadLibrary(library_path); // a new load count, which is what tells prepared calls and checkpoints they're stale
+    if (handle == NULL) {
+        raiseException(1,  "Error: Could not load %s again after closing it\n", library_path);
+    }
+    if (offset != NULL) {
+        uintptr_t base = library_base(handle);
+        storeOffsetForLibLoadedAtAddress(handle, (void*)((uintptr_t)offset_value + (base - old_base)));
+    }
+    if (unloaded) {
+        output_printf("Reloaded %s\n", library_path);
+    } else {
+        output_printf("Warning: %s is still held open by something else, so it couldn't be unloaded and its old code is still in use\n", library_path);
+    }
+
+    InitHook* hook = find_init_hook(library_path);
+    if (hook != NULL) {
+        output_printf("Running init script %s for %s\n", hook->init_script, library_path);
+        run_script(hook->init_script, true);
+    }
+}
+
+#ifdef use_inotify
+
+// Libraries are watched through their directories rather than their files, since a build usually replaces the file
+// rather than writing over it, which ends a watch on the file itself
+typedef struct {
+    char* library_path;
+    int watch; // of the directory the library's file is in
+    char* file_name;
+    bool changed;
+} WatchedLibrary;
+
+static int inotify_fd = -1;
+static WatchedLibrary* watched = NULL;
+static size_t watched_count = 0;
+
+static WatchedLibrary* find_watched(const char* library_path) {
+    for (size_t i = 0; i < watched_count; i++) {
+        if (strcmp(watched[i].library_path, library_path) == 0) return &watched[i];
+    }
+    return NULL;
+}
+
+static void watch_library(const char* library_path, void* handle, void* context) {
+    (void)handle;
+    (void)context;
+    if (find_watched(library_path) != NULL) return;
+    char real_path[PATH_MAX];
+    if (realpath(library_path, real_path) == NULL) return; // eg a bare name that dlopen found on its search path
+    char* slash = strrchr(real_path, '/');
+    *slash = '\0';
+    int watch = inotify_add_watch(inotify_fd, real_path[0] != '\0' ? real_path : "/", IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (watch < 0) {
+        fprintf(stderr, "Warning: Could not watch %s for changes: %s\n", library_path, strerror(errno));
+        return;
+    }
+    watched = realloc(watched, (watched_count + 1) * sizeof(WatchedLibrary));
+    WatchedLibrary* library = &watched[watched_count++];
+    library->library_path = strdup(library_path);
+    library->watch = watch;
+    library->file_name = strdup(slash + 1);
+    library->changed = false;
+}
+
+static void stop_watching() {
+    if (inotify_fd < 0) return;
+    close(inotify_fd); // which removes all of its watches
+    inotify_fd = -1;
+    for (size_t i = 0; i < watched_count; i++) {
+        free(watched[i].library_path);
+        free(watched[i].file_name);
+    }
+    free(watched);
+    watched = NULL;
+    watched_count = 0;
+}
+
+static void start_watching() {
+    if (inotify_fd >= 0) return;
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) {
+        raiseException(1,  "Error: Could not start watching libraries: %s\n", strerror(errno));
+    }
+    forEachOpenedLibrary(watch_library, NULL);
+    output_printf("Watching %zu libraries for changes\n", watched_count);
+}
+
+void reload_changed_libraries() {
+    if (inotify_fd < 0) return;
+    forEachOpenedLibrary(watch_library, NULL); // including any opened since the last time
+
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+    while ((length = read(inotify_fd, buffer, sizeof(buffer))) > 0) {
+        for (char* next = buffer; next < buffer + length;) {
+            const struct inotify_event* event = (const struct inotify_event*)next;
+            next += sizeof(struct inotify_event) + event->len;
+            if (event->len == 0) continue;
+            for (size_t i = 0; i < watched_count; i++) {
+                if (watched[i].watch == event->wd && strcmp(watched[i].file_name, event->name) == 0) watched[i].changed = true;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < watched_count; i++) {
+        if (!watched[i].changed) continue;
+        watched[i].changed = false;
+        output_printf("%s has changed\n", watched[i].library_path);
+        reload_library(watched[i].library_path);
+    }
+}
+
+#else
+
+static void stop_watching() {}
+
+static void start_watching() {
+    raiseException(1,  "Error: watch-libs isn't supported on this platform. Use reload <library> after rebuilding one instead\n");
+}
+
+void reload_changed_libraries() {}
+
+#endif
+
+void run_watch_libs_command(int argc, char** argv) {
+    if (argc == 0 || (argc == 1 && strcmp(argv[0], "on") == 0)) {
+        start_watching();
+    } else if (argc == 1 && strcmp(argv[0], "off") == 0) {
+        stop_watching();
+    } else if (argc == 3 && strcmp(argv[0], "init") == 0) {
+        char* library_path = resolve_library_path(argv[1]);
+        if (library_path == NULL) {
+            raiseException(1,  "Error: Unable to resolve library path for %s\n", argv[1]);
+        }
+        set_init_hook(library_path, argv[2]);
+    } else {
+        raiseException(1,  "Usage: watch-libs [on|off] or watch-libs init <library> <script>\n");
+    }
+}
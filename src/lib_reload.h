@@ -0,0 +1,26 @@
+#ifndef LIB_RELOAD_H
+#define LIB_RELOAD_H
+
+// Reloads a library after it's been rebuilt, without restarting cliffi and losing the variables and setup so far:
+//
+//   reload <library>
+//   watch-libs [on|off]
+//   watch-libs init <library> <script>
+//
+// reload closes the library and opens it again from its file. Prepared calls (eg in a loop) and checkpoints of it are
+// dropped, since they hold addresses in the old copy, and an offset stored by calculate_offset is moved over to the new
+// one. Then the library's init script, if it has one, is run to set it up again.
+// With watch-libs on, each opened library's file is watched with inotify, and any that have been rebuilt since are
+// reloaded before the REPL runs its next command.
+// Variables holding pointers into the old copy of a library aren't updated, since a rebuild can move things around.
+// Watching is only supported where there's inotify; reload works everywhere.
+
+void reload_library(const char* library_path);
+
+// Reloads the watched libraries whose files have changed since this was last called, if watch-libs is on
+void reload_changed_libraries();
+
+// The REPL command, given the args after watch-libs
+void run_watch_libs_command(int argc, char** argv);
+
+#endif // LIB_RELOAD_H
@@ -1,6 +1,12 @@
 // library_manager.c
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for dlmopen
+#endif
 #include "library_manager.h"
+#include "output_buffer.h"
+#include "return_formatter.h"
+#include "types_and_utils.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,6 +20,11 @@
 typedef struct {
     char* libraryPath;
     void* handle;
+    unsigned int loadCount;
+    uint64_t loadNs; // how long the last dlopen took
+    int flags; // it was opened with, which it's opened with again after being closed
+    char* filePath; // for a copy opened under an alias, the library it's a copy of; otherwise NULL, the path being the file
+    bool newNamespace; // whether it's opened in a link map namespace of its own
 } LibraryEntry;
 
 typedef struct {
@@ -27,19 +38,21 @@ void cleanupLibraryManager() {
     for (size_t i = 0; i < libraryMap.count; i++) {
         closeLibrary(libraryMap.entries[i].libraryPath);
         free(libraryMap.entries[i].libraryPath);
+        free(libraryMap.entries[i].filePath);
     }
     free(libraryMap.entries);
 }
 
-void* loadLibraryDirectly(const char* libraryPath) {
+void* loadLibraryDirectly(const char* libraryPath, int flags) {
 #ifdef _WIN32
+    (void)flags;
     void* handle = LoadLibrary(libraryPath);
     if (!handle) {
         fprintf(stderr, "Failed to load library: %lu\n", GetLastError());
         return NULL;
     }
 #else
-    void* handle = dlopen(libraryPath, RTLD_LAZY);
+    void* handle = dlopen(libraryPath, flags != LIBRARY_DEFAULT_FLAGS ? flags : RTLD_LAZY);
     if (!handle) {
         fprintf(stderr, "Failed to load library: %s\n", dlerror());
         return NULL;
@@ -57,38 +70,92 @@ LibraryEntry* getLibraryEntry(const char* libraryPath) {
     return NULL;
 }
 
-void addLibraryEntry(const char* libraryPath, void* handle) {
+void addLibraryEntry(const char* libraryPath, void* handle, int flags, uint64_t loadNs) {
     LibraryEntry* entry = getLibraryEntry(libraryPath);
     if (entry == NULL) {
         libraryMap.entries = realloc(libraryMap.entries, (libraryMap.count + 1) * sizeof(LibraryEntry));
         entry = &libraryMap.entries[libraryMap.count];
         entry->libraryPath = strdup(libraryPath);
+        entry->loadCount = 0;
+        entry->filePath = NULL;
+        entry->newNamespace = false;
         libraryMap.count++;
     }
     entry->handle = handle;
+    if (handle != NULL) entry->loadCount++;
+    entry->flags = flags;
+    entry->loadNs = loadNs;
 }
 
 void* getOrLoadLibrary(const char* libraryPath) {
+    return getOrLoadLibraryWithFlags(libraryPath, LIBRARY_DEFAULT_FLAGS);
+}
+
+void* getOrLoadLibraryWithFlags(const char* libraryPath, int flags) {
 
     LibraryEntry* entry = getLibraryEntry(libraryPath);
     if (entry != NULL) {
         if (entry->handle!=NULL) return entry->handle;
+        if (flags == LIBRARY_DEFAULT_FLAGS) flags = entry->flags;
     }
 
-    void* handle = loadLibraryDirectly(libraryPath);
+    if (entry != NULL && entry->newNamespace) {
+        return loadLibraryInNewNamespace(libraryPath, entry->filePath, flags);
+    }
+
+    uint64_t started = now_ns();
+    void* handle = loadLibraryDirectly(libraryPath, flags);
     if (handle != NULL) {
-        if (entry != NULL) entry->handle=handle; // if lib was loaded but then closed
-        else addLibraryEntry(libraryPath, handle); // if lib was never in list
+        addLibraryEntry(libraryPath, handle, flags, now_ns() - started); // whether it was never in the list, or was loaded but then closed
     }
 
     return handle;
 }
 
+bool canLoadInNewNamespace() {
+#ifdef LM_ID_NEWLM
+    return true;
+#else
+    return false;
+#endif
+}
+
+void* loadLibraryInNewNamespace(const char* alias, const char* libraryPath, int flags) {
+#ifdef LM_ID_NEWLM
+    uint64_t started = now_ns();
+    void* handle = dlmopen(LM_ID_NEWLM, libraryPath, flags != LIBRARY_DEFAULT_FLAGS ? flags : RTLD_LAZY);
+    if (!handle) {
+        fprintf(stderr, "Failed to load library: %s\n", dlerror());
+        return NULL;
+    }
+    addLibraryEntry(alias, handle, flags, now_ns() - started);
+    LibraryEntry* entry = getLibraryEntry(alias);
+    if (entry->filePath != libraryPath) {
+        free(entry->filePath);
+        entry->filePath = strdup(libraryPath);
+    }
+    entry->newNamespace = true;
+    return handle;
+#else
+    (void)alias;
+    (void)libraryPath;
+    (void)flags;
+    fprintf(stderr, "Failed to load library: opening it in a namespace of its own isn't supported on this platform\n");
+    return NULL;
+#endif
+}
+
+const char* getLibraryFilePath(const char* libraryPath) {
+    LibraryEntry* entry = getLibraryEntry(libraryPath);
+    return entry != NULL && entry->filePath != NULL ? entry->filePath : libraryPath;
+}
+
 void closeLibrary(const char* libraryPath) {
     for (size_t i = 0; i < libraryMap.count; i++) {
         if (strcmp(libraryMap.entries[i].libraryPath, libraryPath) == 0) {
             void* handle = libraryMap.entries[i].handle;
             if (handle != NULL) {
+                keep_elided_array(); // it may have been in the library's memory
 #ifdef _WIN32
                 FreeLibrary((HMODULE)handle);
 #else
@@ -101,10 +168,56 @@ void closeLibrary(const char* libraryPath) {
     }
 }
 
+void deferLibraryLoad(const char* libraryPath, int flags) {
+    LibraryEntry* entry = getLibraryEntry(libraryPath);
+    if (entry == NULL) {
+        addLibraryEntry(libraryPath, NULL, flags, 0);
+    } else if (entry->handle == NULL) {
+        entry->flags = flags;
+    }
+}
+
+bool isLibraryOpen(const char* libraryPath) {
+    LibraryEntry* entry = getLibraryEntry(libraryPath);
+    return entry != NULL && entry->handle != NULL;
+}
+
+unsigned int getLibraryLoadCount(const char* libraryPath) {
+    LibraryEntry* entry = getLibraryEntry(libraryPath);
+    return entry != NULL ? entry->loadCount : 0;
+}
+
+int getLibraryFlags(const char* libraryPath) {
+    LibraryEntry* entry = getLibraryEntry(libraryPath);
+    return entry != NULL ? entry->flags : LIBRARY_DEFAULT_FLAGS;
+}
+
+bool isLibraryInNewNamespace(const char* libraryPath) {
+    LibraryEntry* entry = getLibraryEntry(libraryPath);
+    return entry != NULL && entry->newNamespace;
+}
+
+uint64_t getLibraryLoadNs(const char* libraryPath) {
+    LibraryEntry* entry = getLibraryEntry(libraryPath);
+    return entry != NULL ? entry->loadNs : 0;
+}
+
+bool isLibraryStillLoaded(const char* libraryPath) {
+#ifdef _WIN32
+    return GetModuleHandle(libraryPath) != NULL;
+#else
+    void* handle = dlopen(libraryPath, RTLD_LAZY | RTLD_NOLOAD);
+    if (handle == NULL) return false;
+    dlclose(handle); // dropping the reference RTLD_NOLOAD took
+    return true;
+#endif
+}
+
 void closeAllLibraries() {
     for (size_t i = 0; i < libraryMap.count; i++) {
         void* handle = libraryMap.entries[i].handle;
         if (handle != NULL) {
+            keep_elided_array();
 #ifdef _WIN32
             FreeLibrary((HMODULE)handle);
 #else
@@ -116,10 +229,18 @@ void closeAllLibraries() {
 }
 
 void listOpenedLibraries() {
-    printf("Opened libraries:\n");
+    output_printf("Opened libraries:\n");
     for (size_t i = 0; i < libraryMap.count; i++) {
         if (libraryMap.entries[i].handle != NULL) {
-            printf("- %s\n", libraryMap.entries[i].libraryPath);
+            output_printf("- %s\n", libraryMap.entries[i].libraryPath);
         }
     }
-}
\ No newline at end of file
+}
+
+void forEachOpenedLibrary(void (*visit)(const char* libraryPath, void* handle, void* context), void* context) {
+    for (size_t i = 0; i < libraryMap.count; i++) {
+        if (libraryMap.entries[i].handle != NULL) {
+            visit(libraryMap.entries[i].libraryPath, libraryMap.entries[i].handle, context);
+        }
+    }
+}
@@ -3,10 +3,42 @@
 #ifndef LIBRARY_MANAGER_H
 #define LIBRARY_MANAGER_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#define LIBRARY_DEFAULT_FLAGS 0 // RTLD_LAZY, where there's dlopen
+
 void cleanupLibraryManager();
 void* getOrLoadLibrary(const char* libraryPath);
+// Like getOrLoadLibrary, but if the library isn't open yet, opens it with these dlopen flags. A library that
+// was closed, or whose load was deferred, is opened with the flags it had, unless it is given others
+void* getOrLoadLibraryWithFlags(const char* libraryPath, int flags);
+// Opens another copy of the library in a link map namespace of its own (with dlmopen), under an alias that can be used
+// in place of its path from then on. The copy has its own globals, and its own copies of the libraries it depends on, so
+// it shares no state with the library opened the usual way or with any other copy. Opening the alias again after it's
+// been closed opens a fresh copy. NULL if it couldn't be opened, or where there are no namespaces (outside glibc)
+void* loadLibraryInNewNamespace(const char* alias, const char* libraryPath, int flags);
+bool canLoadInNewNamespace();
+// The file a library was opened from, which for a copy opened under an alias is the library it's a copy of
+const char* getLibraryFilePath(const char* libraryPath);
+// Whether it's a copy opened under an alias in a namespace of its own, by loadLibraryInNewNamespace
+bool isLibraryInNewNamespace(const char* libraryPath);
 void closeLibrary(const char* libraryPath);
+// Leaves the library to be opened on first use, but with these dlopen flags then
+void deferLibraryLoad(const char* libraryPath, int flags);
+bool isLibraryOpen(const char* libraryPath);
+// How many times the library has been opened, so that something holding on to its handle or symbols can tell that it
+// has been closed and opened again (eg reloaded after being rebuilt) since. 0 if it never has been
+unsigned int getLibraryLoadCount(const char* libraryPath);
+// The dlopen flags the library was last opened with
+int getLibraryFlags(const char* libraryPath);
+// How long opening the library took, the last time it was opened, including loading any dependencies it brought in
+uint64_t getLibraryLoadNs(const char* libraryPath);
+// Whether the library is still mapped into the process, eg after closing it while something else holds it open too
+bool isLibraryStillLoaded(const char* libraryPath);
 void closeAllLibraries();
 void listOpenedLibraries();
+// Calls visit with the path and handle of each library that's open, in the order they were first opened
+void forEachOpenedLibrary(void (*visit)(const char* libraryPath, void* handle, void* context), void* context);
 
 #endif
\ No newline at end of file
@@ -3,6 +3,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -23,6 +24,11 @@ const char* ENV_DELIM = ":";
 #define use_ld_so_conf
 #endif
 
+#if defined(__ELF__)
+#include <elf.h>
+#define use_elf_build_id
+#endif
+
 #define MAX_PATH_LENGTH 4096
 
 // Function to check if a string ends with a specific substring
@@ -408,7 +414,7 @@ static bool JustTryDlOpenOnBasename(const char* library_name, char* resolved_pat
     return true;
 }
 
-static bool FindSharedLibrary(const char* library_name, char* resolved_path) {
+static bool FindSharedLibrary(const char* library_name, char* resolved_path, bool may_dlopen) {
 
     if (!library_name || library_name[0] == '\0') {
         return false; // Invalid input
@@ -461,7 +467,7 @@ static bool FindSharedLibrary(const char* library_name, char* resolved_path) {
                          || FindInStandardPaths(library_name, resolved_path);
         #endif
 
-        if (!found) {
+        if (!found && may_dlopen) {
               found = JustTryDlOpenOnBasename(library_name, resolved_path);
         }
             return found;
@@ -472,14 +478,47 @@ static bool FindSharedLibrary(const char* library_name, char* resolved_path) {
 
 
 
-// Function to attempt to resolve the library path
-char* resolve_library_path(const char* library_name) {
+typedef struct {
+    char* library_name;
+    char* resolved_path;
+} KnownLibraryPath;
+
+static KnownLibraryPath* known_library_paths = NULL;
+static size_t known_library_path_count = 0;
+
+void remember_resolved_library_path(const char* library_name, const char* resolved_path) {
+    for (size_t i = 0; i < known_library_path_count; i++) {
+        if (strcmp(known_library_paths[i].library_name, library_name) == 0) {
+            free(known_library_paths[i].resolved_path);
+            known_library_paths[i].resolved_path = strdup(resolved_path);
+            return;
+        }
+    }
+    known_library_paths = realloc(known_library_paths, (known_library_path_count + 1) * sizeof(KnownLibraryPath));
+    known_library_paths[known_library_path_count].library_name = strdup(library_name);
+    known_library_paths[known_library_path_count].resolved_path = strdup(resolved_path);
+    known_library_path_count++;
+}
+
+void forEachRememberedLibraryPath(void (*visit)(const char* library_name, const char* resolved_path, void* context), void* context) {
+    for (size_t i = 0; i < known_library_path_count; i++) {
+        visit(known_library_paths[i].library_name, known_library_paths[i].resolved_path, context);
+    }
+}
+
+static char* resolve_library_path_in(const char* library_name, bool may_dlopen) {
     if (!library_name) {
         return NULL;
     }
 
+    for (size_t i = 0; i < known_library_path_count; i++) {
+        if (strcmp(known_library_paths[i].library_name, library_name) == 0) {
+            return strdup(known_library_paths[i].resolved_path);
+        }
+    }
+
     char resolved_path[MAX_PATH_LENGTH];
-    if (FindSharedLibrary(library_name, resolved_path)) {
+    if (FindSharedLibrary(library_name, resolved_path, may_dlopen)) {
         return strdup(resolved_path);
     }
 
@@ -487,10 +526,90 @@ char* resolve_library_path(const char* library_name) {
     if (!str_ends_with(library_name, library_extension)) {
         char library_name_with_extension[strlen(library_name) + strlen(library_extension) + 1];
         snprintf(library_name_with_extension, sizeof(library_name_with_extension), "%s%s", library_name, library_extension);
-        if (FindSharedLibrary(library_name_with_extension, resolved_path)) {
+        if (FindSharedLibrary(library_name_with_extension, resolved_path, may_dlopen)) {
             return strdup(resolved_path);
         }
     }
 
     return NULL; // Library not found
 }
+
+// Function to attempt to resolve the library path
+char* resolve_library_path(const char* library_name) {
+    return resolve_library_path_in(library_name, true);
+}
+
+char* resolve_library_path_without_opening(const char* library_name) {
+    return resolve_library_path_in(library_name, false);
+}
+
+#ifdef use_elf_build_id
+#if UINTPTR_MAX > 0xffffffffu
+typedef Elf64_Ehdr NativeEhdr;
+typedef Elf64_Phdr NativePhdr;
+typedef Elf64_Nhdr NativeNhdr;
+#define NATIVE_ELF_CLASS ELFCLASS64
+#else
+typedef Elf32_Ehdr NativeEhdr;
+typedef Elf32_Phdr NativePhdr;
+typedef Elf32_Nhdr NativeNhdr;
+#define NATIVE_ELF_CLASS ELFCLASS32
+#endif
+
+// Looks through the PT_NOTE segments for the GNU build-id that the linker stamps into most libraries
+static size_t read_elf_build_id(FILE* file, unsigned char* build_id, size_t max_length) {
+    NativeEhdr header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.e_ident, ELFMAG, SELFMAG) != 0 || header.e_ident[EI_CLASS] != NATIVE_ELF_CLASS) {
+        return 0;
+    }
+    for (unsigned i = 0; i < header.e_phnum; i++) {
+        NativePhdr program_header;
+        if (fseek(file, (long)(header.e_phoff + (size_t)i * header.e_phentsize), SEEK_SET) != 0 || fread(&program_header, sizeof(program_header), 1, file) != 1) {
+            return 0;
+        }
+        if (program_header.p_type != PT_NOTE || program_header.p_filesz > 65536) continue;
+        unsigned char notes[program_header.p_filesz + 1];
+        if (fseek(file, (long)program_header.p_offset, SEEK_SET) != 0 || fread(notes, 1, program_header.p_filesz, file) != program_header.p_filesz) {
+            return 0;
+        }
+        size_t offset = 0;
+        while (offset + sizeof(NativeNhdr) <= program_header.p_filesz) {
+            NativeNhdr note;
+            memcpy(&note, notes + offset, sizeof(note));
+            size_t name_offset = offset + sizeof(note);
+            size_t desc_offset = name_offset + ((note.n_namesz + 3) & ~3u);
+            offset = desc_offset + ((note.n_descsz + 3) & ~3u);
+            if (offset > program_header.p_filesz) break;
+            if (note.n_type == NT_GNU_BUILD_ID && note.n_namesz == 4 && memcmp(notes + name_offset, "GNU", 4) == 0 && note.n_descsz <= max_length) {
+                memcpy(build_id, notes + desc_offset, note.n_descsz);
+                return note.n_descsz;
+            }
+        }
+    }
+    return 0;
+}
+#endif
+
+size_t library_identity(const char* path, unsigned char* identity) {
+#ifdef use_elf_build_id
+    FILE* file = fopen(path, "rb");
+    if (file != NULL) {
+        size_t length = read_elf_build_id(file, identity + 1, MAX_LIBRARY_IDENTITY - 1);
+        fclose(file);
+        if (length > 0) {
+            identity[0] = 'B';
+            return length + 1;
+        }
+    }
+#endif
+    struct stat info;
+    if (stat(path, &info) != 0) {
+        return 0; // eg a library that was only found by handing its bare name to dlopen
+    }
+    int64_t size = (int64_t)info.st_size;
+    int64_t modified = (int64_t)info.st_mtime;
+    identity[0] = 'S';
+    memcpy(identity + 1, &size, sizeof(size));
+    memcpy(identity + 1 + sizeof(size), &modified, sizeof(modified));
+    return 1 + sizeof(size) + sizeof(modified);
+}
@@ -3,5 +3,22 @@
 
 // Function to resolve the library path. Returns dynamically allocated string that must be freed by the caller.
 char* resolve_library_path(const char* library_name);
+// Like resolve_library_path, but without its last resort of trying dlopen on the name, so it can be used off the main
+// thread without loading anything. NULL where only the dynamic loader itself (eg its cache) could find the library.
+char* resolve_library_path_without_opening(const char* library_name);
+
+// Makes resolve_library_path return resolved_path for library_name from now on without searching for it,
+// eg because a compiled script has already checked where it is
+void remember_resolved_library_path(const char* library_name, const char* resolved_path);
+// Calls visit with each name remembered that way, such as the aliases given by load <library> as <alias>
+void forEachRememberedLibraryPath(void (*visit)(const char* library_name, const char* resolved_path, void* context), void* context);
+
+#include <stddef.h>
+
+#define MAX_LIBRARY_IDENTITY 64
+
+// Writes something that changes whenever the library is rebuilt into identity (which needs room for MAX_LIBRARY_IDENTITY bytes):
+// its build-id, or failing that its size and modification time. Returns its length, or 0 if the file can't be found.
+size_t library_identity(const char* path, unsigned char* identity);
 
 #endif // LIBRARY_PATH_RESOLVER_H
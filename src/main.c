@@ -16,8 +16,27 @@
 #include <inttypes.h>
 
 #include "exception_handling.h"
+#include "output_buffer.h"
+#include "structured_output.h"
+#include "arg_snapshot.h"
 
 #include "tokenize.h"
+#include "arena.h"
+#include "map_reduce.h"
+#include "memory_search.h"
+#include "memory_snapshot.h"
+#include "write_tracking.h"
+#include "record_replay.h"
+#include "session.h"
+#include "lib_checkpoint.h"
+#include "lib_profile.h"
+#include "lib_reload.h"
+#include "preload.h"
+#include "startup_profile.h"
+#include "script.h"
+#include "stream.h"
+#include "control_flow.h"
+#include "prepared_call.h"
 #if  !defined(_WIN32) && !defined(_WIN64)
 #include <readline/history.h>
 #include <readline/readline.h>
@@ -44,10 +63,28 @@ const char* BASIC_USAGE_STRING = "<library> <return_typeflag> <function_name> [[
 
 
 void print_usage(char* argv0) {
-    printf("%s %s\n", NAME, VERSION);
-    printf("Usage: %s %s\n", argv0, BASIC_USAGE_STRING);
-    printf("  [--help]         Print this help message\n"
+    output_printf("%s %s\n", NAME, VERSION);
+    output_printf("Usage: %s %s\n", argv0, BASIC_USAGE_STRING);
+    output_printf("  [--help]         Print this help message\n"
            "  [--repl]         Start the REPL\n"
+           "  [--run <script>] Run the REPL commands in a script file, one per line\n"
+           "  [--compile <script> [<compiled file>]]  Compile a script so that --run can skip tokenizing it and resolving its libraries\n"
+           "  [--stream[=csv|tsv|binary]] <library> <return_typeflag> <function_name> [args..]\n"
+           "                   Call the function once per record on stdin, with each {} arg (eg -i {}) filled by the next field\n"
+           "  [--replay <recording> [--paced] [--no-verify]]\n"
+           "                   Re-run the calls in a recording, checking them against it and comparing how long they took\n"
+           "  [--quiet]        Don't format or print results (errors are still printed)\n"
+           "  [--output-file <path>]       Write results to a file instead of stdout\n"
+           "  [--output-socket <address>]  Write results to a socket, given as host:port or a unix socket path\n"
+           "  [--format=text|jsonl|cbor]   Print results as text (the default), JSON Lines or a CBOR sequence, one record per call\n"
+           "  [--max-elems <n>]            Print only the first and last n/2 elements of longer arrays, with a summary for numeric ones\n"
+           "  [--max-depth <n>]            Print structs nested more than n deep as { ... }\n"
+           "  [--max-bytes <n>]            Cut each printed value off after about n bytes\n"
+           "  [--print-all-args]           Print every array and pointer arg after the call, rather than only the ones it changed\n"
+           "  [--record <file>]            Record every call made to a file, for replaying later\n"
+           "  [--startup-profile]          Print how long each phase of starting up took, to stderr, before the first command\n"
+           "  [--preload <library>[,<library>..]]  Open these libraries first, reading their files ahead in parallel\n"
+           "                   (global options like these go before everything else)\n"
            "  <library>        The path to the shared library containing the function to invoke\n"
            "                   or the name of the library if it is in the system path\n"
            "  <typeflag>       The type of the return value of the function to invoke\n"
@@ -57,32 +94,32 @@ void print_usage(char* argv0) {
            "                   Types will be inferred if not prefixed with flags\n"
            "                   Flags look like -i for int, -s for string, etc\n"
            "  ...              Mark the position of varargs in the function signature if applicable\n");
-    printf("\n"
+    output_printf("\n"
            "  BASIC EXAMPLES:\n");
-    printf("         %s libexample.so i addints 3 4\n", argv0);
-    printf("         %s path/to/libexample.so v dofoo\n", argv0);
-    printf("         %s ./libexample.so s concatstrings -s hello -s world\n", argv0);
-    printf("         %s libexample.so s concatstrings hello world\n", argv0);
-    printf("         %s libexample.so d multdoubles -d 1.5 1.5d\n", argv0);
-    printf("         %s libc.so i printf 'Here is a number: %%.3f' ... 4.5", argv0);
-    printf("\n");
-    printf("  TYPES:\n"
+    output_printf("         %s libexample.so i addints 3 4\n", argv0);
+    output_printf("         %s path/to/libexample.so v dofoo\n", argv0);
+    output_printf("         %s ./libexample.so s concatstrings -s hello -s world\n", argv0);
+    output_printf("         %s libexample.so s concatstrings hello world\n", argv0);
+    output_printf("         %s libexample.so d multdoubles -d 1.5 1.5d\n", argv0);
+    output_printf("         %s libc.so i printf 'Here is a number: %%.3f' ... 4.5", argv0);
+    output_printf("\n");
+    output_printf("  TYPES:\n"
            "     The primitive typeflags are:\n");
-    printf("       %c for void, only allowed as a return type, and does not accept prefixes\n", TYPE_VOID);
-    printf("       %c for char\n", TYPE_CHAR);
-    printf("       %c for short\n", TYPE_SHORT);
-    printf("       %c for int\n", TYPE_INT);
-    printf("       %c for long\n", TYPE_LONG);
-    printf("       %c for unsigned char\n", TYPE_UCHAR);
-    printf("       %c for unsigned short\n", TYPE_USHORT);
-    printf("       %c for unsigned int\n", TYPE_UINT);
-    printf("       %c for unsigned long\n", TYPE_ULONG);
-    printf("       %c for float, can also be specified by suffixing the value with f\n", TYPE_FLOAT);
-    printf("       %c for double, can also be specified by suffixing the value with d\n", TYPE_DOUBLE);
-    printf("       %c for cstring (ie null terminated char*)\n", TYPE_STRING);
-    printf("       %c for arbitrary pointer (ie void*) specified by address\n", TYPE_VOIDPOINTER);
-    printf("\n");
-    printf("  POINTERS AND ARRAYS AND STRUCTS:\n"
+    output_printf("       %c for void, only allowed as a return type, and does not accept prefixes\n", TYPE_VOID);
+    output_printf("       %c for char\n", TYPE_CHAR);
+    output_printf("       %c for short\n", TYPE_SHORT);
+    output_printf("       %c for int\n", TYPE_INT);
+    output_printf("       %c for long\n", TYPE_LONG);
+    output_printf("       %c for unsigned char\n", TYPE_UCHAR);
+    output_printf("       %c for unsigned short\n", TYPE_USHORT);
+    output_printf("       %c for unsigned int\n", TYPE_UINT);
+    output_printf("       %c for unsigned long\n", TYPE_ULONG);
+    output_printf("       %c for float, can also be specified by suffixing the value with f\n", TYPE_FLOAT);
+    output_printf("       %c for double, can also be specified by suffixing the value with d\n", TYPE_DOUBLE);
+    output_printf("       %c for cstring (ie null terminated char*)\n", TYPE_STRING);
+    output_printf("       %c for arbitrary pointer (ie void*) specified by address\n", TYPE_VOIDPOINTER);
+    output_printf("\n");
+    output_printf("  POINTERS AND ARRAYS AND STRUCTS:\n"
            "     Typeflags can include additional flag prefixes to specify pointers, arrays or structs:\n"
            "     <typeflag> = [p[p..]]<primitive_type>\n"
            "     <typeflag> = [p[p..]][a<size>|t<argnum>][p[p..]]<primitive_type>\n"
@@ -104,14 +141,14 @@ void print_usage(char* argv0) {
            "       In arguments, where the size is specified, the value can be given as NULL, if the function is expected to allocate the array\n"
            "       Note that pa<type> means a pointer to an array of type, while ap<type> means an array of <type> pointers \n"
            "   ARRAY EXAMPLES:\n");
-    printf("     * For a function: int return_buffer(char** outbuff) which returns size\n");
-    printf("     %s libexample.so v return_buffer -past2 NULL -pi 0\n", argv0);
-    printf("     * Or alternatively if it were: void return_buffer(char** outbuff, size_t* outsize)\n");
-    printf("     %s libexample.so i return_buffer -past0 NULL\n", argv0);
-    printf("     * For a function: int add_all_ints(int** nums, size_t size) which returns sum\n");
-    printf("     %s libexample.so i add_all_ints -ai 1,2,3,4,5 -i 5\n", argv0);
-    printf("\n");
-    printf("   STRUCTS:\n"
+    output_printf("     * For a function: int return_buffer(char** outbuff) which returns size\n");
+    output_printf("     %s libexample.so v return_buffer -past2 NULL -pi 0\n", argv0);
+    output_printf("     * Or alternatively if it were: void return_buffer(char** outbuff, size_t* outsize)\n");
+    output_printf("     %s libexample.so i return_buffer -past0 NULL\n", argv0);
+    output_printf("     * For a function: int add_all_ints(int** nums, size_t size) which returns sum\n");
+    output_printf("     %s libexample.so i add_all_ints -ai 1,2,3,4,5 -i 5\n", argv0);
+    output_printf("\n");
+    output_printf("   STRUCTS:\n"
            "      Structs can be used for both arguments and return values\n"
            "      The general syntax is [-]S[K]: <arg> [<arg>..] :S \n"
            "      For arguments the dash is included and values are given (with optional typeflags)\n"
@@ -124,45 +161,43 @@ void print_usage(char* argv0) {
            "    STRUCT EXAMPLES:\n"
            "      Given a struct: struct mystruct { int x; char* s; }\n"
            "      * For a function: void print_struct(struct mystruct s)\n");
-    printf("      %s libexample.so v print_struct -S: 3 \"hello world\" :S\n", argv0);
-    printf("      * For a function: struct mystruct return_struct(int x, char* s)\n");
-    printf("      %s libexample.so S: i s :S 5 \"hello world\"\n", argv0);
-    printf("      * For a function: modifyStruct(struct mystruct* s)\n");
-    printf("      %s libexample.so v modifyStruct -pS: 3 \"hello world\" :S\n", argv0);
-    printf("\n");
-    printf("  VARARGS:\n"
+    output_printf("      %s libexample.so v print_struct -S: 3 \"hello world\" :S\n", argv0);
+    output_printf("      * For a function: struct mystruct return_struct(int x, char* s)\n");
+    output_printf("      %s libexample.so S: i s :S 5 \"hello world\"\n", argv0);
+    output_printf("      * For a function: modifyStruct(struct mystruct* s)\n");
+    output_printf("      %s libexample.so v modifyStruct -pS: 3 \"hello world\" :S\n", argv0);
+    output_printf("\n");
+    output_printf("  VARARGS:\n"
            "     If a function takes varargs the position of the varargs should be specified with the `...` flag\n"
            "     The `...` flag may sometimes be the first arg if the function takes all varargs, or the last for a function that takes varargs where none are being passed\n"
            "     The varargs themselves are the same as any other function args and can be with or without typeflags\n"
            "     (Floats and types shorter than int will be upgraded for you automatically)\n"
            "    VARARGS EXAMPLES:\n");
-    printf("      %s libc.so i printf 'Hello %%s, your number is: %%.3f' ... bob 4.5\n", argv0);
-    printf("      %s libc.so i printf 'This is just a static string' ... \n", argv0);
-    printf("      %s some_lib.so v func_taking_all_varargs ... -i 3 -s hello\n", argv0);
+    output_printf("      %s libc.so i printf 'Hello %%s, your number is: %%.3f' ... bob 4.5\n", argv0);
+    output_printf("      %s libc.so i printf 'This is just a static string' ... \n", argv0);
+    output_printf("      %s some_lib.so v func_taking_all_varargs ... -i 3 -s hello\n", argv0);
 }
 
 void print_function_return(FunctionCallInfo* call_info){
+     if (output_is_quiet()) return;
      setCodeSectionForSegfaultHandler("invoke_and_print_return_value : while printing values");
+        if (is_structured_output_format()) {
+            structured_print_function_return(call_info);
+            unsetCodeSectionForSegfaultHandler();
+            return;
+        }
 
-        // Step 4: Print the return value and any modified arguments
+        // Step 4: Print the return value and any arguments the function modified
 
-        printf("Function returned: ");
+        output_printf("Function returned: ");
 
         // format_and_print_arg_type(call_info->return_var);
         format_and_print_arg_value(call_info->info.return_var);
-        printf("\n");
-
-        for (int i = 0; i < call_info->info.arg_count; i++) {
-            // if it could have been modified, print it
-            // TODO keep track of the original value and compare
-            if (call_info->info.args[i]->is_array || call_info->info.args[i]->pointer_depth > 0) {
-                printf("Arg %d after function return: ", i);
-                format_and_print_arg_type(call_info->info.args[i]);
-                printf(" ");
-                format_and_print_arg_value(call_info->info.args[i]);
-                printf("\n");
-            }
-        }
+        output_printf("\n");
+
+        print_args_after_return(call_info, call_info->arg_snapshot);
+        free_call_snapshot(call_info->arg_snapshot);
+        call_info->arg_snapshot = NULL;
     unsetCodeSectionForSegfaultHandler();
     }
 
@@ -172,6 +207,7 @@ int invoke_and_print_return_value(FunctionCallInfo* call_info, void (*func)(void
     if (invoke_result != 0) {
         fprintf(stderr, "Error: Function invocation failed\n");
     } else {
+        setLastCall(call_info);
         print_function_return(call_info);
     }
     return invoke_result;
@@ -182,7 +218,7 @@ void* loadFunctionHandle(void* lib_handle, const char* function_name) {
     if (isHexFormat(function_name)) { // parse it as an offset of the library
         void* address_offset_relative_to_lib = getAddressFromStoredOffsetRelativeToLibLoadedAtAddress(lib_handle, function_name);
         if (address_offset_relative_to_lib != NULL) {
-            printf("Parsed func '%s' as relative address to the library offset, 0x%" PRIxPTR "\n", function_name, (uintptr_t)address_offset_relative_to_lib);
+            output_printf("Parsed func '%s' as relative address to the library offset, 0x%" PRIxPTR "\n", function_name, (uintptr_t)address_offset_relative_to_lib);
             return address_offset_relative_to_lib;
         } else {
             raiseException(1,  "Error: Could not find a stored offset for your library. Try again after running calculate_offset\n");
@@ -192,7 +228,7 @@ void* loadFunctionHandle(void* lib_handle, const char* function_name) {
 
     void* addressDirectly = tryGetAddressFromAddressStringOrNameOfCoercableVariable(function_name);
     if (addressDirectly != NULL) {
-        printf("Parsed func '%s' as an absolute address -> 0x%" PRIxPTR "\n", function_name, (uintptr_t)addressDirectly);
+        output_printf("Parsed func '%s' as an absolute address -> 0x%" PRIxPTR "\n", function_name, (uintptr_t)addressDirectly);
         return addressDirectly;
     }
 
@@ -221,9 +257,9 @@ void* loadFunctionHandle(void* lib_handle, const char* function_name) {
 
 void printVariableWithArgInfo(char* varName, ArgInfo* arg) {
     format_and_print_arg_type(arg);
-    printf(" %s = ", varName);
+    output_printf(" %s = ", varName);
     format_and_print_arg_value(arg);
-    printf("\n");
+    output_printf("\n");
 }
 
 void parsePrintVariable(char* varName) {
@@ -270,13 +306,14 @@ void parseStoreToMemoryWithAddressAndValue(char* addressStr, int varValueCount,
     } else {
         memcpy(destAddress, arg->value, typeToSize(arg->type, arg->array_value_pointer_depth));
     }
+    if (output_is_quiet()) return;
     // #define HEX_DIGITS (int)(2 * sizeof(void*))
-    // printf("*( (void*) 0x%0*" PRIxPTR ") = ",HEX_DIGITS,(uintptr_t)destAddress);
-    printf("*( (void*) 0x%" PRIxPTR ") = ", (uintptr_t)destAddress);
+    // output_printf("*( (void*) 0x%0*" PRIxPTR ") = ",HEX_DIGITS,(uintptr_t)destAddress);
+    output_printf("*( (void*) 0x%" PRIxPTR ") = ", (uintptr_t)destAddress);
     format_and_print_arg_type(arg);
-    printf(" ");
+    output_printf(" ");
     format_and_print_arg_value(arg);
-    printf("\n");
+    output_printf("\n");
 }
 
 ArgInfo* parseLoadMemoryToArgWithType(char* addressStr, int typeArgc, char** typeArgv) {
@@ -310,31 +347,36 @@ ArgInfo* parseLoadMemoryToArgWithType(char* addressStr, int typeArgc, char** typ
 
 void parseDumpMemoryWithAddressAndType(char* addressStr, int varValueCount, char** varValues) {
     ArgInfo* arg = parseLoadMemoryToArgWithType(addressStr, varValueCount, varValues);
-    printf("(");
+    output_printf("(");
     format_and_print_arg_type(arg);
-    printf("*) %s = ", addressStr);
+    output_printf("*) %s = ", addressStr);
     format_and_print_arg_type(arg);
-    printf(" ");
+    output_printf(" ");
     format_and_print_arg_value(arg);
-    printf("\n");
+    output_printf("\n");
     free(arg);
 }
 
-void parseSetVariableWithNameAndValue(char* varName, int varValueCount, char** varValues) {
-
+void validateVariableName(const char* varName) {
     if (varName == NULL || strlen(varName) == 0) {
         raiseException(1,  "Variable name cannot be empty.\n");
-    } else if (varValues == NULL || varValueCount == 0 || strlen(varValues[0]) == 0) {
-        raiseException(1,  "Variable value cannot be empty.\n");
-    }
-
-    if (strlen(varName) == 1 && charToType(*varName) != TYPE_UNKNOWN) {
+    } else if (strlen(varName) == 1 && charToType(*varName) != TYPE_UNKNOWN) {
         raiseException(1,  "Variable name cannot be a character used in parsing types, such as %s which is used for %s\n", varName, typeToString(charToType(*varName)));
     } else if (*varName == '-') {
         raiseException(1,  "Variable names cannot start with a dash.\n");
+    } else if (*varName == '$') {
+        raiseException(1,  "Variable names cannot start with $, which is kept for $_ and $argN.\n");
     } else if (isAllDigits(varName) || isHexFormat(varName) || isFloatingPoint(varName)) {
         raiseException(1,  "Variable names cannot be a number.\n");
     }
+}
+
+void parseSetVariableWithNameAndValue(char* varName, int varValueCount, char** varValues) {
+
+    if (varValues == NULL || varValueCount == 0 || strlen(varValues[0]) == 0) {
+        raiseException(1,  "Variable value cannot be empty.\n");
+    }
+    validateVariableName(varName);
 
     int extra_args_used = 0;
     ArgInfo* arg = parse_one_arg(varValueCount, varValues, &extra_args_used, false);
@@ -343,17 +385,15 @@ void parseSetVariableWithNameAndValue(char* varName, int varValueCount, char** v
         raiseException(1,  "Invalid variable value (parser failed to consume entire value line)\n");
         return;
     }
-    printVariableWithArgInfo(varName, arg);
+    if (!output_is_quiet()) printVariableWithArgInfo(varName, arg);
     setVar(varName, arg);
     // Should we check if the variable already existed and free the previous value? Or maybe keep a reference count?
 }
 
-void executeREPLCommand(char* command) {
-    int argc;
-    char** argv;
-    if (tokenize(command, &argc, &argv) != 0) {
-        raiseException(1,  "Error: Tokenization failed for command\n");
-    }
+void executeFunctionCall(int argc, char** argv, PreparedCall** prepared);
+
+// prepared, if given, holds on to a prepared version of the call for the next time this same command runs, eg in a loop
+void executeREPLCommand(char* command, int argc, char** argv, PreparedCall** prepared) {
 
     // syntactic sugar for set <var> <value> and print <var>
     if (argc == 1) {
@@ -363,6 +403,8 @@ void executeREPLCommand(char* command) {
             parsePrintVariable(argv[0]);
         }
         return;
+    } else if (try_arithmetic_assignment(argc, argv)) {
+        return;
     } else if (argc >= 3 && strcmp(argv[1], "=") == 0) {
         if (isHexFormat(argv[0])) {
             parseStoreToMemoryWithAddressAndValue(argv[0], argc - 2, argv + 2);
@@ -375,6 +417,21 @@ void executeREPLCommand(char* command) {
     if (argc < 3) {
         raiseException(1,  "Invalid command '%s'. Type 'help' for assistance.\n", command);
     }
+    executeFunctionCall(argc, argv, prepared);
+}
+
+// Calls <library> <return_typeflag> <function_name> [args..], reusing *prepared if it was prepared from the same tokens
+void executeFunctionCall(int argc, char** argv, PreparedCall** prepared) {
+    if (prepared != NULL && *prepared != NULL) {
+        if (prepared_call_matches(*prepared, argc, argv)) {
+            if (invoke_prepared_call(*prepared) != 0) {
+                raiseException(1,  "Error: Function invocation failed\n");
+            }
+            return;
+        }
+        free_prepared_call(*prepared);
+        *prepared = NULL;
+    }
     FunctionCallInfo* call_info = parse_arguments(argc, argv);
     log_function_call_info(call_info);
     void* lib_handle = getOrLoadLibrary(call_info->library_path);
@@ -382,6 +439,9 @@ void executeREPLCommand(char* command) {
         raiseException(1,  "Failed to load library: %s\n", call_info->library_path);
     }
     void* func = loadFunctionHandle(lib_handle, call_info->function_name);
+    if (prepared != NULL) {
+        *prepared = prepare_call(call_info, lib_handle, func, argc, argv);
+    }
 
     int invoke_result = invoke_and_print_return_value(call_info, func);
     if (invoke_result != 0) {
@@ -413,10 +473,7 @@ void discard_equals_but_warn_if_present(char*** argv, int* argc) {
     }
 }
 
-void parseSetVariable(char* varCommand) {
-    int argc;
-    char** argv;
-    tokenize(varCommand, &argc, &argv);
+void parseSetVariable(int argc, char** argv) {
     // <var> <value>
     if (argc < 2) {
         raiseException(1,  "Error: Invalid number of arguments for set\n");
@@ -429,10 +486,7 @@ void parseSetVariable(char* varCommand) {
     parseSetVariableWithNameAndValue(varName, value_args, value_argv);
 }
 
-void parseStoreToMemory(char* memCommand) {
-    int argc;
-    char** argv;
-    tokenize(memCommand, &argc, &argv);
+void parseStoreToMemory(int argc, char** argv) {
     // <address> <value>
     if (argc < 2) {
         raiseException(1,  "Error: Invalid number of arguments for storemem\n");
@@ -445,10 +499,7 @@ void parseStoreToMemory(char* memCommand) {
     parseStoreToMemoryWithAddressAndValue(address, value_args, value_argv);
 }
 
-void parseDumpMemory(char* memCommand) {
-    int argc;
-    char** argv;
-    tokenize(memCommand, &argc, &argv);
+void parseDumpMemory(int argc, char** argv) {
     // <type> <address>
     if (argc < 2) {
         raiseException(1,  "Error: Invalid number of arguments for dumpmem\n");
@@ -460,10 +511,7 @@ void parseDumpMemory(char* memCommand) {
     parseDumpMemoryWithAddressAndType(address, type_args, type_argv);
 }
 
-void parseLoadMemoryToVar(char* loadCommand) {
-    int argc;
-    char** argv;
-    tokenize(loadCommand, &argc, &argv);
+void parseLoadMemoryToVar(int argc, char** argv) {
     // <var> <type> <address>
     if (argc < 3) {
         raiseException(1,  "Error: Invalid number of arguments for loadmem\n");
@@ -475,14 +523,11 @@ void parseLoadMemoryToVar(char* loadCommand) {
     char** type_argv = argv + 1;    // starts after the first argument
     discard_equals_but_warn_if_present(&type_argv, &type_args);
     ArgInfo* arg = parseLoadMemoryToArgWithType(address, type_args, type_argv);
-    printVariableWithArgInfo(varName, arg);
+    if (!output_is_quiet()) printVariableWithArgInfo(varName, arg);
     setVar(varName, arg);
 }
 
-void parseCalculateOffset(char* calculateCommand) {
-    int argc;
-    char** argv;
-    tokenize(calculateCommand, &argc, &argv);
+void parseCalculateOffset(int argc, char** argv) {
     // [<var>] <library> <symbol> <address>
     if (argc < 3 || argc > 4) {
         raiseException(1,  "Error: Invalid number of arguments for calculate_offset\n");
@@ -507,21 +552,125 @@ void parseCalculateOffset(char* calculateCommand) {
         raiseException(1,  "Error: Calculated offset is negative. This is likely an error and the variable probably won't work.\n");
     }
     ptrdiff_t offset = symbol_address - (uintptr_t)address; // maybe technically we should use ptrdiff_t instead but it's unlikely that the offset would be negative
-    printf("Calculation: dlsym(%s,%s)=%p; %p - %p = %p\n", libraryName, symbolName, symbol_handle, symbol_handle, address, (void*)offset);
+    output_printf("Calculation: dlsym(%s,%s)=%p; %p - %p = %p\n", libraryName, symbolName, symbol_handle, symbol_handle, address, (void*)offset);
 
     if (hasVar) {
         ArgInfo* offsetArg = getPVar((void*)offset);
         setVar(varName, offsetArg);
-        printVariableWithArgInfo(varName, offsetArg);
+        if (!output_is_quiet()) printVariableWithArgInfo(varName, offsetArg);
     }
 
     storeOffsetForLibLoadedAtAddress(lib_handle, (void*)offset);
 }
 
-void parseHexdump(char* hexdumpCommand) {
-    int argc;
-    char** argv;
-    tokenize(hexdumpCommand, &argc, &argv);
+void parseQuiet(int argc, char** argv) {
+    // [on|off]
+    if (argc == 0 || strcmp(argv[0], "on") == 0) {
+        output_set_quiet(true);
+    } else if (strcmp(argv[0], "off") == 0) {
+        output_set_quiet(false);
+    } else {
+        raiseException(1,  "Error: quiet takes on or off\n");
+    }
+}
+
+void parseOutputSink(int argc, char** argv) {
+    // terminal | file <path> | socket <address>
+    if (argc == 1 && strcmp(argv[0], "terminal") == 0) {
+        output_set_sink_terminal();
+    } else if (argc == 2 && strcmp(argv[0], "file") == 0) {
+        output_set_sink_file(argv[1]);
+    } else if (argc == 2 && strcmp(argv[0], "socket") == 0) {
+        output_set_sink_socket(argv[1]);
+    } else {
+        raiseException(1,  "Error: Invalid arguments for output. Use output terminal, output file <path> or output socket <address>\n");
+    }
+}
+
+void parseOutputFormat(int argc, char** argv) {
+    // text | jsonl | cbor
+    if (argc != 1) {
+        raiseException(1,  "Error: Invalid arguments for format. Use format text, format jsonl or format cbor\n");
+    }
+    set_output_format(parse_output_format(argv[0]));
+}
+
+// returns true if argv[*i] is the option, and sets *value to its value, given either as --option=value or --option value
+bool matchOptionWithValue(int argc, char* argv[], int* i, const char* option, char** value) {
+    size_t option_len = strlen(option);
+    if (strncmp(argv[*i], option, option_len) != 0) return false;
+    if (argv[*i][option_len] == '=') {
+        *value = argv[*i] + option_len + 1;
+        return true;
+    } else if (argv[*i][option_len] == '\0') {
+        if (*i + 1 >= argc) {
+            raiseException(1,  "Error: Option %s requires a value\n", option);
+        }
+        *value = argv[++(*i)];
+        return true;
+    }
+    return false;
+}
+
+size_t parseOutputLimitValue(const char* option, const char* value) {
+    char* end;
+    unsigned long long limit = strtoull(value, &end, 0);
+    if (value[0] == '\0' || value[0] == '-' || *end != '\0') {
+        raiseException(1,  "Error: %s takes a number (or 0 for no limit), not '%s'\n", option, value);
+    }
+    return (size_t)limit;
+}
+
+// handles --max-elems, --max-depth and --max-bytes, which are shared by the command line and the limits command
+bool matchOutputLimitOption(int argc, char* argv[], int* i) {
+    char* value;
+    OutputLimits limits = get_output_limits();
+    if (matchOptionWithValue(argc, argv, i, "--max-elems", &value)) {
+        limits.max_elems = parseOutputLimitValue("--max-elems", value);
+    } else if (matchOptionWithValue(argc, argv, i, "--max-depth", &value)) {
+        limits.max_depth = (int)parseOutputLimitValue("--max-depth", value);
+    } else if (matchOptionWithValue(argc, argv, i, "--max-bytes", &value)) {
+        limits.max_bytes = parseOutputLimitValue("--max-bytes", value);
+    } else {
+        return false;
+    }
+    set_output_limits(limits);
+    return true;
+}
+
+void parseLimits(int argc, char** argv) {
+    // [--max-elems <n>] [--max-depth <n>] [--max-bytes <n>]
+    for (int i = 0; i < argc; i++) {
+        if (!matchOutputLimitOption(argc, argv, &i)) {
+            raiseException(1,  "Error: Unknown limit '%s'. Use --max-elems, --max-depth or --max-bytes\n", argv[i]);
+        }
+    }
+    OutputLimits limits = get_output_limits();
+    output_printf("max-elems: %zu, max-depth: %d, max-bytes: %zu (0 means no limit)\n", limits.max_elems, limits.max_depth, limits.max_bytes);
+}
+
+void parsePrintArgs(int argc, char** argv) {
+    // all | changed
+    if (argc == 1 && strcmp(argv[0], "all") == 0) {
+        set_print_all_args(true);
+    } else if (argc == 1 && strcmp(argv[0], "changed") == 0) {
+        set_print_all_args(false);
+    } else {
+        raiseException(1,  "Error: Invalid arguments for printargs. Use printargs all or printargs changed\n");
+    }
+}
+
+void parsePage(int argc, char** argv) {
+    // [<start> [<count>]]
+    if (argc > 2) {
+        raiseException(1,  "Error: Invalid arguments for page. Use page [<start> [<count>]]\n");
+    }
+    size_t start = argc > 0 ? parseOutputLimitValue("page", argv[0]) : 0;
+    size_t count = argc > 1 ? parseOutputLimitValue("page", argv[1]) : 0;
+    page_last_elided_array(argc > 0, start, count);
+}
+
+void parseHexdump(int argc, char** argv) {
     // <address> <size>
     if (argc < 2) {
         raiseException(1,  "Error: Invalid number of arguments for hexdump\n");
@@ -540,21 +689,59 @@ void parseHexdump(char* hexdumpCommand) {
 
 
 
-int parseREPLCommand(char* command){
-        command = trim_whitespace(command);
-        if (strlen(command) > 0) {
-            if (strcmp(command, "quit") == 0 || strcmp(command, "exit") == 0) {
+void parseLet(int argc, char** argv, PreparedCall** prepared) {
+    // <var> = <library> <return_typeflag> <function_name> [args..]
+    if (argc < 5 || strcmp(argv[1], "=") != 0) {
+        raiseException(1,  "Usage: let <var> = <library> <return_typeflag> <function_name> [args..]\n");
+    }
+    validateVariableName(argv[0]);
+    executeFunctionCall(argc - 2, argv + 2, prepared);
+    setVar(argv[0], getVar("$_")); // the call's own return value, not a copy of it
+}
+
+void parseCompile(int argc, char** argv) {
+    if (argc > 2) {
+        raiseException(1,  "Usage: compile <script> [<compiled file>]\n");
+    }
+    compile_script(argv[0], argc == 2 ? argv[1] : NULL);
+}
+
+char* resolveLibraryPathOrRaise(const char* libraryName) {
+    char* resolvedPath = resolve_library_path(libraryName);
+    if (resolvedPath == NULL) {
+        raiseException(1,  "Error: Unable to resolve library path for %s\n", libraryName);
+    }
+    return resolvedPath;
+}
+
+// Runs a command that has already been split into tokens, each command getting the tokens after its name.
+// command is the line they came from, for error messages. Returns 1 for quit or exit.
+int runTokenizedREPLCommand(char* command, int argc, char** argv, PreparedCall** prepared) {
+            bool bare = argc == 1;
+            int cmd_argc = argc - 1;
+            char** cmd_argv = argv + 1;
+            if (bare && (strcmp(argv[0], "quit") == 0 || strcmp(argv[0], "exit") == 0)) {
                 closeAllLibraries();
                 return 1;
-            } else if (strcmp(command, "help") == 0) {
-                printf("Running a command:\n");
-                printf("  %s\n", BASIC_USAGE_STRING);
-                printf("Documentation:\n"
+            } else if (is_control_flow_command(argv[0])) {
+                return run_control_flow(command);
+            } else if (bare && strcmp(argv[0], "help") == 0) {
+                output_printf("Running a command:\n");
+                output_printf("  %s\n", BASIC_USAGE_STRING);
+                output_printf("Documentation:\n"
                        "  help: Print this help message\n"
                        "  docs: Print the cliffi docs\n"
                        "Variables:\n"
                        "  set <var> <value>: Set a variable. Alternate form: <var> = <value>\n"
                        "  print <var>: Print the value of a variable. Alternate form: <var>\n"
+                       "  let <var> = <library> <return_typeflag> <function_name> [args..]: Call a function and keep its return value in a variable\n"
+                       "  $_, $arg0, $arg1..: The return value and args of the last function called, usable anywhere a variable is\n"
+                       "Arrays:\n"
+                       "  map [--threads <n>] [--instances] <var> = <library> <return_typeflag> <function_name> [args..]:"
+                       "      Call the function once per element of the array variables among the args, collecting the returns in a new array\n"
+                       "      (with --instances, each thread but the first calls a copy of the library of its own, <library>@<n>)\n"
+                       "  reduce sum|min|max|mean <array var> [<result var>]: Summarize a numeric array\n"
+                       "  reduce hist <bins> <array var> [<result var>]: Count the elements that fall in each of bins equal slices of [min, max]\n"
                        "Memory Management:\n"
                        "  store <address> <value>: Set the value of a memory address\n"
                        "  dump <type> <address>: Print the value at a memory address\n"
@@ -562,46 +749,140 @@ int parseREPLCommand(char* command){
                        "  calculate_offset [<variable>] <library> <symbol> <address>:"
                        "      Calculate memory offset by comparing the address of a known symbol [and store in var]\n"
                        "  hexdump <address> <size>: Print a hexdump of memory\n"
+                       "  search [--threads <n>] [--max <n>] [--endian little|big|both] [<var> =] <heap|all|<start>-<end>|library> <pattern>:\n"
+                       "      Find hex bytes (with ?? for any byte) or a typed value (eg -i 42 or -s text) in memory, keeping the addresses in $search or <var>\n"
+                       "  refs [<var> =] <address> [--range <n>] [--depth <n>]: Find the pointers to the address (or the n bytes from it) in writable\n"
+                       "      memory, and with --depth the pointers to those in turn, keeping the first level in $refs or <var>\n"
+                       "  snapshot [<name> <heap|all|<start>-<end>|library>]: Copy the writable memory there (of a library, its data and bss),\n"
+                       "      hashing each page, or without args list the snapshots\n"
+                       "  diff <snapshot> <snapshot|live>: Print the ranges of memory that changed, with where they are and what they were and are\n"
+                       "  trackwrites <<start>-<end>|library> <library> <return_typeflag> <function_name> [args..]: Run the call with the\n"
+                       "      memory there write protected, and print the pages and cache lines it wrote to\n"
                        "Shared Library Management:\n"
                        "  list: List all opened libraries\n"
+                       "  load <library> [--now|--lazy] [--global|--local] [--deepbind] [--nodelete]: Open the library with these dlopen flags\n"
+                       "      rather than lazily on first use, timing it and each dependency it brings in\n"
+                       "  load <library> as <alias> [--namespace new] [flags..]: Give the library another name to call it by, or with --namespace new,\n"
+                       "      open a separate copy of it under that name, with globals of its own, in a new dlmopen namespace\n"
+                       "  preload <library> [<library>..]: Open several libraries, resolving them and reading their files ahead in parallel\n"
+                       "  libstats <library> [--willneed] [--prefault]: Print how long the library took to open, and the relocations and mapped\n"
+                       "      and resident pages of it and its dependencies, optionally reading them in and timing that\n"
                        "  close <library>: Close the specified library\n"
                        "  closeall: Close all opened libraries\n"
+                       "  checkpoint <library>: Save the library's globals (its writable segments) as they are now\n"
+                       "  reset <library>: Put the library's globals back to how they were at its checkpoint, copying back only the pages that changed\n"
+                       "  reload <library>: Close the library and open it again, eg after rebuilding it, then run its init script if it has one\n"
+                       "  watch-libs [on|off]: Reload any opened library whose file changes, before running the next command\n"
+                       "  watch-libs init <library> <script>: Run the script each time the library is reloaded, to set it up again\n"
+                       "Output:\n"
+                       "  output terminal: Write results to stdout (the default)\n"
+                       "  output file <path>: Write results to a file\n"
+                       "  output socket <address>: Write results to a socket, given as host:port or a unix socket path\n"
+                       "  quiet [on|off]: Skip formatting and printing results entirely\n"
+                       "  format text|jsonl|cbor: Print results as text, JSON Lines or a CBOR sequence\n"
+                       "  limits [--max-elems <n>] [--max-depth <n>] [--max-bytes <n>]: Show or set how much of each result is printed, 0 meaning no limit\n"
+                       "  page [<start> [<count>]]: Print more of the last result that was cut short, without calling the function again\n"
+                       "  printargs all|changed: After each call, print every array and pointer arg, or only what the function changed (the default)\n"
+                       "Recording:\n"
+                       "  record <file> [--max-buffer <n>]: Record each call from now on, keeping up to n bytes (64KB by default) of each buffer its args point to\n"
+                       "  record off: Stop recording\n"
+                       "  replay <file> [--paced] [--no-verify]: Re-run the recorded calls as fast as possible (or at the recorded pace),\n"
+                       "      reporting any that return or leave buffers different from the recording, and each function's time per call\n"
+                       "Sessions:\n"
+                       "  session save <file>: Save the variables, open libraries, stored offsets and any calls recorded so far\n"
+                       "  session load <file>: Load a saved session, replaying its recorded calls to restore the libraries' own state\n"
+                       "Control flow:\n"
+                       "  for <var> in <start>..<end> [<step>] { ... }: Run a block with var counting from start up to (not including) end\n"
+                       "  while <condition> { ... }: Run a block for as long as the condition holds\n"
+                       "  if <condition> { ... } [else if <condition> { ... }] [else { ... }]: Run a block if the condition holds\n"
+                       "  break, continue: Leave a loop, or skip to its next iteration\n"
+                       "      A condition is a value (true if non-zero) or <value> ==|!=|<|<=|>|>= <value>, with numbers or variables as values\n"
+                       "  <var> = <value> <op> <value>, <var> <op>= <value>: Integer and floating point arithmetic, for + - * / % & | ^ << >>\n"
+                       "Scripts:\n"
+                       "  run <script>: Run the commands in a file, one per line, stopping at the first one that fails\n"
+                       "  compile <script> [<compiled file>]: Save the script pre-tokenized with its libraries resolved, which run then uses while it's up to date\n"
                        "Shell commands:\n"
                        "  !<command>: Run a shell command\n"
                        "  shell: Drop into an interactive shell\n"
                        "REPL Management:\n"
                        "  exit: Quit the REPL\n");
-            } else if (strcmp(command, "docs") == 0) {
+            } else if (bare && strcmp(argv[0], "docs") == 0) {
                 print_usage(">");
-            } else if (strcmp(command, "list") == 0) {
+            } else if (bare && strcmp(argv[0], "list") == 0) {
                 listOpenedLibraries();
-            } else if (strncmp(command, "close", 5) == 0) {
-                char* libraryName = command + 5;
-                while (*libraryName == ' ') {
-                    libraryName++;
-                }
-                char* resolvedPath = resolve_library_path(libraryName);
-                printf("Closing Library: %s\n",resolvedPath);
+            } else if (argc == 2 && strcmp(argv[0], "close") == 0) {
+                char* resolvedPath = resolve_library_path(argv[1]);
+                output_printf("Closing Library: %s\n",resolvedPath);
                 closeLibrary(resolvedPath);
-            } else if (strcmp(command, "closeall") == 0) {
+            } else if (bare && strcmp(argv[0], "closeall") == 0) {
                 closeAllLibraries();
-            } else if (strncmp(command, "set ", 4) == 0) {
-                parseSetVariable(command + 4);
-            } else if (strncmp(command, "print ", 6) == 0) {
-                parsePrintVariable(command + 6);
-            } else if (strncmp(command, "store ", 6) == 0) {
-                parseStoreToMemory(command + 6);
-            } else if (strncmp(command, "dump ", 5) == 0) {
-                parseDumpMemory(command + 5);
-            } else if (strncmp(command, "load ", 5) == 0) {
-                parseLoadMemoryToVar(command + 5);
-            } else if (strncmp(command, "calculate_offset ", 17) == 0) {
-                parseCalculateOffset(command + 17);
-            } else if (strncmp(command, "hexdump ", 8) == 0) {
-                parseHexdump(command + 8); // could also be done by dump aC<size> <address>
-            } else if (command[0] == '!') {
-                system(command + 1); // could also be done via libc.so v system "<command>" but this is more direct and convenient
-            } else if (strcmp(command, "shell") == 0) {
+            } else if (argc == 2 && strcmp(argv[0], "checkpoint") == 0) {
+                checkpoint_library(resolveLibraryPathOrRaise(argv[1]));
+            } else if (argc == 2 && strcmp(argv[0], "reset") == 0) {
+                reset_library(resolveLibraryPathOrRaise(argv[1]));
+            } else if (argc == 2 && strcmp(argv[0], "reload") == 0) {
+                reload_library(resolveLibraryPathOrRaise(argv[1]));
+            } else if (strcmp(argv[0], "watch-libs") == 0) {
+                run_watch_libs_command(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "map") == 0) {
+                run_map(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "reduce") == 0) {
+                run_reduce(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "record") == 0) {
+                run_record_command(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "replay") == 0) {
+                run_replay_command(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "session") == 0) {
+                run_session_command(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "let") == 0) {
+                parseLet(cmd_argc, cmd_argv, prepared);
+            } else if (argc > 1 && strcmp(argv[0], "set") == 0) {
+                parseSetVariable(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "print") == 0) {
+                if (cmd_argc != 1) raiseException(1,  "Error: print takes a single variable name\n");
+                parsePrintVariable(cmd_argv[0]);
+            } else if (argc > 1 && strcmp(argv[0], "store") == 0) {
+                parseStoreToMemory(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "dump") == 0) {
+                parseDumpMemory(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "load") == 0) {
+                if (cmd_argc == 1 || strncmp(cmd_argv[1], "--", 2) == 0 || strcmp(cmd_argv[1], "as") == 0) {
+                    run_load_library_command(cmd_argc, cmd_argv); // load <library> [as <alias>] [flags..]
+                } else {
+                    parseLoadMemoryToVar(cmd_argc, cmd_argv);
+                }
+            } else if (argc > 1 && strcmp(argv[0], "preload") == 0) {
+                preload_libraries(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "libstats") == 0) {
+                run_libstats_command(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "calculate_offset") == 0) {
+                parseCalculateOffset(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "search") == 0) {
+                run_search_command(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "refs") == 0) {
+                run_refs_command(cmd_argc, cmd_argv);
+            } else if (strcmp(argv[0], "snapshot") == 0) {
+                run_snapshot_command(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "diff") == 0) {
+                run_diff_command(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "trackwrites") == 0) {
+                run_trackwrites_command(command, cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "hexdump") == 0) {
+                parseHexdump(cmd_argc, cmd_argv); // could also be done by dump aC<size> <address>
+            } else if (strcmp(argv[0], "quiet") == 0) {
+                parseQuiet(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "output") == 0) {
+                parseOutputSink(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "format") == 0) {
+                parseOutputFormat(cmd_argc, cmd_argv);
+            } else if (strcmp(argv[0], "limits") == 0) {
+                parseLimits(cmd_argc, cmd_argv);
+            } else if (argc > 1 && strcmp(argv[0], "printargs") == 0) {
+                parsePrintArgs(cmd_argc, cmd_argv);
+            } else if (strcmp(argv[0], "page") == 0) {
+                parsePage(cmd_argc, cmd_argv);
+            } else if (bare && strcmp(argv[0], "shell") == 0) {
+                output_flush();
                 // if $SHELL is set, run that
                 if (getenv("SHELL") != NULL) {
                     system(getenv("SHELL"));
@@ -609,22 +890,78 @@ int parseREPLCommand(char* command){
                     fprintf(stderr, "Warning: SHELL environment variable not set. Running an unprefixed 'sh -i'\n");
                     system("sh -i");
                 }
+            } else if (argc == 2 && strcmp(argv[0], "run") == 0) {
+                return run_script(argv[1], true);
+            } else if (argc > 1 && strcmp(argv[0], "compile") == 0) {
+                parseCompile(cmd_argc, cmd_argv);
             } else {
-                executeREPLCommand(command); // also handles alternate forms of set (<varname>) and print (<varname> = <value>)
+                executeREPLCommand(command, argc, argv, prepared); // also handles alternate forms of set (<varname>) and print (<varname> = <value>)
             }
+            return 0;
+}
+
+int parseREPLCommand(char* command){
+        ArenaMark command_start = arena_mark(command_arena());
+        int breakRepl = 0;
+        command = trim_whitespace(command);
+        if (command[0] == '!') {
+            output_flush();
+            system(command + 1); // could also be done via libc.so v system "<command>" but this is more direct and convenient
+        } else if (strlen(command) > 0) {
+            int argc;
+            char** argv;
+            tokenize(command, &argc, &argv);
+            breakRepl = runTokenizedREPLCommand(command, argc, argv, NULL);
         }
-        return 0;
+        output_flush(); // each command's output goes out in one piece
+        arena_release(command_arena(), command_start);
+        return breakRepl;
 }
 
 
 
+// Readline and the history are set up just before the first prompt rather than at startup, so that they're only paid for
+// once there's someone to type at it, after the init files have run
+void initInteractiveInput() {
+    static bool initialized = false;
+    if (initialized) return;
+    initialized = true;
+    // rl_completion_entry_function = (Function*)cliffi_completion;
+    rl_bind_key('\t', rl_complete);
+    using_history();
+    read_history(".cliffi_history");
+    startup_phase_done("readline and history");
+    print_startup_profile();
+}
+
+// Reads a command, carrying on over more lines while it has a { block that isn't closed yet
+char* readREPLCommand() {
+    initInteractiveInput();
+    char* command = readline("> ");
+    if (command == NULL) return NULL;
+    int depth = block_depth_change(command);
+    while (depth > 0) {
+        char* line = readline("... ");
+        if (line == NULL) break; // run what there is, which will complain about the unclosed block
+        depth += block_depth_change(line);
+        size_t command_length = strlen(command);
+        command = realloc(command, command_length + strlen(line) + 2);
+        command[command_length] = '\n';
+        strcpy(command + command_length + 1, line);
+        free(line);
+    }
+    return command;
+}
+
 void startRepl() {
 
     char* command;
 
-    while ((command = readline("> ")) != NULL) {
+    while ((command = readREPLCommand()) != NULL) {
         int breakRepl = 0;
+        ArenaMark command_start = arena_mark(command_arena());
         TRY
+        reload_changed_libraries();
         if (strlen(command) > 0) {
             // fprintf(stderr, "Command: %s\n", command);
             HIST_ENTRY* last_command = history_get(history_length);
@@ -640,6 +977,7 @@ void startRepl() {
             if (isTestEnvExit1OnFail) exit(1);
             fprintf(stderr, "Restarting REPL...\n");
         END_TRY
+        arena_release(command_arena(), command_start); // in case the command raised before it could release its own tokens
         if (breakRepl) break;
     }
 }
@@ -660,24 +998,9 @@ bool checkAndRunCliffiInitWithPath(char* path) {
         free(full_path);
         return false;
     } else {
-        printf("Running cliffi init file at %s\n", full_path);
-        char* line = NULL;
-        size_t len = 0;
-        ssize_t read;
-        while ((read = getline(&line, &len, file)) != -1) {
-            if (line[read - 1] == '\n') {
-                line[read - 1] = '\0';
-            }
-            TRY
-                int breakRepl = parseREPLCommand(line);
-                if (breakRepl) break; //TODO: why is this needed?
-            CATCHALL
-                printException();
-                fprintf(stderr, "Error encountered in processing a line from .cliffi_init file: %s\n", line);
-            END_TRY
-        }
-        free(line);
         fclose(file);
+        output_printf("Running cliffi init file at %s\n", full_path);
+        run_script(full_path, false);
     }
     free(full_path);
     return true;
@@ -686,19 +1009,86 @@ bool checkAndRunCliffiInitWithPath(char* path) {
 void checkAndRunCliffiInits() {
     // look for a file .cliffi_init in the current directory and run it if it exists
     // otherwise look for a file .cliffi_init in the home directory and run it if it exists
+    set_library_loads_deferred(true); // libraries loaded there are only opened once something uses them
     if (!checkAndRunCliffiInitWithPath(".")) {
         char* home = getenv("HOME");
         if (home != NULL) {
             checkAndRunCliffiInitWithPath(home);
         }
     }
+    set_library_loads_deferred(false);
+    startup_phase_done("init files");
+}
+
+void preloadLibraryList(char* value) {
+    int count = 0;
+    char** library_names = NULL;
+    char* save_token;
+    for (char* name = strtok_r(value, ",", &save_token); name != NULL; name = strtok_r(NULL, ",", &save_token)) {
+        library_names = realloc(library_names, (count + 1) * sizeof(char*));
+        library_names[count++] = name;
+    }
+    preload_libraries(count, library_names);
+    free(library_names);
+}
+
+// --preload <library>[,<library>..]
+void parsePreloadOption(char* value) {
+    TRY
+        preloadLibraryList(value);
+    CATCHALL
+        printException();
+        exit(1);
+    END_TRY
+}
+
+// Consumes the global options that may precede everything else, and returns how many argv entries they took up
+int consumeGlobalOptions(int argc, char* argv[]) {
+    int i;
+    for (i = 1; i < argc; i++) {
+        char* value;
+        if (strcmp(argv[i], "--quiet") == 0) {
+            output_set_quiet(true);
+        } else if (matchOptionWithValue(argc, argv, &i, "--output-file", &value)) {
+            output_set_sink_file(value);
+        } else if (matchOptionWithValue(argc, argv, &i, "--output-socket", &value)) {
+            output_set_sink_socket(value);
+        } else if (matchOptionWithValue(argc, argv, &i, "--format", &value)) {
+            set_output_format(parse_output_format(value));
+        } else if (strcmp(argv[i], "--print-all-args") == 0) {
+            set_print_all_args(true);
+        } else if (strcmp(argv[i], "--startup-profile") == 0) {
+            enable_startup_profile();
+        } else if (matchOptionWithValue(argc, argv, &i, "--preload", &value)) {
+            parsePreloadOption(value);
+        } else if (matchOptionWithValue(argc, argv, &i, "--record", &value)) {
+            start_recording(value, RECORD_DEFAULT_MAX_BUFFER);
+        } else if (matchOutputLimitOption(argc, argv, &i)) {
+            continue;
+        } else {
+            break;
+        }
+    }
+    return i - 1;
 }
 
 #ifndef CLIFFI_UNIT_TESTING // don't defined main() when compiling for unit tests to avoid a collision
 int main(int argc, char* argv[]) {
-    setbuf(stdout, NULL); // disable buffering for stdout
+    setbuf(stdout, NULL); // disable buffering for stdout, so that output from the called functions interleaves correctly with ours
     setbuf(stderr, NULL); // disable buffering for stderr
+    // our own output is buffered per command by the output module instead
+    startup_profile_begin();
+    output_init();
     main_method_install_exception_handlers();
+    startup_phase_done("output and signal handlers");
+
+    int global_options_used = consumeGlobalOptions(argc, argv);
+    startup_phase_done("global options");
+    if (global_options_used > 0) {
+        argv[global_options_used] = argv[0];
+        argv += global_options_used;
+        argc -= global_options_used;
+    }
 
     if (argc > 1 && strcmp(argv[1], "--help") == 0) {
         print_usage(argv[0]);
@@ -755,7 +1145,8 @@ int main(int argc, char* argv[]) {
             }
             if (isNewLine || isFinalArg ){
                 command[strlen(command) - 1] = '\0'; // remove the trailing space
-                printf("Executing \"%s\"\n", command);
+                output_printf("Executing \"%s\"\n", command);
+                ArenaMark command_start = arena_mark(command_arena());
                 TRY
                 parseREPLCommand(command);
                 CATCHALL
@@ -763,18 +1154,71 @@ int main(int argc, char* argv[]) {
                     if (isTestEnvExit1OnFail) exit(1);
                     fprintf(stderr, "Restarting REPL...\n");
                 END_TRY
+                arena_release(command_arena(), command_start);
                 command[0] = '\0'; // reset the command
             }
         }
         return(0);
         #endif
+    } else if (argc > 1 && strcmp(argv[1], "--compile") == 0) {
+        if (argc < 3 || argc > 4) {
+            fprintf(stderr, "Usage: %s --compile <script> [<compiled file>]\n", argv[0]);
+            return 1;
+        }
+        TRY
+            compile_script(argv[2], argc == 4 ? argv[3] : NULL);
+            output_flush();
+        CATCHALL
+            printException();
+            exit(1);
+        END_TRY
+        return 0;
+    } else if (argc > 1 && strncmp(argv[1], "--stream", 8) == 0 && (argv[1][8] == '\0' || argv[1][8] == '=')) {
+        if (argc < 5) {
+            fprintf(stderr, "Usage: %s --stream[=csv|tsv|binary] %s", argv[0], BASIC_USAGE_STRING);
+            return 1;
+        }
+        TRY
+            StreamInputFormat format = argv[1][8] == '=' ? parse_stream_input_format(argv[1] + 9) : STREAM_INPUT_CSV;
+            run_stream(argc - 2, argv + 2, format);
+            output_flush();
+        CATCHALL
+            printException();
+            exit(1);
+        END_TRY
+        return 0;
+    } else if (argc > 1 && strcmp(argv[1], "--replay") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: %s --replay <recording> [--paced] [--no-verify]\n", argv[0]);
+            return 1;
+        }
+        TRY
+            run_replay_command(argc - 2, argv + 2);
+            output_flush();
+        CATCHALL
+            printException();
+            exit(1);
+        END_TRY
+        return 0;
+    } else if (argc > 1 && strcmp(argv[1], "--run") == 0) {
+        if (argc != 3) {
+            fprintf(stderr, "Usage: %s --run <script>\n", argv[0]);
+            return 1;
+        }
+        TRY
+            checkAndRunCliffiInits();
+            run_script(argv[2], true);
+            output_flush();
+            startup_phase_done("running the script");
+            print_startup_profile();
+        CATCHALL
+            printException();
+            exit(1);
+        END_TRY
+        return 0;
     } else if (argc > 1 && strcmp(argv[1], "--repl") == 0)
     replmode: {
         checkAndRunCliffiInits();
-        // rl_completion_entry_function = (Function*)cliffi_completion;
-        rl_bind_key('\t', rl_complete);
-        using_history();
-        read_history(".cliffi_history");
         fprintf(stderr, "cliffi %s. Starting REPL... Type 'help' for assistance. Type 'exit' to quit:\n", VERSION);
 
         // Start the REPL
@@ -792,7 +1236,7 @@ int main(int argc, char* argv[]) {
 // print all args
 #ifdef DEBUG
     for (int i = 0; i < argc; i++) {
-        printf("argv[%d] = %s\n", i, argv[i]);
+        output_printf("argv[%d] = %s\n", i, argv[i]);
     }
 #endif
 
@@ -815,14 +1259,18 @@ int main(int argc, char* argv[]) {
 
     // Step 2.5 (optional): Print the parsed function call call_info
     log_function_call_info(call_info);
+    startup_phase_done("parsing the call");
 
     // Step 3: Invoke the specified function
 
     void* lib_handle = getOrLoadLibrary(call_info->library_path);
+    startup_phase_done("opening the library");
 
     void* func = loadFunctionHandle(lib_handle, call_info->function_name);
+    startup_phase_done("looking up the function");
 
     int invoke_result = invoke_and_print_return_value(call_info, func);
+    startup_phase_done("calling it and printing the result");
 
     // Clean up
 
@@ -831,6 +1279,8 @@ int main(int argc, char* argv[]) {
     // freeFunctionCallInfo(call_info);
 
     // Wait to close the library until after we're done with everything in case it returns pointers to literals stored in the library
+    output_flush();
+    print_startup_profile();
 #ifdef _WIN32
     FreeLibrary(lib_handle);
 #else
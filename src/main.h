@@ -1,6 +1,22 @@
 #ifndef MAIN_H
 #define MAIN_H
 
+#include "types_and_utils.h"
 
+struct PreparedCall;
 
-#endif // MAIN_H
\ No newline at end of file
+// Runs one line of REPL input. Returns 1 if it was quit or exit.
+int parseREPLCommand(char* command);
+
+// The same for a line that has already been split into tokens, with command being the line itself (for error messages).
+// prepared may be NULL, or else somewhere to keep a prepared version of the call for the next time this same command runs.
+int runTokenizedREPLCommand(char* command, int argc, char** argv, struct PreparedCall** prepared);
+
+void* loadFunctionHandle(void* lib_handle, const char* function_name);
+void print_function_return(FunctionCallInfo* call_info);
+void printVariableWithArgInfo(char* varName, ArgInfo* arg);
+
+// Raises an exception for names that couldn't be told apart from values or type flags
+void validateVariableName(const char* varName);
+
+#endif // MAIN_H
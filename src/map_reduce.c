@@ -0,0 +1,389 @@
+#include "map_reduce.h"
+#include "argparser.h"
+#include "array_stats.h"
+#include "exception_handling.h"
+#include "invoke_handler.h"
+#include "library_manager.h"
+#include "library_path_resolver.h"
+#include "main.h"
+#include "output_buffer.h"
+#include "var_map.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <dlfcn.h>
+#include <pthread.h>
+#define MAP_THREADS
+#endif
+
+#define MAX_MAP_THREADS 256
+#define MAX_MAP_INSTANCES 15 // glibc has room for 16 link map namespaces, one of which is the program's own
+
+typedef struct {
+    unsigned int arg_index;
+    const unsigned char* elements;
+    size_t element_size;
+} ZippedArg;
+
+typedef struct {
+    FunctionCallInfo* call_info;
+    PreparedCif* cif;
+    void* func;
+    ZippedArg* zipped;
+    int zipped_count;
+    unsigned char* results;
+    size_t result_size;
+} MapJob;
+
+typedef struct {
+    const MapJob* job;
+    void* func; // the job's, or that of the copy of the library the slice calls
+    size_t start;
+    size_t end;
+} MapSlice;
+
+static ArgInfo* new_value_arg(ArgType type) {
+    ArgInfo* arg = calloc(1, sizeof(ArgInfo));
+    arg->value = calloc(1, sizeof(*arg->value));
+    arg->type = type;
+    arg->explicitType = true;
+    return arg;
+}
+
+static ArgInfo* new_array_arg(ArgType type, void* elements, size_t count) {
+    ArgInfo* arg = new_value_arg(type);
+    arg->is_array = ARRAY_STATIC_SIZE;
+    arg->static_or_implied_size = count;
+    arg->value->ptr_val = elements;
+    return arg;
+}
+
+// Each slice gets its own value pointers and return slot, so the slices can run side by side with the same prepared cif
+static void map_slice(const MapSlice* slice) {
+    const MapJob* job = slice->job;
+    unsigned int arg_count = job->call_info->info.arg_count;
+    void** values = malloc((arg_count + 1) * sizeof(void*));
+    for (unsigned int i = 0; i < arg_count; i++) {
+        values[i] = job->call_info->info.args[i]->value;
+    }
+    ArgInfo return_var = *job->call_info->info.return_var;
+    return_var.value = calloc(1, sizeof(*return_var.value)); // big enough for ffi_call's idea of a small integer return
+    FunctionCallInfo call_info = *job->call_info;
+    call_info.info.return_var = &return_var;
+
+    for (size_t element = slice->start; element < slice->end; element++) {
+        for (int i = 0; i < job->zipped_count; i++) {
+            const ZippedArg* zipped = &job->zipped[i];
+            values[zipped->arg_index] = (void*)(zipped->elements + element * zipped->element_size); // straight out of the array
+        }
+        call_prepared_cif(&call_info, job->cif, slice->func, values);
+        memcpy(job->results + element * job->result_size, return_var.value, job->result_size);
+    }
+    free(return_var.value);
+    free(values);
+}
+
+#ifdef MAP_THREADS
+static void* map_slice_thread(void* arg) {
+    map_slice(arg);
+    return NULL;
+}
+#endif
+
+// The function in the library's <n>th copy, <library>@<n>, opening the copy if it isn't open yet. Copies stay open
+// between maps, so that the state each one has built up can be looked at afterwards, or carried on with
+static void* instance_function(const FunctionCallInfo* call_info, int instance) {
+    size_t alias_size = strlen(call_info->library_path) + 16;
+    char* alias = malloc(alias_size);
+    snprintf(alias, alias_size, "%s@%d", call_info->library_path, instance);
+    void* handle;
+    if (getLibraryLoadCount(alias) > 0) {
+        handle = getOrLoadLibrary(alias); // a fresh copy, if it was closed since
+    } else {
+#ifdef RTLD_GLOBAL
+        int flags = getLibraryFlags(call_info->library_path) & ~RTLD_GLOBAL; // which a namespace of its own can't have
+#else
+        int flags = getLibraryFlags(call_info->library_path);
+#endif
+        handle = loadLibraryInNewNamespace(alias, getLibraryFilePath(call_info->library_path), flags);
+        if (handle != NULL) remember_resolved_library_path(alias, alias);
+    }
+    free(alias);
+    if (handle == NULL) {
+        raiseException(1,  "Error: Couldn't open copy %d of %s\n", instance, call_info->library_path);
+    }
+    return loadFunctionHandle(handle, call_info->function_name);
+}
+
+static bool is_scalar(const ArgInfo* arg) {
+    return arg->pointer_depth == 0 && !arg->is_array && arg->type != TYPE_STRUCT && arg->type != TYPE_VOID && arg->type != TYPE_STRING;
+}
+
+void run_map(int argc, char** argv) {
+    int threads = 1;
+    bool instances = false;
+    while (argc > 0 && strncmp(argv[0], "--", 2) == 0) {
+        if (argc > 1 && strcmp(argv[0], "--threads") == 0) {
+            threads = atoi(argv[1]);
+            if (threads < 1 || threads > MAX_MAP_THREADS) {
+                raiseException(1,  "Error: --threads must be between 1 and %d\n", MAX_MAP_THREADS);
+            }
+            argc -= 2;
+            argv += 2;
+        } else if (strcmp(argv[0], "--instances") == 0) {
+            instances = true;
+            argc--;
+            argv++;
+        } else {
+            break;
+        }
+    }
+    if (argc < 5 || strcmp(argv[1], "=") != 0) {
+        raiseException(1,  "Usage: map [--threads <n>] [--instances] <var> = <library> <return_typeflag> <function_name> [args..]\n");
+    }
+    if (instances && !canLoadInNewNamespace()) {
+        raiseException(1,  "Error: --instances isn't supported on this platform, which can't load more than one copy of a library\n");
+    }
+    if (instances && threads > MAX_MAP_INSTANCES) {
+        raiseException(1,  "Error: With --instances there can be at most %d threads, as there's only room for so many copies of a library\n", MAX_MAP_INSTANCES);
+    }
+    char* name = argv[0];
+    validateVariableName(name);
+    int call_argc = argc - 2;
+    char** call_argv = argv + 2;
+
+    FunctionCallInfo* call_info = parse_arguments(call_argc, call_argv);
+    ArgInfo* return_var = call_info->info.return_var;
+    if (!is_scalar(return_var)) {
+        raiseException(1,  "Error: map can only collect returns of numbers, chars, bools or P pointers\n");
+    }
+
+    // array variables that were passed as they are (rather than cast) get zipped
+    MapJob job = {call_info, NULL, NULL, calloc(call_info->info.arg_count + 1, sizeof(ZippedArg)), 0, NULL, typeToSize(return_var->type, 0)};
+    size_t count = 0;
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        ArgInfo* arg = call_info->info.args[i];
+        bool is_array_var = false;
+        for (int t = 3; t < call_argc && !is_array_var; t++) {
+            is_array_var = arg->is_array && getVar(call_argv[t]) == arg;
+        }
+        if (!is_array_var) continue;
+        if (arg->array_value_pointer_depth > 0 || arg->pointer_depth > 0 || arg->type == TYPE_STRUCT) {
+            raiseException(1,  "Error: map can only go over arrays of numbers, chars, bools, strings or P pointers\n");
+        }
+        size_t size = get_size_for_arginfo_sized_array(arg);
+        count = job.zipped_count == 0 || size < count ? size : count;
+        job.zipped[job.zipped_count++] = (ZippedArg){i, arg->value->ptr_val, typeToSize(arg->type, 0)};
+        call_info->info.args[i] = new_value_arg(arg->type); // the call itself takes one element
+    }
+    if (job.zipped_count == 0) {
+        raiseException(1,  "Error: map needs at least one array variable among the args to go over\n");
+    }
+
+    void* lib_handle = getOrLoadLibrary(call_info->library_path);
+    if (lib_handle == NULL) {
+        raiseException(1,  "Failed to load library: %s\n", call_info->library_path);
+    }
+    job.func = loadFunctionHandle(lib_handle, call_info->function_name);
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        if (call_info->info.args[i]->type == TYPE_STRUCT) {
+            raiseException(1,  "Error: map doesn't support functions that take structs\n");
+        }
+    }
+    job.cif = prepare_cif(call_info); // never NULL, since the return is a scalar
+    job.results = malloc(count > 0 ? count * job.result_size : 1);
+
+    if ((size_t)threads > count) threads = count > 0 ? (int)count : 1;
+    MapSlice slices[MAX_MAP_THREADS];
+    for (int i = 0; i < threads; i++) {
+        slices[i] = (MapSlice){&job, job.func, count * i / threads, count * (i + 1) / threads};
+        if (instances && i > 0) slices[i].func = instance_function(call_info, i);
+    }
+    output_flush(); // before handing over to the function, as with any other call
+    setCodeSectionForSegfaultHandler("run_map : calling the function");
+#ifdef MAP_THREADS
+    pthread_t workers[MAX_MAP_THREADS];
+    for (int i = 1; i < threads; i++) {
+        pthread_create(&workers[i], NULL, map_slice_thread, &slices[i]);
+    }
+    map_slice(&slices[0]); // the first slice runs here, where a crash can be caught like for any other call
+    for (int i = 1; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+#else
+    for (int i = 0; i < threads; i++) {
+        map_slice(&slices[i]);
+    }
+#endif
+    unsetCodeSectionForSegfaultHandler();
+    free_prepared_cif(job.cif);
+    free(job.zipped);
+
+    ArgInfo* result = new_array_arg(return_var->type, job.results, count);
+    setVar(name, result);
+    if (!output_is_quiet()) printVariableWithArgInfo(name, result);
+}
+
+static bool is_numeric_type(ArgType type) {
+    switch (type) {
+        case TYPE_SHORT: case TYPE_INT: case TYPE_LONG:
+        case TYPE_UCHAR: case TYPE_USHORT: case TYPE_UINT: case TYPE_ULONG:
+        case TYPE_FLOAT: case TYPE_DOUBLE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_unsigned_type(ArgType type) {
+    return type == TYPE_UCHAR || type == TYPE_USHORT || type == TYPE_UINT || type == TYPE_ULONG;
+}
+
+typedef union {
+    short s;
+    int i;
+    long l;
+    unsigned char uc;
+    unsigned short us;
+    unsigned int ui;
+    unsigned long ul;
+    float f;
+    double d;
+} Element;
+
+static Element read_element(const unsigned char* elements, ArgType type, size_t index) {
+    Element element;
+    size_t size = typeToSize(type, 0);
+    memcpy(&element, elements + index * size, size); // arrays from foreign code aren't necessarily aligned
+    return element;
+}
+
+static double element_as_double(const unsigned char* elements, ArgType type, size_t index) {
+    Element element = read_element(elements, type, index);
+    switch (type) {
+        case TYPE_SHORT: return element.s;
+        case TYPE_INT: return element.i;
+        case TYPE_LONG: return (double)element.l;
+        case TYPE_UCHAR: return element.uc;
+        case TYPE_USHORT: return element.us;
+        case TYPE_UINT: return element.ui;
+        case TYPE_ULONG: return (double)element.ul;
+        case TYPE_FLOAT: return element.f;
+        default: return element.d;
+    }
+}
+
+// Integer sums are added up exactly rather than taken from the stats, which keep the sum as a double
+static ArgInfo* exact_integer_sum(const unsigned char* elements, ArgType type, size_t count) {
+    ArgInfo* result = new_value_arg(is_unsigned_type(type) ? TYPE_ULONG : TYPE_LONG);
+    for (size_t i = 0; i < count; i++) {
+        Element element = read_element(elements, type, i);
+        switch (type) {
+            case TYPE_SHORT: result->value->l_val += element.s; break;
+            case TYPE_INT: result->value->l_val += element.i; break;
+            case TYPE_LONG: result->value->l_val += element.l; break;
+            case TYPE_UCHAR: result->value->ul_val += element.uc; break;
+            case TYPE_USHORT: result->value->ul_val += element.us; break;
+            case TYPE_UINT: result->value->ul_val += element.ui; break;
+            default: result->value->ul_val += element.ul; break;
+        }
+    }
+    return result;
+}
+
+static ArgInfo* stat_value(ArgType type, NumericStatValue value) {
+    ArgInfo* result = new_value_arg(type);
+    switch (type) {
+        case TYPE_SHORT: result->value->s_val = (short)value.i; break;
+        case TYPE_INT: result->value->i_val = (int)value.i; break;
+        case TYPE_LONG: result->value->l_val = (long)value.i; break;
+        case TYPE_UCHAR: result->value->uc_val = (unsigned char)value.u; break;
+        case TYPE_USHORT: result->value->us_val = (unsigned short)value.u; break;
+        case TYPE_UINT: result->value->ui_val = (unsigned int)value.u; break;
+        case TYPE_ULONG: result->value->ul_val = (unsigned long)value.u; break;
+        case TYPE_FLOAT: result->value->f_val = (float)value.d; break;
+        default: result->value->d_val = value.d; break;
+    }
+    return result;
+}
+
+static bool is_floating_type(ArgType type) {
+    return type == TYPE_FLOAT || type == TYPE_DOUBLE;
+}
+
+static double stat_as_double(ArgType type, NumericStatValue value) {
+    return is_floating_type(type) ? value.d : is_unsigned_type(type) ? (double)value.u : (double)value.i;
+}
+
+static ArgInfo* histogram(const unsigned char* elements, ArgType type, size_t count, const NumericArrayStats* stats, size_t bins) {
+    unsigned long* counts = calloc(bins, sizeof(unsigned long));
+    double lowest = stat_as_double(type, stats->min);
+    double width = (stat_as_double(type, stats->max) - lowest) / bins;
+    for (size_t i = 0; i < count; i++) {
+        double element = element_as_double(elements, type, i);
+        if (isnan(element)) continue;
+        size_t bin = width > 0 ? (size_t)((element - lowest) / width) : 0;
+        counts[bin < bins ? bin : bins - 1]++; // the max itself goes in the last bin
+    }
+    if (!output_is_quiet()) output_printf("%zu bins of width %g from %g\n", bins, width, lowest);
+    return new_array_arg(TYPE_ULONG, counts, bins);
+}
+
+void run_reduce(int argc, char** argv) {
+    // <op> [<bins>] <array var> [<result var>]
+    bool is_hist = argc > 0 && strcmp(argv[0], "hist") == 0;
+    int array_at = is_hist ? 2 : 1;
+    if (argc < array_at + 1 || argc > array_at + 2) {
+        raiseException(1,  "Usage: reduce sum|min|max|mean <array var> [<result var>], or reduce hist <bins> <array var> [<result var>]\n");
+    }
+    const char* op = argv[0];
+    if (!is_hist && strcmp(op, "sum") != 0 && strcmp(op, "min") != 0 && strcmp(op, "max") != 0 && strcmp(op, "mean") != 0) {
+        raiseException(1,  "Error: Unknown reduce operation %s, expected sum, min, max, mean or hist\n", op);
+    }
+    long bins = is_hist ? strtol(argv[1], NULL, 0) : 0;
+    if (is_hist && bins < 1) {
+        raiseException(1,  "Error: hist needs at least 1 bin\n");
+    }
+    ArgInfo* array = getVar(argv[array_at]);
+    if (array == NULL) {
+        raiseException(1,  "Error: Variable %s not found\n", argv[array_at]);
+    }
+    if (!array->is_array || array->pointer_depth > 0 || array->array_value_pointer_depth > 0 || !is_numeric_type(array->type)) {
+        raiseException(1,  "Error: reduce works on arrays of numbers, and %s isn't one\n", argv[array_at]);
+    }
+    char* result_name = argc == array_at + 2 ? argv[array_at + 1] : NULL;
+    if (result_name != NULL) validateVariableName(result_name);
+
+    const unsigned char* elements = array->value->ptr_val;
+    size_t count = elements != NULL ? get_size_for_arginfo_sized_array(array) : 0;
+    NumericArrayStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (count > 0) stats = compute_numeric_array_stats(elements, array->type, count);
+    size_t counted = stats.count - stats.nan_count;
+    if (counted == 0 && strcmp(op, "sum") != 0) {
+        raiseException(1,  "Error: %s has no elements to take the %s of\n", argv[array_at], op);
+    }
+
+    ArgInfo* result;
+    if (is_hist) {
+        result = histogram(elements, array->type, count, &stats, (size_t)bins);
+    } else if (strcmp(op, "sum") == 0) {
+        if (is_floating_type(array->type)) {
+            result = new_value_arg(TYPE_DOUBLE);
+            result->value->d_val = stats.sum;
+        } else {
+            result = exact_integer_sum(elements, array->type, count);
+        }
+    } else if (strcmp(op, "mean") == 0) {
+        result = new_value_arg(TYPE_DOUBLE);
+        result->value->d_val = stats.sum / counted;
+    } else {
+        result = stat_value(array->type, strcmp(op, "min") == 0 ? stats.min : stats.max);
+    }
+
+    if (result_name != NULL) setVar(result_name, result);
+    if (!output_is_quiet()) printVariableWithArgInfo(result_name != NULL ? result_name : (char*)op, result);
+}
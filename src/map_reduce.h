@@ -0,0 +1,24 @@
+#ifndef MAP_REDUCE_H
+#define MAP_REDUCE_H
+
+// Whole-array operations on array variables, so that working over millions of elements doesn't take millions of commands.
+//
+//   map [--threads <n>] [--instances] <var> = <library> <return_typeflag> <function_name> [args..]
+//
+// calls a function once per element. Each arg that names an array variable is replaced by successive elements of it,
+// several of them being zipped together (stopping at the end of the shortest), while other args stay as they are for
+// every call. To pass an array variable whole instead, cast it, eg -ai arr. The returns are collected into a new array
+// variable. The call is prepared once, elements are passed to it straight out of the arrays, and with --threads the
+// elements are split between that many threads. With --instances, each thread but the first calls a copy of the
+// library of its own, <library>@<n>, opened in a namespace of its own, for functions that aren't thread safe.
+//
+//   reduce sum|min|max|mean <array var> [<result var>]
+//   reduce hist <bins> <array var> [<result var>]
+//
+// summarizes a numeric array, hist counting the elements that fall into each of bins equal slices of [min, max].
+// NaNs are left out. The result is printed, and also kept in the result variable if one is given.
+
+void run_map(int argc, char** argv);
+void run_reduce(int argc, char** argv);
+
+#endif // MAP_REDUCE_H
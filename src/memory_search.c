@@ -0,0 +1,1070 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for dlinfo and dl_iterate_phdr
+#endif
+#include "memory_search.h"
+#include "argparser.h"
+#include "exception_handling.h"
+#include "library_manager.h"
+#include "library_path_resolver.h"
+#include "main.h"
+#include "output_buffer.h"
+#include "parse_address.h"
+#include "types_and_utils.h"
+#include "var_map.h"
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SEARCH_THREADS
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#define use_proc_maps
+#define MAPS_CHECK_SLACK 4096 // room for /proc/self/maps to have grown, when checking it hasn't changed
+#define MAPS_MAX_ATTEMPTS 5
+#endif
+
+#if defined(__ELF__) && defined(__GLIBC__)
+#include <dlfcn.h>
+#include <link.h>
+#define use_link_map
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define SEARCH_CHUNK_SIZE (1 << 20) // how much a thread takes at a time
+
+typedef struct {
+    unsigned char* bytes;
+    unsigned char* mask; // 0xff for the bytes that have to match, 0 for ??
+    size_t length;
+    size_t first; // the first and last bytes that have to match, which candidates are found by
+    size_t last;
+    bool has_wildcards;
+} SearchPattern;
+
+typedef struct {
+    uintptr_t* addresses; // mapped before the regions are gathered, and left out of them, so it isn't searched itself
+    size_t count;
+    size_t capacity;
+} SearchMatches;
+
+// Looks for matches starting in the first length bytes from from, of which available bytes can be read. Returns false
+// once there's no room for more matches
+typedef bool (*ChunkScanner)(const unsigned char* from, size_t length, size_t available, const void* context, SearchMatches* matches);
+
+typedef struct {
+    const SearchPattern* patterns;
+    int count;
+} SearchPatterns;
+
+typedef struct {
+    const MemoryRegions* regions;
+    ChunkScanner scan;
+    const void* context;
+    size_t region; // the next chunk for a thread to take
+    uintptr_t offset;
+    bool full; // whether any thread has found as many matches as it can keep
+#ifdef SEARCH_THREADS
+    pthread_mutex_t lock;
+    pthread_cond_t all_done;
+    int done;
+    int threads;
+#endif
+} SearchQueue;
+
+typedef struct {
+    SearchQueue* queue;
+    SearchMatches matches;
+} SearchWorker;
+
+static void add_region(MemoryRegions* regions, uintptr_t start, uintptr_t end) {
+    if (start >= end) return;
+    regions->regions = realloc(regions->regions, (regions->count + 1) * sizeof(MemoryRegion));
+    regions->regions[regions->count++] = (MemoryRegion){start, end};
+}
+
+void exclude_memory_range(MemoryRegions* regions, uintptr_t start, uintptr_t end) {
+    size_t count = regions->count;
+    for (size_t i = 0; i < count; i++) {
+        MemoryRegion region = regions->regions[i];
+        if (end <= region.start || region.end <= start) continue;
+        regions->regions[i].end = start > region.start ? start : region.start; // what's left before it, if anything
+        if (end < region.end) add_region(regions, end, region.end);
+    }
+    size_t kept = 0;
+    for (size_t i = 0; i < regions->count; i++) {
+        if (regions->regions[i].start < regions->regions[i].end) regions->regions[kept++] = regions->regions[i];
+    }
+    regions->count = kept;
+}
+
+static size_t total_bytes(const MemoryRegions* regions) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < regions->count; i++) bytes += regions->regions[i].end - regions->regions[i].start;
+    return bytes;
+}
+
+static int compare_addresses(const void* a, const void* b) {
+    uintptr_t left = *(const uintptr_t*)a, right = *(const uintptr_t*)b;
+    return left < right ? -1 : left > right;
+}
+
+static bool matches_at(const unsigned char* at, const SearchPattern* pattern) {
+    if (!pattern->has_wildcards) return memcmp(at, pattern->bytes, pattern->length) == 0;
+    for (size_t i = 0; i < pattern->length; i++) {
+        if ((at[i] & pattern->mask[i]) != pattern->bytes[i]) return false;
+    }
+    return true;
+}
+
+static bool add_match(SearchMatches* matches, const unsigned char* at) {
+    if (matches->count == matches->capacity) return false;
+    matches->addresses[matches->count++] = (uintptr_t)at;
+    return true;
+}
+
+// Looks for the pattern starting at each of the first starts bytes from from, each of which has the pattern's whole
+// length after it that can be read. Returns false once there's no room for more matches
+static bool scan_chunk(const unsigned char* from, size_t starts, const SearchPattern* pattern, SearchMatches* matches) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // candidates 16 at a time, as those with both the first and last fixed bytes in place
+    const __m128i first = _mm_set1_epi8((char)pattern->bytes[pattern->first]);
+    const __m128i last = _mm_set1_epi8((char)pattern->bytes[pattern->last]);
+    for (; i + 16 <= starts; i += 16) {
+        __m128i at_first = _mm_loadu_si128((const __m128i*)(from + i + pattern->first));
+        __m128i at_last = _mm_loadu_si128((const __m128i*)(from + i + pattern->last));
+        unsigned int candidates = (unsigned int)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(at_first, first), _mm_cmpeq_epi8(at_last, last)));
+        while (candidates != 0) {
+            const unsigned char* at = from + i + __builtin_ctz(candidates);
+            if (matches_at(at, pattern) && !add_match(matches, at)) return false;
+            candidates &= candidates - 1;
+        }
+    }
+#endif
+    while (i < starts) {
+        const unsigned char* found = memchr(from + i + pattern->first, pattern->bytes[pattern->first], starts - i);
+        if (found == NULL) break;
+        const unsigned char* at = found - pattern->first;
+        if (matches_at(at, pattern) && !add_match(matches, at)) return false;
+        i = (size_t)(at - from) + 1;
+    }
+    return true;
+}
+
+static bool scan_for_patterns(const unsigned char* from, size_t length, size_t available, const void* context, SearchMatches* matches) {
+    const SearchPatterns* patterns = context;
+    for (int p = 0; p < patterns->count; p++) {
+        const SearchPattern* pattern = &patterns->patterns[p];
+        if (available < pattern->length) continue;
+        size_t starts = available - pattern->length + 1 < length ? available - pattern->length + 1 : length;
+        if (!scan_chunk(from, starts, pattern, matches)) return false;
+    }
+    return true;
+}
+
+// Takes the next chunk, returning false once there are none left
+static bool next_chunk(SearchQueue* queue, const unsigned char** from, size_t* length, size_t* available) {
+    bool taken = false;
+#ifdef SEARCH_THREADS
+    pthread_mutex_lock(&queue->lock);
+#endif
+    if (!queue->full && queue->region < queue->regions->count) {
+        const MemoryRegion* region = &queue->regions->regions[queue->region];
+        *from = (const unsigned char*)(region->start + queue->offset);
+        *available = region->end - region->start - queue->offset;
+        *length = *available < SEARCH_CHUNK_SIZE ? *available : SEARCH_CHUNK_SIZE;
+        queue->offset += *length;
+        if (region->start + queue->offset >= region->end) {
+            queue->region++;
+            queue->offset = 0;
+        }
+        taken = true;
+    }
+#ifdef SEARCH_THREADS
+    pthread_mutex_unlock(&queue->lock);
+#endif
+    return taken;
+}
+
+// Doesn't allocate anything, since freeing memory could unmap part of a region that another thread is searching
+static void search_chunks(SearchWorker* worker) {
+    SearchQueue* queue = worker->queue;
+    const unsigned char* from;
+    size_t length, available;
+    while (next_chunk(queue, &from, &length, &available)) {
+        if (!queue->scan(from, length, available, queue->context, &worker->matches)) {
+#ifdef SEARCH_THREADS
+            pthread_mutex_lock(&queue->lock);
+#endif
+            queue->full = true; // so that the other threads stop too
+#ifdef SEARCH_THREADS
+            pthread_mutex_unlock(&queue->lock);
+#endif
+            return;
+        }
+    }
+}
+
+#ifdef SEARCH_THREADS
+static void* search_worker(void* arg) {
+    SearchWorker* worker = arg;
+    search_chunks(worker);
+    // threads only exit once they're all done, since an exiting thread can unmap cached stacks that are being searched
+    SearchQueue* queue = worker->queue;
+    pthread_mutex_lock(&queue->lock);
+    queue->done++;
+    pthread_cond_broadcast(&queue->all_done);
+    while (queue->done < queue->threads) pthread_cond_wait(&queue->all_done, &queue->lock);
+    pthread_mutex_unlock(&queue->lock);
+    return NULL;
+}
+#endif
+
+// Runs the scan over the regions on up to threads threads, this one among them, returning how many there were
+static int run_workers(SearchQueue* queue, SearchWorker* workers, int threads) {
+    for (int i = 0; i < threads; i++) {
+        workers[i].queue = queue;
+        workers[i].matches.count = 0;
+    }
+    setCodeSectionForSegfaultHandler("run_workers : searching memory");
+#ifdef SEARCH_THREADS
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->all_done, NULL);
+    queue->done = 0;
+    queue->threads = threads;
+    pthread_t* thread_ids = calloc((size_t)threads, sizeof(pthread_t));
+    int started_threads = 0;
+    while (started_threads < threads - 1 && pthread_create(&thread_ids[started_threads], NULL, search_worker, &workers[started_threads + 1]) == 0) {
+        started_threads++;
+    }
+    queue->threads = started_threads + 1;
+    search_worker(&workers[0]); // this thread being one of them, where a fault can be caught like in any other command
+    for (int i = 0; i < started_threads; i++) {
+        pthread_join(thread_ids[i], NULL);
+    }
+    free(thread_ids);
+    pthread_cond_destroy(&queue->all_done);
+    pthread_mutex_destroy(&queue->lock);
+    threads = started_threads + 1;
+#else
+    threads = 1;
+    search_chunks(&workers[0]);
+#endif
+    unsetCodeSectionForSegfaultHandler();
+    return threads;
+}
+
+// The matches the workers found, sorted, in one array
+static uintptr_t* collect_matches(const SearchWorker* workers, int threads, size_t* count) {
+    *count = 0;
+    for (int i = 0; i < threads; i++) *count += workers[i].matches.count;
+    uintptr_t* addresses = malloc((*count > 0 ? *count : 1) * sizeof(uintptr_t));
+    size_t collected = 0;
+    for (int i = 0; i < threads; i++) {
+        memcpy(addresses + collected, workers[i].matches.addresses, workers[i].matches.count * sizeof(uintptr_t));
+        collected += workers[i].matches.count;
+    }
+    qsort(addresses, *count, sizeof(uintptr_t), compare_addresses);
+    return addresses;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    c = (char)tolower((unsigned char)c);
+    return c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+}
+
+static bool host_is_little_endian() {
+    const uint16_t one = 1;
+    return *(const unsigned char*)&one == 1;
+}
+
+static void reverse_bytes(unsigned char* bytes, size_t length) {
+    for (size_t i = 0; i < length / 2; i++) {
+        unsigned char swapped = bytes[i];
+        bytes[i] = bytes[length - 1 - i];
+        bytes[length - 1 - i] = swapped;
+    }
+}
+
+static SearchPattern new_pattern(size_t length) {
+    SearchPattern pattern = {malloc(length > 0 ? length : 1), malloc(length > 0 ? length : 1), length, 0, 0, false};
+    memset(pattern.mask, 0xff, length);
+    return pattern;
+}
+
+static void free_pattern(SearchPattern* pattern) {
+    free(pattern->bytes);
+    free(pattern->mask);
+}
+
+// 7f 45 4c 46, 7f454c46 or 48 8b ?? 05
+static SearchPattern parse_byte_pattern(int argc, char** argv) {
+    size_t digits = 0;
+    for (int i = 0; i < argc; i++) digits += strlen(argv[i]);
+    SearchPattern pattern = new_pattern(digits / 2);
+    size_t length = 0;
+    for (int i = 0; i < argc; i++) {
+        const char* hex = argv[i];
+        size_t hex_length = strlen(hex);
+        bool valid = hex_length % 2 == 0;
+        for (size_t j = 0; valid && j < hex_length; j += 2) {
+            if (hex[j] == '?' && hex[j + 1] == '?') {
+                pattern.bytes[length] = 0;
+                pattern.mask[length++] = 0;
+                pattern.has_wildcards = true;
+            } else if (hex_digit(hex[j]) >= 0 && hex_digit(hex[j + 1]) >= 0) {
+                pattern.bytes[length++] = (unsigned char)(hex_digit(hex[j]) << 4 | hex_digit(hex[j + 1]));
+            } else {
+                valid = false;
+            }
+        }
+        if (!valid) {
+            free_pattern(&pattern);
+            raiseException(1,  "Error: %s isn't a pattern of hex bytes. Give bytes like 7f 45 ?? 46, with ?? for any byte, or a typed value like -i 42\n", hex);
+        }
+    }
+    pattern.length = length;
+    return pattern;
+}
+
+// -i 42, -d 3.14, -s text, or any other value as it'd be given to a function, in this machine's byte order
+static SearchPattern parse_value_pattern(int argc, char** argv, bool* can_swap) {
+    int extra_args_used = 0;
+    ArgInfo* arg = parse_one_arg(argc, argv, &extra_args_used, false);
+    if (extra_args_used + 1 != argc) {
+        raiseException(1,  "Error: The pattern has to be a single value, like -i 42 or -s text\n");
+    }
+    bool is_string = arg->type == TYPE_STRING && arg->pointer_depth == 0 && !arg->is_array;
+    if (!is_string && (arg->pointer_depth > 0 || arg->is_array || arg->type == TYPE_STRUCT || arg->type == TYPE_VOID)) {
+        raiseException(1,  "Error: The value to search for has to be a number, char, bool, P pointer or string\n");
+    }
+    const void* value = is_string ? (const void*)arg->value->str_val : (const void*)arg->value;
+    size_t length = is_string ? strlen(arg->value->str_val) : typeToSize(arg->type, 0);
+    SearchPattern pattern = new_pattern(length);
+    memcpy(pattern.bytes, value, length);
+    memset((void*)value, 0, length); // so the search doesn't find the parsed value as well
+    *can_swap = !is_string && length > 1;
+    return pattern;
+}
+
+static void find_anchors(SearchPattern* pattern) {
+    bool found = false;
+    for (size_t i = 0; i < pattern->length; i++) {
+        if (pattern->mask[i] == 0) continue;
+        if (!found) pattern->first = i;
+        pattern->last = i;
+        found = true;
+    }
+    if (!found) {
+        raiseException(1,  "Error: The pattern needs at least one byte that isn't ??\n");
+    }
+}
+
+#ifdef use_proc_maps
+typedef enum { MAPPINGS_ALL, MAPPINGS_HEAP, MAPPINGS_WRITABLE } MappingKind;
+
+typedef struct {
+    unsigned long start;
+    unsigned long end;
+    unsigned long offset;
+    unsigned long inode;
+    char perms[5];
+    const char* path; // "" for anonymous mappings
+} Mapping;
+
+static char* read_proc_maps() {
+    FILE* maps = fopen("/proc/self/maps", "r");
+    if (maps == NULL) {
+        raiseException(1,  "Error: Could not read /proc/self/maps\n");
+    }
+    size_t length = 0, capacity = 1 << 16;
+    char* text = malloc(capacity);
+    size_t got;
+    while ((got = fread(text + length, 1, capacity - length - 1, maps)) > 0) {
+        length += got;
+        if (capacity - length - 1 == 0) text = realloc(text, capacity *= 2);
+    }
+    text[length] = '\0';
+    fclose(maps);
+    return text;
+}
+
+// Parses the line at *text into mapping, moving *text on to the next one. The path is cut off in place
+static bool next_mapping(char** text, Mapping* mapping) {
+    while (**text != '\0') {
+        char* line = *text;
+        char* line_end = line + strcspn(line, "\n");
+        *text = *line_end != '\0' ? line_end + 1 : line_end;
+        *line_end = '\0';
+        int path_at = 0;
+        if (sscanf(line, "%lx-%lx %4s %lx %*s %lu %n", &mapping->start, &mapping->end, mapping->perms, &mapping->offset,
+                   &mapping->inode, &path_at) < 5) {
+            continue;
+        }
+        mapping->path = line + path_at;
+        return true;
+    }
+    return false;
+}
+
+static bool is_unsafe_to_read(const char* path) {
+    // the vDSO's data pages, and device memory, which can fault or have side effects when read
+    if (strcmp(path, "[vvar]") == 0 || strcmp(path, "[vvar_vclock]") == 0 || strcmp(path, "[vsyscall]") == 0) return true;
+    return strncmp(path, "/dev/", 5) == 0 && strcmp(path, "/dev/zero") != 0 && strncmp(path, "/dev/shm/", 9) != 0;
+}
+
+// The readable mappings of that kind in the text of /proc/self/maps, with any file mapped past its end cut off where
+// it ends, since reading past there raises SIGBUS. With a range, the readable parts of it
+static void gather_mappings_from(char* text, MemoryRegions* regions, MappingKind kind, const MemoryRegion* within) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    Mapping mapping;
+    while (next_mapping(&text, &mapping)) {
+        unsigned long start = mapping.start, end = mapping.end;
+        const char* path = mapping.path;
+        if (mapping.perms[0] != 'r' || is_unsafe_to_read(path)) continue;
+        if (kind == MAPPINGS_HEAP && strcmp(path, "[heap]") != 0 && !(path[0] == '\0' && mapping.perms[1] == 'w')) continue;
+        // cliffi's own stack only holds its own frames, which are bound to have the address being looked for
+        if (kind == MAPPINGS_WRITABLE && (mapping.perms[1] != 'w' || strcmp(path, "[stack]") == 0)) continue;
+        struct stat info;
+        if (path[0] == '/' && mapping.inode != 0 && stat(path, &info) == 0 && S_ISREG(info.st_mode)) {
+            if ((unsigned long)info.st_size <= mapping.offset) continue;
+            unsigned long file_end = start + ((info.st_size - mapping.offset + page_size - 1) & ~(page_size - 1));
+            if (file_end < end) end = file_end;
+        }
+        if (within != NULL) {
+            if (start < within->start) start = within->start;
+            if (end > within->end) end = within->end;
+        }
+        add_region(regions, start, end);
+    }
+}
+
+// Returns the text of /proc/self/maps they were gathered from
+static char* gather_mappings(MemoryRegions* regions, MappingKind kind, const MemoryRegion* within) {
+    char* text = read_proc_maps();
+    char* parsed = strdup(text);
+    gather_mappings_from(parsed, regions, kind, within);
+    free(parsed);
+    return text;
+}
+
+// Freeing memory can unmap it, or give it back from the end of the heap, so regions gathered from /proc/self/maps are
+// only sure to be there if it still reads the same once everything's ready to search them. Reading it again into check
+// (allocated beforehand, with MAPS_CHECK_SLACK to spare, and only freed once the search is over) doesn't allocate
+static bool maps_unchanged(const char* text, char* check) {
+    size_t size = strlen(text) + MAPS_CHECK_SLACK, length = 0;
+    int fd = open("/proc/self/maps", O_RDONLY);
+    if (fd < 0) return false;
+    ssize_t got;
+    while (length < size - 1 && (got = read(fd, check + length, size - 1 - length)) > 0) length += (size_t)got;
+    close(fd);
+    check[length] = '\0';
+    return strcmp(check, text) == 0;
+}
+#endif
+
+#ifdef use_link_map
+typedef struct {
+    uintptr_t base;
+    const char* name;
+    MemoryRegions* regions;
+    bool writable_only; // just the segments holding its data and bss, less what's made read only after relocation
+    bool found;
+} LibrarySegments;
+
+static int collect_library_segments(struct dl_phdr_info* info, size_t size, void* context) {
+    (void)size;
+    LibrarySegments* segments = context;
+    if (info->dlpi_addr != segments->base || strcmp(info->dlpi_name, segments->name) != 0) return 0;
+    segments->found = true;
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* header = &info->dlpi_phdr[i];
+        if (header->p_type != PT_LOAD || header->p_memsz == 0 || (header->p_flags & PF_R) == 0) continue;
+        if (segments->writable_only && (header->p_flags & PF_W) == 0) continue;
+        uintptr_t start = (info->dlpi_addr + header->p_vaddr) & ~(uintptr_t)(page_size - 1);
+        uintptr_t end = (info->dlpi_addr + header->p_vaddr + header->p_memsz + page_size - 1) & ~(uintptr_t)(page_size - 1);
+        add_region(segments->regions, start, end);
+    }
+    for (int i = 0; segments->writable_only && i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)* header = &info->dlpi_phdr[i];
+        if (header->p_type != PT_GNU_RELRO) continue;
+        uintptr_t start = (info->dlpi_addr + header->p_vaddr) & ~(uintptr_t)(page_size - 1);
+        uintptr_t end = (info->dlpi_addr + header->p_vaddr + header->p_memsz) & ~(uintptr_t)(page_size - 1);
+        exclude_memory_range(segments->regions, start, end);
+    }
+    return 1;
+}
+#endif
+
+static void gather_library_segments(MemoryRegions* regions, const char* library_name, bool writable_only) {
+#ifdef use_link_map
+    char* library_path = resolve_library_path(library_name);
+    if (library_path == NULL) {
+        raiseException(1,  "Error: %s isn't heap, all, a range <start>-<end> or a library that can be found\n", library_name);
+    }
+    void* handle = getOrLoadLibrary(library_path);
+    if (handle == NULL) {
+        raiseException(1,  "Failed to load library: %s\n", library_path);
+    }
+    struct link_map* map = NULL;
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0 || map == NULL) {
+        raiseException(1,  "Error: Could not find where %s is loaded: %s\n", library_path, dlerror());
+    }
+    LibrarySegments segments = {(uintptr_t)map->l_addr, map->l_name, regions, writable_only, false};
+    dl_iterate_phdr(collect_library_segments, &segments);
+    free(library_path);
+    if (!segments.found) {
+        raiseException(1,  "Error: Could not find the segments of %s\n", library_name);
+    }
+#else
+    (void)regions;
+    (void)writable_only;
+    raiseException(1,  "Error: Searching a library (%s) isn't supported on this platform, only a range <start>-<end>\n", library_name);
+#endif
+}
+
+// <start>-<end>, either of which can be a variable or an offset like any other address
+static bool parse_range(const char* where, MemoryRegion* range) {
+    const char* dash = strchr(where + 1, '-');
+    if (dash == NULL) return false;
+    char* start = strndup(where, (size_t)(dash - where));
+    void* start_address = tryGetAddressFromAddressStringOrNameOfCoercableVariable(start);
+    void* end_address = tryGetAddressFromAddressStringOrNameOfCoercableVariable(dash + 1);
+    free(start);
+    if (start_address == NULL || end_address == NULL) return false;
+    if ((uintptr_t)end_address <= (uintptr_t)start_address) {
+        raiseException(1,  "Error: The range %s ends before it starts\n", where);
+    }
+    *range = (MemoryRegion){(uintptr_t)start_address, (uintptr_t)end_address};
+    return true;
+}
+
+// Returns the text of /proc/self/maps they were gathered from, if they were
+static char* gather_regions(MemoryRegions* regions, const char* where, bool writable_only) {
+    MemoryRegion range;
+    if (strcmp(where, "heap") == 0 || strcmp(where, "all") == 0) {
+#ifdef use_proc_maps
+        MappingKind kind = strcmp(where, "heap") == 0 ? MAPPINGS_HEAP : writable_only ? MAPPINGS_WRITABLE : MAPPINGS_ALL;
+        return gather_mappings(regions, kind, NULL);
+#else
+        raiseException(1,  "Error: Searching %s isn't supported on this platform, only a range <start>-<end>\n", where);
+#endif
+    } else if (parse_range(where, &range)) {
+#ifdef use_proc_maps
+        return gather_mappings(regions, writable_only ? MAPPINGS_WRITABLE : MAPPINGS_ALL, &range);
+#else
+        add_region(regions, range.start, range.end);
+#endif
+    } else {
+        gather_library_segments(regions, where, writable_only);
+    }
+    return NULL;
+}
+
+MemoryRegions gather_memory_regions(const char* where, bool writable_only) {
+    MemoryRegions regions = {NULL, 0};
+    free(gather_regions(&regions, where, writable_only));
+    return regions;
+}
+
+void free_memory_regions(MemoryRegions* regions) {
+    free(regions->regions);
+    *regions = (MemoryRegions){NULL, 0};
+}
+
+// The workers, with room for their matches, are kept from one search to the next while the thread count and --max stay
+// the same, so that their mappings (left out of the regions searched) don't change /proc/self/maps each time
+static SearchWorker* worker_pool = NULL;
+static int pool_threads = 0;
+static size_t pool_capacity = 0;
+
+static SearchWorker* get_workers(int threads, size_t capacity) {
+    if (worker_pool != NULL && pool_threads == threads && pool_capacity == capacity) return worker_pool;
+    for (int i = 0; worker_pool != NULL && i < pool_threads; i++) {
+#ifdef SEARCH_THREADS
+        munmap(worker_pool[i].matches.addresses, pool_capacity * sizeof(uintptr_t));
+#else
+        free(worker_pool[i].matches.addresses);
+#endif
+    }
+    free(worker_pool);
+    worker_pool = calloc((size_t)threads, sizeof(SearchWorker));
+    pool_threads = threads;
+    pool_capacity = capacity;
+    for (int i = 0; i < threads; i++) {
+#ifdef SEARCH_THREADS
+        void* addresses = mmap(NULL, capacity * sizeof(uintptr_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        worker_pool[i].matches.addresses = addresses != MAP_FAILED ? addresses : NULL;
+#else
+        worker_pool[i].matches.addresses = malloc(capacity * sizeof(uintptr_t));
+#endif
+        worker_pool[i].matches.capacity = capacity;
+        if (worker_pool[i].matches.addresses == NULL) {
+            pool_threads = i;
+            raiseException(1,  "Failed to allocate memory for the matches.\n");
+        }
+    }
+    return worker_pool;
+}
+
+static void exclude_workers(MemoryRegions* regions, const SearchWorker* workers, int threads) {
+    for (int i = 0; i < threads; i++) {
+        exclude_memory_range(regions, (uintptr_t)workers[i].matches.addresses, (uintptr_t)(workers[i].matches.addresses + workers[i].matches.capacity));
+    }
+}
+
+// The arrays search and refs have handed back as variables, which hold the very addresses a later search or refs looks
+// for. They're never freed, even once the variable is set to something else, so they're left out for good
+static MemoryRegions result_arrays = {NULL, 0};
+
+static void keep_result_array(const uintptr_t* addresses, size_t count) {
+    add_region(&result_arrays, (uintptr_t)addresses, (uintptr_t)(addresses + (count > 0 ? count : 1)));
+}
+
+static void exclude_result_arrays(MemoryRegions* regions) {
+    for (size_t i = 0; i < result_arrays.count; i++) {
+        exclude_memory_range(regions, result_arrays.regions[i].start, result_arrays.regions[i].end);
+    }
+}
+
+static int default_thread_count() {
+#ifdef SEARCH_THREADS
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : cpus > SEARCH_MAX_THREADS ? SEARCH_MAX_THREADS : (int)cpus;
+#else
+    return 1;
+#endif
+}
+
+void run_search_command(int argc, char** argv) {
+    int threads = default_thread_count();
+    size_t max_matches = SEARCH_DEFAULT_MAX_MATCHES;
+    const char* endian = NULL;
+    while (argc > 1 && strncmp(argv[0], "--", 2) == 0) {
+        if (strcmp(argv[0], "--threads") == 0) {
+            threads = atoi(argv[1]);
+            if (threads < 1 || threads > SEARCH_MAX_THREADS) {
+                raiseException(1,  "Error: --threads must be between 1 and %d\n", SEARCH_MAX_THREADS);
+            }
+        } else if (strcmp(argv[0], "--max") == 0) {
+            max_matches = strtoul(argv[1], NULL, 0);
+            if (max_matches == 0) {
+                raiseException(1,  "Error: --max must be at least 1\n");
+            }
+        } else if (strcmp(argv[0], "--endian") == 0) {
+            endian = argv[1];
+            if (strcmp(endian, "little") != 0 && strcmp(endian, "big") != 0 && strcmp(endian, "both") != 0) {
+                raiseException(1,  "Error: --endian takes little, big or both\n");
+            }
+        } else {
+            raiseException(1,  "Error: Unknown option %s for search\n", argv[0]);
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    const char* name = "$search";
+    if (argc > 2 && strcmp(argv[1], "=") == 0) {
+        validateVariableName(argv[0]);
+        name = argv[0];
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc < 2) {
+        raiseException(1,  "Usage: search [--threads <n>] [--max <n>] [--endian little|big|both] [<var> =] <heap|all|<start>-<end>|library> <pattern>\n");
+    }
+#ifndef SEARCH_THREADS
+    threads = 1;
+#endif
+
+    SearchPattern patterns[2];
+    int pattern_count = 1;
+    bool can_swap = false;
+    patterns[0] = argv[1][0] == '-' ? parse_value_pattern(argc - 1, argv + 1, &can_swap) : parse_byte_pattern(argc - 1, argv + 1);
+    if (endian != NULL && !can_swap) {
+        free_pattern(&patterns[0]);
+        raiseException(1,  "Error: --endian only applies to typed values of more than one byte\n");
+    }
+    if (endian != NULL && strcmp(endian, "both") == 0) {
+        patterns[1] = new_pattern(patterns[0].length);
+        memcpy(patterns[1].bytes, patterns[0].bytes, patterns[0].length);
+        reverse_bytes(patterns[1].bytes, patterns[1].length);
+        if (memcmp(patterns[0].bytes, patterns[1].bytes, patterns[0].length) != 0) pattern_count = 2;
+        else free_pattern(&patterns[1]);
+    } else if (endian != NULL && (strcmp(endian, "little") == 0) != host_is_little_endian()) {
+        reverse_bytes(patterns[0].bytes, patterns[0].length);
+    }
+    for (int p = 0; p < pattern_count; p++) {
+        find_anchors(&patterns[p]);
+    }
+
+    SearchWorker* workers = get_workers(threads, max_matches);
+    MemoryRegions regions;
+    char* maps;
+    char* maps_check = NULL;
+    for (int attempt = 1; ; attempt++) {
+        regions = (MemoryRegions){NULL, 0};
+        maps = gather_regions(&regions, argv[0], false);
+        exclude_workers(&regions, workers, threads);
+        exclude_result_arrays(&regions);
+        for (int p = 0; p < pattern_count; p++) {
+            exclude_memory_range(&regions, (uintptr_t)patterns[p].bytes, (uintptr_t)patterns[p].bytes + patterns[p].length);
+        }
+        if (maps == NULL) break; // a library's segments, which stay put
+#ifdef use_proc_maps
+        maps_check = malloc(strlen(maps) + MAPS_CHECK_SLACK);
+        if (maps_unchanged(maps, maps_check)) break;
+        free(maps_check);
+        free(maps);
+        free(regions.regions);
+        if (attempt == MAPS_MAX_ATTEMPTS) {
+            raiseException(1,  "Error: The memory map kept changing while gathering the regions to search\n");
+        }
+#endif
+    }
+
+    uint64_t started = now_ns();
+    SearchPatterns searched_patterns = {patterns, pattern_count};
+    SearchQueue queue = {.regions = &regions, .scan = scan_for_patterns, .context = &searched_patterns, .region = 0, .offset = 0, .full = false};
+    threads = run_workers(&queue, workers, threads);
+    uint64_t elapsed_ns = now_ns() - started;
+
+    size_t found;
+    uintptr_t* addresses = collect_matches(workers, threads, &found);
+    if (found > max_matches) {
+        memset(addresses + max_matches, 0, (found - max_matches) * sizeof(uintptr_t)); // past what's kept, so not left out
+        found = max_matches;
+    }
+
+    size_t searched = total_bytes(&regions);
+    if (queue.full) {
+        output_printf("Found %zu matches in %.3f ms on %d threads, stopping at --max, so there may be more\n", found, elapsed_ns / 1e6, threads);
+    } else {
+        output_printf("Found %zu matches in %.1f MB of %zu regions in %.3f ms on %d threads (%.0f MB/s)\n", found, searched / 1e6,
+                      regions.count, elapsed_ns / 1e6, threads, elapsed_ns > 0 ? searched * 1e3 / elapsed_ns : 0.0);
+    }
+    free(regions.regions);
+    free(maps);
+    free(maps_check);
+    for (int p = 0; p < pattern_count; p++) free_pattern(&patterns[p]);
+
+    ArgInfo* result = calloc(1, sizeof(ArgInfo));
+    result->value = calloc(1, sizeof(*result->value));
+    result->type = TYPE_VOIDPOINTER;
+    result->explicitType = true;
+    result->is_array = ARRAY_STATIC_SIZE;
+    result->static_or_implied_size = found;
+    result->value->ptr_val = addresses;
+    keep_result_array(addresses, found);
+    setVar(name, result);
+    if (!output_is_quiet()) printVariableWithArgInfo((char*)name, result);
+}
+
+#define REF_TARGET SIZE_MAX
+
+// A pointer refs found, and the one it points near at the level before (or REF_TARGET, for the target itself)
+typedef struct {
+    uintptr_t address;
+    uintptr_t value;
+    size_t parent;
+} RefNode;
+
+typedef struct {
+    RefNode* nodes;
+    size_t count;
+} RefLevel;
+
+typedef struct {
+    MemoryRegion* ranges; // sorted and merged, what a word has to point into to count
+    size_t count;
+    uintptr_t low; // of them all
+    uintptr_t high;
+} RefTargets;
+
+static bool points_into(const RefTargets* targets, uintptr_t value) {
+    size_t low = 0, high = targets->count;
+    while (low < high) { // the first range that ends after the value
+        size_t middle = low + (high - low) / 2;
+        if (targets->ranges[middle].end <= value) low = middle + 1;
+        else high = middle;
+    }
+    return low < targets->count && targets->ranges[low].start <= value;
+}
+
+// Each aligned word in the chunk that points into the targets
+static bool scan_for_refs(const unsigned char* from, size_t length, size_t available, const void* context, SearchMatches* matches) {
+    const RefTargets* targets = context;
+    uintptr_t span = targets->high - targets->low;
+    uintptr_t end = (uintptr_t)from + length;
+    uintptr_t readable_end = (uintptr_t)from + available;
+    for (uintptr_t at = ((uintptr_t)from + sizeof(uintptr_t) - 1) & ~(uintptr_t)(sizeof(uintptr_t) - 1);
+         at < end && at + sizeof(uintptr_t) <= readable_end; at += sizeof(uintptr_t)) {
+        uintptr_t value = *(const uintptr_t*)at;
+        if (value - targets->low >= span || !points_into(targets, value)) continue;
+        if (!add_match(matches, (const unsigned char*)at)) return false;
+    }
+    return true;
+}
+
+static int compare_regions(const void* a, const void* b) {
+    return compare_addresses(&((const MemoryRegion*)a)->start, &((const MemoryRegion*)b)->start);
+}
+
+static RefTargets merge_targets(MemoryRegion* ranges, size_t count) {
+    qsort(ranges, count, sizeof(MemoryRegion), compare_regions);
+    size_t merged = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (merged > 0 && ranges[i].start <= ranges[merged - 1].end) {
+            if (ranges[i].end > ranges[merged - 1].end) ranges[merged - 1].end = ranges[i].end;
+        } else {
+            ranges[merged++] = ranges[i];
+        }
+    }
+    return (RefTargets){ranges, merged, merged > 0 ? ranges[0].start : 0, merged > 0 ? ranges[merged - 1].end : 0};
+}
+
+// Memory holding addresses is cleared before it's freed, so that later levels (and later refs) don't find it
+static void clear_and_free(void* memory, size_t size) {
+    if (memory != NULL) memset(memory, 0, size);
+    free(memory);
+}
+
+#ifdef use_proc_maps
+// The writable mappings, as of when /proc/self/maps last changed, so that refs after refs don't gather them again
+static char* cached_maps = NULL;
+static MemoryRegions cached_writable = {NULL, 0};
+
+// Returns whether they had to be gathered again
+static bool refresh_writable_mappings() {
+    char* text = read_proc_maps();
+    if (cached_maps != NULL && strcmp(text, cached_maps) == 0) {
+        free(text);
+        return false;
+    }
+    free(cached_maps);
+    cached_maps = text;
+    free(cached_writable.regions);
+    cached_writable = (MemoryRegions){NULL, 0};
+    char* parsed = strdup(text);
+    gather_mappings_from(parsed, &cached_writable, MAPPINGS_WRITABLE, NULL);
+    free(parsed);
+    return true;
+}
+#endif
+
+void describe_memory_address(uintptr_t address, char* description, size_t size) {
+#ifdef SEARCH_THREADS
+    Dl_info info;
+    if (dladdr((void*)address, &info) != 0 && info.dli_fname != NULL && info.dli_fname[0] != '\0') {
+        const char* module = strrchr(info.dli_fname, '/') != NULL ? strrchr(info.dli_fname, '/') + 1 : info.dli_fname;
+        if (info.dli_sname != NULL && info.dli_saddr != NULL) {
+            snprintf(description, size, "%s %s+0x%lx", module, info.dli_sname, (unsigned long)(address - (uintptr_t)info.dli_saddr));
+        } else {
+            snprintf(description, size, "%s+0x%lx", module, (unsigned long)(address - (uintptr_t)info.dli_fbase));
+        }
+        return;
+    }
+#endif
+#ifdef use_proc_maps
+    char* text = cached_maps != NULL ? strdup(cached_maps) : read_proc_maps();
+    char* line = text;
+    Mapping mapping;
+    while (next_mapping(&line, &mapping)) {
+        if (address < mapping.start || address >= mapping.end) continue;
+        snprintf(description, size, "%s", mapping.path[0] != '\0' ? mapping.path : "anonymous");
+        free(text);
+        return;
+    }
+    free(text);
+#endif
+    snprintf(description, size, "unknown");
+}
+
+static void print_refs(const RefLevel* levels, int level_count, int level, size_t parent) {
+    for (size_t i = 0; i < levels[level].count; i++) {
+        const RefNode* node = &levels[level].nodes[i];
+        if (node->parent != parent) continue;
+        char where[512];
+        describe_memory_address(node->address, where, sizeof(where));
+        output_printf("%*s%p (%s) -> %p\n", level * 2, "", (void*)node->address, where, (void*)node->value);
+        if (level + 1 < level_count) print_refs(levels, level_count, level + 1, i);
+    }
+}
+
+static bool already_found(const RefLevel* levels, int level_count, uintptr_t address) {
+    for (int l = 0; l < level_count; l++) {
+        for (size_t i = 0; i < levels[l].count; i++) {
+            if (levels[l].nodes[i].address == address) return true;
+        }
+    }
+    return false;
+}
+
+// The node at the level before whose stretch of memory the value points into, the nearest after it if several do
+static size_t find_parent(const RefLevel* previous, uintptr_t value, uintptr_t back) {
+    for (size_t i = 0; i < previous->count; i++) { // sorted by address
+        const RefNode* node = &previous->nodes[i];
+        if (value < node->address + sizeof(uintptr_t) && value + back >= node->address) return i;
+    }
+    return 0;
+}
+
+void run_refs_command(int argc, char** argv) {
+    int threads = default_thread_count();
+    size_t max_matches = REFS_DEFAULT_MAX_MATCHES;
+    size_t range = 1;
+    int depth = 1;
+    char* positional[3];
+    int positional_count = 0;
+    for (int i = 0; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0 && i + 1 < argc) {
+            if (strcmp(argv[i], "--range") == 0) {
+                range = strtoul(argv[i + 1], NULL, 0);
+                if (range == 0) {
+                    raiseException(1,  "Error: --range must be at least 1\n");
+                }
+            } else if (strcmp(argv[i], "--depth") == 0) {
+                depth = atoi(argv[i + 1]);
+                if (depth < 1 || depth > REFS_MAX_DEPTH) {
+                    raiseException(1,  "Error: --depth must be between 1 and %d\n", REFS_MAX_DEPTH);
+                }
+            } else if (strcmp(argv[i], "--threads") == 0) {
+                threads = atoi(argv[i + 1]);
+                if (threads < 1 || threads > SEARCH_MAX_THREADS) {
+                    raiseException(1,  "Error: --threads must be between 1 and %d\n", SEARCH_MAX_THREADS);
+                }
+            } else if (strcmp(argv[i], "--max") == 0) {
+                max_matches = strtoul(argv[i + 1], NULL, 0);
+                if (max_matches == 0) {
+                    raiseException(1,  "Error: --max must be at least 1\n");
+                }
+            } else {
+                raiseException(1,  "Error: Unknown option %s for refs\n", argv[i]);
+            }
+            i++;
+        } else if (positional_count < 3) {
+            positional[positional_count++] = argv[i];
+        } else {
+            positional_count = 0;
+            break;
+        }
+    }
+    const char* name = "$refs";
+    if (positional_count == 3 && strcmp(positional[1], "=") == 0) {
+        validateVariableName(positional[0]);
+        name = positional[0];
+    } else if (positional_count != 1) {
+        raiseException(1,  "Usage: refs [<var> =] <address> [--range <n>] [--depth <n>] [--threads <n>] [--max <n>]\n");
+    }
+    void* address = getAddressFromAddressStringOrNameOfCoercableVariable(positional[positional_count - 1]);
+    if (address == NULL) {
+        raiseException(1,  "Error: Invalid address for refs\n");
+    }
+#ifndef use_proc_maps
+    raiseException(1,  "Error: refs isn't supported on this platform, since it needs /proc/self/maps\n");
+#else
+#ifndef SEARCH_THREADS
+    threads = 1;
+#endif
+    SearchWorker* workers = get_workers(threads, max_matches);
+    bool rebuilt = false;
+    uintptr_t back = range > sizeof(uintptr_t) ? range - sizeof(uintptr_t) : 0;
+
+    RefLevel* levels = calloc((size_t)depth, sizeof(RefLevel));
+    int level_count = 0;
+    size_t found = 0, searched = 0;
+    bool full = false;
+    uint64_t started = now_ns();
+    for (int level = 0; level < depth; level++) {
+        size_t target_count = level == 0 ? 1 : levels[level - 1].count;
+        MemoryRegion* ranges = malloc(target_count * sizeof(MemoryRegion));
+        for (size_t i = 0; i < target_count; i++) {
+            uintptr_t at = level == 0 ? (uintptr_t)address : levels[level - 1].nodes[i].address;
+            ranges[i] = level == 0 ? (MemoryRegion){at, at + range} : (MemoryRegion){at > back ? at - back : 0, at + sizeof(uintptr_t)};
+        }
+        RefTargets targets = merge_targets(ranges, target_count);
+
+        MemoryRegions regions;
+        char* maps_check;
+        for (int attempt = 1; ; attempt++) {
+            rebuilt = refresh_writable_mappings() || rebuilt;
+            regions = (MemoryRegions){malloc((cached_writable.count > 0 ? cached_writable.count : 1) * sizeof(MemoryRegion)), cached_writable.count};
+            memcpy(regions.regions, cached_writable.regions, cached_writable.count * sizeof(MemoryRegion));
+            exclude_workers(&regions, workers, threads);
+            exclude_result_arrays(&regions);
+            exclude_memory_range(&regions, (uintptr_t)ranges, (uintptr_t)(ranges + target_count));
+            for (int l = 0; l < level; l++) {
+                exclude_memory_range(&regions, (uintptr_t)levels[l].nodes, (uintptr_t)(levels[l].nodes + levels[l].count));
+            }
+            maps_check = malloc(strlen(cached_maps) + MAPS_CHECK_SLACK);
+            if (maps_unchanged(cached_maps, maps_check)) break;
+            free(maps_check);
+            free(regions.regions);
+            if (attempt == MAPS_MAX_ATTEMPTS) {
+                raiseException(1,  "Error: The memory map kept changing while gathering the regions to search\n");
+            }
+        }
+        SearchQueue queue = {.regions = &regions, .scan = scan_for_refs, .context = &targets, .region = 0, .offset = 0, .full = false};
+        threads = run_workers(&queue, workers, threads);
+        searched += total_bytes(&regions);
+        full = full || queue.full;
+        free(regions.regions);
+        free(maps_check);
+        clear_and_free(ranges, target_count * sizeof(MemoryRegion));
+
+        size_t count;
+        uintptr_t* addresses = collect_matches(workers, threads, &count);
+        if (count > max_matches) count = max_matches;
+        RefLevel* current = &levels[level];
+        current->nodes = malloc((count > 0 ? count : 1) * sizeof(RefNode));
+        for (size_t i = 0; i < count; i++) {
+            if (level > 0 && already_found(levels, level, addresses[i])) continue; // going round a cycle
+            uintptr_t value = *(const uintptr_t*)addresses[i];
+            size_t parent = level == 0 ? REF_TARGET : find_parent(&levels[level - 1], value, back);
+            current->nodes[current->count++] = (RefNode){addresses[i], value, parent};
+        }
+        clear_and_free(addresses, (count > 0 ? count : 1) * sizeof(uintptr_t));
+        for (int i = 0; i < threads; i++) memset(workers[i].matches.addresses, 0, workers[i].matches.count * sizeof(uintptr_t));
+        found += current->count;
+        level_count++;
+        if (current->count == 0) break;
+    }
+    uint64_t elapsed_ns = now_ns() - started;
+
+    output_printf("Found %zu pointers to %p", found, address);
+    if (range > 1) output_printf(" (or the %zu bytes from there)", range);
+    output_printf(" over %d levels, searching %.1f MB of %zu writable regions (%s) in %.3f ms on %d threads%s\n", level_count,
+                  searched / 1e6, cached_writable.count, rebuilt ? "gathered again" : "as cached", elapsed_ns / 1e6, threads,
+                  full ? ", stopping at --max, so there may be more" : "");
+    print_refs(levels, level_count, 0, REF_TARGET);
+
+    uintptr_t* referrers = malloc((levels[0].count > 0 ? levels[0].count : 1) * sizeof(uintptr_t));
+    for (size_t i = 0; i < levels[0].count; i++) referrers[i] = levels[0].nodes[i].address;
+    ArgInfo* result = calloc(1, sizeof(ArgInfo));
+    result->value = calloc(1, sizeof(*result->value));
+    result->type = TYPE_VOIDPOINTER;
+    result->explicitType = true;
+    result->is_array = ARRAY_STATIC_SIZE;
+    result->static_or_implied_size = levels[0].count;
+    result->value->ptr_val = referrers;
+    keep_result_array(referrers, levels[0].count);
+    for (int l = 0; l < level_count; l++) clear_and_free(levels[l].nodes, (levels[l].count > 0 ? levels[l].count : 1) * sizeof(RefNode));
+    free(levels);
+    setVar(name, result);
+#endif
+}
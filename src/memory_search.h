@@ -0,0 +1,65 @@
+#ifndef MEMORY_SEARCH_H
+#define MEMORY_SEARCH_H
+
+// Finds a pattern of bytes in memory:
+//
+//   search [--threads <n>] [--max <n>] [--endian little|big|both] [<var> =] <where> <pattern>
+//
+// where is heap (the [heap] and the anonymous writable mappings, where malloc's bigger blocks and other threads' arenas
+// are), all (every readable mapping), a range <start>-<end>, or a library (its loaded segments, including its globals).
+// The regions come from /proc/self/maps, leaving out those that can't be read and the parts of mapped files past their
+// end. The pattern is either hex bytes, with ?? for any byte (eg 7f 45 4c 46 or 48 8b ?? 05), or a typed value as it'd
+// be given to a function (eg -i 42, -d 3.14 or -s text). A typed value is searched for in this machine's byte order,
+// unless --endian says otherwise, both searching for either.
+// The regions are split into chunks that --threads threads (by default one per CPU) take in turn. Within a chunk,
+// candidates are found 16 at a time by comparing the pattern's first and last fixed bytes with SSE2 where there is
+// that, or by memchr on the first, and each is then compared with the whole pattern.
+// The addresses found, up to --max of them (by default SEARCH_DEFAULT_MAX_MATCHES), are kept sorted in an array
+// variable, $search unless another is named, for following up with dump or hexdump. Copies of a string pattern that
+// the command line itself left in memory can show up among them.
+// Ranges can be searched anywhere; the rest need /proc/self/maps (so Linux), and libraries glibc too.
+//
+//   refs [<var> =] <address> [--range <n>] [--depth <n>] [--threads <n>] [--max <n>]
+//
+// finds what points at an address, or anywhere in the --range bytes from it: each aligned pointer-sized word in the
+// writable mappings (but cliffi's own stack) whose value lands there, split between threads as for search. Each is
+// printed with the library and symbol it's in, or else the mapping. With --depth, the pointers to those are found in
+// turn, and so on, each pointer found being taken to be within an object of up to --range bytes, so the next level
+// looks for pointers to anywhere in the --range bytes that end with it. Up to --max pointers are kept at each level,
+// and those at the first are kept in an array variable, $refs unless another is named. The writable mappings are
+// cached, and only gathered again once /proc/self/maps changes. The arrays search and refs have kept their results in
+// are never searched, by either. Needs /proc/self/maps.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SEARCH_DEFAULT_MAX_MATCHES 100000
+#define SEARCH_MAX_THREADS 64
+#define REFS_DEFAULT_MAX_MATCHES 1000
+#define REFS_MAX_DEPTH 8
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+} MemoryRegion;
+
+typedef struct {
+    MemoryRegion* regions;
+    size_t count;
+} MemoryRegions;
+
+// The regions that where names, as search takes it. With writable_only, only those that are writable, less cliffi's
+// own stack, and of a library only the segments holding its data and bss, less what's made read only after relocation
+MemoryRegions gather_memory_regions(const char* where, bool writable_only);
+void free_memory_regions(MemoryRegions* regions);
+// Cuts [start, end) out of the regions, eg so that something doesn't find its own buffers
+void exclude_memory_range(MemoryRegions* regions, uintptr_t start, uintptr_t end);
+// Where the address is: the library and symbol, or else the mapping
+void describe_memory_address(uintptr_t address, char* description, size_t size);
+
+// The REPL commands, given the args after search or refs
+void run_search_command(int argc, char** argv);
+void run_refs_command(int argc, char** argv);
+
+#endif // MEMORY_SEARCH_H
@@ -0,0 +1,467 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for process_vm_readv and dladdr
+#endif
+#include "memory_snapshot.h"
+#include "exception_handling.h"
+#include "memory_search.h"
+#include "output_buffer.h"
+#include "types_and_utils.h"
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define use_mmap
+#define use_dladdr
+#endif
+
+#ifdef __linux__
+#include <sys/uio.h>
+#define use_process_vm_readv
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define use_crc32_instruction
+#endif
+
+#define SNAPSHOT_PAGE_SIZE 4096 // what each hash covers
+#define DIFF_LIVE_CHUNK (16 * SNAPSHOT_PAGE_SIZE) // how much of live memory is read at a time to compare
+
+typedef struct {
+    uintptr_t start;
+    uintptr_t end;
+    unsigned char* bytes; // the copy of [start, end)
+    uint32_t* hashes; // of each page of it, the first and last being only the part of their page within it
+} SnapshotRegion;
+
+typedef struct Snapshot {
+    char* name;
+    char* where;
+    SnapshotRegion* regions; // in order of address
+    size_t count;
+    unsigned char* copy; // every region's bytes, mapped apart from the heap so that snapshots of it don't take in others
+    size_t copy_size;
+    uint32_t* hashes;
+    size_t page_count;
+    struct Snapshot* next;
+} Snapshot;
+
+typedef struct {
+    bool pending; // whether there's a changed range being built up, which changes touching it are added to
+    uintptr_t start;
+    uintptr_t end;
+    unsigned char old_bytes[DIFF_SHOWN_BYTES];
+    unsigned char new_bytes[DIFF_SHOWN_BYTES];
+    size_t ranges;
+    size_t bytes;
+    size_t pages;
+    size_t pages_skipped; // those whose hashes matched
+    size_t pages_unreadable;
+} DiffState;
+
+static Snapshot* snapshots = NULL;
+
+static size_t pages_in(uintptr_t start, uintptr_t end) {
+    return start < end ? (end - 1) / SNAPSHOT_PAGE_SIZE - start / SNAPSHOT_PAGE_SIZE + 1 : 0;
+}
+
+static uint32_t crc32c_table[256];
+
+static uint32_t crc32c_software(const unsigned char* bytes, size_t length) {
+    if (crc32c_table[1] == 0) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++) crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+            crc32c_table[i] = crc;
+        }
+    }
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < length; i++) crc = (crc >> 8) ^ crc32c_table[(crc ^ bytes[i]) & 0xff];
+    return ~crc;
+}
+
+#ifdef use_crc32_instruction
+__attribute__((target("sse4.2"))) static uint32_t crc32c_hardware(const unsigned char* bytes, size_t length) {
+    uint64_t crc = 0xffffffff;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        crc = _mm_crc32_u64(crc, word);
+    }
+    for (; i < length; i++) crc = _mm_crc32_u8((uint32_t)crc, bytes[i]);
+    return ~(uint32_t)crc;
+}
+#endif
+
+static uint32_t hash_page(const unsigned char* bytes, size_t length) {
+    static uint32_t (*crc32c)(const unsigned char*, size_t) = NULL;
+    if (crc32c == NULL) {
+        crc32c = crc32c_software;
+#ifdef use_crc32_instruction
+        if (__builtin_cpu_supports("sse4.2")) crc32c = crc32c_hardware;
+#endif
+    }
+    return crc32c(bytes, length);
+}
+
+// Copies as much of [from, from + length) as can be read before the first byte that can't, returning how much that was.
+// process_vm_readv on ourselves fails with EFAULT rather than faulting, so memory unmapped since it was found is safe
+static size_t read_memory(void* to, uintptr_t from, size_t length) {
+#ifdef use_process_vm_readv
+    struct iovec local = {to, length};
+    struct iovec remote = {(void*)from, length};
+    ssize_t got = process_vm_readv(getpid(), &local, 1, &remote, 1, 0);
+    if (got >= 0) return (size_t)got;
+    if (errno != ENOSYS && errno != EPERM) return 0;
+#endif
+    memcpy(to, (const void*)from, length);
+    return length;
+}
+
+static unsigned char* allocate_copy(size_t size) {
+#ifdef use_mmap
+    void* copy = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return copy != MAP_FAILED ? copy : NULL;
+#else
+    return malloc(size);
+#endif
+}
+
+static void free_snapshot(Snapshot* snapshot) {
+#ifdef use_mmap
+    if (snapshot->copy != NULL) munmap(snapshot->copy, snapshot->copy_size);
+#else
+    free(snapshot->copy);
+#endif
+    free(snapshot->hashes);
+    free(snapshot->regions);
+    free(snapshot->name);
+    free(snapshot->where);
+    free(snapshot);
+}
+
+static void add_snapshot_region(Snapshot* snapshot, uintptr_t start, uintptr_t end, unsigned char* bytes) {
+    if (start >= end) return;
+    snapshot->regions = realloc(snapshot->regions, (snapshot->count + 1) * sizeof(SnapshotRegion));
+    snapshot->regions[snapshot->count++] = (SnapshotRegion){start, end, bytes, NULL};
+}
+
+// Copies what can still be read of [start, end) to to, each stretch of it either side of what can't being a region
+static void copy_region(Snapshot* snapshot, uintptr_t start, uintptr_t end, unsigned char* to) {
+    uintptr_t at = start, copied_from = start;
+    while (at < end) {
+        size_t got = read_memory(to + (at - start), at, end - at);
+        if (got > 0) {
+            at += got;
+            continue;
+        }
+        add_snapshot_region(snapshot, copied_from, at, to + (copied_from - start));
+        at = (at / SNAPSHOT_PAGE_SIZE + 1) * SNAPSHOT_PAGE_SIZE;
+        if (at > end) at = end;
+        copied_from = at;
+    }
+    add_snapshot_region(snapshot, copied_from, end, to + (copied_from - start));
+}
+
+static void hash_snapshot(Snapshot* snapshot) {
+    snapshot->page_count = 0;
+    for (size_t i = 0; i < snapshot->count; i++) {
+        snapshot->page_count += pages_in(snapshot->regions[i].start, snapshot->regions[i].end);
+    }
+    snapshot->hashes = malloc((snapshot->page_count + 1) * sizeof(uint32_t));
+    uint32_t* hash = snapshot->hashes;
+    for (size_t i = 0; i < snapshot->count; i++) {
+        SnapshotRegion* region = &snapshot->regions[i];
+        region->hashes = hash;
+        for (uintptr_t from = region->start; from < region->end; hash++) {
+            uintptr_t to = (from / SNAPSHOT_PAGE_SIZE + 1) * SNAPSHOT_PAGE_SIZE;
+            if (to > region->end) to = region->end;
+            *hash = hash_page(region->bytes + (from - region->start), to - from);
+            from = to;
+        }
+    }
+}
+
+static int compare_regions(const void* a, const void* b) {
+    uintptr_t left = ((const MemoryRegion*)a)->start, right = ((const MemoryRegion*)b)->start;
+    return left < right ? -1 : left > right;
+}
+
+static Snapshot* find_snapshot(const char* name) {
+    for (Snapshot* snapshot = snapshots; snapshot != NULL; snapshot = snapshot->next) {
+        if (strcmp(snapshot->name, name) == 0) return snapshot;
+    }
+    return NULL;
+}
+
+static void drop_snapshot(const char* name) {
+    for (Snapshot** link = &snapshots; *link != NULL; link = &(*link)->next) {
+        if (strcmp((*link)->name, name) != 0) continue;
+        Snapshot* dropped = *link;
+        *link = dropped->next;
+        free_snapshot(dropped);
+        return;
+    }
+}
+
+static void take_snapshot(const char* name, const char* where) {
+    uint64_t started = now_ns();
+    MemoryRegions regions = gather_memory_regions(where, true);
+    for (Snapshot* other = snapshots; other != NULL; other = other->next) {
+        exclude_memory_range(&regions, (uintptr_t)other->copy, (uintptr_t)other->copy + other->copy_size);
+    }
+    qsort(regions.regions, regions.count, sizeof(MemoryRegion), compare_regions);
+    size_t size = 0;
+    for (size_t i = 0; i < regions.count; i++) size += regions.regions[i].end - regions.regions[i].start;
+    if (size == 0) {
+        free_memory_regions(&regions);
+        raiseException(1,  "Error: There's nothing writable to snapshot in %s\n", where);
+    }
+    Snapshot* snapshot = calloc(1, sizeof(Snapshot));
+    snapshot->copy = allocate_copy(size);
+    if (snapshot->copy == NULL) {
+        free(snapshot);
+        free_memory_regions(&regions);
+        raiseException(1,  "Failed to allocate memory for the snapshot.\n");
+    }
+    snapshot->copy_size = size;
+    unsigned char* to = snapshot->copy;
+    for (size_t i = 0; i < regions.count; i++) {
+        copy_region(snapshot, regions.regions[i].start, regions.regions[i].end, to);
+        to += regions.regions[i].end - regions.regions[i].start;
+    }
+    free_memory_regions(&regions);
+    hash_snapshot(snapshot);
+    snapshot->name = strdup(name);
+    snapshot->where = strdup(where);
+    drop_snapshot(name);
+    snapshot->next = snapshots;
+    snapshots = snapshot;
+
+    size_t copied = 0;
+    for (size_t i = 0; i < snapshot->count; i++) copied += snapshot->regions[i].end - snapshot->regions[i].start;
+    output_printf("Took snapshot %s of %s: %zu bytes in %zu regions, %zu pages hashed, in %.3f ms\n", name, where, copied,
+                  snapshot->count, snapshot->page_count, (now_ns() - started) / 1e6);
+}
+
+static void list_snapshots() {
+    if (snapshots == NULL) {
+        output_printf("No snapshots taken\n");
+        return;
+    }
+    for (Snapshot* snapshot = snapshots; snapshot != NULL; snapshot = snapshot->next) {
+        output_printf("  %s: %s, %zu regions, %zu pages\n", snapshot->name, snapshot->where, snapshot->count, snapshot->page_count);
+    }
+}
+
+void run_snapshot_command(int argc, char** argv) {
+    if (argc == 0) {
+        list_snapshots();
+        return;
+    }
+    if (argc != 2) {
+        raiseException(1,  "Usage: snapshot [<name> <heap|all|<start>-<end>|library>]\n");
+    }
+    if (strcmp(argv[0], "live") == 0) {
+        raiseException(1,  "Error: live is what diff calls memory as it is now, so it can't name a snapshot\n");
+    }
+    take_snapshot(argv[0], argv[1]);
+}
+
+#ifdef use_dladdr
+static bool starts_symbol(uintptr_t address) {
+    Dl_info info;
+    return dladdr((void*)address, &info) != 0 && info.dli_sname != NULL && (uintptr_t)info.dli_saddr == address;
+}
+#else
+static bool starts_symbol(uintptr_t address) {
+    (void)address;
+    return false;
+}
+#endif
+
+static void print_bytes(const unsigned char* bytes, size_t shown, bool more) {
+    for (size_t i = 0; i < shown; i++) output_printf(i == 0 ? "%02x" : " %02x", bytes[i]);
+    if (more) output_puts(" ..");
+}
+
+static void print_change(DiffState* diff) {
+    size_t length = diff->end - diff->start;
+    diff->ranges++;
+    diff->bytes += length;
+    if (diff->ranges > DIFF_MAX_PRINTED) return;
+    char where[512];
+    describe_memory_address(diff->start, where, sizeof(where));
+    output_printf("%p +%zu (%s): ", (void*)diff->start, length, where);
+    if (length == sizeof(int32_t)) {
+        int32_t old_value, new_value;
+        memcpy(&old_value, diff->old_bytes, sizeof(old_value));
+        memcpy(&new_value, diff->new_bytes, sizeof(new_value));
+        output_printf("int %d -> %d\n", (int)old_value, (int)new_value);
+    } else if (length == sizeof(int64_t)) {
+        int64_t old_value, new_value;
+        memcpy(&old_value, diff->old_bytes, sizeof(old_value));
+        memcpy(&new_value, diff->new_bytes, sizeof(new_value));
+        output_printf("long %lld -> %lld (0x%llx -> 0x%llx)\n", (long long)old_value, (long long)new_value,
+                      (unsigned long long)old_value, (unsigned long long)new_value);
+    } else {
+        size_t shown = length < DIFF_SHOWN_BYTES ? length : DIFF_SHOWN_BYTES;
+        print_bytes(diff->old_bytes, shown, length > shown);
+        output_puts(" -> ");
+        print_bytes(diff->new_bytes, shown, length > shown);
+        output_putc('\n');
+    }
+}
+
+// Adds the changed bytes [start, end), whose old and new values are at old_bytes and new_bytes
+static void add_change(DiffState* diff, uintptr_t start, uintptr_t end, const unsigned char* old_bytes, const unsigned char* new_bytes) {
+    if (diff->pending && (start != diff->end || starts_symbol(start))) {
+        print_change(diff);
+        diff->pending = false;
+    }
+    if (!diff->pending) {
+        diff->pending = true;
+        diff->start = diff->end = start;
+    }
+    for (uintptr_t at = start; at < end && at - diff->start < DIFF_SHOWN_BYTES; at++) {
+        diff->old_bytes[at - diff->start] = old_bytes[at - start];
+        diff->new_bytes[at - diff->start] = new_bytes[at - start];
+    }
+    diff->end = end;
+}
+
+static size_t first_difference(const unsigned char* a, const unsigned char* b, size_t length) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= length; i += 16) {
+        int equal = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)), _mm_loadu_si128((const __m128i*)(b + i))));
+        if (equal != 0xffff) return i + (size_t)__builtin_ctz(~equal & 0xffff);
+    }
+#endif
+    for (; i < length; i++) {
+        if (a[i] != b[i]) return i;
+    }
+    return length;
+}
+
+// Adds the changes between old_bytes and new_bytes, which are what was and is at [start, start + length), each widened
+// to the 4 byte words it touches
+static void compare_bytes(DiffState* diff, uintptr_t start, size_t length, const unsigned char* old_bytes, const unsigned char* new_bytes) {
+    size_t at = 0;
+    while ((at += first_difference(old_bytes + at, new_bytes + at, length - at)) < length) {
+        uintptr_t word = (start + at) & ~(uintptr_t)3;
+        size_t from = word > start ? word - start : 0;
+        size_t to = word + 4 - start < length ? word + 4 - start : length;
+        add_change(diff, start + from, start + to, old_bytes + from, new_bytes + from);
+        at = to;
+    }
+}
+
+// Whether [from, to) is just what region's hash of page covers, so that it can be compared by hash
+static bool is_hashed_piece(const SnapshotRegion* region, uintptr_t page, uintptr_t from, uintptr_t to) {
+    uintptr_t hashed_from = page > region->start ? page : region->start;
+    uintptr_t hashed_to = page + SNAPSHOT_PAGE_SIZE < region->end ? page + SNAPSHOT_PAGE_SIZE : region->end;
+    return from == hashed_from && to == hashed_to;
+}
+
+static uint32_t hash_of(const SnapshotRegion* region, uintptr_t page) {
+    return region->hashes[page / SNAPSHOT_PAGE_SIZE - region->start / SNAPSHOT_PAGE_SIZE];
+}
+
+static size_t compare_overlap(DiffState* diff, const SnapshotRegion* a, const SnapshotRegion* b) {
+    uintptr_t start = a->start > b->start ? a->start : b->start;
+    uintptr_t end = a->end < b->end ? a->end : b->end;
+    for (uintptr_t page = start / SNAPSHOT_PAGE_SIZE * SNAPSHOT_PAGE_SIZE; page < end; page += SNAPSHOT_PAGE_SIZE) {
+        uintptr_t from = page > start ? page : start;
+        uintptr_t to = page + SNAPSHOT_PAGE_SIZE < end ? page + SNAPSHOT_PAGE_SIZE : end;
+        diff->pages++;
+        if (is_hashed_piece(a, page, from, to) && is_hashed_piece(b, page, from, to) && hash_of(a, page) == hash_of(b, page)) {
+            diff->pages_skipped++;
+            continue;
+        }
+        compare_bytes(diff, from, to - from, a->bytes + (from - a->start), b->bytes + (from - b->start));
+    }
+    return end - start;
+}
+
+static size_t snapshot_bytes(const Snapshot* snapshot) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < snapshot->count; i++) bytes += snapshot->regions[i].end - snapshot->regions[i].start;
+    return bytes;
+}
+
+// Returns how many bytes the two have in common, the rest having only been in one or the other
+static size_t diff_snapshots(DiffState* diff, const Snapshot* a, const Snapshot* b) {
+    size_t common = 0, j = 0;
+    for (size_t i = 0; i < a->count; i++) {
+        const SnapshotRegion* region = &a->regions[i];
+        while (j < b->count && b->regions[j].end <= region->start) j++;
+        for (size_t k = j; k < b->count && b->regions[k].start < region->end; k++) {
+            common += compare_overlap(diff, region, &b->regions[k]);
+        }
+    }
+    return common;
+}
+
+static void diff_live(DiffState* diff, const Snapshot* snapshot) {
+    unsigned char live[DIFF_LIVE_CHUNK];
+    for (size_t i = 0; i < snapshot->count; i++) {
+        const SnapshotRegion* region = &snapshot->regions[i];
+        diff->pages += pages_in(region->start, region->end);
+        for (uintptr_t at = region->start; at < region->end;) {
+            uintptr_t chunk_end = (at / DIFF_LIVE_CHUNK + 1) * DIFF_LIVE_CHUNK;
+            if (chunk_end > region->end) chunk_end = region->end;
+            size_t got = read_memory(live, at, chunk_end - at);
+            if (got > 0) {
+                compare_bytes(diff, at, got, region->bytes + (at - region->start), live);
+                at += got;
+                continue;
+            }
+            diff->pages_unreadable++;
+            at = (at / SNAPSHOT_PAGE_SIZE + 1) * SNAPSHOT_PAGE_SIZE;
+        }
+    }
+}
+
+void run_diff_command(int argc, char** argv) {
+    if (argc != 2) {
+        raiseException(1,  "Usage: diff <snapshot> <snapshot|live>\n");
+    }
+    const Snapshot* a = find_snapshot(argv[0]);
+    const Snapshot* b = strcmp(argv[1], "live") == 0 ? NULL : find_snapshot(argv[1]);
+    if (a == NULL || (b == NULL && strcmp(argv[1], "live") != 0)) {
+        raiseException(1,  "Error: There's no snapshot named %s\n", a == NULL ? argv[0] : argv[1]);
+    }
+    uint64_t started = now_ns();
+    DiffState diff = {0};
+    size_t common = b != NULL ? diff_snapshots(&diff, a, b) : 0;
+    if (b == NULL) diff_live(&diff, a);
+    if (diff.pending) print_change(&diff);
+
+    double took_ms = (now_ns() - started) / 1e6;
+    if (diff.ranges > DIFF_MAX_PRINTED) output_printf("(only the first %d ranges are printed)\n", DIFF_MAX_PRINTED);
+    if (b != NULL) {
+        output_printf("%zu bytes changed in %zu range%s, comparing %zu of %zu pages (the rest had the same hash), in %.3f ms\n",
+                      diff.bytes, diff.ranges, diff.ranges == 1 ? "" : "s", diff.pages - diff.pages_skipped, diff.pages, took_ms);
+        size_t only_a = snapshot_bytes(a) - common, only_b = snapshot_bytes(b) - common;
+        if (only_a > 0 || only_b > 0) {
+            output_printf("%zu bytes were only in %s and %zu only in %s\n", only_a, a->name, only_b, b->name);
+        }
+    } else {
+        output_printf("%zu bytes changed in %zu range%s over %zu pages, in %.3f ms\n", diff.bytes, diff.ranges,
+                      diff.ranges == 1 ? "" : "s", diff.pages, took_ms);
+        if (diff.pages_unreadable > 0) output_printf("%zu pages can no longer be read\n", diff.pages_unreadable);
+    }
+}
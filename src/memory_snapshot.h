@@ -0,0 +1,27 @@
+#ifndef MEMORY_SNAPSHOT_H
+#define MEMORY_SNAPSHOT_H
+
+// Finds which bytes a sequence of calls changed:
+//
+//   snapshot [<name> <where>]
+//   diff <name> <name|live>
+//
+// snapshot copies the writable parts of where, which is taken as search takes it (a library being the segments holding
+// its data and bss), and keeps a CRC32C hash of each page of the copy, using the CPU's crc32 instruction where there is
+// that. Without arguments it lists the snapshots taken. The parts that can't be read when the copy is made are left out.
+// diff compares a snapshot with another, or with memory as it is now. Between two snapshots, only the pages whose
+// hashes differ are compared, 16 bytes at a time with SSE2 where there is that; against live memory, every page is.
+// Each change is widened to the 4 byte words it touches, and changes next to each other are printed as one range, unless
+// a symbol starts where the next one does, with the library and symbol (or else the mapping) it's in and what it was
+// and is now: as an int if it's 4 bytes, a long if it's 8, and otherwise as bytes, up to DIFF_SHOWN_BYTES of them.
+// At most DIFF_MAX_PRINTED ranges are printed, the rest only being counted.
+// Snapshots of the heap also see cliffi's own allocations, such as the ones for the command line, change.
+
+#define DIFF_SHOWN_BYTES 16
+#define DIFF_MAX_PRINTED 256
+
+// The REPL commands, given the args after snapshot or diff
+void run_snapshot_command(int argc, char** argv);
+void run_diff_command(int argc, char** argv);
+
+#endif // MEMORY_SNAPSHOT_H
@@ -0,0 +1,433 @@
+#include "number_formatter.h"
+#include <float.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+size_t format_uint64(uint64_t value, char* buffer) {
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    while (value >= 100) { // two digits per division
+        unsigned pair = (unsigned)(value % 100) * 2;
+        value /= 100;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    }
+    if (value >= 10) {
+        unsigned pair = (unsigned)value * 2;
+        *--p = digit_pairs[pair + 1];
+        *--p = digit_pairs[pair];
+    } else {
+        *--p = (char)('0' + value);
+    }
+    size_t length = (size_t)(digits + sizeof(digits) - p);
+    memcpy(buffer, p, length);
+    return length;
+}
+
+size_t format_int64(int64_t value, char* buffer) {
+    if (value < 0) {
+        buffer[0] = '-';
+        return 1 + format_uint64((uint64_t)0 - (uint64_t)value, buffer + 1);
+    }
+    return format_uint64((uint64_t)value, buffer);
+}
+
+// writes significand / 10^fraction_digits in plain decimal notation, always with at least one digit after the point
+static size_t format_fixed_point(bool negative, uint64_t significand, int fraction_digits, char* buffer) {
+    char digits[20];
+    size_t digit_count = format_uint64(significand, digits);
+    char* p = buffer;
+    if (negative) *p++ = '-';
+    if ((int)digit_count <= fraction_digits) { // 0.000ddd
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = 0; i < fraction_digits - (int)digit_count; i++) *p++ = '0';
+        memcpy(p, digits, digit_count);
+        p += digit_count;
+    } else {
+        size_t integer_digits = digit_count - (size_t)fraction_digits;
+        memcpy(p, digits, integer_digits);
+        p += integer_digits;
+        *p++ = '.';
+        if (fraction_digits == 0) {
+            *p++ = '0';
+        } else {
+            memcpy(p, digits + integer_digits, (size_t)fraction_digits);
+            p += fraction_digits;
+        }
+    }
+    return (size_t)(p - buffer);
+}
+
+// snprintf output that reads as an integer (no point, exponent, inf or nan) gets a .0 added
+static size_t add_point_zero_if_integral(char* buffer, size_t length) {
+    if (strpbrk(buffer, ".eEnN") == NULL) {
+        buffer[length++] = '.';
+        buffer[length++] = '0';
+    }
+    return length;
+}
+
+// The fast paths look for the fewest fraction digits k such that value == m / 10^k with m and 10^k both exact,
+// in which case the division is correctly rounded, so m / 10^k in decimal reads back as exactly value.
+// They only apply where arithmetic isn't carried out at higher precision (eg on x87).
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD == 0
+#define use_exact_fast_path
+static const double exact_powers_of_ten[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8,
+                                             1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+static const float exact_powers_of_ten_f[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+#endif
+
+// Grisu3 (Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers", 2010): the value and the
+// boundaries halfway to its neighbours are scaled by a cached power of ten into 64 bit fixed point, and digits are
+// generated from the upper boundary until what's left is within them. That gives the shortest digits, and the closest
+// to the value of those, for all but about 0.5% of values, where it can tell it hasn't, and the snprintf search is
+// the fallback.
+typedef struct {
+    uint64_t f;
+    int e; // the value is f * 2^e
+} DiyFp;
+
+static DiyFp diy_fp_multiply(DiyFp x, DiyFp y) { // the top 64 bits of the 128 bit product, rounded
+    const uint64_t low_32 = 0xFFFFFFFFu;
+    uint64_t a = x.f >> 32, b = x.f & low_32, c = y.f >> 32, d = y.f & low_32;
+    uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+    uint64_t middle = (bd >> 32) + (ad & low_32) + (bc & low_32) + (1u << 31);
+    return (DiyFp){ac + (ad >> 32) + (bc >> 32) + (middle >> 32), x.e + y.e + 64};
+}
+
+static DiyFp diy_fp_normalize(DiyFp x) {
+    while ((x.f & 0xFFC0000000000000ull) == 0) {
+        x.f <<= 10;
+        x.e -= 10;
+    }
+    while ((x.f & 0x8000000000000000ull) == 0) {
+        x.f <<= 1;
+        x.e -= 1;
+    }
+    return x;
+}
+
+// 10^decimal_exponent, rounded to 64 bits, every 8th power from 10^-348 to 10^340
+static const struct {
+    uint64_t significand;
+    int16_t binary_exponent;
+    int16_t decimal_exponent;
+} cached_powers[] = {
+    {0xfa8fd5a0081c0288ull, -1220, -348},
+    {0xbaaee17fa23ebf76ull, -1193, -340},
+    {0x8b16fb203055ac76ull, -1166, -332},
+    {0xcf42894a5dce35eaull, -1140, -324},
+    {0x9a6bb0aa55653b2dull, -1113, -316},
+    {0xe61acf033d1a45dfull, -1087, -308},
+    {0xab70fe17c79ac6caull, -1060, -300},
+    {0xff77b1fcbebcdc4full, -1034, -292},
+    {0xbe5691ef416bd60cull, -1007, -284},
+    {0x8dd01fad907ffc3cull, -980, -276},
+    {0xd3515c2831559a83ull, -954, -268},
+    {0x9d71ac8fada6c9b5ull, -927, -260},
+    {0xea9c227723ee8bcbull, -901, -252},
+    {0xaecc49914078536dull, -874, -244},
+    {0x823c12795db6ce57ull, -847, -236},
+    {0xc21094364dfb5637ull, -821, -228},
+    {0x9096ea6f3848984full, -794, -220},
+    {0xd77485cb25823ac7ull, -768, -212},
+    {0xa086cfcd97bf97f4ull, -741, -204},
+    {0xef340a98172aace5ull, -715, -196},
+    {0xb23867fb2a35b28eull, -688, -188},
+    {0x84c8d4dfd2c63f3bull, -661, -180},
+    {0xc5dd44271ad3cdbaull, -635, -172},
+    {0x936b9fcebb25c996ull, -608, -164},
+    {0xdbac6c247d62a584ull, -582, -156},
+    {0xa3ab66580d5fdaf6ull, -555, -148},
+    {0xf3e2f893dec3f126ull, -529, -140},
+    {0xb5b5ada8aaff80b8ull, -502, -132},
+    {0x87625f056c7c4a8bull, -475, -124},
+    {0xc9bcff6034c13053ull, -449, -116},
+    {0x964e858c91ba2655ull, -422, -108},
+    {0xdff9772470297ebdull, -396, -100},
+    {0xa6dfbd9fb8e5b88full, -369, -92},
+    {0xf8a95fcf88747d94ull, -343, -84},
+    {0xb94470938fa89bcfull, -316, -76},
+    {0x8a08f0f8bf0f156bull, -289, -68},
+    {0xcdb02555653131b6ull, -263, -60},
+    {0x993fe2c6d07b7facull, -236, -52},
+    {0xe45c10c42a2b3b06ull, -210, -44},
+    {0xaa242499697392d3ull, -183, -36},
+    {0xfd87b5f28300ca0eull, -157, -28},
+    {0xbce5086492111aebull, -130, -20},
+    {0x8cbccc096f5088ccull, -103, -12},
+    {0xd1b71758e219652cull, -77, -4},
+    {0x9c40000000000000ull, -50, 4},
+    {0xe8d4a51000000000ull, -24, 12},
+    {0xad78ebc5ac620000ull, 3, 20},
+    {0x813f3978f8940984ull, 30, 28},
+    {0xc097ce7bc90715b3ull, 56, 36},
+    {0x8f7e32ce7bea5c70ull, 83, 44},
+    {0xd5d238a4abe98068ull, 109, 52},
+    {0x9f4f2726179a2245ull, 136, 60},
+    {0xed63a231d4c4fb27ull, 162, 68},
+    {0xb0de65388cc8ada8ull, 189, 76},
+    {0x83c7088e1aab65dbull, 216, 84},
+    {0xc45d1df942711d9aull, 242, 92},
+    {0x924d692ca61be758ull, 269, 100},
+    {0xda01ee641a708deaull, 295, 108},
+    {0xa26da3999aef774aull, 322, 116},
+    {0xf209787bb47d6b85ull, 348, 124},
+    {0xb454e4a179dd1877ull, 375, 132},
+    {0x865b86925b9bc5c2ull, 402, 140},
+    {0xc83553c5c8965d3dull, 428, 148},
+    {0x952ab45cfa97a0b3ull, 455, 156},
+    {0xde469fbd99a05fe3ull, 481, 164},
+    {0xa59bc234db398c25ull, 508, 172},
+    {0xf6c69a72a3989f5cull, 534, 180},
+    {0xb7dcbf5354e9beceull, 561, 188},
+    {0x88fcf317f22241e2ull, 588, 196},
+    {0xcc20ce9bd35c78a5ull, 614, 204},
+    {0x98165af37b2153dfull, 641, 212},
+    {0xe2a0b5dc971f303aull, 667, 220},
+    {0xa8d9d1535ce3b396ull, 694, 228},
+    {0xfb9b7cd9a4a7443cull, 720, 236},
+    {0xbb764c4ca7a44410ull, 747, 244},
+    {0x8bab8eefb6409c1aull, 774, 252},
+    {0xd01fef10a657842cull, 800, 260},
+    {0x9b10a4e5e9913129ull, 827, 268},
+    {0xe7109bfba19c0c9dull, 853, 276},
+    {0xac2820d9623bf429ull, 880, 284},
+    {0x80444b5e7aa7cf85ull, 907, 292},
+    {0xbf21e44003acdd2dull, 933, 300},
+    {0x8e679c2f5e44ff8full, 960, 308},
+    {0xd433179d9c8cb841ull, 986, 316},
+    {0x9e19db92b4e31ba9ull, 1013, 324},
+    {0xeb96bf6ebadf77d9ull, 1039, 332},
+    {0xaf87023b9bf0ee6bull, 1066, 340},
+};
+#define CACHED_POWERS_OFFSET 348
+#define CACHED_POWERS_STEP 8
+// where the scaled value's binary exponent is kept, so its integral part fits in 32 bits and the digits don't overflow
+#define GRISU_MIN_EXPONENT (-60)
+#define GRISU_MAX_EXPONENT (-32)
+
+static const uint32_t small_powers_of_ten[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+// Moves the last digit down while that brings it closer to the value, and then says whether it's certainly the closest
+// and within the boundaries, all the distances being scaled as rest is
+static bool round_weed(char* digits, int length, uint64_t distance_too_high_w, uint64_t unsafe_interval, uint64_t rest,
+                       uint64_t ten_kappa, uint64_t unit) {
+    uint64_t small_distance = distance_too_high_w - unit;
+    uint64_t big_distance = distance_too_high_w + unit;
+    while (rest < small_distance && unsafe_interval - rest >= ten_kappa &&
+           (rest + ten_kappa < small_distance || small_distance - rest >= rest + ten_kappa - small_distance)) {
+        digits[length - 1]--;
+        rest += ten_kappa;
+    }
+    if (rest < big_distance && unsafe_interval - rest >= ten_kappa &&
+        (rest + ten_kappa < big_distance || big_distance - rest > rest + ten_kappa - big_distance)) {
+        return false;
+    }
+    return 2 * unit <= rest && rest <= unsafe_interval - 4 * unit;
+}
+
+// The digits of w (scaled), stopping once they're between low and high, which share its exponent. The value is then
+// digits * 10^kappa
+static bool generate_digits(DiyFp low, DiyFp w, DiyFp high, char* digits, int* length, int* kappa) {
+    uint64_t unit = 1;
+    DiyFp too_low = {low.f - unit, low.e};
+    DiyFp too_high = {high.f + unit, high.e};
+    uint64_t unsafe_interval = too_high.f - too_low.f;
+    int shift = -w.e;
+    uint64_t one = (uint64_t)1 << shift;
+    uint32_t integrals = (uint32_t)(too_high.f >> shift);
+    uint64_t fractionals = too_high.f & (one - 1);
+    int power = 0;
+    while (power < 9 && integrals >= small_powers_of_ten[power + 1]) power++;
+    uint32_t divisor = small_powers_of_ten[power];
+    *kappa = integrals > 0 ? power + 1 : 0;
+    *length = 0;
+    while (*kappa > 0) {
+        digits[(*length)++] = (char)('0' + integrals / divisor);
+        integrals %= divisor;
+        (*kappa)--;
+        uint64_t rest = ((uint64_t)integrals << shift) + fractionals;
+        if (rest < unsafe_interval) {
+            return round_weed(digits, *length, too_high.f - w.f, unsafe_interval, rest, (uint64_t)divisor << shift, unit);
+        }
+        divisor /= 10;
+    }
+    for (;;) { // ends within 18 digits, by when the interval, growing tenfold each time, is past one
+        fractionals *= 10;
+        unit *= 10;
+        unsafe_interval *= 10;
+        digits[(*length)++] = (char)('0' + (fractionals >> shift));
+        fractionals &= one - 1;
+        (*kappa)--;
+        if (fractionals < unsafe_interval) {
+            return round_weed(digits, *length, (too_high.f - w.f) * unit, unsafe_interval, fractionals, one, unit);
+        }
+    }
+}
+
+// The shortest digits of f * 2^e, where lower_closer says its neighbour below is half as far as the one above (as
+// for a power of two). Returns how many there are, with the value being digits * 10^*decimal_exponent, or 0 if
+// Grisu3 can't be sure of them
+static int grisu3(uint64_t f, int e, bool lower_closer, char* digits, int* decimal_exponent) {
+    DiyFp w = diy_fp_normalize((DiyFp){f, e});
+    DiyFp plus = diy_fp_normalize((DiyFp){(f << 1) + 1, e - 1});
+    DiyFp minus = lower_closer ? (DiyFp){(f << 2) - 1, e - 2} : (DiyFp){(f << 1) - 1, e - 1};
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    int min_exponent = GRISU_MIN_EXPONENT - (w.e + 64);
+    int k = (int)ceil((min_exponent + 63) * 0.30102999566398114); // log10(2)
+    int index = (CACHED_POWERS_OFFSET + k - 1) / CACHED_POWERS_STEP + 1;
+    if (index < 0 || index >= (int)(sizeof(cached_powers) / sizeof(cached_powers[0]))) return 0;
+    DiyFp ten_mk = {cached_powers[index].significand, cached_powers[index].binary_exponent};
+    if (ten_mk.e < min_exponent || ten_mk.e > GRISU_MAX_EXPONENT - (w.e + 64)) return 0;
+
+    int length, kappa;
+    if (!generate_digits(diy_fp_multiply(minus, ten_mk), diy_fp_multiply(w, ten_mk), diy_fp_multiply(plus, ten_mk),
+                         digits, &length, &kappa)) {
+        return 0;
+    }
+    while (length > 1 && digits[length - 1] == '0') { // can be left by rounding the last digit down
+        length--;
+        kappa++;
+    }
+    *decimal_exponent = kappa - cached_powers[index].decimal_exponent;
+    return length;
+}
+
+// The digits as %.<precision>g would print them, with a .0 if they'd read as an integer
+static size_t format_digits_as_g(bool negative, const char* digits, int length, int decimal_exponent, int precision, char* buffer) {
+    int exponent = length + decimal_exponent - 1; // of the first digit
+    char* p = buffer;
+    if (negative) *p++ = '-';
+    if (exponent < -4 || exponent >= precision) {
+        *p++ = digits[0];
+        if (length > 1) {
+            *p++ = '.';
+            memcpy(p, digits + 1, (size_t)length - 1);
+            p += length - 1;
+        }
+        *p++ = 'e';
+        *p++ = exponent < 0 ? '-' : '+';
+        unsigned magnitude = (unsigned)(exponent < 0 ? -exponent : exponent);
+        if (magnitude < 10) *p++ = '0';
+        p += format_uint64(magnitude, p);
+    } else if (exponent < 0) {
+        *p++ = '0';
+        *p++ = '.';
+        for (int i = 0; i < -exponent - 1; i++) *p++ = '0';
+        memcpy(p, digits, (size_t)length);
+        p += length;
+    } else {
+        for (int i = 0; i <= exponent; i++) *p++ = i < length ? digits[i] : '0';
+        *p++ = '.';
+        if (length > exponent + 1) {
+            memcpy(p, digits + exponent + 1, (size_t)(length - exponent - 1));
+            p += length - exponent - 1;
+        } else {
+            *p++ = '0';
+        }
+    }
+    return (size_t)(p - buffer);
+}
+
+size_t format_double_shortest(double value, char* buffer) {
+#ifdef use_exact_fast_path
+    const double two_to_the_53 = 9007199254740992.0;
+    double magnitude = fabs(value);
+    if (magnitude < two_to_the_53) { // also false for nan
+        for (int k = 0; k < (int)(sizeof(exact_powers_of_ten) / sizeof(exact_powers_of_ten[0])); k++) {
+            double scaled = magnitude * exact_powers_of_ten[k];
+            if (scaled >= two_to_the_53) break;
+            uint64_t significand = (uint64_t)(scaled + 0.5);
+            if ((double)significand / exact_powers_of_ten[k] == magnitude) {
+                return format_fixed_point(signbit(value), significand, k, buffer);
+            }
+        }
+    }
+#endif
+    // otherwise the shortest digits that round trip, which are at most 17 for a double. They're printed as %g would with
+    // the precision the search below ends at: for normal values anything that round trips with fewer digits also comes
+    // out of %.15g, since %g drops trailing zeros, but subnormals have less precision, so the search for those starts from 1
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biased_exponent = (int)(bits >> 52 & 0x7FF);
+    uint64_t fraction = bits & 0xFFFFFFFFFFFFFull;
+    if (biased_exponent != 0x7FF && (biased_exponent != 0 || fraction != 0)) { // not inf, nan or zero
+        char digits[32];
+        int decimal_exponent;
+        uint64_t f = biased_exponent != 0 ? fraction | (uint64_t)1 << 52 : fraction;
+        int e = (biased_exponent != 0 ? biased_exponent : 1) - 1075;
+        int length = grisu3(f, e, fraction == 0 && biased_exponent > 1, digits, &decimal_exponent);
+        if (length > 0) {
+            int precision = biased_exponent == 0 ? length : length > 15 ? length : 15;
+            return format_digits_as_g(signbit(value), digits, length, decimal_exponent, precision, buffer);
+        }
+    }
+    char formatted[NUMBER_FORMAT_BUFFER_SIZE];
+    int length = 0;
+    for (int precision = fabs(value) < DBL_MIN ? 1 : 15; precision <= 17; precision++) {
+        length = snprintf(formatted, sizeof(formatted) - 2, "%.*g", precision, value);
+        if (precision == 17 || strtod(formatted, NULL) == value || isnan(value)) break;
+    }
+    memcpy(buffer, formatted, (size_t)length + 1);
+    return add_point_zero_if_integral(buffer, (size_t)length);
+}
+
+size_t format_float_shortest(float value, char* buffer) {
+#ifdef use_exact_fast_path
+    const float two_to_the_24 = 16777216.0f;
+    float magnitude = fabsf(value);
+    if (magnitude < two_to_the_24) {
+        for (int k = 0; k < (int)(sizeof(exact_powers_of_ten_f) / sizeof(exact_powers_of_ten_f[0])); k++) {
+            float scaled = magnitude * exact_powers_of_ten_f[k];
+            if (scaled >= two_to_the_24) break;
+            uint32_t significand = (uint32_t)(scaled + 0.5f);
+            if ((float)significand / exact_powers_of_ten_f[k] == magnitude) {
+                return format_fixed_point(signbit(value), significand, k, buffer);
+            }
+        }
+    }
+#endif
+    // at most 9 digits for a float, found as for a double
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    int biased_exponent = (int)(bits >> 23 & 0xFF);
+    uint32_t fraction = bits & 0x7FFFFF;
+    if (biased_exponent != 0xFF && (biased_exponent != 0 || fraction != 0)) {
+        char digits[32];
+        int decimal_exponent;
+        uint64_t f = biased_exponent != 0 ? fraction | (uint32_t)1 << 23 : fraction;
+        int e = (biased_exponent != 0 ? biased_exponent : 1) - 150;
+        int length = grisu3(f, e, fraction == 0 && biased_exponent > 1, digits, &decimal_exponent);
+        if (length > 0) {
+            int precision = biased_exponent == 0 ? length : length > 6 ? length : 6;
+            return format_digits_as_g(signbit(value), digits, length, decimal_exponent, precision, buffer);
+        }
+    }
+    char formatted[NUMBER_FORMAT_BUFFER_SIZE];
+    int length = 0;
+    for (int precision = fabsf(value) < FLT_MIN ? 1 : 6; precision <= 9; precision++) {
+        length = snprintf(formatted, sizeof(formatted) - 2, "%.*g", precision, (double)value);
+        if (precision == 9 || strtof(formatted, NULL) == value || isnan(value)) break;
+    }
+    memcpy(buffer, formatted, (size_t)length + 1);
+    return add_point_zero_if_integral(buffer, (size_t)length);
+}
@@ -0,0 +1,20 @@
+#ifndef NUMBER_FORMATTER_H
+#define NUMBER_FORMATTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Formatting for the hot path of printing results, writing into a caller supplied buffer and returning the length written.
+// Buffers must have room for NUMBER_FORMAT_BUFFER_SIZE characters; none of these null terminate.
+
+#define NUMBER_FORMAT_BUFFER_SIZE 40
+
+size_t format_uint64(uint64_t value, char* buffer);
+size_t format_int64(int64_t value, char* buffer);
+
+// The shortest decimal representation that reads back as exactly the same value.
+// Anything that would otherwise look like an integer gets a trailing .0, eg 3.0, 0.5, 1e+300, nan
+size_t format_double_shortest(double value, char* buffer);
+size_t format_float_shortest(float value, char* buffer);
+
+#endif // NUMBER_FORMATTER_H
@@ -0,0 +1,249 @@
+#include "output_buffer.h"
+#include "exception_handling.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shims.h"
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define use_fd_sinks
+#endif
+
+#define OUTPUT_BUFFER_SIZE (64 * 1024)
+
+static char output_buffer[OUTPUT_BUFFER_SIZE];
+static size_t output_buffer_length = 0;
+static size_t output_bytes_total = 0; // everything ever passed in, flushed or not
+
+static OutputSinkType sink_type = OUTPUT_SINK_TERMINAL;
+#ifdef use_fd_sinks
+static int sink_fd = STDOUT_FILENO;
+#else
+static FILE* sink_file = NULL; // NULL means stdout
+#endif
+
+static bool quiet_mode = false;
+
+static void write_to_sink(const char* data, size_t length) {
+#ifdef use_fd_sinks
+    while (length > 0) {
+        ssize_t written = write(sink_fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return; // nowhere sensible left to report it
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+#else
+    FILE* out = sink_file == NULL ? stdout : sink_file;
+    fwrite(data, 1, length, out);
+    fflush(out);
+#endif
+}
+
+void output_flush() {
+    if (output_buffer_length == 0) return;
+    size_t length = output_buffer_length;
+    output_buffer_length = 0; // reset first so that a fault while writing doesn't make us write it twice
+    write_to_sink(output_buffer, length);
+}
+
+void output_flush_from_signal_handler() {
+#ifdef use_fd_sinks
+    size_t length = output_buffer_length;
+    output_buffer_length = 0;
+    if (length > OUTPUT_BUFFER_SIZE) return; // interrupted mid-update, don't trust it
+    const char* data = output_buffer;
+    while (length > 0) {
+        ssize_t written = write(sink_fd, data, length);
+        if (written <= 0) return;
+        data += written;
+        length -= (size_t)written;
+    }
+#else
+    output_flush();
+#endif
+}
+
+static void output_flush_at_exit() {
+    output_flush();
+}
+
+void output_init() {
+    atexit(output_flush_at_exit);
+}
+
+void output_write(const char* data, size_t length) {
+    output_bytes_total += length;
+    if (output_buffer_length + length > OUTPUT_BUFFER_SIZE) {
+        output_flush();
+        if (length > OUTPUT_BUFFER_SIZE) { // too big to be worth buffering
+            write_to_sink(data, length);
+            return;
+        }
+    }
+    memcpy(output_buffer + output_buffer_length, data, length);
+    output_buffer_length += length;
+}
+
+size_t output_bytes_written() {
+    return output_bytes_total;
+}
+
+void output_puts(const char* str) {
+    output_write(str, strlen(str));
+}
+
+void output_putc(char c) {
+    output_bytes_total++;
+    if (output_buffer_length == OUTPUT_BUFFER_SIZE) output_flush();
+    output_buffer[output_buffer_length++] = c;
+}
+
+void output_printf(const char* formatstr, ...) {
+    va_list args;
+    va_start(args, formatstr);
+    size_t remaining = OUTPUT_BUFFER_SIZE - output_buffer_length;
+    int needed = vsnprintf(output_buffer + output_buffer_length, remaining, formatstr, args);
+    va_end(args);
+    if (needed < 0) return;
+    output_bytes_total += (size_t)needed;
+    if ((size_t)needed < remaining) { // the common case, formatted straight into the buffer
+        output_buffer_length += (size_t)needed;
+        return;
+    }
+
+    output_flush();
+    if ((size_t)needed < OUTPUT_BUFFER_SIZE) {
+        va_start(args, formatstr);
+        vsnprintf(output_buffer, OUTPUT_BUFFER_SIZE, formatstr, args);
+        va_end(args);
+        output_buffer_length = (size_t)needed;
+    } else {
+        char* large;
+        va_start(args, formatstr);
+        int length = vasprintf(&large, formatstr, args);
+        va_end(args);
+        if (length < 0) return;
+        write_to_sink(large, (size_t)length);
+        free(large);
+    }
+}
+
+static void close_current_sink() {
+    output_flush();
+#ifdef use_fd_sinks
+    if (sink_type != OUTPUT_SINK_TERMINAL) close(sink_fd);
+    sink_fd = STDOUT_FILENO;
+#else
+    if (sink_file != NULL) fclose(sink_file);
+    sink_file = NULL;
+#endif
+    sink_type = OUTPUT_SINK_TERMINAL;
+}
+
+void output_set_sink_terminal() {
+    close_current_sink();
+}
+
+void output_set_sink_file(const char* path) {
+    if (path == NULL || strlen(path) == 0) {
+        raiseException(1, "Error: Output file path cannot be empty\n");
+    }
+#ifdef use_fd_sinks
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        raiseException(1, "Error: Could not open output file %s: %s\n", path, strerror(errno));
+    }
+    close_current_sink();
+    sink_fd = fd;
+#else
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        raiseException(1, "Error: Could not open output file %s\n", path);
+    }
+    close_current_sink();
+    sink_file = file;
+#endif
+    sink_type = OUTPUT_SINK_FILE;
+}
+
+void output_set_sink_socket(const char* address) {
+    if (address == NULL || strlen(address) == 0) {
+        raiseException(1, "Error: Output socket address cannot be empty\n");
+    }
+#ifdef use_fd_sinks
+    int fd = -1;
+    if (strchr(address, '/') != NULL) { // a unix domain socket path
+        struct sockaddr_un addr;
+        if (strlen(address) >= sizeof(addr.sun_path)) {
+            raiseException(1, "Error: Unix socket path %s is too long\n", address);
+        }
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, address);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            if (fd >= 0) close(fd);
+            raiseException(1, "Error: Could not connect to unix socket %s: %s\n", address, strerror(errno));
+        }
+    } else { // host:port
+        char* host = strdup(address);
+        char* port = strrchr(host, ':');
+        if (port == NULL) {
+            free(host);
+            raiseException(1, "Error: Socket address %s should be of the form host:port or a unix socket path\n", address);
+        }
+        *port++ = '\0';
+        struct addrinfo hints;
+        struct addrinfo* results;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        int status = getaddrinfo(strlen(host) > 0 ? host : "localhost", port, &hints, &results);
+        free(host);
+        if (status != 0) {
+            raiseException(1, "Error: Could not resolve socket address %s: %s\n", address, gai_strerror(status));
+        }
+        for (struct addrinfo* candidate = results; candidate != NULL; candidate = candidate->ai_next) {
+            fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+            if (fd < 0) continue;
+            if (connect(fd, candidate->ai_addr, candidate->ai_addrlen) == 0) break;
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(results);
+        if (fd < 0) {
+            raiseException(1, "Error: Could not connect to %s\n", address);
+        }
+    }
+    close_current_sink();
+    signal(SIGPIPE, SIG_IGN); // a reader going away should be an error, not kill us
+    sink_fd = fd;
+    sink_type = OUTPUT_SINK_SOCKET;
+#else
+    raiseException(1, "Error: Socket output is not supported on this platform\n");
+#endif
+}
+
+OutputSinkType output_get_sink_type() {
+    return sink_type;
+}
+
+void output_set_quiet(bool quiet) {
+    quiet_mode = quiet;
+}
+
+bool output_is_quiet() {
+    return quiet_mode;
+}
@@ -0,0 +1,39 @@
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// All of cliffi's regular (stdout) output goes through this buffer rather than through printf directly,
+// so that a command's output is written with one syscall at the command boundary instead of one per fragment.
+// Diagnostics still go straight to stderr.
+
+typedef enum {
+    OUTPUT_SINK_TERMINAL, // stdout
+    OUTPUT_SINK_FILE,
+    OUTPUT_SINK_SOCKET,   // tcp host:port or a unix socket path
+} OutputSinkType;
+
+void output_init();
+void output_printf(const char* formatstr, ...);
+void output_write(const char* data, size_t length);
+void output_puts(const char* str); // unlike puts() this does not append a newline
+void output_putc(char c);
+// A running total of everything written so far, for measuring how much a single result has printed
+size_t output_bytes_written();
+
+// Flush points: command boundaries, before handing control to foreign code, and before exiting
+void output_flush();
+// Only uses write(), so it may be called from inside a signal handler
+void output_flush_from_signal_handler();
+
+void output_set_sink_terminal();
+void output_set_sink_file(const char* path);
+void output_set_sink_socket(const char* address);
+OutputSinkType output_get_sink_type();
+
+// In quiet mode the result printing functions skip formatting entirely
+void output_set_quiet(bool quiet);
+bool output_is_quiet();
+
+#endif // OUTPUT_BUFFER_H
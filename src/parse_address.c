@@ -22,10 +22,20 @@ void storeOffsetForLibLoadedAtAddress(void* libhandle, void* address) {
     setVar(varname, getPVar(address));
 }
 
-void* getAddressFromStoredOffsetRelativeToLibLoadedAtAddress(void* libhandle, const char* addressStr) {
+ArgInfo* getStoredOffsetForLibLoadedAtAddress(void* libhandle) {
     char* varname;
     asprintf(&varname, "liboffset_%p", libhandle);
     ArgInfo* offset = getVar(varname);
+    free(varname);
+    return offset;
+}
+
+bool isStoredOffsetVarName(const char* name) {
+    return strncmp(name, "liboffset_", 10) == 0;
+}
+
+void* getAddressFromStoredOffsetRelativeToLibLoadedAtAddress(void* libhandle, const char* addressStr) {
+    ArgInfo* offset = getStoredOffsetForLibLoadedAtAddress(libhandle);
     if (offset == NULL) {
         raiseException(1,  "Error: No offset stored for library loaded at address %p\n. Try again after running calculate_offset.", libhandle);
         return NULL;
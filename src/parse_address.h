@@ -8,5 +8,9 @@ void* getAddressFromAddressStringOrNameOfCoercableVariable(const char* addressSt
 void* tryGetAddressFromAddressStringOrNameOfCoercableVariable(const char* addressStr);
 void* getAddressFromStoredOffsetRelativeToLibLoadedAtAddress(void* libhandle, const char* addressStr);
 void storeOffsetForLibLoadedAtAddress(void* libhandle, void* address);
+// The offset calculate_offset stored for the library, or NULL if there isn't one
+ArgInfo* getStoredOffsetForLibLoadedAtAddress(void* libhandle);
+// Whether a variable name is one of those used to store the offsets
+bool isStoredOffsetVarName(const char* name);
 
 #endif // PARSE_ADDRESS_H
\ No newline at end of file
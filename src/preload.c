@@ -0,0 +1,123 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for readahead
+#endif
+#include "preload.h"
+#include "exception_handling.h"
+#include "library_manager.h"
+#include "library_path_resolver.h"
+#include "output_buffer.h"
+#include "types_and_utils.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PRELOAD_THREADS
+#endif
+
+typedef struct {
+    const char* library_name;
+    char* resolved_path; // NULL if it couldn't be found
+} PreloadedLibrary;
+
+typedef struct {
+    PreloadedLibrary* libraries;
+    size_t count;
+    size_t next; // the next library for a worker to take
+#ifdef PRELOAD_THREADS
+    pthread_mutex_t lock;
+#endif
+} PreloadQueue;
+
+// Gets the file into the page cache, so that dlopen doesn't have to wait for the disk
+static void read_ahead(const char* path) {
+#ifdef PRELOAD_THREADS
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat info;
+    if (fstat(fd, &info) == 0) {
+#if defined(__linux__)
+        readahead(fd, 0, (size_t)info.st_size);
+#elif defined(POSIX_FADV_WILLNEED)
+        posix_fadvise(fd, 0, info.st_size, POSIX_FADV_WILLNEED);
+#endif
+    }
+    close(fd);
+#else
+    (void)path; // Windows reads ahead on its own well enough
+#endif
+}
+
+// On a worker thread, so resolving the path mustn't fall back to dlopen, which would open the library out of order
+static void preload_one(PreloadedLibrary* library) {
+    library->resolved_path = resolve_library_path_without_opening(library->library_name);
+    if (library->resolved_path != NULL) read_ahead(library->resolved_path);
+}
+
+#ifdef PRELOAD_THREADS
+static void* preload_worker(void* arg) {
+    PreloadQueue* queue = arg;
+    while (true) {
+        pthread_mutex_lock(&queue->lock);
+        size_t index = queue->next++;
+        pthread_mutex_unlock(&queue->lock);
+        if (index >= queue->count) return NULL;
+        preload_one(&queue->libraries[index]);
+    }
+}
+#endif
+
+void preload_libraries(int count, char** library_names) {
+    PreloadQueue queue = {.libraries = calloc(count > 0 ? (size_t)count : 1, sizeof(PreloadedLibrary)), .count = (size_t)count, .next = 0};
+    for (int i = 0; i < count; i++) queue.libraries[i].library_name = library_names[i];
+
+    uint64_t started = now_ns();
+    int threads = count < PRELOAD_MAX_THREADS ? (count > 0 ? count : 1) : PRELOAD_MAX_THREADS;
+#ifdef PRELOAD_THREADS
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_t workers[PRELOAD_MAX_THREADS];
+    int started_threads = 0;
+    while (started_threads < threads - 1 && pthread_create(&workers[started_threads], NULL, preload_worker, &queue) == 0) {
+        started_threads++;
+    }
+    preload_worker(&queue); // this thread being one of them, which also takes care of everything if no others could be started
+    for (int i = 0; i < started_threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    pthread_mutex_destroy(&queue.lock);
+    threads = started_threads + 1;
+#else
+    threads = 1;
+    for (int i = 0; i < count; i++) preload_one(&queue.libraries[i]);
+#endif
+    uint64_t read_ahead_ns = now_ns() - started;
+
+    // dlopen takes the loader's lock anyway, so opening them from the threads wouldn't overlap anything more
+    size_t opened = 0;
+    const char* missing = NULL;
+    for (int i = 0; i < count; i++) {
+        PreloadedLibrary* library = &queue.libraries[i];
+        // one only the loader could find is left for here, on this thread, where resolving it can try dlopen
+        if (library->resolved_path == NULL) library->resolved_path = resolve_library_path(library->library_name);
+        if (library->resolved_path == NULL) {
+            if (missing == NULL) missing = library->library_name;
+            continue;
+        }
+        remember_resolved_library_path(library->library_name, library->resolved_path);
+        if (getOrLoadLibrary(library->resolved_path) != NULL) opened++;
+        else if (missing == NULL) missing = library->library_name;
+    }
+    uint64_t elapsed_ns = now_ns() - started;
+    output_printf("Preloaded %zu libraries in %.3f ms: %.3f ms resolving and reading them ahead on %d threads, %.3f ms opening them\n",
+                  opened, elapsed_ns / 1e6, read_ahead_ns / 1e6, threads, (elapsed_ns - read_ahead_ns) / 1e6);
+    for (int i = 0; i < count; i++) free(queue.libraries[i].resolved_path);
+    free(queue.libraries);
+    if (missing != NULL) {
+        raiseException(1,  "Error: Failed to preload %s\n", missing);
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef PRELOAD_H
+#define PRELOAD_H
+
+// Opens a batch of libraries up front, overlapping the disk reads they wait on:
+//
+//   preload <library> [<library>..]    or the global option --preload <library>[,<library>..]
+//
+// Each library's path is resolved, and its file read ahead into the page cache (with readahead, or posix_fadvise
+// where there isn't that), on a thread of its own, up to PRELOAD_MAX_THREADS at once. Then the libraries are opened one
+// after another in the order given, since the dynamic loader serializes that anyway, but by then opening them mostly
+// doesn't have to wait for the disk. Their resolved paths are remembered, so calls naming them don't search again.
+// Only the libraries' own files are read ahead, not those of the libraries they depend on.
+
+#define PRELOAD_MAX_THREADS 16
+
+void preload_libraries(int count, char** library_names);
+
+#endif // PRELOAD_H
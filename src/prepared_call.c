@@ -0,0 +1,94 @@
+#include "prepared_call.h"
+#include "invoke_handler.h"
+#include "library_manager.h"
+#include "main.h"
+#include "var_map.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+struct PreparedCall {
+    FunctionCallInfo* call_info;
+    void* lib_handle;
+    unsigned int lib_load_count; // func is only good while the library stays loaded as it was, not across a reload
+    void* func;
+    PreparedCif* cif; // NULL for calls returning structs, which go through invoke_dynamic_function each time
+    int token_count;
+    ArgInfo** bound_vars; // for each token, the variable it named when the call was prepared, if any
+};
+
+static bool is_direct_arg(const FunctionCallInfo* call_info, const ArgInfo* arg) {
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        if (call_info->info.args[i] == arg) return true;
+    }
+    return false;
+}
+
+static bool is_bound_var(const PreparedCall* prepared, const ArgInfo* arg) {
+    for (int i = 0; i < prepared->token_count; i++) {
+        if (prepared->bound_vars[i] == arg) return true;
+    }
+    return false;
+}
+
+PreparedCall* prepare_call(FunctionCallInfo* call_info, void* lib_handle, void* func, int argc, char** argv) {
+    if (call_info->info.return_var->type == TYPE_STRUCT || getVar(argv[2]) != NULL) {
+        return NULL; // struct returns are rebuilt by every call, and a variable holding the function's address could change
+    }
+
+    PreparedCall* prepared = calloc(1, sizeof(PreparedCall));
+    prepared->call_info = call_info;
+    prepared->lib_handle = lib_handle;
+    prepared->lib_load_count = getLibraryLoadCount(call_info->library_path);
+    prepared->func = func;
+    prepared->token_count = argc;
+    prepared->bound_vars = calloc(argc, sizeof(ArgInfo*));
+
+    bool reusable = true;
+    for (int i = 1; i < argc && reusable; i++) {
+        if (i == 2) continue; // the function name
+        prepared->bound_vars[i] = getVar(argv[i]);
+        if (prepared->bound_vars[i] == NULL) continue;
+        // a variable that was cast to another type was copied into a new arg at parse time, so later changes to it would be missed
+        reusable = i == 1 ? prepared->bound_vars[i] == call_info->info.return_var : is_direct_arg(call_info, prepared->bound_vars[i]);
+    }
+    for (unsigned int i = 0; i < call_info->info.arg_count && reusable; i++) {
+        const ArgInfo* arg = call_info->info.args[i];
+        if (is_bound_var(prepared, arg)) continue;
+        reusable = arg->pointer_depth == 0 && !arg->is_array && arg->type != TYPE_STRING && arg->type != TYPE_STRUCT;
+    }
+    if (!reusable) {
+        free_prepared_call(prepared);
+        return NULL;
+    }
+    prepared->cif = prepare_cif(call_info);
+    return prepared;
+}
+
+bool prepared_call_matches(const PreparedCall* prepared, int argc, char** argv) {
+    if (argc != prepared->token_count) return false;
+    for (int i = 1; i < argc; i++) {
+        if (i != 2 && getVar(argv[i]) != prepared->bound_vars[i]) return false;
+    }
+    return getOrLoadLibrary(prepared->call_info->library_path) == prepared->lib_handle &&
+           getLibraryLoadCount(prepared->call_info->library_path) == prepared->lib_load_count;
+}
+
+int invoke_prepared_call(PreparedCall* prepared) {
+    log_function_call_info(prepared->call_info);
+    int invoke_result = prepared->cif != NULL ? invoke_prepared_cif(prepared->call_info, prepared->cif, prepared->func)
+                                              : invoke_dynamic_function(prepared->call_info, prepared->func);
+    if (invoke_result != 0) {
+        fprintf(stderr, "Error: Function invocation failed\n");
+    } else {
+        setLastCall(prepared->call_info);
+        print_function_return(prepared->call_info);
+    }
+    return invoke_result;
+}
+
+void free_prepared_call(PreparedCall* prepared) {
+    if (prepared == NULL) return;
+    free_prepared_cif(prepared->cif);
+    free(prepared->bound_vars);
+    free(prepared); // the call_info is left alone, as everywhere else, since its values may still be referenced
+}
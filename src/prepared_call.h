@@ -0,0 +1,24 @@
+#ifndef PREPARED_CALL_H
+#define PREPARED_CALL_H
+
+#include "types_and_utils.h"
+
+// A function call that has been parsed, had its library and symbol looked up and its call interface prepared, so that
+// running the same command again (eg in a loop) goes straight to the call.
+// Only calls whose literal args are plain scalars can be prepared, since the callee could change anything else between calls.
+// Args that name variables are bound to the variables themselves, so they pick up new values as the variables change.
+typedef struct PreparedCall PreparedCall;
+
+// Returns NULL if the call can't be reused, in which case it has to be parsed afresh each time
+PreparedCall* prepare_call(FunctionCallInfo* call_info, void* lib_handle, void* func, int argc, char** argv);
+
+// Whether the command's tokens (the same ones it was prepared from) still mean the same call, ie the library is still
+// loaded (and hasn't been reloaded since) and each token names the same variable, or lack of one, as before
+bool prepared_call_matches(const PreparedCall* prepared, int argc, char** argv);
+
+// Invokes the call and prints its results, like invoke_and_print_return_value
+int invoke_prepared_call(PreparedCall* prepared);
+
+void free_prepared_call(PreparedCall* prepared);
+
+#endif // PREPARED_CALL_H
@@ -0,0 +1,757 @@
+#include "record_replay.h"
+#include "exception_handling.h"
+#include "invoke_handler.h"
+#include "library_manager.h"
+#include "library_path_resolver.h"
+#include "main.h"
+#include "output_buffer.h"
+#include "return_formatter.h"
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#endif
+
+// A recording is written in the host's own byte order, like compiled scripts:
+//   "CLIFFIR" magic, u32 version
+// followed by entries that each start with a u8 kind:
+//   'L' a library: u32 id, path, u32 identity length, identity bytes (as from library_identity)
+//   'C' a call: u32 library id, symbol, u64 ns since the recording started, u64 ns the call took, then the signature
+//       (i32 vararg start, u32 arg count, u8 return type, and a u8 type and u8 shape for each arg), a buffer for each
+//       arg's value, one for the return value unless it's void, and one more for each string, pointer or array arg as
+//       it was after the call
+// where strings are a u32 length followed by the bytes and a null, and buffers are a u64 full length (all ones for
+// NULL), a u32 length of how much of it was kept, and that many bytes.
+
+#define RECORDING_MAGIC "CLIFFIR"
+#define RECORDING_VERSION 1
+#define RECORD_CALL 'C'
+#define RECORD_LIBRARY 'L'
+#define NULL_BUFFER UINT64_MAX
+#define MAX_PRINTED_DIVERGENCES 10
+
+typedef enum {
+    SHAPE_UNSUPPORTED = -1,
+    SHAPE_VALUE = 0,   // passed as it is, which for strings means the characters are recorded
+    SHAPE_POINTER = 1, // a pointer to a single value
+    SHAPE_ARRAY = 2,   // a flat array of values
+} ArgShape;
+
+typedef struct {
+    unsigned char* data;
+    size_t length;
+    size_t capacity;
+} ByteBuffer;
+
+typedef struct {
+    FILE* file;
+    char* path;
+    size_t max_buffer;
+    uint64_t started_ns;
+    char** libraries; // the index of each is its id in the recording
+    size_t library_count;
+    ByteBuffer pending; // the entry for the call in progress, as far as it was captured before the call
+    bool pending_ok;
+    uint64_t call_started_ns;
+    size_t recorded;
+    size_t left_out;
+} Recorder;
+
+static Recorder recorder;
+
+static void buffer_append(ByteBuffer* buffer, const void* data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        size_t capacity = buffer->capacity > 0 ? buffer->capacity : 256;
+        while (capacity < buffer->length + length) capacity *= 2;
+        unsigned char* grown = realloc(buffer->data, capacity);
+        if (grown == NULL) raiseException(1,  "Failed to allocate memory for the recording.\n");
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+static void buffer_u8(ByteBuffer* buffer, uint8_t value) { buffer_append(buffer, &value, sizeof(value)); }
+static void buffer_u32(ByteBuffer* buffer, uint32_t value) { buffer_append(buffer, &value, sizeof(value)); }
+static void buffer_u64(ByteBuffer* buffer, uint64_t value) { buffer_append(buffer, &value, sizeof(value)); }
+
+static void buffer_string(ByteBuffer* buffer, const char* str) {
+    uint32_t length = (uint32_t)strlen(str);
+    buffer_u32(buffer, length);
+    buffer_append(buffer, str, (size_t)length + 1);
+}
+
+static void buffer_memory(ByteBuffer* buffer, const void* memory, uint64_t length, size_t max_kept) {
+    if (memory == NULL) {
+        buffer_u64(buffer, NULL_BUFFER);
+        buffer_u32(buffer, 0);
+        return;
+    }
+    uint32_t kept = (uint32_t)(length < max_kept ? length : max_kept);
+    buffer_u64(buffer, length);
+    buffer_u32(buffer, kept);
+    buffer_append(buffer, memory, kept);
+}
+
+static ArgShape arg_shape(const ArgInfo* arg) {
+    if (arg->type == TYPE_STRUCT) return SHAPE_UNSUPPORTED;
+    if (arg->is_array) {
+        bool flat = arg->pointer_depth == 0 && arg->array_value_pointer_depth == 0 && arg->type != TYPE_STRING && arg->type != TYPE_VOIDPOINTER;
+        return flat ? SHAPE_ARRAY : SHAPE_UNSUPPORTED;
+    }
+    if (arg->pointer_depth == 0) return SHAPE_VALUE;
+    return arg->pointer_depth == 1 && arg->type != TYPE_STRING ? SHAPE_POINTER : SHAPE_UNSUPPORTED;
+}
+
+// whether the callee could change what the arg refers to, so that it's recorded again after the call
+static bool is_kept_after_call(char type, ArgShape shape) {
+    return shape != SHAPE_VALUE || type == TYPE_STRING;
+}
+
+// The memory that's recorded for an arg: the value itself, a string's characters, or what a pointer or array points to
+static const void* arg_memory(const ArgInfo* arg, ArgShape shape, uint64_t* length) {
+    if (shape == SHAPE_VALUE && arg->type != TYPE_STRING) {
+        *length = typeToSize(arg->type, 0);
+        return arg->value;
+    }
+    if (shape == SHAPE_VALUE) {
+        const char* str = arg->value->str_val;
+        *length = str != NULL ? strlen(str) + 1 : 0;
+        return str;
+    }
+    *length = typeToSize(arg->type, 0) * (shape == SHAPE_ARRAY ? get_size_for_arginfo_sized_array(arg) : 1);
+    return arg->value->ptr_val;
+}
+
+static void buffer_arg(ByteBuffer* buffer, const ArgInfo* arg, ArgShape shape) {
+    uint64_t length;
+    const void* memory = arg_memory(arg, shape, &length);
+    buffer_memory(buffer, memory, length, recorder.max_buffer);
+}
+
+static void finish_recording_at_exit() {
+    stop_recording(false);
+}
+
+void start_recording(const char* path, size_t max_buffer) {
+    static bool registered_at_exit = false;
+    if (recorder.file != NULL) stop_recording(true);
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        raiseException(1,  "Error: Could not open %s to record calls to\n", path);
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    fwrite(RECORDING_MAGIC, 1, sizeof(RECORDING_MAGIC), file);
+    uint32_t version = RECORDING_VERSION;
+    fwrite(&version, sizeof(version), 1, file);
+    fflush(file); // so that a process forked from this one (as by --repltest) doesn't write the header out again
+
+    recorder.file = file;
+    recorder.path = strdup(path);
+    recorder.max_buffer = max_buffer;
+    recorder.recorded = 0;
+    recorder.left_out = 0;
+    recorder.pending_ok = false;
+    recorder.started_ns = now_ns();
+    if (!registered_at_exit) {
+        atexit(finish_recording_at_exit);
+        registered_at_exit = true;
+    }
+}
+
+void stop_recording(bool print_summary) {
+    if (recorder.file == NULL) return;
+    fclose(recorder.file);
+    recorder.file = NULL;
+    if (print_summary) {
+        output_printf("Recorded %zu calls to %s", recorder.recorded, recorder.path);
+        if (recorder.left_out > 0) {
+            output_printf(" (%zu more involved structs or nested pointers and were left out)", recorder.left_out);
+        }
+        output_printf("\n");
+    }
+    for (size_t i = 0; i < recorder.library_count; i++) free(recorder.libraries[i]);
+    free(recorder.libraries);
+    free(recorder.pending.data);
+    free(recorder.path);
+    memset(&recorder, 0, sizeof(recorder));
+}
+
+bool is_recording() {
+    return recorder.file != NULL;
+}
+
+static uint32_t recorded_library_id(const char* path) {
+    for (size_t i = 0; i < recorder.library_count; i++) {
+        if (strcmp(recorder.libraries[i], path) == 0) return (uint32_t)i;
+    }
+    char** grown = realloc(recorder.libraries, (recorder.library_count + 1) * sizeof(char*));
+    if (grown == NULL) raiseException(1,  "Failed to allocate memory for the recording.\n");
+    recorder.libraries = grown;
+    uint32_t id = (uint32_t)recorder.library_count++;
+    recorder.libraries[id] = strdup(path);
+
+    unsigned char identity[MAX_LIBRARY_IDENTITY];
+    uint32_t identity_length = (uint32_t)library_identity(path, identity);
+    ByteBuffer entry = {0};
+    buffer_u8(&entry, RECORD_LIBRARY);
+    buffer_u32(&entry, id);
+    buffer_string(&entry, path);
+    buffer_u32(&entry, identity_length);
+    buffer_append(&entry, identity, identity_length);
+    fwrite(entry.data, 1, entry.length, recorder.file);
+    free(entry.data);
+    return id;
+}
+
+void record_call_before(const FunctionCallInfo* call_info) {
+    ByteBuffer* pending = &recorder.pending;
+    pending->length = 0;
+    recorder.pending_ok = false;
+
+    const ArgInfo* return_var = call_info->info.return_var;
+    if (return_var->type == TYPE_STRUCT || return_var->pointer_depth > 0 || return_var->is_array) {
+        recorder.left_out++;
+        return;
+    }
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        if (arg_shape(call_info->info.args[i]) == SHAPE_UNSUPPORTED) {
+            recorder.left_out++;
+            return;
+        }
+    }
+
+    buffer_u32(pending, (uint32_t)(int32_t)call_info->info.vararg_start);
+    buffer_u32(pending, call_info->info.arg_count);
+    buffer_u8(pending, (uint8_t)return_var->type);
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        buffer_u8(pending, (uint8_t)call_info->info.args[i]->type);
+        buffer_u8(pending, (uint8_t)arg_shape(call_info->info.args[i]));
+    }
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        buffer_arg(pending, call_info->info.args[i], arg_shape(call_info->info.args[i]));
+    }
+    recorder.pending_ok = true;
+    recorder.call_started_ns = now_ns(); // last, so that capturing the args isn't counted
+}
+
+void record_call_after(const FunctionCallInfo* call_info) {
+    uint64_t finished = now_ns();
+    if (!recorder.pending_ok) return;
+    recorder.pending_ok = false;
+
+    ByteBuffer* pending = &recorder.pending;
+    if (call_info->info.return_var->type != TYPE_VOID) {
+        buffer_arg(pending, call_info->info.return_var, SHAPE_VALUE);
+    }
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        const ArgInfo* arg = call_info->info.args[i];
+        ArgShape shape = arg_shape(arg);
+        if (is_kept_after_call((char)arg->type, shape)) buffer_arg(pending, arg, shape);
+    }
+
+    uint32_t library = recorded_library_id(call_info->library_path);
+    ByteBuffer header = {0};
+    buffer_u8(&header, RECORD_CALL);
+    buffer_u32(&header, library);
+    buffer_string(&header, call_info->function_name);
+    buffer_u64(&header, recorder.call_started_ns - recorder.started_ns);
+    buffer_u64(&header, finished - recorder.call_started_ns);
+    fwrite(header.data, 1, header.length, recorder.file);
+    fwrite(pending->data, 1, pending->length, recorder.file);
+    free(header.data);
+    recorder.recorded++;
+}
+
+typedef struct {
+    const unsigned char* position;
+    const unsigned char* end;
+    bool ok;
+} RecordingReader;
+
+typedef struct {
+    bool is_null;
+    uint64_t length;
+    uint32_t kept;
+    const unsigned char* bytes;
+} RecordedBuffer;
+
+static bool read_bytes(RecordingReader* reader, void* out, size_t length) {
+    if (!reader->ok || (size_t)(reader->end - reader->position) < length) return reader->ok = false;
+    memcpy(out, reader->position, length);
+    reader->position += length;
+    return true;
+}
+
+static uint8_t read_u8(RecordingReader* reader) {
+    uint8_t value = 0;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static uint32_t read_u32(RecordingReader* reader) {
+    uint32_t value = 0;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static uint64_t read_u64(RecordingReader* reader) {
+    uint64_t value = 0;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+// returns the string where it lies in the recording
+static const char* read_string(RecordingReader* reader) {
+    uint32_t length = read_u32(reader);
+    if (!reader->ok || (size_t)(reader->end - reader->position) <= length || reader->position[length] != '\0') {
+        reader->ok = false;
+        return "";
+    }
+    const char* str = (const char*)reader->position;
+    reader->position += (size_t)length + 1;
+    return str;
+}
+
+static RecordedBuffer read_buffer(RecordingReader* reader) {
+    RecordedBuffer buffer = {false, 0, 0, NULL};
+    buffer.length = read_u64(reader);
+    buffer.kept = read_u32(reader);
+    buffer.is_null = buffer.length == NULL_BUFFER;
+    if (!reader->ok || buffer.kept > buffer.length || (size_t)(reader->end - reader->position) < buffer.kept) {
+        reader->ok = false;
+        return buffer;
+    }
+    buffer.bytes = reader->position;
+    reader->position += buffer.kept;
+    return buffer;
+}
+
+typedef struct {
+    const char* path;
+    void* handle;
+} ReplayLibrary;
+
+// The calls to one function with one signature, which share the function's address and call interface
+typedef struct {
+    uint32_t library;
+    const char* symbol;
+    const unsigned char* signature;
+    size_t signature_length;
+    void* func;
+    PreparedCif* cif;
+    bool takes_addresses;
+    size_t calls;
+    uint64_t recorded_ns;
+    uint64_t replayed_ns;
+} ReplayTarget;
+
+typedef struct {
+    size_t target;
+    FunctionCallInfo call_info;
+    void** values;
+    RecordedBuffer recorded_return;
+    RecordedBuffer* recorded_after; // for each arg, where is_kept_after_call
+    uint64_t offset_ns;
+    uint64_t duration_ns;
+} ReplayCall;
+
+typedef struct {
+    unsigned char* data;
+    ReplayLibrary* libraries;
+    size_t library_count;
+    ReplayTarget* targets;
+    size_t target_count;
+    ReplayCall* calls;
+    size_t call_count;
+} Replay;
+
+static void* replay_alloc(size_t size) {
+    void* memory = calloc(1, size > 0 ? size : 1);
+    if (memory == NULL) raiseException(1,  "Failed to allocate memory for the replay.\n");
+    return memory;
+}
+
+static void* replay_grow(void* array, size_t count, size_t element_size) {
+    if (count != 0 && (count < 16 || (count & (count - 1)) != 0)) return array; // it's grown to 16, then doubled each time it fills
+    void* grown = realloc(array, (count > 0 ? count * 2 : 16) * element_size);
+    if (grown == NULL) raiseException(1,  "Failed to allocate memory for the replay.\n");
+    return grown;
+}
+
+// An arg holding the recorded value, with buffers of its own for what it points to
+static ArgInfo* make_replay_arg(char type, ArgShape shape, const RecordedBuffer* recorded) {
+    ArgInfo* arg = replay_alloc(sizeof(ArgInfo));
+    arg->type = (ArgType)type;
+    arg->explicitType = true;
+    arg->value = replay_alloc(sizeof(*arg->value));
+    if (recorded == NULL) return arg; // a return value, yet to be filled in
+    if (shape == SHAPE_VALUE && type != TYPE_STRING) {
+        memcpy(arg->value, recorded->bytes, recorded->kept < sizeof(*arg->value) ? recorded->kept : sizeof(*arg->value));
+        return arg;
+    }
+    void* memory = NULL;
+    if (!recorded->is_null) {
+        memory = replay_alloc((size_t)recorded->length); // anything past what was kept is left zeroed
+        memcpy(memory, recorded->bytes, recorded->kept);
+    }
+    arg->value->ptr_val = memory;
+    if (shape == SHAPE_POINTER) arg->pointer_depth = 1;
+    if (shape == SHAPE_ARRAY) {
+        arg->is_array = ARRAY_STATIC_SIZE;
+        arg->static_or_implied_size = (size_t)recorded->length / typeToSize(arg->type, 0);
+    }
+    return arg;
+}
+
+static size_t find_or_add_target(Replay* replay, uint32_t library, const char* symbol, const unsigned char* signature, size_t signature_length, size_t last) {
+    for (size_t i = replay->target_count > 0 ? last : 0, checked = 0; checked < replay->target_count; i = (i + 1) % replay->target_count, checked++) {
+        ReplayTarget* target = &replay->targets[i];
+        if (target->library == library && target->signature_length == signature_length && strcmp(target->symbol, symbol) == 0 &&
+            memcmp(target->signature, signature, signature_length) == 0) {
+            return i;
+        }
+    }
+    replay->targets = replay_grow(replay->targets, replay->target_count, sizeof(ReplayTarget));
+    ReplayTarget* target = &replay->targets[replay->target_count];
+    memset(target, 0, sizeof(*target));
+    target->library = library;
+    target->symbol = symbol;
+    target->signature = signature;
+    target->signature_length = signature_length;
+    return replay->target_count++;
+}
+
+static void read_call(Replay* replay, RecordingReader* reader, size_t* last_target) {
+    uint32_t library = read_u32(reader);
+    const char* symbol = read_string(reader);
+    replay->calls = replay_grow(replay->calls, replay->call_count, sizeof(ReplayCall));
+    ReplayCall* call = &replay->calls[replay->call_count];
+    memset(call, 0, sizeof(*call));
+    call->offset_ns = read_u64(reader);
+    call->duration_ns = read_u64(reader);
+
+    const unsigned char* signature = reader->position;
+    call->call_info.info.vararg_start = (int32_t)read_u32(reader);
+    uint32_t arg_count = read_u32(reader);
+    char return_type = (char)read_u8(reader);
+    if (!reader->ok || library >= replay->library_count || (size_t)(reader->end - reader->position) < (size_t)arg_count * 2) {
+        reader->ok = false;
+        return;
+    }
+    const unsigned char* arg_types = reader->position;
+    reader->position += (size_t)arg_count * 2;
+
+    FunctionCallInfo* call_info = &call->call_info;
+    call_info->library_path = (char*)replay->libraries[library].path;
+    call_info->function_name = (char*)symbol;
+    call_info->info.arg_count = arg_count;
+    call_info->info.args = replay_alloc(arg_count * sizeof(ArgInfo*));
+    call_info->info.return_var = make_replay_arg(return_type, SHAPE_VALUE, NULL);
+    call->values = replay_alloc(arg_count * sizeof(void*));
+    call->recorded_after = replay_alloc(arg_count * sizeof(RecordedBuffer));
+    bool takes_addresses = false;
+    for (uint32_t i = 0; i < arg_count && reader->ok; i++) {
+        char type = (char)arg_types[i * 2];
+        ArgShape shape = (ArgShape)arg_types[i * 2 + 1];
+        if (shape > SHAPE_ARRAY || (shape != SHAPE_VALUE && typeToSize((ArgType)type, 0) == 0)) {
+            reader->ok = false;
+            return;
+        }
+        RecordedBuffer recorded = read_buffer(reader);
+        call_info->info.args[i] = make_replay_arg(type, shape, &recorded);
+        call->values[i] = call_info->info.args[i]->value;
+        takes_addresses |= type == TYPE_VOIDPOINTER && shape == SHAPE_VALUE;
+    }
+    if (return_type != TYPE_VOID) call->recorded_return = read_buffer(reader);
+    for (uint32_t i = 0; i < arg_count && reader->ok; i++) {
+        if (is_kept_after_call((char)arg_types[i * 2], (ArgShape)arg_types[i * 2 + 1])) call->recorded_after[i] = read_buffer(reader);
+    }
+    if (!reader->ok) return;
+
+    call->target = *last_target = find_or_add_target(replay, library, symbol, signature, (size_t)(arg_types + (size_t)arg_count * 2 - signature), *last_target);
+    ReplayTarget* target = &replay->targets[call->target];
+    if (target->func == NULL && !target->takes_addresses) {
+        target->takes_addresses = takes_addresses;
+        if (!takes_addresses) {
+            target->func = loadFunctionHandle(replay->libraries[library].handle, symbol);
+            target->cif = prepare_cif(call_info);
+        }
+    }
+    replay->call_count++;
+}
+
+static void read_library(Replay* replay, RecordingReader* reader) {
+    uint32_t id = read_u32(reader);
+    const char* path = read_string(reader);
+    uint32_t identity_length = read_u32(reader);
+    unsigned char recorded[MAX_LIBRARY_IDENTITY];
+    if (!reader->ok || id != replay->library_count || identity_length > MAX_LIBRARY_IDENTITY || !read_bytes(reader, recorded, identity_length)) {
+        reader->ok = false;
+        return;
+    }
+    unsigned char current[MAX_LIBRARY_IDENTITY];
+    if (library_identity(path, current) != identity_length || memcmp(recorded, current, identity_length) != 0) {
+        output_printf("Note: %s has changed since the recording was made\n", path);
+    }
+    replay->libraries = replay_grow(replay->libraries, replay->library_count, sizeof(ReplayLibrary));
+    ReplayLibrary* library = &replay->libraries[replay->library_count++];
+    library->path = path;
+    library->handle = getOrLoadLibrary(path);
+    if (library->handle == NULL) {
+        raiseException(1,  "Failed to load library: %s\n", path);
+    }
+}
+
+static unsigned char* read_whole_file(const char* path, size_t* length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    size_t capacity = 1 << 16;
+    size_t used = 0;
+    unsigned char* data = malloc(capacity);
+    size_t got;
+    while (data != NULL && (got = fread(data + used, 1, capacity - used, file)) > 0) {
+        used += got;
+        if (used == capacity) data = realloc(data, capacity *= 2);
+    }
+    fclose(file);
+    if (data == NULL) raiseException(1,  "Failed to allocate memory for the replay.\n");
+    *length = used;
+    return data;
+}
+
+// Goes through the whole recording in replay->data up front, with each call's args made ready to pass, so that
+// replaying it is only the calls
+static void parse_recording(Replay* replay, size_t length, const char* name) {
+    RecordingReader reader = {replay->data, replay->data + length, true};
+    char magic[sizeof(RECORDING_MAGIC)];
+    if (!read_bytes(&reader, magic, sizeof(magic)) || memcmp(magic, RECORDING_MAGIC, sizeof(magic)) != 0 || read_u32(&reader) != RECORDING_VERSION) {
+        raiseException(1,  "Error: %s isn't a cliffi recording\n", name);
+    }
+    size_t last_target = 0;
+    while (reader.ok && reader.position < reader.end) {
+        uint8_t kind = read_u8(&reader);
+        if (kind == RECORD_LIBRARY) {
+            read_library(replay, &reader);
+        } else if (kind == RECORD_CALL) {
+            read_call(replay, &reader, &last_target);
+        } else {
+            reader.ok = false;
+        }
+    }
+    if (!reader.ok) {
+        raiseException(1,  "Error: Recording %s is corrupt after its first %zu calls\n", name, replay->call_count);
+    }
+}
+
+static void load_recording(Replay* replay, const char* path) {
+    size_t length;
+    replay->data = read_whole_file(path, &length);
+    if (replay->data == NULL) {
+        raiseException(1,  "Error: Could not read recording %s\n", path);
+    }
+    parse_recording(replay, length, path);
+}
+
+// Where the replayed memory first differs from the recorded, or -1 if it doesn't (as far as it was kept)
+static int64_t first_difference(const void* memory, uint64_t length, const RecordedBuffer* recorded) {
+    if (memory == NULL || recorded->is_null) return (memory == NULL) == recorded->is_null ? -1 : 0;
+    uint64_t compared = recorded->kept < length ? recorded->kept : length;
+    const unsigned char* bytes = memory;
+    for (uint64_t i = 0; i < compared; i++) {
+        if (bytes[i] != recorded->bytes[i]) return (int64_t)i;
+    }
+    return length == recorded->length ? -1 : (int64_t)compared;
+}
+
+// Returns whether the call did what it did when recorded, printing how it didn't if print is set
+static bool verify_call(const ReplayCall* call, size_t index, bool print) {
+    const FunctionCallInfo* call_info = &call->call_info;
+    const ArgInfo* return_var = call_info->info.return_var;
+    bool matches = true;
+    if (return_var->type != TYPE_VOID && return_var->type != TYPE_VOIDPOINTER) { // returned addresses are bound to differ
+        uint64_t length;
+        const void* memory = arg_memory(return_var, SHAPE_VALUE, &length);
+        if (first_difference(memory, length, &call->recorded_return) >= 0) {
+            matches = false;
+            if (print) {
+                ArgInfo* recorded = make_replay_arg((char)return_var->type, SHAPE_VALUE, &call->recorded_return);
+                output_printf("Call %zu to %s returned ", index + 1, call_info->function_name);
+                format_and_print_arg_value(return_var);
+                output_printf(" but ");
+                format_and_print_arg_value(recorded);
+                output_printf(" when recorded\n");
+                if (recorded->type == TYPE_STRING) free(recorded->value->str_val);
+                free(recorded->value);
+                free(recorded);
+            }
+        }
+    }
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        const ArgInfo* arg = call_info->info.args[i];
+        ArgShape shape = arg->is_array ? SHAPE_ARRAY : arg->pointer_depth > 0 ? SHAPE_POINTER : SHAPE_VALUE;
+        if (!is_kept_after_call((char)arg->type, shape)) continue;
+        uint64_t length;
+        const void* memory = arg_memory(arg, shape, &length);
+        int64_t difference = first_difference(memory, length, &call->recorded_after[i]);
+        if (difference >= 0) {
+            matches = false;
+            if (print) {
+                output_printf("Call %zu to %s left arg %u different from the recording, from byte %" PRId64 "\n", index + 1, call_info->function_name, i, difference);
+            }
+        }
+    }
+    return matches;
+}
+
+static void wait_until(uint64_t deadline_ns) {
+    uint64_t now;
+    while ((now = now_ns()) < deadline_ns) {
+        uint64_t remaining = deadline_ns - now;
+        if (remaining < 2000000) continue; // sleeps can overshoot, so the last stretch is spun out
+        uint64_t sleep_ns = remaining - 1000000;
+#if defined(_WIN32) || defined(_WIN64)
+        Sleep((DWORD)(sleep_ns / 1000000));
+#else
+        struct timespec pause = {(time_t)(sleep_ns / 1000000000u), (long)(sleep_ns % 1000000000u)};
+        nanosleep(&pause, NULL);
+#endif
+    }
+}
+
+static void print_replay_summary(const Replay* replay, size_t replayed, size_t skipped, size_t divergences, bool verify, uint64_t elapsed_ns) {
+    uint64_t recorded_ns = 0;
+    uint64_t replayed_ns = 0;
+    for (size_t i = 0; i < replay->target_count; i++) {
+        recorded_ns += replay->targets[i].recorded_ns;
+        replayed_ns += replay->targets[i].replayed_ns;
+    }
+    output_printf("Replayed %zu calls in %.3f ms, %.3f ms of it in the calls themselves (recorded: %.3f ms)\n", replayed, elapsed_ns / 1e6,
+                  replayed_ns / 1e6, recorded_ns / 1e6);
+    if (skipped > 0) {
+        output_printf("Skipped %zu calls that take P addresses, which only meant something to the recording process\n", skipped);
+    }
+    if (verify) {
+        if (divergences == 0) {
+            output_printf("Every call matched the recording\n");
+        } else {
+            output_printf("%zu calls diverged from the recording\n", divergences);
+        }
+    }
+    output_printf("Time per call, recorded -> replayed:\n");
+    for (size_t i = 0; i < replay->target_count; i++) {
+        const ReplayTarget* target = &replay->targets[i];
+        if (target->calls == 0) continue;
+        double recorded_mean = (double)target->recorded_ns / target->calls;
+        double replayed_mean = (double)target->replayed_ns / target->calls;
+        output_printf("  %-24s %8zu calls %12.1f ns -> %12.1f ns", target->symbol, target->calls, recorded_mean, replayed_mean);
+        if (recorded_mean > 0) output_printf("  %+.1f%%", (replayed_mean - recorded_mean) * 100 / recorded_mean);
+        output_printf("\n");
+    }
+}
+
+void run_replay(const char* path, bool paced, bool verify) {
+    Replay replay = {0};
+    load_recording(&replay, path);
+
+    size_t replayed = 0;
+    size_t skipped = 0;
+    size_t divergences = 0;
+    output_flush(); // anything the functions print should come after what we've printed so far
+    setCodeSectionForSegfaultHandler("run_replay:ffi_call");
+    uint64_t started = now_ns();
+    for (size_t i = 0; i < replay.call_count; i++) {
+        ReplayCall* call = &replay.calls[i];
+        ReplayTarget* target = &replay.targets[call->target];
+        if (target->takes_addresses) {
+            skipped++;
+            continue;
+        }
+        if (paced) wait_until(started + call->offset_ns);
+        uint64_t call_started = now_ns();
+        call_prepared_cif(&call->call_info, target->cif, target->func, call->values);
+        target->replayed_ns += now_ns() - call_started;
+        target->recorded_ns += call->duration_ns;
+        target->calls++;
+        replayed++;
+        if (verify && !verify_call(call, i, divergences < MAX_PRINTED_DIVERGENCES)) {
+            divergences++;
+        }
+    }
+    uint64_t elapsed = now_ns() - started;
+    unsetCodeSectionForSegfaultHandler();
+    if (divergences > MAX_PRINTED_DIVERGENCES) {
+        output_printf("(only the first %d divergences are shown)\n", MAX_PRINTED_DIVERGENCES);
+    }
+    print_replay_summary(&replay, replayed, skipped, divergences, verify, elapsed);
+    // the args, and the recording their names point into, are left alone like any other call's, as strings the
+    // functions returned may point into them
+}
+
+unsigned char* copy_recording_so_far(size_t* length) {
+    if (recorder.file == NULL) return NULL;
+    fflush(recorder.file);
+    unsigned char* data = read_whole_file(recorder.path, length);
+    if (data == NULL) {
+        raiseException(1,  "Error: Could not read back the recording %s\n", recorder.path);
+    }
+    return data;
+}
+
+size_t replay_recording_data(unsigned char* data, size_t length, const char* name) {
+    Replay replay = {0};
+    replay.data = data;
+    parse_recording(&replay, length, name);
+    output_flush();
+    setCodeSectionForSegfaultHandler("replay_recording_data:ffi_call");
+    size_t replayed = 0;
+    for (size_t i = 0; i < replay.call_count; i++) {
+        ReplayCall* call = &replay.calls[i];
+        ReplayTarget* target = &replay.targets[call->target];
+        if (target->takes_addresses) continue;
+        call_prepared_cif(&call->call_info, target->cif, target->func, call->values);
+        replayed++;
+    }
+    unsetCodeSectionForSegfaultHandler();
+    return replayed;
+}
+
+void run_record_command(int argc, char** argv) {
+    if (argc == 1 && strcmp(argv[0], "off") == 0) {
+        if (!is_recording()) raiseException(1,  "Error: Calls aren't being recorded\n");
+        stop_recording(true);
+        return;
+    }
+    size_t max_buffer = RECORD_DEFAULT_MAX_BUFFER;
+    if (argc == 3 && strcmp(argv[1], "--max-buffer") == 0) {
+        char* end;
+        max_buffer = (size_t)strtoull(argv[2], &end, 10);
+        if (*end != '\0' || argv[2][0] == '-') raiseException(1,  "Error: --max-buffer takes a number of bytes, not %s\n", argv[2]);
+    } else if (argc != 1) {
+        raiseException(1,  "Usage: record <file> [--max-buffer <n>] | record off\n");
+    }
+    start_recording(argv[0], max_buffer);
+    output_printf("Recording calls to %s\n", argv[0]);
+}
+
+void run_replay_command(int argc, char** argv) {
+    bool paced = false;
+    bool verify = true;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--paced") == 0) {
+            paced = true;
+        } else if (strcmp(argv[i], "--no-verify") == 0) {
+            verify = false;
+        } else {
+            raiseException(1,  "Usage: replay <file> [--paced] [--no-verify]\n");
+        }
+    }
+    if (argc < 1) raiseException(1,  "Usage: replay <file> [--paced] [--no-verify]\n");
+    run_replay(argv[0], paced, verify);
+}
@@ -0,0 +1,50 @@
+#ifndef RECORD_REPLAY_H
+#define RECORD_REPLAY_H
+
+#include "types_and_utils.h"
+#include <stdbool.h>
+
+// Recording logs every function call made from the command line, REPL or a script to a file, compactly: the library
+// (with its build-id), the symbol and signature, the bytes of each arg including what pointer, array and string args
+// point to (up to a limit per buffer), the return value, what the pointed-to buffers held afterwards, and how long the
+// call took.
+//
+//   record <file> [--max-buffer <n>]    or the global option --record <file>
+//   record off
+//
+// Replaying re-runs the recorded calls in-process, as fast as possible or with --paced at the pace they were recorded,
+// without any of the parsing or printing in between, and reports where the returns or buffers differ from the
+// recording, and how each function's time per call compares with the recorded one. That makes a workload recorded
+// against one build of a library into a benchmark for the next.
+//
+//   replay <file> [--paced] [--no-verify]    or cliffi --replay <file> [--paced] [--no-verify]
+//
+// Calls involving structs, pointers to pointers or arrays of pointers are left out of recordings, and calls taking raw
+// P addresses are skipped on replay, since the addresses mean nothing to another process. Calls made by stream and map
+// aren't recorded.
+
+#define RECORD_DEFAULT_MAX_BUFFER (64 * 1024) // bytes kept of each buffer an arg points to
+
+void start_recording(const char* path, size_t max_buffer);
+void stop_recording(bool print_summary);
+bool is_recording();
+
+// Called around ffi_call by invoke_handler: before captures the args and starts the clock, after stops it and logs the call
+void record_call_before(const FunctionCallInfo* call_info);
+void record_call_after(const FunctionCallInfo* call_info);
+
+void run_replay(const char* path, bool paced, bool verify);
+
+// The bytes of a recording of the calls recorded so far (which the caller frees), or NULL if nothing is being recorded
+unsigned char* copy_recording_so_far(size_t* length);
+
+// Runs the calls in a recording held in memory, without checking or timing them, eg to get libraries back into the
+// state they were in when it was recorded. Takes ownership of data, since the calls' args may point into it.
+// Returns the number of calls made.
+size_t replay_recording_data(unsigned char* data, size_t length, const char* name);
+
+// The REPL commands, given the args after record or replay
+void run_record_command(int argc, char** argv);
+void run_replay_command(int argc, char** argv);
+
+#endif // RECORD_REPLAY_H
@@ -6,76 +6,455 @@
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <math.h>
 #include "exception_handling.h"
+#include "output_buffer.h"
+#include "number_formatter.h"
+#include "array_stats.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define use_sse2_escape_scan
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define use_neon_escape_scan
+#endif
 
 
 void print_char_with_escape(char c) {
     switch (c) {
         case '\0':
-            printf("\\0");
+            output_puts("\\0");
             break;
         case '\n':
-            printf("\\n");
+            output_puts("\\n");
             break;
         case '\r':
-            printf("\\r");
+            output_puts("\\r");
             break;
         case '\t':
-            printf("\\t");
+            output_puts("\\t");
             break;
         case '\\':
-            printf("\\\\");
+            output_puts("\\\\");
             break;
         default:
-            if (isprint(c)) {
-                printf("%c", c);
+            if (isprint((unsigned char)c)) {
+                output_putc(c);
             } else {
-                printf("\\x%02x", c);
+                output_printf("\\x%02x", (unsigned char)c);
             }
             break;
     }
 }
 
+static inline bool char_needs_escape(unsigned char c) {
+    return c < 0x20 || c >= 0x7f || c == '\\';
+}
+
+// returns the index of the first character print_char_with_escape would escape, or length if there isn't one
+static size_t find_char_needing_escape(const char *buffer, size_t length) {
+    size_t i = 0;
+#if defined(use_sse2_escape_scan)
+    for (; i + 16 <= length; i += 16) {
+        const __m128i chars = _mm_loadu_si128((const __m128i *)(buffer + i));
+        // as signed bytes, everything from 0x80 up is negative, so one less-than covers both control and high characters
+        const __m128i needs_escape = _mm_or_si128(_mm_cmplt_epi8(chars, _mm_set1_epi8(0x20)),
+                                                  _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8(0x7f)), _mm_cmpeq_epi8(chars, _mm_set1_epi8('\\'))));
+        int mask = _mm_movemask_epi8(needs_escape);
+        if (mask != 0) {
+            size_t offset = 0;
+            while (!(mask & 1)) {
+                mask >>= 1;
+                offset++;
+            }
+            return i + offset;
+        }
+    }
+#elif defined(use_neon_escape_scan)
+    for (; i + 16 <= length; i += 16) {
+        const uint8x16_t chars = vld1q_u8((const uint8_t *)buffer + i);
+        const uint8x16_t needs_escape = vorrq_u8(vorrq_u8(vcltq_u8(chars, vdupq_n_u8(0x20)), vcgeq_u8(chars, vdupq_n_u8(0x7f))),
+                                                 vceqq_u8(chars, vdupq_n_u8('\\')));
+        if (vmaxvq_u8(needs_escape) != 0) break; // let the scalar loop find exactly where
+    }
+#endif
+    for (; i < length; i++) {
+        if (char_needs_escape((unsigned char)buffer[i])) break;
+    }
+    return i;
+}
+
 void print_char_buffer(const char *buffer, size_t length) {
-    for (size_t i = 0; i < length; i++) {
-        unsigned char c = buffer[i];
-        print_char_with_escape(c);
+    size_t i = 0;
+    while (i < length) {
+        size_t run = find_char_needing_escape(buffer + i, length - i);
+        output_write(buffer + i, run); // the plain run goes out in one piece
+        i += run;
+        if (i < length) print_char_with_escape(buffer[i++]);
     }
 }
 
-void hexdump(const void *data, size_t size) {
-    const unsigned char *byte = (const unsigned char *)data;
+// rows of 16 bytes for [start, end), with offsets relative to byte
+static void print_hexdump_rows(const unsigned char *byte, size_t start, size_t end, bool multiline) {
     size_t i, j;
-    bool multiline = size > 16;
-    if (multiline) printf("(Hexvalue)\nOffset\n");
-
-    for (i = 0; i < size; i += 16) {
-        if (multiline) printf("%08zx  ", i); // Offset
+    for (i = start; i < end; i += 16) {
+        if (multiline) output_printf("%08zx  ", i); // Offset
 
         // Hex bytes
         for (j = 0; j < 16; j++) {
-            if (j==8) printf(" "); // Add space between the two halves of the hexdump
-            if (i + j < size) {
-                printf("%02x ", byte[i + j]);
+            if (j==8) output_puts(" "); // Add space between the two halves of the hexdump
+            if (i + j < end) {
+                output_printf("%02x ", byte[i + j]);
             } else {
-                 if (multiline) printf("   "); // Fill space if less than 16 bytes in the line
+                 if (multiline) output_puts("   "); // Fill space if less than 16 bytes in the line
             }
         }
 
-        if (multiline) printf(" ");
-        if (!multiline) printf("= ");
+        if (multiline) output_puts(" ");
+        if (!multiline) output_puts("= ");
 
         // ASCII characters
         for (j = 0; j < 16; j++) {
-            if (i + j < size) {
-                printf("%c", isprint(byte[i + j]) ? byte[i + j] : '.');
+            if (i + j < end) {
+                output_putc(isprint(byte[i + j]) ? byte[i + j] : '.');
+            }
+        }
+
+        output_puts("\n");
+    }
+}
+
+void hexdump(const void *data, size_t size) {
+    bool multiline = size > 16;
+    if (multiline) output_puts("(Hexvalue)\nOffset\n");
+    print_hexdump_rows((const unsigned char *)data, 0, size, multiline);
+}
+
+
+// formats element offset of an array of a numeric type into buffer (which needs NUMBER_FORMAT_BUFFER_SIZE bytes), returning the length
+static inline size_t format_numeric_value(const void* values, ArgType type, size_t offset, char* buffer) {
+    switch (type) {
+        case TYPE_SHORT: return format_int64(((const short*)values)[offset], buffer);
+        case TYPE_INT: return format_int64(((const int*)values)[offset], buffer);
+        case TYPE_LONG: return format_int64(((const long*)values)[offset], buffer);
+        case TYPE_UCHAR: return format_uint64(((const unsigned char*)values)[offset], buffer);
+        case TYPE_USHORT: return format_uint64(((const unsigned short*)values)[offset], buffer);
+        case TYPE_UINT: return format_uint64(((const unsigned int*)values)[offset], buffer);
+        case TYPE_ULONG: return format_uint64(((const unsigned long*)values)[offset], buffer);
+        case TYPE_FLOAT: return format_float_shortest(((const float*)values)[offset], buffer);
+        case TYPE_DOUBLE: return format_double_shortest(((const double*)values)[offset], buffer);
+        default: return 0;
+    }
+}
+
+static bool is_numeric_type(ArgType type) {
+    switch (type) {
+        case TYPE_SHORT: case TYPE_INT: case TYPE_LONG:
+        case TYPE_UCHAR: case TYPE_USHORT: case TYPE_UINT: case TYPE_ULONG:
+        case TYPE_FLOAT: case TYPE_DOUBLE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static OutputLimits output_limits = {0, 0, 0};
+
+void set_output_limits(OutputLimits limits) {
+    output_limits = limits;
+}
+
+OutputLimits get_output_limits() {
+    return output_limits;
+}
+
+// State for the value currently being printed, reset by each top level call to format_and_print_arg_value
+static size_t result_byte_limit = 0; // 0 when unbounded, as it is for paging
+static size_t result_start_bytes = 0;
+static bool result_truncated = false;
+
+static size_t result_bytes_remaining(size_t pending) {
+    if (result_byte_limit == 0) return SIZE_MAX;
+    size_t used = output_bytes_written() + pending - result_start_bytes;
+    return used >= result_byte_limit ? 0 : result_byte_limit - used;
+}
+
+// How a flat array is laid out when printed
+typedef enum {
+    ARRAY_AS_CHARS,    // char, as one escaped string
+    ARRAY_AS_HEXDUMP,  // unsigned char
+    ARRAY_AS_NUMBERS,  // the other numeric types, formatted in chunks
+    ARRAY_AS_VALUES,   // everything else, one print_arg_value per element
+} ArrayLayout;
+
+static ArrayLayout array_layout(ArgType type, int pointer_depth) {
+    if (pointer_depth == 0) {
+        if (type == TYPE_CHAR) return ARRAY_AS_CHARS;
+        if (type == TYPE_UCHAR) return ARRAY_AS_HEXDUMP;
+        if (is_numeric_type(type)) return ARRAY_AS_NUMBERS;
+    }
+    return ARRAY_AS_VALUES;
+}
+
+// The last array that wasn't printed in full, which the page command continues from. It's left where it was printed,
+// until keep_elided_array is told its memory may go away, when the elements not yet paged through are copied
+static struct {
+    const void* values; // NULL when there isn't one
+    void* kept; // the copy of elements first.. once there is one, which values then points to
+    size_t first;
+    ArgType type;
+    int pointer_depth;
+    size_t count;
+    size_t next;
+    bool of_pointers; // it was an array of pointers, which went away since they can't be copied with what they point to
+} last_elided_array = {NULL, NULL, 0, TYPE_VOID, 0, 0, 0, false};
+
+static void forget_elided_array() {
+    if (last_elided_array.kept != NULL && last_elided_array.type == TYPE_STRING) {
+        for (size_t i = 0; i < last_elided_array.count - last_elided_array.first; i++) free(((char**)last_elided_array.kept)[i]);
+    }
+    free(last_elided_array.kept);
+    last_elided_array.values = NULL;
+    last_elided_array.kept = NULL;
+    last_elided_array.first = 0;
+    last_elided_array.of_pointers = false;
+}
+
+static void remember_elided_array(const void* values, ArgType type, int pointer_depth, size_t count, size_t next) {
+    forget_elided_array();
+    last_elided_array.values = values;
+    last_elided_array.type = type;
+    last_elided_array.pointer_depth = pointer_depth;
+    last_elided_array.count = count;
+    last_elided_array.next = next;
+}
+
+void keep_elided_array() {
+    if (last_elided_array.values == NULL || last_elided_array.kept != NULL) return;
+    if (last_elided_array.pointer_depth > 0) {
+        forget_elided_array();
+        last_elided_array.of_pointers = true;
+        return;
+    }
+    size_t element_size = typeToSize(last_elided_array.type, 0);
+    size_t first = last_elided_array.next < last_elided_array.count ? last_elided_array.next : last_elided_array.count;
+    if (array_layout(last_elided_array.type, 0) == ARRAY_AS_HEXDUMP) first = first / 16 * 16; // whole rows
+    size_t size = (last_elided_array.count - first) * element_size;
+    void* kept = malloc(size > 0 ? size : 1);
+    if (kept == NULL) {
+        forget_elided_array();
+        return;
+    }
+    memcpy(kept, (const char*)last_elided_array.values + first * element_size, size);
+    if (last_elided_array.type == TYPE_STRING) {
+        for (size_t i = 0; i < last_elided_array.count - first; i++) {
+            char* string = ((char**)kept)[i];
+            ((char**)kept)[i] = string != NULL ? strdup(string) : NULL;
+        }
+    }
+    last_elided_array.kept = kept;
+    last_elided_array.first = first;
+    // indexed as the whole array was, so that the elements (and hexdump offsets) keep their numbers
+    last_elided_array.values = (const void*)((uintptr_t)kept - first * element_size);
+}
+
+// v, v, .. for elements [start, end) of a flat array of a numeric type, formatted in chunks rather than going through print_arg_value per element.
+// Returns where it stopped, which is before end if the result ran out of bytes.
+static size_t print_numeric_elements(const void* values, ArgType type, size_t start, size_t end) {
+    char chunk[4096];
+    size_t used = 0;
+    size_t element_size = typeToSize(type, 0);
+    bool aligned = (uintptr_t)values % element_size == 0;
+    union { long l; double d; } aligned_copy; // big enough for any numeric type
+    size_t i;
+    for (i = start; i < end; i++) {
+        if (result_bytes_remaining(used) == 0) break;
+        if (used + NUMBER_FORMAT_BUFFER_SIZE + 2 > sizeof(chunk)) {
+            output_write(chunk, used);
+            used = 0;
+        }
+        if (i > start) {
+            chunk[used++] = ',';
+            chunk[used++] = ' ';
+        }
+        if (aligned) {
+            used += format_numeric_value(values, type, i, chunk + used);
+        } else { // bugfix for architectures that throw a bus error when trying to read from an unaligned address
+            memcpy(&aligned_copy, (const char*)values + i * element_size, element_size);
+            used += format_numeric_value(&aligned_copy, type, 0, chunk + used);
+        }
+    }
+    output_write(chunk, used);
+    return i;
+}
+
+static void print_hexdump_rows(const unsigned char* byte, size_t start, size_t end, bool multiline);
+void print_arg_value(const void* value, ArgType type, size_t offset, int pointer_depth);
+
+// prints elements [start, end) in the array's layout, without any surrounding braces, and returns where it stopped
+static size_t print_array_elements(const void* values, ArgType type, int pointer_depth, size_t start, size_t end, size_t total_count) {
+    size_t i = start;
+    switch (array_layout(type, pointer_depth)) {
+        case ARRAY_AS_CHARS: {
+            size_t remaining = result_bytes_remaining(0);
+            i = end - start > remaining ? start + remaining : end;
+            print_char_buffer((const char*)values + start, i - start);
+            break;
+        }
+        case ARRAY_AS_HEXDUMP:
+            for (; i < end && result_bytes_remaining(0) > 0; i = i + 16 < end ? i + 16 : end) {
+                print_hexdump_rows((const unsigned char*)values, i, i + 16 < end ? i + 16 : end, total_count > 16);
             }
+            break;
+        case ARRAY_AS_NUMBERS:
+            i = print_numeric_elements(values, type, start, end);
+            break;
+        case ARRAY_AS_VALUES:
+            for (; i < end && result_bytes_remaining(0) > 0; i++) {
+                if (i > start) output_puts(", ");
+                print_arg_value(values, type, i, pointer_depth);
+            }
+            break;
+    }
+    return i;
+}
+
+static void print_stat_value(NumericStatValue value, ArgType type) {
+    char formatted[NUMBER_FORMAT_BUFFER_SIZE];
+    size_t length;
+    switch (type) {
+        case TYPE_SHORT: case TYPE_INT: case TYPE_LONG: length = format_int64(value.i, formatted); break;
+        case TYPE_FLOAT: case TYPE_DOUBLE: length = format_double_shortest(value.d, formatted); break;
+        default: length = format_uint64(value.u, formatted); break;
+    }
+    output_write(formatted, length);
+}
+
+// a summary line for numeric arrays that weren't printed in full
+static void print_numeric_array_stats(const void* values, ArgType type, size_t count) {
+    NumericArrayStats stats = compute_numeric_array_stats(values, type, count);
+    char formatted[NUMBER_FORMAT_BUFFER_SIZE];
+    output_printf("(count=%zu, min=", stats.count);
+    print_stat_value(stats.min, type);
+    output_puts(", max=");
+    print_stat_value(stats.max, type);
+    output_puts(", sum=");
+    if (type != TYPE_FLOAT && type != TYPE_DOUBLE && fabs(stats.sum) < 9223372036854775808.0) { // integer sums read better without the .0
+        output_write(formatted, format_int64((int64_t)stats.sum, formatted));
+    } else {
+        output_write(formatted, format_double_shortest(stats.sum, formatted));
+    }
+    if (type == TYPE_FLOAT || type == TYPE_DOUBLE) output_printf(", nans=%zu", stats.nan_count);
+    output_puts(")");
+}
+
+// Prints a whole flat array, keeping to the output limits: past max_elems only the head and tail are printed,
+// and past max_bytes the rest is cut off. Either way the array is remembered for paging, and numeric arrays get a summary.
+static void print_array(const void* values, ArgType type, int pointer_depth, size_t count) {
+    ArrayLayout layout = array_layout(type, pointer_depth);
+    size_t head_end = count;
+    size_t tail_start = count;
+    if (output_limits.max_elems != 0 && count > output_limits.max_elems) {
+        head_end = (output_limits.max_elems + 1) / 2;
+        tail_start = count - output_limits.max_elems / 2;
+        if (layout == ARRAY_AS_HEXDUMP) { // whole rows, so the offsets still line up
+            head_end = (head_end + 15) / 16 * 16;
+            tail_start = tail_start / 16 * 16;
+            if (tail_start <= head_end) head_end = tail_start = count;
         }
+    }
 
-        printf("\n");
+    bool braces = layout == ARRAY_AS_NUMBERS || layout == ARRAY_AS_VALUES;
+    if (layout == ARRAY_AS_HEXDUMP && count > 16) output_puts("(Hexvalue)\nOffset\n");
+    if (braces) output_puts("{ ");
+    size_t reached = print_array_elements(values, type, pointer_depth, 0, head_end, count);
+    bool truncated = reached < head_end;
+    if (truncated) {
+        remember_elided_array(values, type, pointer_depth, count, reached);
+    } else if (head_end < count) {
+        size_t skipped = tail_start - head_end;
+        if (layout == ARRAY_AS_HEXDUMP) {
+            output_printf("... %zu more bytes ...\n", skipped);
+        } else if (layout == ARRAY_AS_CHARS) {
+            output_printf("[... %zu more ...]", skipped);
+        } else {
+            output_printf(", ... %zu more ...", skipped);
+        }
+        remember_elided_array(values, type, pointer_depth, count, head_end);
+        if (tail_start < count && braces && result_bytes_remaining(0) > 0) output_puts(", ");
+        truncated = print_array_elements(values, type, pointer_depth, tail_start, count, count) < count;
+    }
+    if (truncated) {
+        output_printf("%s... (truncated at %zu bytes)", layout == ARRAY_AS_HEXDUMP ? "" : " ", result_byte_limit);
+        result_truncated = true;
+    }
+    if (braces) output_puts(" }");
+    if ((truncated || head_end < count) && layout != ARRAY_AS_VALUES && layout != ARRAY_AS_CHARS) {
+        if (layout != ARRAY_AS_HEXDUMP) output_puts(" ");
+        print_numeric_array_stats(values, type, count);
     }
 }
 
+void print_array_slice(const void* values, ArgType type, size_t start, size_t end, size_t max_elems) {
+    ArrayLayout layout = array_layout(type, 0);
+    if (layout == ARRAY_AS_HEXDUMP) layout = ARRAY_AS_NUMBERS; // a few bytes read better inline
+    size_t head_end = end;
+    size_t tail_start = end;
+    if (max_elems != 0 && end - start > max_elems) {
+        head_end = start + (max_elems + 1) / 2;
+        tail_start = end - max_elems / 2;
+    }
+    result_byte_limit = 0;
+    output_puts(layout == ARRAY_AS_CHARS ? "\"" : "{ ");
+    if (layout == ARRAY_AS_NUMBERS) {
+        print_numeric_elements(values, type, start, head_end);
+    } else {
+        print_array_elements(values, type, 0, start, head_end, end);
+    }
+    if (head_end < end) {
+        output_printf(layout == ARRAY_AS_CHARS ? "[... %zu more ...]" : ", ... %zu more ...", tail_start - head_end);
+        if (layout != ARRAY_AS_CHARS && tail_start < end) output_puts(", ");
+        if (layout == ARRAY_AS_NUMBERS) {
+            print_numeric_elements(values, type, tail_start, end);
+        } else {
+            print_array_elements(values, type, 0, tail_start, end, end);
+        }
+    }
+    output_puts(layout == ARRAY_AS_CHARS ? "\"" : " }");
+}
+
+void page_last_elided_array(bool has_start, size_t start, size_t count) {
+    if (last_elided_array.of_pointers) {
+        raiseException(1,  "Error: The last result was an array of pointers into a library that has since been closed\n");
+    }
+    if (last_elided_array.values == NULL) {
+        raiseException(1,  "Error: There is no partially printed result to page through\n");
+    }
+    if (!has_start) {
+        start = last_elided_array.next;
+        if (start >= last_elided_array.count) {
+            raiseException(1,  "Error: Already at the end of the last result, use page <start> [count] to go back\n");
+        }
+    } else if (start >= last_elided_array.count) {
+        raiseException(1,  "Error: Start %zu is past the end of the last result, which has %zu elements\n", start, last_elided_array.count);
+    }
+    if (start < last_elided_array.first) {
+        raiseException(1,  "Error: Only elements %zu on of the last result were kept when a library was closed\n", last_elided_array.first);
+    }
+    if (count == 0) count = output_limits.max_elems != 0 ? output_limits.max_elems : 100;
+    size_t end = count > last_elided_array.count - start ? last_elided_array.count : start + count;
+
+    result_byte_limit = 0;
+    ArrayLayout layout = array_layout(last_elided_array.type, last_elided_array.pointer_depth);
+    bool braces = layout == ARRAY_AS_NUMBERS || layout == ARRAY_AS_VALUES;
+    output_printf("Elements %zu to %zu of %zu:%s", start, end - 1, last_elided_array.count, layout == ARRAY_AS_HEXDUMP ? "\n" : " ");
+    if (braces) output_puts("{ ");
+    print_array_elements(last_elided_array.values, last_elided_array.type, last_elided_array.pointer_depth, start, end, last_elided_array.count);
+    if (braces) output_puts(" }");
+    if (layout != ARRAY_AS_HEXDUMP) output_puts("\n");
+    last_elided_array.next = end;
+}
 
     void print_arg_value(const void* value, ArgType type, size_t offset, int pointer_depth) {
     if (pointer_depth > 0) {
@@ -83,7 +462,7 @@ void hexdump(const void *data, size_t size) {
         for (int j = 0; j < pointer_depth; j++) {
             value = *(void**)value;
             if (value == NULL) {
-                printf("(NULL pointer)");
+                output_puts("(NULL pointer)");
                 return;
             }
         }
@@ -108,54 +487,43 @@ void hexdump(const void *data, size_t size) {
             print_char_with_escape(((char*)value)[offset]);
             break;
         case TYPE_SHORT:
-            printf("%hd", ((short*)value)[offset]);
-            break;
         case TYPE_INT:
-            printf("%d", ((int*)value)[offset]);
-            break;
         case TYPE_LONG:
-            printf("%ld", ((long*)value)[offset]);
-            break;
         case TYPE_UCHAR:
-            printf("%u",  ((unsigned char*)value)[offset]);
-            break;
         case TYPE_USHORT:
-            printf("%hu", ((unsigned short*)value)[offset]);
-            break;
         case TYPE_UINT:
-            printf("%u", ((unsigned int*)value)[offset]);
-            break;
         case TYPE_ULONG:
-            printf("%lu", ((unsigned long*)value)[offset]);
-            break;
         case TYPE_FLOAT:
-            printf("%f", ((float*)value)[offset]);
-            break;
-        case TYPE_DOUBLE:
-            printf("%lf", ((double*)value)[offset]);
+        case TYPE_DOUBLE: {
+            char formatted[NUMBER_FORMAT_BUFFER_SIZE];
+            output_write(formatted, format_numeric_value(value, type, offset, formatted));
             break;
-        case TYPE_STRING:
-            printf("\"");
-            print_char_buffer(((char**)value)[offset], strlen(((char**)value)[offset]));
-            printf("\"");
+        }
+        case TYPE_STRING: {
+            size_t length = strlen(((char**)value)[offset]);
+            size_t remaining = result_bytes_remaining(0);
+            output_puts("\"");
+            print_char_buffer(((char**)value)[offset], length > remaining ? remaining : length);
+            output_puts(length > remaining ? "...\"" : "\"");
             break;
+        }
         case TYPE_VOIDPOINTER:
             // #define HEX_DIGITS (int)(2 * sizeof(void*))
-            // printf("0x%0*" PRIxPTR, HEX_DIGITS,(uintptr_t)((void**)value)[offset]);
-            printf("0x%" PRIxPTR, (uintptr_t)((void**)value)[offset]);
+            // output_printf("0x%0*" PRIxPTR, HEX_DIGITS,(uintptr_t)((void**)value)[offset]);
+            output_printf("0x%" PRIxPTR, (uintptr_t)((void**)value)[offset]);
             break;
         case TYPE_POINTER:
             raiseException(1,  "Should not be printing pointer values directly");
         case TYPE_VOID:
-            printf("(void)");
+            output_puts("(void)");
             break;
         case TYPE_STRUCT:
             raiseException(1,  "Should not be printing struct values directly");
         case TYPE_BOOL:
-            printf("%s", ((bool*)value)[offset] ? "true" : "false");
+            output_printf("%s", ((bool*)value)[offset] ? "true" : "false");
             break;
         default:
-            printf("Unsupported type");
+            output_puts("Unsupported type");
             break;
     }
     if (alligned_copy != NULL) {
@@ -163,30 +531,46 @@ void hexdump(const void *data, size_t size) {
     }
 }
 
-    void format_and_print_arg_type(const ArgInfo* arg) {
+    // writes the same type description format_and_print_arg_type prints into buffer, truncating if needed, and returns its length
+    size_t format_arg_type(const ArgInfo* arg, char* buffer, size_t buffer_size) {
+        size_t length = 0;
+        #define APPEND_TYPE_PART(...) \
+            do { \
+                int written = snprintf(buffer + length, length < buffer_size ? buffer_size - length : 0, __VA_ARGS__); \
+                if (written > 0) length += (size_t)written; \
+            } while (0)
         if (!arg->is_array) {
-        printf("%s", typeToString(arg->type));
-        for (int i = 0; i < arg->pointer_depth; i++) {
-            printf("*");
-        }} else { // is an array
-            printf("%s ", typeToString(arg->type));
+            APPEND_TYPE_PART("%s", typeToString(arg->type));
+            for (int i = 0; i < arg->pointer_depth; i++) {
+                APPEND_TYPE_PART("*");
+            }
+        } else { // is an array
+            APPEND_TYPE_PART("%s ", typeToString(arg->type));
             for (int i = 0; i < arg->array_value_pointer_depth; i++) {
-                printf("*");
+                APPEND_TYPE_PART("*");
             }
             if (arg->pointer_depth > 0) {
-                printf("(");
+                APPEND_TYPE_PART("(");
                 for (int i = 0; i < arg->pointer_depth; i++) {
-                    printf("*");
+                    APPEND_TYPE_PART("*");
                 }
-                printf(")");
+                APPEND_TYPE_PART(")");
             }
-            printf("[%zu]", get_size_for_arginfo_sized_array(arg));
+            APPEND_TYPE_PART("[%zu]", get_size_for_arginfo_sized_array(arg));
         }
+        #undef APPEND_TYPE_PART
+        return length < buffer_size ? length : buffer_size - 1;
     }
 
+    void format_and_print_arg_type(const ArgInfo* arg) {
+        char type_description[128];
+        size_t length = format_arg_type(arg, type_description, sizeof(type_description));
+        output_write(type_description, length);
+    }
 
-    //this contains an optional override for the value, which is used for printing struct fields
-    void format_and_print_arg_value(const ArgInfo* arg) {  //, char* buffer, size_t buffer_size) {
+
+    // depth counts how many structs deep this value is, for max_depth
+    static void print_value_at_depth(const ArgInfo* arg, int depth) {
 
         const void* value;
         value = arg->value;
@@ -195,47 +579,47 @@ void hexdump(const void *data, size_t size) {
             for (int j = 0; j < arg->pointer_depth; j++) {
                 value = *(void**)value;
                 if (arg->type!=TYPE_STRUCT && value == NULL) {
-                    printf("(NULL pointer)");
+                    output_puts("(NULL pointer)");
                     return;
                 }
             }
         }
         if (arg->type==TYPE_STRUCT){
-            printf("{ ");
+            if (output_limits.max_depth != 0 && depth >= output_limits.max_depth) {
+                output_puts("{ ... }");
+                return;
+            }
+            output_puts("{ ");
             StructInfo* struct_info = arg->struct_info;
             for (int i = 0; i < struct_info->info.arg_count; i++) {
+                if (result_truncated) break; // a field already said so
+                if (result_bytes_remaining(0) == 0) {
+                    output_printf("%s... (truncated at %zu bytes)", i > 0 ? ", " : "", result_byte_limit);
+                    result_truncated = true;
+                    break;
+                }
+                if (i > 0) {
+                    output_puts(", ");
+                }
                 format_and_print_arg_type(struct_info->info.args[i]);
-                printf(" ");
+                output_puts(" ");
                 // void* override = struct_info->value_ptrs==NULL ? NULL : struct_info->value_ptrs[i];
-                format_and_print_arg_value(struct_info->info.args[i]);
-                if (i < struct_info->info.arg_count - 1) {
-                    printf(", ");
-                }
+                print_value_at_depth(struct_info->info.args[i], depth + 1);
             }
-            printf(" }");
+            output_puts(" }");
         }
         else if (!arg->is_array) {
             print_arg_value(value, arg->type, 0, 0);
         }
         else { // is an array
             value = *(void**)value; // because arrays are stored as pointers
-            size_t array_size = get_size_for_arginfo_sized_array(arg);
-            if(arg->array_value_pointer_depth==0){
-                if (arg->type == TYPE_CHAR){
-                    print_char_buffer((const char*)value, array_size);
-                    // print it as a string, with escape characters
-                } else if (arg->type == TYPE_UCHAR) {
-                    hexdump(value, array_size);
-            } else goto print_regular;
-            } else print_regular: {
-                printf("{ ");
-                for (size_t i = 0; i < array_size; i++) {
-                    print_arg_value(value, arg->type,i, arg->array_value_pointer_depth);
-                    if (i < array_size - 1) {
-                        printf(", ");
-                    }
-                }
-                printf(" }");
-            }
+            print_array(value, arg->type, arg->array_value_pointer_depth, get_size_for_arginfo_sized_array(arg));
         }
-    }
\ No newline at end of file
+    }
+
+    void format_and_print_arg_value(const ArgInfo* arg) {  //, char* buffer, size_t buffer_size) {
+        result_byte_limit = output_limits.max_bytes;
+        result_start_bytes = output_bytes_written();
+        result_truncated = false;
+        print_value_at_depth(arg, 0);
+    }
@@ -6,7 +6,30 @@
 // void format_and_print_return_value(const ArgInfo* return_value);
 void format_and_print_arg_value(const ArgInfo* arg); //, char* buffer, size_t buffer_size);
 void format_and_print_arg_type(const ArgInfo* arg);
+size_t format_arg_type(const ArgInfo* arg, char* buffer, size_t buffer_size);
 void hexdump(const void* data, size_t size);
+
+// Limits on how much of a single value gets printed, with 0 meaning no limit.
+// Arrays longer than max_elems show only their first and last elements (plus a summary if they're numeric),
+// structs nested deeper than max_depth show as { ... }, and anything past max_bytes of output is cut off.
+typedef struct OutputLimits {
+    size_t max_elems;
+    int max_depth;
+    size_t max_bytes;
+} OutputLimits;
+
+void set_output_limits(OutputLimits limits);
+OutputLimits get_output_limits();
+
+// Prints elements [start, end) of a flat array inline, as { v, v } or as a quoted string for chars,
+// showing only the first and last few if there are more than max_elems (unless it's 0)
+void print_array_slice(const void* values, ArgType type, size_t start, size_t end, size_t max_elems);
+
+// Prints count more elements of the last array that was cut short, continuing where it left off unless has_start is set.
+// A count of 0 means a page of max_elems (or 100 if that's unlimited).
+void page_last_elided_array(bool has_start, size_t start, size_t count);
+// Copies the elements of that array that haven't been paged through yet, for when the memory it's in may go away
+void keep_elided_array();
 // void print_arg_value(const void* value, ArgType type);
 
 #endif // RETURN_FORMATTER_H
\ No newline at end of file
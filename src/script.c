@@ -0,0 +1,424 @@
+#include "script.h"
+#include "arena.h"
+#include "control_flow.h"
+#include "exception_handling.h"
+#include "library_path_resolver.h"
+#include "main.h"
+#include "output_buffer.h"
+#include "tokenize.h"
+#include "types_and_utils.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The compiled format is written in the host's own byte order, since it's only a cache for the machine that made it:
+//   "CLIFFIC" magic, u32 version, u64 script hash, u64 environment hash
+//   u32 library count, then for each: library name as written, resolved path, u32 identity length, identity bytes
+//   u32 command count, then for each: u32 line number, u8 kind, the line itself, and for tokenized commands u32 argc and the tokens
+// where each string is a u32 length followed by its bytes and a terminating null, so the tokens can be used where they lie.
+
+#define COMPILED_MAGIC "CLIFFIC"
+#define COMPILED_VERSION 1
+#define COMPILED_EXTENSION ".cliffic"
+
+typedef enum {
+    COMMAND_TOKENIZED = 0,
+    COMMAND_RAW = 1, // shell escapes and blocks, which are run as the text they are
+} CompiledCommandKind;
+
+typedef struct {
+    uint32_t line_number;
+    uint8_t kind;
+    char* text;
+    int argc;
+    char** argv;
+} ScriptCommand;
+
+typedef struct {
+    char* library_name;
+    char* resolved_path;
+} ScriptLibrary;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t length) {
+    const unsigned char* bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+#define FNV_OFFSET_BASIS 14695981039346656037ULL
+
+// where libraries get resolved from besides the script itself: relative paths depend on the directory, and names on the search path
+static uint64_t environment_hash() {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    char cwd[4096];
+    if (getcwd(cwd, sizeof(cwd)) != NULL) {
+        hash = fnv1a(hash, cwd, strlen(cwd) + 1);
+    }
+#if defined(_WIN32)
+    const char* search_path = getenv("PATH");
+#else
+    const char* search_path = getenv("LD_LIBRARY_PATH");
+#endif
+    if (search_path != NULL) {
+        hash = fnv1a(hash, search_path, strlen(search_path) + 1);
+    }
+    return hash;
+}
+
+static char* read_whole_file(const char* path, size_t* length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+    size_t capacity = 4096;
+    size_t used = 0;
+    char* data = malloc(capacity);
+    size_t got;
+    while ((got = fread(data + used, 1, capacity - used - 1, file)) > 0) {
+        used += got;
+        if (capacity - used - 1 == 0) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    fclose(file);
+    data[used] = '\0';
+    *length = used;
+    return data;
+}
+
+// null terminates the line at its newline (if it has one) so it can be looked at on its own
+static char* line_ending_at(char* line, char* newline) {
+    if (newline != NULL) *newline = '\0';
+    return line;
+}
+
+static char* default_cache_path(const char* script_path) {
+    char* path = malloc(strlen(script_path) + strlen(COMPILED_EXTENSION) + 1);
+    strcpy(path, script_path);
+    strcat(path, COMPILED_EXTENSION);
+    return path;
+}
+
+// Cuts the script into its commands in place, skipping blank lines and comments. A command that opens a { block runs on
+// over the following lines until the block is closed. The caller frees the returned array.
+static ScriptCommand* split_script_lines(char* script, size_t* command_count) {
+    size_t capacity = 64;
+    size_t count = 0;
+    ScriptCommand* commands = malloc(capacity * sizeof(ScriptCommand));
+    uint32_t line_number = 0;
+    char* line = script;
+    while (*line != '\0') {
+        line_number++;
+        uint32_t first_line_number = line_number;
+        char* newline = strchr(line, '\n');
+        int depth = block_depth_change(line_ending_at(line, newline));
+        bool is_block = depth > 0;
+        while (depth > 0 && newline != NULL) { // the rest of the block stays part of this command, newlines and all
+            *newline = '\n';
+            char* block_line = newline + 1;
+            newline = strchr(block_line, '\n');
+            line_number++;
+            depth += block_depth_change(line_ending_at(block_line, newline));
+        }
+        char* next = newline != NULL ? newline + 1 : line + strlen(line);
+        if (newline != NULL) *newline = '\0';
+        char* text = trim_whitespace(line); // also takes care of \r
+        if (text[0] != '\0' && text[0] != '#') {
+            if (count == capacity) {
+                capacity *= 2;
+                commands = realloc(commands, capacity * sizeof(ScriptCommand));
+            }
+            // blocks are parsed when they run, so they're kept as text too
+            uint8_t kind = text[0] == '!' || is_block ? COMMAND_RAW : COMMAND_TOKENIZED;
+            commands[count++] = (ScriptCommand){first_line_number, kind, text, 0, NULL};
+        }
+        line = next;
+    }
+    *command_count = count;
+    return commands;
+}
+
+static void write_u32(FILE* file, uint32_t value) { fwrite(&value, sizeof(value), 1, file); }
+static void write_u64(FILE* file, uint64_t value) { fwrite(&value, sizeof(value), 1, file); }
+static void write_string(FILE* file, const char* str) {
+    uint32_t length = (uint32_t)strlen(str);
+    write_u32(file, length);
+    fwrite(str, 1, (size_t)length + 1, file);
+}
+
+// What compile_script has built up by the time it's writing the compiled script out
+static void free_compiled_parts(char* script, ScriptCommand* commands, ScriptLibrary* libraries, size_t library_count, ArenaMark start) {
+    for (size_t i = 0; i < library_count; i++) free(libraries[i].resolved_path);
+    free(libraries);
+    arena_release(command_arena(), start);
+    free(commands);
+    free(script);
+}
+
+void compile_script(const char* script_path, const char* cache_path) {
+    size_t script_length = 0;
+    char* script = read_whole_file(script_path, &script_length);
+    if (script == NULL) {
+        raiseException(1,  "Error: Could not read script %s\n", script_path);
+    }
+    uint64_t script_hash = fnv1a(FNV_OFFSET_BASIS, script, script_length);
+    size_t command_count;
+    ScriptCommand* commands = split_script_lines(script, &command_count);
+
+    // every command that looks like a function call gets its library looked up now, so that running it won't have to
+    ArenaMark start = arena_mark(command_arena());
+    ScriptLibrary* libraries = NULL;
+    size_t library_count = 0;
+    for (size_t i = 0; i < command_count; i++) {
+        if (commands[i].kind != COMMAND_TOKENIZED) continue;
+        tokenize(commands[i].text, &commands[i].argc, &commands[i].argv);
+        char** argv = commands[i].argv;
+        if (commands[i].argc < 3 || strcmp(argv[1], "=") == 0) continue;
+        bool seen = false;
+        for (size_t j = 0; j < library_count && !seen; j++) {
+            seen = strcmp(libraries[j].library_name, argv[0]) == 0;
+        }
+        if (seen) continue;
+        char* resolved = resolve_library_path(argv[0]); // NULL for the builtin commands, which stay as they are
+        if (resolved != NULL) {
+            libraries = realloc(libraries, (library_count + 1) * sizeof(ScriptLibrary));
+            libraries[library_count++] = (ScriptLibrary){argv[0], resolved};
+        }
+    }
+
+    char* default_path = cache_path == NULL ? default_cache_path(script_path) : NULL;
+    if (cache_path == NULL) cache_path = default_path;
+    // written alongside and then renamed into place, so a half written file is never mistaken for a compiled script
+    char temporary_path[strlen(cache_path) + 5];
+    snprintf(temporary_path, sizeof(temporary_path), "%s.tmp", cache_path);
+    FILE* file = fopen(temporary_path, "wb");
+    if (file == NULL) {
+        free_compiled_parts(script, commands, libraries, library_count, start);
+        free(default_path);
+        raiseException(1,  "Error: Could not write compiled script to %s\n", temporary_path);
+    }
+    fwrite(COMPILED_MAGIC, 1, sizeof(COMPILED_MAGIC), file);
+    write_u32(file, COMPILED_VERSION);
+    write_u64(file, script_hash);
+    write_u64(file, environment_hash());
+
+    write_u32(file, (uint32_t)library_count);
+    for (size_t i = 0; i < library_count; i++) {
+        unsigned char identity[MAX_LIBRARY_IDENTITY];
+        size_t identity_length = library_identity(libraries[i].resolved_path, identity);
+        write_string(file, libraries[i].library_name);
+        write_string(file, libraries[i].resolved_path);
+        write_u32(file, (uint32_t)identity_length);
+        fwrite(identity, 1, identity_length, file);
+    }
+
+    write_u32(file, (uint32_t)command_count);
+    for (size_t i = 0; i < command_count; i++) {
+        write_u32(file, commands[i].line_number);
+        fputc(commands[i].kind, file);
+        write_string(file, commands[i].text);
+        if (commands[i].kind == COMMAND_TOKENIZED) {
+            write_u32(file, (uint32_t)commands[i].argc);
+            for (int j = 0; j < commands[i].argc; j++) {
+                write_string(file, commands[i].argv[j]);
+            }
+        }
+    }
+
+    bool write_failed = ferror(file) != 0;
+    if (fclose(file) != 0) write_failed = true;
+    if (write_failed || rename(temporary_path, cache_path) != 0) {
+        remove(temporary_path);
+        free_compiled_parts(script, commands, libraries, library_count, start);
+        char* failed_path = arena_strndup(command_arena(), cache_path, strlen(cache_path)); // it may be default_path
+        free(default_path);
+        raiseException(1,  "Error: Could not write compiled script to %s\n", failed_path);
+    }
+    output_printf("Compiled %zu commands from %s to %s (%zu libraries resolved)\n", command_count, script_path, cache_path, library_count);
+
+    free_compiled_parts(script, commands, libraries, library_count, start);
+    free(default_path);
+}
+
+typedef struct {
+    char* position;
+    char* end;
+    bool ok;
+} CompiledReader;
+
+static bool read_bytes(CompiledReader* reader, void* out, size_t length) {
+    if (!reader->ok || (size_t)(reader->end - reader->position) < length) return reader->ok = false;
+    memcpy(out, reader->position, length);
+    reader->position += length;
+    return true;
+}
+
+static uint32_t read_u32(CompiledReader* reader) {
+    uint32_t value = 0;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static uint64_t read_u64(CompiledReader* reader) {
+    uint64_t value = 0;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+// returns the string where it lies in the file's contents
+static char* read_string(CompiledReader* reader) {
+    uint32_t length = read_u32(reader);
+    if (!reader->ok || (size_t)(reader->end - reader->position) <= length || reader->position[length] != '\0') {
+        reader->ok = false;
+        return "";
+    }
+    char* str = reader->position;
+    reader->position += (size_t)length + 1;
+    return str;
+}
+
+// Loads the compiled version of a script if there's one that's still up to date, in which case the commands' text and tokens
+// point into *contents and their argvs into *token_pointers, all of which the caller frees
+static ScriptCommand* load_compiled_script(const char* cache_path, uint64_t script_hash, size_t* command_count, char** contents, char*** token_pointers) {
+    size_t length;
+    char* data = read_whole_file(cache_path, &length);
+    if (data == NULL) return NULL;
+    CompiledReader reader = {data, data + length, true};
+
+    char magic[sizeof(COMPILED_MAGIC)];
+    read_bytes(&reader, magic, sizeof(magic));
+    bool up_to_date = reader.ok && memcmp(magic, COMPILED_MAGIC, sizeof(magic)) == 0 && read_u32(&reader) == COMPILED_VERSION &&
+                      read_u64(&reader) == script_hash && read_u64(&reader) == environment_hash();
+
+    uint32_t library_count = up_to_date ? read_u32(&reader) : 0;
+    ScriptLibrary libraries[library_count > 0 && library_count < 4096 ? library_count : 1];
+    if (library_count >= 4096) up_to_date = false;
+    for (uint32_t i = 0; up_to_date && i < library_count; i++) {
+        libraries[i].library_name = read_string(&reader);
+        libraries[i].resolved_path = read_string(&reader);
+        uint32_t identity_length = read_u32(&reader);
+        unsigned char recorded[MAX_LIBRARY_IDENTITY];
+        unsigned char current[MAX_LIBRARY_IDENTITY];
+        up_to_date = reader.ok && identity_length <= MAX_LIBRARY_IDENTITY && read_bytes(&reader, recorded, identity_length) &&
+                     library_identity(libraries[i].resolved_path, current) == identity_length && memcmp(recorded, current, identity_length) == 0;
+    }
+
+    uint32_t count = up_to_date ? read_u32(&reader) : 0;
+    up_to_date = up_to_date && reader.ok && count <= length; // every command takes more than a byte, so a bigger count is corrupt
+    ScriptCommand* commands = up_to_date ? malloc(((size_t)count + 1) * sizeof(ScriptCommand)) : NULL;
+    // the argvs all come from one array, which is sized once the tokens have been counted
+    size_t pointer_count = 0;
+    char* commands_start = reader.position;
+    for (int pass = 0; up_to_date && pass < 2; pass++) {
+        reader.position = commands_start;
+        char** next_pointer = pass == 1 ? (*token_pointers = malloc((pointer_count + 1) * sizeof(char*))) : NULL;
+        for (uint32_t i = 0; up_to_date && i < count; i++) {
+            ScriptCommand* command = &commands[i];
+            command->line_number = read_u32(&reader);
+            read_bytes(&reader, &command->kind, 1);
+            command->text = read_string(&reader);
+            command->argc = 0;
+            command->argv = NULL;
+            if (command->kind == COMMAND_TOKENIZED) {
+                command->argc = (int)read_u32(&reader);
+                if (!reader.ok || (size_t)command->argc > length) {
+                    reader.ok = false;
+                    break;
+                }
+                command->argv = next_pointer;
+                for (int j = 0; j < command->argc; j++) {
+                    char* token = read_string(&reader);
+                    if (next_pointer != NULL) *next_pointer++ = token;
+                }
+                if (next_pointer != NULL) *next_pointer++ = NULL;
+                pointer_count += (size_t)command->argc + 1;
+            } else if (command->kind != COMMAND_RAW) {
+                reader.ok = false;
+            }
+            up_to_date = reader.ok;
+        }
+    }
+
+    if (!up_to_date) {
+        if (commands != NULL) {
+            free(*token_pointers);
+            free(commands);
+        }
+        free(data);
+        fprintf(stderr, "Note: %s is out of date, so running the script from source. Compile it again to bring it up to date\n", cache_path);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < library_count; i++) {
+        remember_resolved_library_path(libraries[i].library_name, libraries[i].resolved_path);
+    }
+    *command_count = count;
+    *contents = data;
+    return commands;
+}
+
+// Returns 1 for quit, and -1 if the command failed (having already reported why)
+static int run_script_command(const ScriptCommand* command, bool from_source) {
+    volatile int result = 0;
+    ArenaMark command_start = arena_mark(command_arena());
+    TRY
+        if (from_source || command->kind == COMMAND_RAW) {
+            result = parseREPLCommand(command->text);
+        } else {
+            result = runTokenizedREPLCommand(command->text, command->argc, command->argv, NULL);
+            output_flush();
+        }
+    CATCHALL
+        printException();
+        result = -1;
+    END_TRY
+    arena_release(command_arena(), command_start);
+    return result;
+}
+
+int run_script(const char* script_path, bool stop_on_error) {
+    size_t script_length = 0;
+    char* script = read_whole_file(script_path, &script_length);
+    if (script == NULL) {
+        raiseException(1,  "Error: Could not read script %s\n", script_path);
+    }
+
+    char* cache_path = default_cache_path(script_path);
+    char* compiled_contents = NULL;
+    char** token_pointers = NULL;
+    size_t command_count = 0;
+    ScriptCommand* commands = NULL;
+    struct stat cache_info;
+    if (stat(cache_path, &cache_info) == 0) {
+        commands = load_compiled_script(cache_path, fnv1a(FNV_OFFSET_BASIS, script, script_length), &command_count, &compiled_contents, &token_pointers);
+    }
+    bool from_source = commands == NULL;
+    if (from_source) {
+        commands = split_script_lines(script, &command_count);
+    }
+
+    int result = 0;
+    char failure[1024] = "";
+    for (size_t i = 0; i < command_count && result != 1; i++) {
+        result = run_script_command(&commands[i], from_source);
+        if (result == -1) {
+            snprintf(failure, sizeof(failure), "line %u of %s: %s", commands[i].line_number, script_path, commands[i].text);
+            if (stop_on_error) break;
+            fprintf(stderr, "Error encountered in processing %s\n", failure);
+        }
+    }
+
+    free(commands);
+    free(token_pointers);
+    free(compiled_contents);
+    free(cache_path);
+    free(script);
+    if (result == -1 && stop_on_error) {
+        raiseException(1,  "Error: Script stopped at %s\n", failure);
+    }
+    return result == 1 ? 1 : 0;
+}
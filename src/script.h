@@ -0,0 +1,22 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdbool.h>
+
+// A script is a file of REPL commands, one per line, like .cliffi_init. Blank lines and lines starting with # are skipped,
+// and a for, while or if block runs over as many lines as it takes to close it.
+//
+// compile_script saves a script with every command already split into tokens, along with where each library it calls
+// was resolved to, by default as <script>.cliffic. run_script then runs from that instead of the text for as long as it
+// is up to date, ie the script hasn't changed, cliffi is run from the same directory with the same library search path,
+// and each library still has the same build-id (or size and modification time, for libraries without one).
+// Arguments are still parsed each time a command runs, since they can name variables that only exist by then.
+
+// Returns 1 if the script ran quit or exit, like parseREPLCommand.
+// If stop_on_error, the first command that fails stops the script with an exception, otherwise it's reported and the script carries on.
+int run_script(const char* script_path, bool stop_on_error);
+
+// cache_path may be NULL for the default of <script>.cliffic
+void compile_script(const char* script_path, const char* cache_path);
+
+#endif // SCRIPT_H
@@ -0,0 +1,505 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // for dladdr and dlinfo
+#endif
+#include "session.h"
+#include "arena.h"
+#include "exception_handling.h"
+#include "library_manager.h"
+#include "library_path_resolver.h"
+#include "output_buffer.h"
+#include "parse_address.h"
+#include "record_replay.h"
+#include "types_and_utils.h"
+#include "var_map.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <dlfcn.h>
+#if defined(__GLIBC__) || defined(RTLD_DI_LINKMAP) // it's an enum rather than a macro in glibc
+#include <link.h>
+#define use_library_relative_pointers
+#endif
+#endif
+
+// A session is written in the host's own byte order, like compiled scripts:
+//   "CLIFFIS" magic, u32 version
+//   u32 library count, then for each: the path calls name it by (or the alias of a copy in a namespace of its own), the
+//     file it was opened from, u8 whether it's such a copy, u32 dlopen flags, u8 whether it has a stored offset, and
+//     u64 offset from where the library is loaded
+//   u32 count of other names for the libraries (eg aliases given by load <library> as <alias>), then for each: name,
+//     u32 index of the library it names
+//   u64 length of the recorded calls (0 if there are none), then the recording itself
+//   u32 variable count, then for each: name, u8 kind, and then for
+//     SESSION_VAR_VALUE: u8 type, u8 shape, u8 explicit type, u64 length (all ones for NULL) and that many bytes
+//     SESSION_VAR_ALIAS: u32 index of an earlier variable holding the very same value
+//     SESSION_VAR_LIBRARY_POINTER: u8 explicit type, u32 library index, u64 offset from where the library is loaded
+// where strings are a u32 length followed by the bytes and a null.
+
+#define SESSION_MAGIC "CLIFFIS"
+#define SESSION_VERSION 3
+#define NULL_VALUE UINT64_MAX
+#define VALUE_SIZE sizeof(*((ArgInfo*)NULL)->value)
+
+typedef enum {
+    SESSION_VAR_VALUE = 0,
+    SESSION_VAR_ALIAS = 1,
+    SESSION_VAR_LIBRARY_POINTER = 2,
+} SessionVarKind;
+
+typedef enum {
+    SHAPE_UNSUPPORTED = -1,
+    SHAPE_VALUE = 0, // including strings, whose characters are saved
+    SHAPE_POINTER = 1,
+    SHAPE_ARRAY = 2,
+} VarShape;
+
+typedef struct {
+    void* handle;
+    const char* path;
+} SessionLibrary;
+
+typedef struct {
+    const char* name;
+    uint32_t library;
+} SessionLibraryName;
+
+typedef struct {
+    FILE* file;
+    SessionLibrary* libraries;
+    size_t library_count;
+    SessionLibraryName* library_names;
+    size_t library_name_count;
+    ArgInfo** saved_values; // of the variables written so far, for spotting aliases
+    size_t saved_count;
+    size_t left_out;
+    size_t raw_pointers;
+} SessionWriter;
+
+static void write_u8(FILE* file, uint8_t value) { fwrite(&value, sizeof(value), 1, file); }
+static void write_u32(FILE* file, uint32_t value) { fwrite(&value, sizeof(value), 1, file); }
+static void write_u64(FILE* file, uint64_t value) { fwrite(&value, sizeof(value), 1, file); }
+static void write_string(FILE* file, const char* str) {
+    uint32_t length = (uint32_t)strlen(str);
+    write_u32(file, length);
+    fwrite(str, 1, (size_t)length + 1, file);
+}
+
+static VarShape var_shape(const ArgInfo* var) {
+    if (var->type == TYPE_STRUCT) return SHAPE_UNSUPPORTED;
+    if (var->is_array) {
+        bool flat = var->pointer_depth == 0 && var->array_value_pointer_depth == 0 && var->type != TYPE_STRING;
+        return flat ? SHAPE_ARRAY : SHAPE_UNSUPPORTED;
+    }
+    if (var->pointer_depth == 0) return SHAPE_VALUE;
+    return var->pointer_depth == 1 && var->type != TYPE_STRING ? SHAPE_POINTER : SHAPE_UNSUPPORTED;
+}
+
+static const void* var_memory(const ArgInfo* var, VarShape shape, uint64_t* length) {
+    if (shape == SHAPE_VALUE && var->type != TYPE_STRING) {
+        *length = typeToSize(var->type, 0);
+        return var->value;
+    }
+    if (shape == SHAPE_VALUE) {
+        *length = var->value->str_val != NULL ? strlen(var->value->str_val) + 1 : 0;
+        return var->value->str_val;
+    }
+    *length = typeToSize(var->type, 0) * (shape == SHAPE_ARRAY ? get_size_for_arginfo_sized_array(var) : 1);
+    return var->value->ptr_val;
+}
+
+#ifdef use_library_relative_pointers
+static struct link_map* library_link_map(void* handle) {
+    struct link_map* map = NULL;
+    if (dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0) return NULL;
+    return map;
+}
+#endif
+
+// Where the library is loaded, which stored offsets are saved relative to, since it moves from one process to the
+// next. 0 where that can't be told, in which case they're saved as they are
+static uintptr_t library_base(void* handle) {
+#ifdef use_library_relative_pointers
+    struct link_map* map = library_link_map(handle);
+    if (map != NULL) return (uintptr_t)map->l_addr;
+#else
+    (void)handle;
+#endif
+    return 0;
+}
+
+// Finds the library a P variable points into, if it's one of the open ones
+static bool find_library_relative_pointer(const SessionWriter* writer, void* address, uint32_t* library, uint64_t* offset) {
+#ifdef use_library_relative_pointers
+    Dl_info info;
+#ifdef __GLIBC__
+    // the link map tells apart copies of the same file opened in namespaces of their own, which the file name doesn't
+    struct link_map* found = NULL;
+    if (address == NULL || dladdr1(address, &info, (void**)&found, RTLD_DL_LINKMAP) == 0 || found == NULL) return false;
+#else
+    if (address == NULL || dladdr(address, &info) == 0 || info.dli_fname == NULL) return false;
+#endif
+    for (size_t i = 0; i < writer->library_count; i++) {
+        struct link_map* map = library_link_map(writer->libraries[i].handle);
+#ifdef __GLIBC__
+        if (map != NULL && map == found) {
+#else
+        if (map != NULL && map->l_name != NULL && strcmp(map->l_name, info.dli_fname) == 0) {
+#endif
+            *library = (uint32_t)i;
+            *offset = (uint64_t)((uintptr_t)address - (uintptr_t)map->l_addr);
+            return true;
+        }
+    }
+#else
+    (void)writer;
+    (void)address;
+    (void)library;
+    (void)offset;
+#endif
+    return false;
+}
+
+static void collect_library(const char* library_path, void* handle, void* context) {
+    SessionWriter* writer = context;
+    writer->libraries = realloc(writer->libraries, (writer->library_count + 1) * sizeof(SessionLibrary));
+    writer->libraries[writer->library_count].handle = handle;
+    writer->libraries[writer->library_count].path = library_path;
+    writer->library_count++;
+}
+
+static void collect_library_name(const char* library_name, const char* resolved_path, void* context) {
+    SessionWriter* writer = context;
+    if (strcmp(library_name, resolved_path) == 0) return;
+    for (size_t i = 0; i < writer->library_count; i++) {
+        if (strcmp(writer->libraries[i].path, resolved_path) != 0) continue;
+        writer->library_names = realloc(writer->library_names, (writer->library_name_count + 1) * sizeof(SessionLibraryName));
+        writer->library_names[writer->library_name_count++] = (SessionLibraryName){library_name, (uint32_t)i};
+        return;
+    }
+}
+
+static void count_saved_var(const char* name, ArgInfo* value, void* context) {
+    SessionWriter* writer = context;
+    if (!isStoredOffsetVarName(name) && var_shape(value) != SHAPE_UNSUPPORTED) writer->saved_count++;
+}
+
+static void write_var(const char* name, ArgInfo* value, void* context) {
+    SessionWriter* writer = context;
+    if (isStoredOffsetVarName(name)) return; // these are saved with their libraries, since they're named after where those were loaded
+    VarShape shape = var_shape(value);
+    if (shape == SHAPE_UNSUPPORTED) {
+        writer->left_out++;
+        return;
+    }
+    write_string(writer->file, name);
+    for (size_t i = 0; i < writer->saved_count; i++) {
+        if (writer->saved_values[i] == value) {
+            write_u8(writer->file, SESSION_VAR_ALIAS);
+            write_u32(writer->file, (uint32_t)i);
+            writer->saved_values[writer->saved_count++] = value;
+            return;
+        }
+    }
+    writer->saved_values[writer->saved_count++] = value;
+
+    uint32_t library;
+    uint64_t offset;
+    if (value->type == TYPE_VOIDPOINTER && shape == SHAPE_VALUE) {
+        if (find_library_relative_pointer(writer, value->value->ptr_val, &library, &offset)) {
+            write_u8(writer->file, SESSION_VAR_LIBRARY_POINTER);
+            write_u8(writer->file, value->explicitType);
+            write_u32(writer->file, library);
+            write_u64(writer->file, offset);
+            return;
+        }
+        if (value->value->ptr_val != NULL) writer->raw_pointers++;
+    }
+    uint64_t length;
+    const void* memory = var_memory(value, shape, &length);
+    write_u8(writer->file, SESSION_VAR_VALUE);
+    write_u8(writer->file, (uint8_t)value->type);
+    write_u8(writer->file, (uint8_t)shape);
+    write_u8(writer->file, value->explicitType);
+    write_u64(writer->file, memory != NULL ? length : NULL_VALUE);
+    if (memory != NULL) fwrite(memory, 1, (size_t)length, writer->file);
+}
+
+void save_session(const char* path) {
+    SessionWriter writer = {0};
+    forEachOpenedLibrary(collect_library, &writer);
+    forEachRememberedLibraryPath(collect_library_name, &writer);
+    forEachVar(count_saved_var, &writer);
+    size_t var_count = writer.saved_count;
+    writer.saved_values = malloc((var_count > 0 ? var_count : 1) * sizeof(ArgInfo*));
+    writer.saved_count = 0;
+    size_t recording_length = 0;
+    unsigned char* recording = copy_recording_so_far(&recording_length);
+
+    writer.file = fopen(path, "wb");
+    if (writer.file == NULL) {
+        free(writer.libraries);
+        free(writer.library_names);
+        free(writer.saved_values);
+        free(recording);
+        raiseException(1,  "Error: Could not open %s to save the session to\n", path);
+    }
+    fwrite(SESSION_MAGIC, 1, sizeof(SESSION_MAGIC), writer.file);
+    write_u32(writer.file, SESSION_VERSION);
+
+    write_u32(writer.file, (uint32_t)writer.library_count);
+    for (size_t i = 0; i < writer.library_count; i++) {
+        const char* library_path = writer.libraries[i].path;
+        ArgInfo* offset = getStoredOffsetForLibLoadedAtAddress(writer.libraries[i].handle);
+        write_string(writer.file, library_path);
+        write_string(writer.file, getLibraryFilePath(library_path));
+        write_u8(writer.file, isLibraryInNewNamespace(library_path));
+        write_u32(writer.file, (uint32_t)getLibraryFlags(library_path));
+        write_u8(writer.file, offset != NULL);
+        uintptr_t base = library_base(writer.libraries[i].handle);
+        write_u64(writer.file, offset != NULL ? (uint64_t)((uintptr_t)offset->value->ptr_val - base) : 0);
+    }
+    write_u32(writer.file, (uint32_t)writer.library_name_count);
+    for (size_t i = 0; i < writer.library_name_count; i++) {
+        write_string(writer.file, writer.library_names[i].name);
+        write_u32(writer.file, writer.library_names[i].library);
+    }
+
+    write_u64(writer.file, recording_length);
+    if (recording != NULL) fwrite(recording, 1, recording_length, writer.file);
+    free(recording);
+
+    write_u32(writer.file, (uint32_t)var_count);
+    forEachVar(write_var, &writer);
+    fclose(writer.file);
+
+    output_printf("Saved %zu variables and %zu libraries%s to %s\n", writer.saved_count, writer.library_count,
+                  recording_length > 0 ? ", along with the calls recorded so far," : "", path);
+    if (writer.left_out > 0) {
+        output_printf("Note: %zu struct or nested pointer variables were left out\n", writer.left_out);
+    }
+    if (writer.raw_pointers > 0) {
+        output_printf("Note: %zu P variables point outside the libraries, and will be restored to the same addresses\n", writer.raw_pointers);
+    }
+    free(writer.libraries);
+    free(writer.library_names);
+    free(writer.saved_values);
+}
+
+typedef struct {
+    const unsigned char* position;
+    const unsigned char* end;
+    bool ok;
+} SessionReader;
+
+static bool read_bytes(SessionReader* reader, void* out, size_t length) {
+    if (!reader->ok || (size_t)(reader->end - reader->position) < length) return reader->ok = false;
+    memcpy(out, reader->position, length);
+    reader->position += length;
+    return true;
+}
+
+static uint8_t read_u8(SessionReader* reader) {
+    uint8_t value = 0;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static uint32_t read_u32(SessionReader* reader) {
+    uint32_t value = 0;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static uint64_t read_u64(SessionReader* reader) {
+    uint64_t value = 0;
+    read_bytes(reader, &value, sizeof(value));
+    return value;
+}
+
+static const char* read_string(SessionReader* reader) {
+    uint32_t length = read_u32(reader);
+    if (!reader->ok || (size_t)(reader->end - reader->position) <= length || reader->position[length] != '\0') {
+        reader->ok = false;
+        return "";
+    }
+    const char* str = (const char*)reader->position;
+    reader->position += (size_t)length + 1;
+    return str;
+}
+
+// A pointer to the next length bytes, which are left where they lie
+static const unsigned char* read_span(SessionReader* reader, uint64_t length) {
+    if (!reader->ok || (uint64_t)(reader->end - reader->position) < length) {
+        reader->ok = false;
+        return NULL;
+    }
+    const unsigned char* span = reader->position;
+    reader->position += length;
+    return span;
+}
+
+static ArgInfo* new_var(ArgType type, bool explicit_type) {
+    ArgInfo* var = calloc(1, sizeof(ArgInfo));
+    var->type = type;
+    var->explicitType = explicit_type;
+    var->value = calloc(1, sizeof(*var->value));
+    return var;
+}
+
+static ArgInfo* read_value_var(SessionReader* reader) {
+    ArgType type = (ArgType)read_u8(reader);
+    VarShape shape = (VarShape)read_u8(reader);
+    bool explicit_type = read_u8(reader) != 0;
+    uint64_t length = read_u64(reader);
+    const unsigned char* bytes = length != NULL_VALUE ? read_span(reader, length) : NULL;
+    if (!reader->ok || shape > SHAPE_ARRAY || typeToSize(type, 0) == 0 || (shape == SHAPE_VALUE && type != TYPE_STRING && length > VALUE_SIZE)) {
+        reader->ok = false;
+        return NULL;
+    }
+    ArgInfo* var = new_var(type, explicit_type);
+    if (shape == SHAPE_VALUE && type != TYPE_STRING) {
+        memcpy(var->value, bytes, (size_t)length);
+        return var;
+    }
+    void* memory = NULL;
+    if (bytes != NULL) {
+        memory = malloc(length > 0 ? (size_t)length : 1);
+        memcpy(memory, bytes, (size_t)length);
+    }
+    var->value->ptr_val = memory;
+    if (shape == SHAPE_POINTER) var->pointer_depth = 1;
+    if (shape == SHAPE_ARRAY) {
+        var->is_array = ARRAY_STATIC_SIZE;
+        var->static_or_implied_size = (size_t)length / typeToSize(type, 0);
+    }
+    return var;
+}
+
+// A copy of a library in a namespace of its own is opened again under its alias, as load <library> as <alias> does
+static void* load_session_library(const char* library_path, const char* file_path, bool new_namespace, int flags) {
+    if (!new_namespace || isLibraryInNewNamespace(library_path)) return getOrLoadLibraryWithFlags(library_path, flags);
+    if (!canLoadInNewNamespace()) return NULL;
+    void* handle = loadLibraryInNewNamespace(library_path, file_path, flags);
+    if (handle != NULL) remember_resolved_library_path(library_path, library_path);
+    return handle;
+}
+
+void load_session(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        raiseException(1,  "Error: Could not read session %s\n", path);
+    }
+    fseek(file, 0, SEEK_END);
+    long file_length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    unsigned char* data = malloc(file_length > 0 ? (size_t)file_length : 1);
+    size_t length = data != NULL && file_length > 0 ? fread(data, 1, (size_t)file_length, file) : 0;
+    fclose(file);
+    if (data == NULL) raiseException(1,  "Failed to allocate memory for the session.\n");
+
+    SessionReader reader = {data, data + length, true};
+    char magic[sizeof(SESSION_MAGIC)];
+    if (!read_bytes(&reader, magic, sizeof(magic)) || memcmp(magic, SESSION_MAGIC, sizeof(magic)) != 0 || read_u32(&reader) != SESSION_VERSION) {
+        free(data);
+        raiseException(1,  "Error: %s isn't a cliffi session\n", path);
+    }
+
+    uint32_t library_count = read_u32(&reader);
+    void** handles = calloc(library_count > 0 ? library_count : 1, sizeof(void*));
+    const char** library_paths = calloc(library_count > 0 ? library_count : 1, sizeof(char*));
+    for (uint32_t i = 0; i < library_count && reader.ok; i++) {
+        const char* library_path = library_paths[i] = read_string(&reader);
+        const char* file_path = read_string(&reader);
+        bool new_namespace = read_u8(&reader) != 0;
+        int flags = (int)read_u32(&reader);
+        bool has_offset = read_u8(&reader) != 0;
+        uint64_t offset = read_u64(&reader);
+        if (!reader.ok) break;
+        handles[i] = load_session_library(library_path, file_path, new_namespace, flags);
+        if (handles[i] == NULL) {
+            char* failed_path = arena_strndup(command_arena(), library_path, strlen(library_path)); // it lies in data
+            free(handles);
+            free(library_paths);
+            free(data);
+            raiseException(1,  "Failed to load library: %s\n", failed_path);
+        }
+        if (has_offset) storeOffsetForLibLoadedAtAddress(handles[i], (void*)((uintptr_t)offset + library_base(handles[i])));
+    }
+    uint32_t library_name_count = read_u32(&reader);
+    for (uint32_t i = 0; i < library_name_count && reader.ok; i++) {
+        const char* name = read_string(&reader);
+        uint32_t library = read_u32(&reader);
+        if (reader.ok && library < library_count) remember_resolved_library_path(name, library_paths[library]);
+    }
+    free(library_paths);
+
+    size_t replayed = 0;
+    uint64_t recording_length = read_u64(&reader);
+    const unsigned char* recording = read_span(&reader, recording_length);
+    if (reader.ok && recording_length > 0) {
+        unsigned char* calls = malloc((size_t)recording_length);
+        memcpy(calls, recording, (size_t)recording_length);
+        replayed = replay_recording_data(calls, (size_t)recording_length, path);
+    }
+
+    uint32_t var_count = read_u32(&reader);
+    ArgInfo** vars = calloc(var_count > 0 ? var_count : 1, sizeof(ArgInfo*));
+    uint32_t restored = 0;
+    for (; restored < var_count && reader.ok; restored++) {
+        const char* name = read_string(&reader);
+        SessionVarKind kind = (SessionVarKind)read_u8(&reader);
+        if (kind == SESSION_VAR_ALIAS) {
+            uint32_t index = read_u32(&reader);
+            vars[restored] = index < restored ? vars[index] : NULL;
+        } else if (kind == SESSION_VAR_LIBRARY_POINTER) {
+            bool explicit_type = read_u8(&reader) != 0;
+            uint32_t library = read_u32(&reader);
+            uint64_t offset = read_u64(&reader);
+            if (!reader.ok || library >= library_count) {
+                reader.ok = false;
+                break;
+            }
+#ifdef use_library_relative_pointers
+            struct link_map* map = library_link_map(handles[library]);
+            if (map != NULL) {
+                vars[restored] = new_var(TYPE_VOIDPOINTER, explicit_type);
+                vars[restored]->value->ptr_val = (void*)((uintptr_t)map->l_addr + (uintptr_t)offset);
+            }
+#else
+            (void)explicit_type;
+            (void)offset;
+#endif
+        } else if (kind == SESSION_VAR_VALUE) {
+            vars[restored] = read_value_var(&reader);
+        } else {
+            reader.ok = false;
+        }
+        if (!reader.ok || vars[restored] == NULL) {
+            reader.ok = false;
+            break;
+        }
+        setVar(name, vars[restored]); // the name lies in data, but setVar copies it
+    }
+    free(vars);
+    free(handles);
+    free(data);
+    if (!reader.ok) {
+        raiseException(1,  "Error: Session %s is corrupt after its first %u variables\n", path, restored);
+    }
+    output_printf("Loaded %u variables and %u libraries from %s", restored, library_count, path);
+    if (replayed > 0) output_printf(", replaying %zu recorded calls", replayed);
+    output_printf("\n");
+}
+
+void run_session_command(int argc, char** argv) {
+    if (argc == 2 && strcmp(argv[0], "save") == 0) {
+        save_session(argv[1]);
+    } else if (argc == 2 && strcmp(argv[0], "load") == 0) {
+        load_session(argv[1]);
+    } else {
+        raiseException(1,  "Usage: session save|load <file>\n");
+    }
+}
@@ -0,0 +1,25 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+// A session is the state built up by commands like those in a .cliffi_init, saved so that it can be got back in
+// milliseconds rather than built up again:
+//
+//   session save <file>
+//   session load <file>
+//
+// It holds the open libraries and the offsets calculate_offset stored for them, and the variables, including the
+// contents of the strings, arrays and pointers they hold. P variables that point into one of the libraries are saved
+// relative to it, so they still point at the same thing once it's loaded somewhere else.
+// State inside the libraries themselves (eg whatever their init functions set up) can't be saved directly, so if calls
+// are being recorded (see record_replay.h) when the session is saved, the calls recorded so far are saved with it,
+// and replayed on load before the variables are restored. So an init file can start with record, and end with
+// session save, for later ones to just session load.
+// Struct variables, and ones holding pointers to pointers or arrays of pointers, are left out.
+
+void save_session(const char* path);
+void load_session(const char* path);
+
+// The REPL command, given the args after session
+void run_session_command(int argc, char** argv);
+
+#endif // SESSION_H
@@ -0,0 +1,41 @@
+#include "startup_profile.h"
+#include "types_and_utils.h"
+#include <stdbool.h>
+#include <stdio.h>
+
+typedef struct {
+    const char* name;
+    uint64_t ended_ns;
+} StartupPhase;
+
+static uint64_t started_ns = 0;
+static StartupPhase phases[STARTUP_PROFILE_MAX_PHASES];
+static int phase_count = 0;
+static bool enabled = false;
+static bool printed = false;
+
+void startup_profile_begin() {
+    started_ns = now_ns();
+}
+
+void startup_phase_done(const char* phase) {
+    if (printed || phase_count == STARTUP_PROFILE_MAX_PHASES) return;
+    phases[phase_count++] = (StartupPhase){phase, now_ns()};
+}
+
+void enable_startup_profile() {
+    enabled = true;
+}
+
+void print_startup_profile() {
+    if (!enabled || printed) return;
+    printed = true;
+    uint64_t total_ns = phase_count > 0 ? phases[phase_count - 1].ended_ns - started_ns : 0;
+    fprintf(stderr, "Startup profile, %.3f ms in all:\n", total_ns / 1e6);
+    uint64_t phase_started = started_ns;
+    for (int i = 0; i < phase_count; i++) {
+        uint64_t took = phases[i].ended_ns - phase_started;
+        fprintf(stderr, "  %8.3f ms  %5.1f%%  %s\n", took / 1e6, total_ns > 0 ? 100.0 * took / total_ns : 0.0, phases[i].name);
+        phase_started = phases[i].ended_ns;
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef STARTUP_PROFILE_H
+#define STARTUP_PROFILE_H
+
+// Where the time goes between cliffi starting and its first command, for the global option --startup-profile.
+// Startup is split into phases by marking the end of each one, each starting where the one before it ended.
+// Marking is cheap enough to always do, and the phases are only printed (to stderr) if the profile was asked for.
+
+#define STARTUP_PROFILE_MAX_PHASES 16
+
+void startup_profile_begin();
+void startup_phase_done(const char* phase);
+
+void enable_startup_profile();
+
+// Prints the phases marked so far if the profile was asked for, the first time it's called
+void print_startup_profile();
+
+#endif // STARTUP_PROFILE_H
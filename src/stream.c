@@ -0,0 +1,646 @@
+#include "stream.h"
+#include "argparser.h"
+#include "exception_handling.h"
+#include "invoke_handler.h"
+#include "library_manager.h"
+#include "main.h"
+#include "output_buffer.h"
+#include "return_formatter.h"
+#include "structured_output.h"
+#include "var_map.h"
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <pthread.h>
+#define STREAM_THREADS // on windows the stages just take turns on the one thread
+#endif
+
+#define STREAM_BATCHES 4 // in flight between the stages at once
+#define STREAM_BATCH_RECORDS 4096 // for binary input, text input is read STREAM_READ_SIZE at a time instead
+#define STREAM_READ_SIZE (1 << 20)
+#define NO_STRING ((size_t)-1)
+
+// the same members as an ArgInfo value, so copying one over the other works
+typedef union {
+    char c_val;
+    short s_val;
+    int i_val;
+    long l_val;
+    unsigned char uc_val;
+    unsigned short us_val;
+    unsigned int ui_val;
+    unsigned long ul_val;
+    float f_val;
+    double d_val;
+    char* str_val;
+    void* ptr_val;
+    bool b_val;
+    size_t offset; // where a string is kept in its batch, while the batch may still move in memory
+} StreamValue;
+
+typedef struct {
+    char* data; // the input text, or for binary input the strings
+    size_t length;
+    size_t capacity;
+    StreamValue* fields; // field_count of them per record
+    StreamValue* results;
+    size_t count;
+    size_t record_capacity;
+    char* strings; // copies of returned strings, since the function may reuse its buffer for the next call
+    size_t strings_length;
+    size_t strings_capacity;
+    unsigned long long first_record;
+    bool last; // nothing comes after this batch, because the input ended or was bad
+} StreamBatch;
+
+typedef struct {
+    StreamBatch* batches[STREAM_BATCHES];
+    size_t head;
+    size_t count;
+#ifdef STREAM_THREADS
+    pthread_mutex_t mutex;
+    pthread_cond_t ready;
+#endif
+} BatchQueue;
+
+typedef struct {
+    StreamInputFormat format;
+    FunctionCallInfo* call_info;
+    PreparedCif* cif;
+    void* func;
+    void** values; // for ffi_call, pointing at each arg's value
+    ArgInfo** placeholders;
+    int field_count;
+    size_t value_size;
+    bool string_return;
+
+    char* carry; // text after the last complete line of the previous read
+    size_t carry_length;
+    bool input_ended;
+    unsigned long long records_read;
+    char* error; // set by the reader for bad input, and raised once everything before it has been written
+
+    BatchQueue free_batches;
+    BatchQueue to_invoke;
+    BatchQueue to_write;
+} Stream;
+
+StreamInputFormat parse_stream_input_format(const char* name) {
+    if (strcmp(name, "csv") == 0) return STREAM_INPUT_CSV;
+    if (strcmp(name, "tsv") == 0) return STREAM_INPUT_TSV;
+    if (strcmp(name, "binary") == 0) return STREAM_INPUT_BINARY;
+    raiseException(1,  "Error: Unknown stream input format %s, expected csv, tsv or binary\n", name);
+    return STREAM_INPUT_CSV;
+}
+
+static void queue_init(BatchQueue* queue) {
+    queue->head = queue->count = 0;
+#ifdef STREAM_THREADS
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->ready, NULL);
+#endif
+}
+
+static void queue_destroy(BatchQueue* queue) {
+#ifdef STREAM_THREADS
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->ready);
+#else
+    (void)queue;
+#endif
+}
+
+static void queue_push(BatchQueue* queue, StreamBatch* batch) {
+#ifdef STREAM_THREADS
+    pthread_mutex_lock(&queue->mutex);
+#endif
+    queue->batches[(queue->head + queue->count++) % STREAM_BATCHES] = batch;
+#ifdef STREAM_THREADS
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->mutex);
+#endif
+}
+
+static StreamBatch* queue_pop(BatchQueue* queue) {
+#ifdef STREAM_THREADS
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0) pthread_cond_wait(&queue->ready, &queue->mutex);
+#endif
+    StreamBatch* batch = queue->batches[queue->head];
+    queue->head = (queue->head + 1) % STREAM_BATCHES;
+    queue->count--;
+#ifdef STREAM_THREADS
+    pthread_mutex_unlock(&queue->mutex);
+#endif
+    return batch;
+}
+
+// The reader can't raise exceptions from its own thread, so it leaves the message for the main thread to raise at the end
+static void stream_fail(Stream* stream, const char* formatstr, ...) {
+    va_list args;
+    va_start(args, formatstr);
+    char message[512];
+    vsnprintf(message, sizeof(message), formatstr, args);
+    va_end(args);
+    stream->error = strdup(message);
+}
+
+static void reserve_data(StreamBatch* batch, size_t extra) {
+    if (batch->length + extra <= batch->capacity) return;
+    while (batch->length + extra > batch->capacity) batch->capacity *= 2;
+    batch->data = realloc(batch->data, batch->capacity);
+}
+
+static StreamValue* add_record(Stream* stream, StreamBatch* batch) {
+    if (batch->count == batch->record_capacity) {
+        batch->record_capacity *= 2;
+        batch->fields = realloc(batch->fields, batch->record_capacity * stream->field_count * sizeof(StreamValue));
+        batch->results = realloc(batch->results, batch->record_capacity * sizeof(StreamValue));
+    }
+    return &batch->fields[batch->count++ * stream->field_count];
+}
+
+typedef enum {
+    FIELD_OK,
+    FIELD_INVALID,
+    FIELD_OUT_OF_RANGE,
+} StreamFieldResult;
+
+static void store_integer(StreamValue* value, ArgType type, long long signed_value, unsigned long long unsigned_value) {
+    switch (type) {
+        case TYPE_CHAR: value->c_val = (char)signed_value; break;
+        case TYPE_SHORT: value->s_val = (short)signed_value; break;
+        case TYPE_INT: value->i_val = (int)signed_value; break;
+        case TYPE_LONG: value->l_val = (long)signed_value; break;
+        case TYPE_UCHAR: value->uc_val = (unsigned char)unsigned_value; break;
+        case TYPE_USHORT: value->us_val = (unsigned short)unsigned_value; break;
+        case TYPE_UINT: value->ui_val = (unsigned int)unsigned_value; break;
+        case TYPE_ULONG: value->ul_val = (unsigned long)unsigned_value; break;
+        case TYPE_BOOL: value->b_val = signed_value != 0; break;
+        case TYPE_VOIDPOINTER: value->ptr_val = (void*)(uintptr_t)unsigned_value; break;
+        default: break;
+    }
+}
+
+// The range a field of an integer type takes. Signed types also take hex up to their unsigned maximum, as the bit pattern.
+static void integer_range(ArgType type, long long* min, unsigned long long* max, unsigned long long* hex_max) {
+    *min = 0;
+    switch (type) {
+        case TYPE_CHAR: *min = SCHAR_MIN; *max = SCHAR_MAX; *hex_max = UCHAR_MAX; break;
+        case TYPE_SHORT: *min = SHRT_MIN; *max = SHRT_MAX; *hex_max = USHRT_MAX; break;
+        case TYPE_INT: *min = INT_MIN; *max = INT_MAX; *hex_max = UINT_MAX; break;
+        case TYPE_LONG: *min = LONG_MIN; *max = LONG_MAX; *hex_max = ULONG_MAX; break;
+        case TYPE_BOOL: *min = LLONG_MIN; *max = *hex_max = ULLONG_MAX; break; // anything non-zero is true
+        case TYPE_UCHAR: *max = *hex_max = UCHAR_MAX; break;
+        case TYPE_USHORT: *max = *hex_max = USHRT_MAX; break;
+        case TYPE_UINT: *max = *hex_max = UINT_MAX; break;
+        case TYPE_VOIDPOINTER: *max = *hex_max = UINTPTR_MAX; break;
+        default: *max = *hex_max = ULONG_MAX; break; // TYPE_ULONG
+    }
+}
+
+static StreamFieldResult parse_integer_field(ArgType type, const char* text, StreamValue* value) {
+    long long min;
+    unsigned long long max, hex_max;
+    integer_range(type, &min, &max, &hex_max);
+    while (isspace((unsigned char)*text)) text++;
+    char* end;
+    errno = 0;
+    if (text[0] == '-') {
+        long long number = strtoll(text, &end, 0);
+        if (end == text || *end != '\0') return FIELD_INVALID;
+        if (errno == ERANGE || number < min) return FIELD_OUT_OF_RANGE;
+        store_integer(value, type, number, (unsigned long long)number);
+        return FIELD_OK;
+    }
+    unsigned long long number = strtoull(text, &end, 0);
+    if (end == text || *end != '\0') return FIELD_INVALID;
+    if (errno == ERANGE || number > (isHexFormat(text) ? hex_max : max)) return FIELD_OUT_OF_RANGE;
+    store_integer(value, type, (long long)number, number);
+    return FIELD_OK;
+}
+
+// Converts a text field straight into its value, with none of the allocation that convert_arg_value does for a
+// single value. Strings are left where they are in the batch.
+static StreamFieldResult parse_text_field(const ArgInfo* placeholder, char* text, StreamValue* value) {
+    char* end = text;
+    errno = 0;
+    switch (placeholder->type) {
+        case TYPE_STRING:
+            value->str_val = text;
+            return FIELD_OK;
+        case TYPE_FLOAT:
+            value->f_val = strtof(text, &end);
+            break;
+        case TYPE_DOUBLE:
+            value->d_val = strtod(text, &end);
+            break;
+        case TYPE_CHAR:
+        case TYPE_UCHAR:
+            // a single character other than a digit is taken as it is, and anything else as a number
+            if (text[0] != '\0' && text[1] == '\0' && !isdigit((unsigned char)text[0])) {
+                value->c_val = text[0];
+                return FIELD_OK;
+            }
+            return parse_integer_field(placeholder->type, text, value);
+        case TYPE_BOOL:
+            if (strcmp(text, "true") == 0 || strcmp(text, "false") == 0) {
+                value->b_val = text[0] == 't';
+                return FIELD_OK;
+            }
+            return parse_integer_field(placeholder->type, text, value);
+        default:
+            return parse_integer_field(placeholder->type, text, value);
+    }
+    if (end == text || *end != '\0') return FIELD_INVALID;
+    return errno == ERANGE ? FIELD_OUT_OF_RANGE : FIELD_OK;
+}
+
+static bool parse_text_record(Stream* stream, StreamBatch* batch, char* line) {
+    char separator = stream->format == STREAM_INPUT_TSV ? '\t' : ',';
+    unsigned long long record = batch->first_record + batch->count;
+    StreamValue* values = add_record(stream, batch);
+    int field = 0;
+    char* cursor = line;
+    while (true) {
+        char* text = cursor;
+        if (stream->format == STREAM_INPUT_CSV && *cursor == '"') { // unquoted in place, "" being a literal quote
+            char* read = cursor + 1;
+            char* write = cursor;
+            while (*read != '"' || read[1] == '"') {
+                if (*read == '\0') {
+                    stream_fail(stream, "Error: Record %llu has an unterminated quote\n", record);
+                    return false;
+                }
+                if (*read == '"') read++;
+                *write++ = *read++;
+            }
+            *write = '\0';
+            cursor = read + 1;
+            if (*cursor != separator && *cursor != '\0') {
+                stream_fail(stream, "Error: Record %llu has text after the closing quote of field %d\n", record, field);
+                return false;
+            }
+        } else {
+            while (*cursor != separator && *cursor != '\0') cursor++;
+        }
+        bool more = *cursor == separator;
+        *cursor = '\0';
+        if (field == stream->field_count) {
+            stream_fail(stream, "Error: Record %llu has more than the %d fields there are placeholders for\n", record, stream->field_count);
+            return false;
+        }
+        StreamFieldResult result = parse_text_field(stream->placeholders[field], text, &values[field]);
+        if (result != FIELD_OK) {
+            stream_fail(stream, "Error: Field %d of record %llu %s %s: %s\n", field, record,
+                        result == FIELD_INVALID ? "isn't a valid" : "is out of range for", typeToString(stream->placeholders[field]->type), text);
+            return false;
+        }
+        field++;
+        if (!more) break;
+        cursor++;
+    }
+    if (field != stream->field_count) {
+        stream_fail(stream, "Error: Record %llu has %d fields, but there are %d placeholders\n", record, field, stream->field_count);
+        return false;
+    }
+    return true;
+}
+
+static void read_text_batch(Stream* stream, StreamBatch* batch) {
+    batch->length = 0;
+    reserve_data(batch, stream->carry_length);
+    memcpy(batch->data, stream->carry, stream->carry_length);
+    batch->length = stream->carry_length;
+    size_t lines_end = 0; // just past the last newline
+    while (!stream->input_ended) {
+        reserve_data(batch, STREAM_READ_SIZE + 1);
+        size_t read = fread(batch->data + batch->length, 1, STREAM_READ_SIZE, stdin);
+        size_t searched = batch->length;
+        batch->length += read;
+        if (read < STREAM_READ_SIZE) stream->input_ended = true;
+        for (size_t i = batch->length; i > searched; i--) {
+            if (batch->data[i - 1] == '\n') {
+                lines_end = i;
+                break;
+            }
+        }
+        if (lines_end > 0) break;
+    }
+    if (stream->input_ended) lines_end = batch->length;
+
+    stream->carry_length = batch->length - lines_end;
+    if (stream->carry_length > 0) {
+        stream->carry = realloc(stream->carry, stream->carry_length);
+        memcpy(stream->carry, batch->data + lines_end, stream->carry_length);
+    }
+    reserve_data(batch, 1);
+    batch->data[lines_end] = '\0';
+
+    char* line = batch->data;
+    while (line < batch->data + lines_end) {
+        char* newline = memchr(line, '\n', batch->data + lines_end - line);
+        char* next = newline != NULL ? newline + 1 : batch->data + lines_end;
+        size_t length = (newline != NULL ? newline : batch->data + lines_end) - line;
+        if (length > 0 && line[length - 1] == '\r') length--;
+        line[length] = '\0';
+        if (length > 0 && !parse_text_record(stream, batch, line)) {
+            batch->count--; // the bad record, which the ones before it are still run without
+            batch->last = true;
+            return;
+        }
+        line = next;
+    }
+    batch->last = stream->input_ended;
+}
+
+static void read_binary_batch(Stream* stream, StreamBatch* batch) {
+    batch->length = 0;
+    while (batch->count < STREAM_BATCH_RECORDS && !stream->input_ended) {
+        unsigned long long record = batch->first_record + batch->count;
+        StreamValue* values = add_record(stream, batch);
+        for (int field = 0; field < stream->field_count; field++) {
+            unsigned char header[4];
+            size_t read = fread(header, 1, sizeof(header), stdin);
+            if (read == 0 && field == 0) { // a clean end between records
+                batch->count--;
+                stream->input_ended = true;
+                break;
+            } else if (read != sizeof(header)) {
+                stream_fail(stream, "Error: Record %llu ends partway through field %d\n", record, field);
+                batch->count--;
+                stream->input_ended = true;
+                break;
+            }
+            uint32_t length = header[0] | (uint32_t)header[1] << 8 | (uint32_t)header[2] << 16 | (uint32_t)header[3] << 24;
+            const ArgInfo* placeholder = stream->placeholders[field];
+            if (placeholder->type == TYPE_STRING) {
+                reserve_data(batch, (size_t)length + 1);
+                read = fread(batch->data + batch->length, 1, length, stdin);
+                batch->data[batch->length + read] = '\0';
+                values[field].offset = batch->length;
+                batch->length += (size_t)length + 1;
+            } else {
+                size_t size = typeToSize(placeholder->type, 0);
+                if (length != size) {
+                    stream_fail(stream, "Error: Field %d of record %llu is %u bytes, but a %s is %zu\n", field, record, length, typeToString(placeholder->type), size);
+                    batch->count--;
+                    stream->input_ended = true;
+                    break;
+                }
+                memset(&values[field], 0, sizeof(StreamValue));
+                read = fread(&values[field], 1, size, stdin);
+            }
+            if (read != length) {
+                stream_fail(stream, "Error: Record %llu ends partway through field %d\n", record, field);
+                batch->count--;
+                stream->input_ended = true;
+                break;
+            }
+        }
+    }
+    // the strings are all in place now, so they can be pointed to
+    for (size_t i = 0; i < batch->count * stream->field_count; i++) {
+        if (stream->placeholders[i % stream->field_count]->type == TYPE_STRING) {
+            batch->fields[i].str_val = batch->data + batch->fields[i].offset;
+        }
+    }
+    batch->last = stream->input_ended;
+}
+
+static void read_batch(Stream* stream, StreamBatch* batch) {
+    batch->count = 0;
+    batch->first_record = stream->records_read;
+    if (stream->format == STREAM_INPUT_BINARY) {
+        read_binary_batch(stream, batch);
+    } else {
+        read_text_batch(stream, batch);
+    }
+    stream->records_read += batch->count;
+}
+
+static void invoke_batch(Stream* stream, StreamBatch* batch) {
+    ArgInfo* return_var = stream->call_info->info.return_var;
+    batch->strings_length = 0;
+    for (size_t record = 0; record < batch->count; record++) {
+        const StreamValue* fields = &batch->fields[record * stream->field_count];
+        for (int field = 0; field < stream->field_count; field++) {
+            memcpy(stream->placeholders[field]->value, &fields[field], stream->value_size);
+        }
+        call_prepared_cif(stream->call_info, stream->cif, stream->func, stream->values);
+        StreamValue* result = &batch->results[record];
+        memcpy(result, return_var->value, stream->value_size);
+        if (stream->string_return) {
+            if (result->str_val == NULL) {
+                result->offset = NO_STRING;
+                continue;
+            }
+            size_t length = strlen(result->str_val) + 1;
+            if (batch->strings_length + length > batch->strings_capacity) {
+                while (batch->strings_length + length > batch->strings_capacity) batch->strings_capacity *= 2;
+                batch->strings = realloc(batch->strings, batch->strings_capacity);
+            }
+            memcpy(batch->strings + batch->strings_length, result->str_val, length);
+            result->offset = batch->strings_length;
+            batch->strings_length += length;
+        }
+    }
+}
+
+static void write_batch(Stream* stream, StreamBatch* batch) {
+    if (output_is_quiet()) return;
+    StreamValue value;
+    ArgInfo result = *stream->call_info->info.return_var; // with its value swapped for each record's in turn
+    result.value = (void*)&value;
+    bool structured = is_structured_output_format();
+    for (size_t record = 0; record < batch->count; record++) {
+        value = batch->results[record];
+        if (stream->string_return) value.str_val = value.offset == NO_STRING ? NULL : batch->strings + value.offset;
+        if (structured) {
+            structured_print_stream_record(batch->first_record + record, &result);
+        } else if (result.type == TYPE_VOID) {
+            continue;
+        } else if (stream->string_return && value.str_val == NULL) {
+            output_puts("NULL\n");
+        } else {
+            format_and_print_arg_value(&result);
+            output_putc('\n');
+        }
+    }
+    output_flush();
+}
+
+#ifdef STREAM_THREADS
+static void* reader_thread(void* arg) {
+    Stream* stream = arg;
+    bool last;
+    do {
+        StreamBatch* batch = queue_pop(&stream->free_batches);
+        read_batch(stream, batch);
+        last = batch->last;
+        queue_push(&stream->to_invoke, batch);
+    } while (!last);
+    return NULL;
+}
+
+static void* writer_thread(void* arg) {
+    Stream* stream = arg;
+    bool last;
+    do {
+        StreamBatch* batch = queue_pop(&stream->to_write);
+        write_batch(stream, batch);
+        last = batch->last;
+        queue_push(&stream->free_batches, batch);
+    } while (!last);
+    return NULL;
+}
+#endif
+
+// Placeholders are set up as variables with names the parser will never see otherwise, so that it uses them as args
+// directly, and filling in a placeholder's value is all it takes to change the arg
+static ArgInfo* make_placeholder(char* flag, int index, char** name) {
+    int extra_args_used = 0;
+    ArgInfo* placeholder = parse_one_arg(2, (char*[]){flag, "0", NULL}, &extra_args_used, false);
+    if (placeholder->pointer_depth > 0 || placeholder->is_array || placeholder->type == TYPE_STRUCT || placeholder->type == TYPE_VOID) {
+        raiseException(1,  "Error: Placeholder %d is a %s, but placeholders can only be numbers, chars, bools, strings or P pointers\n", index, typeToString(placeholder->type));
+    }
+    *name = malloc(16);
+    snprintf(*name, 16, "{%d}", index);
+    setVar(*name, placeholder);
+    return placeholder;
+}
+
+static bool is_type_flag(const char* token) {
+    return token[0] == '-' && token[1] != '\0' && !isAllDigits(token + 1) && !isHexFormat(token + 1) && !isFloatingPoint(token + 1);
+}
+
+unsigned long long run_stream(int argc, char** argv, StreamInputFormat format) {
+    if (argc < 3) {
+        raiseException(1,  "Usage: --stream[=csv|tsv|binary] <library> <return_typeflag> <function_name> [args with {} placeholders..]\n");
+    }
+    Stream stream;
+    memset(&stream, 0, sizeof(stream));
+    stream.format = format;
+    stream.placeholders = malloc(argc * sizeof(ArgInfo*));
+
+    char** call_argv = malloc((argc + 1) * sizeof(char*));
+    int call_argc = 0;
+    for (int i = 0; i < argc; i++) {
+        if (i >= 3 && strcmp(argv[i], "{}") == 0) {
+            raiseException(1,  "Error: The placeholder at arg %d needs a type flag in front of it, eg -i {}\n", i);
+        } else if (i >= 3 && i + 1 < argc && strcmp(argv[i + 1], "{}") == 0 && is_type_flag(argv[i])) {
+            stream.placeholders[stream.field_count] = make_placeholder(argv[i], stream.field_count, &call_argv[call_argc++]);
+            stream.field_count++;
+            i++;
+        } else {
+            call_argv[call_argc++] = argv[i];
+        }
+    }
+    call_argv[call_argc] = NULL;
+    if (stream.field_count == 0) {
+        raiseException(1,  "Error: --stream needs at least one {} placeholder among the args\n");
+    }
+
+    stream.call_info = parse_arguments(call_argc, call_argv);
+    const ArgInfo* return_var = stream.call_info->info.return_var;
+    if (return_var->is_array || (return_var->pointer_depth > 0 && return_var->type != TYPE_VOID)) {
+        raiseException(1,  "Error: --stream can only print returns of numbers, chars, bools, strings and P pointers\n");
+    }
+    stream.string_return = return_var->type == TYPE_STRING;
+    void* lib_handle = getOrLoadLibrary(stream.call_info->library_path);
+    if (lib_handle == NULL) {
+        raiseException(1,  "Failed to load library: %s\n", stream.call_info->library_path);
+    }
+    stream.func = loadFunctionHandle(lib_handle, stream.call_info->function_name);
+    stream.cif = prepare_cif(stream.call_info);
+    if (stream.cif == NULL) {
+        raiseException(1,  "Error: --stream doesn't support functions that take or return structs\n");
+    }
+    stream.values = malloc((stream.call_info->info.arg_count + 1) * sizeof(void*));
+    for (unsigned int i = 0; i < stream.call_info->info.arg_count; i++) {
+        stream.values[i] = stream.call_info->info.args[i]->value;
+    }
+    stream.value_size = sizeof(*return_var->value);
+
+#if defined(_WIN32) || defined(_WIN64)
+    if (format == STREAM_INPUT_BINARY) _setmode(_fileno(stdin), _O_BINARY);
+#endif
+
+    StreamBatch batches[STREAM_BATCHES];
+    queue_init(&stream.free_batches);
+    queue_init(&stream.to_invoke);
+    queue_init(&stream.to_write);
+    for (int i = 0; i < STREAM_BATCHES; i++) {
+        StreamBatch* batch = &batches[i];
+        memset(batch, 0, sizeof(*batch));
+        batch->capacity = STREAM_READ_SIZE + 1;
+        batch->data = malloc(batch->capacity);
+        batch->record_capacity = STREAM_BATCH_RECORDS;
+        batch->fields = malloc(batch->record_capacity * stream.field_count * sizeof(StreamValue));
+        batch->results = malloc(batch->record_capacity * sizeof(StreamValue));
+        batch->strings_capacity = 4096;
+        batch->strings = malloc(batch->strings_capacity);
+        queue_push(&stream.free_batches, batch);
+    }
+
+    output_flush(); // the writer has the output to itself from here
+    setCodeSectionForSegfaultHandler("run_stream : calling the function");
+#ifdef STREAM_THREADS
+    // the calls stay on this thread, where a crash in the function can be caught like any other
+    pthread_t reader, writer;
+    pthread_create(&reader, NULL, reader_thread, &stream);
+    pthread_create(&writer, NULL, writer_thread, &stream);
+    bool last;
+    do {
+        StreamBatch* batch = queue_pop(&stream.to_invoke);
+        invoke_batch(&stream, batch);
+        last = batch->last;
+        queue_push(&stream.to_write, batch);
+    } while (!last);
+    pthread_join(reader, NULL);
+    pthread_join(writer, NULL);
+#else
+    bool last;
+    do {
+        StreamBatch* batch = queue_pop(&stream.free_batches);
+        read_batch(&stream, batch);
+        invoke_batch(&stream, batch);
+        write_batch(&stream, batch);
+        last = batch->last;
+        queue_push(&stream.free_batches, batch);
+    } while (!last);
+#endif
+    unsetCodeSectionForSegfaultHandler();
+
+    for (int i = 0; i < STREAM_BATCHES; i++) {
+        free(batches[i].data);
+        free(batches[i].fields);
+        free(batches[i].results);
+        free(batches[i].strings);
+    }
+    queue_destroy(&stream.free_batches);
+    queue_destroy(&stream.to_invoke);
+    queue_destroy(&stream.to_write);
+    free_prepared_cif(stream.cif);
+    free(stream.values);
+    free(stream.carry);
+    free(stream.placeholders);
+    free(call_argv); // the placeholder names stay, as the variables they name do
+    if (stream.error != NULL) {
+        char error[512];
+        snprintf(error, sizeof(error), "%s", stream.error);
+        free(stream.error);
+        raiseException(1,  "%s", error);
+    }
+    return stream.records_read;
+}
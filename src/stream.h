@@ -0,0 +1,32 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+// Stream mode runs one call for every record read from stdin, like an in-process xargs:
+//
+//   cliffi --stream[=csv|tsv|binary] <library> <return_typeflag> <function_name> [args..]
+//
+// where each {} among the args is a placeholder, filled by the next field of each record in turn. Placeholders need a
+// type flag (eg -i {} or -s {}), and can only be numbers, chars, bools, strings or P pointers.
+// CSV (the default) has one record per line with "quoted" fields allowed, TSV splits lines on tabs only, and binary
+// records are a run of fields each given as a 32 bit little-endian length followed by that many bytes, which are the
+// value in native byte order for numbers or the characters for strings.
+//
+// The call is prepared once and then invoked straight from the parsed fields, with reading and parsing, calling, and
+// formatting the results each on their own thread, so a batch of records can be parsed while the previous one is being
+// called and the one before that printed. Each record's return value is printed on its own line, or as
+// {"record": <n>, "return": <value>} with --format=jsonl|cbor.
+
+typedef enum {
+    STREAM_INPUT_CSV,
+    STREAM_INPUT_TSV,
+    STREAM_INPUT_BINARY,
+} StreamInputFormat;
+
+// parses csv, tsv or binary, raising an exception for anything else
+StreamInputFormat parse_stream_input_format(const char* name);
+
+// argv starts at the library. Returns the number of records processed, raising an exception for bad input,
+// in which case the records before the bad one will still have been run.
+unsigned long long run_stream(int argc, char** argv, StreamInputFormat format);
+
+#endif // STREAM_H
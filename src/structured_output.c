@@ -0,0 +1,410 @@
+#include "structured_output.h"
+#include "exception_handling.h"
+#include "invoke_handler.h"
+#include "number_formatter.h"
+#include "output_buffer.h"
+#include "return_formatter.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// The writer streams straight into the output buffer as it walks the ArgInfo tree, so it never allocates.
+// Containers are written with definite lengths in CBOR, so callers always pass the element count up front.
+
+static OutputFormat current_format = OUTPUT_FORMAT_TEXT;
+
+void set_output_format(OutputFormat format) {
+    current_format = format;
+}
+
+OutputFormat get_output_format() {
+    return current_format;
+}
+
+bool is_structured_output_format() {
+    return current_format != OUTPUT_FORMAT_TEXT;
+}
+
+OutputFormat parse_output_format(const char* name) {
+    if (strcmp(name, "text") == 0) return OUTPUT_FORMAT_TEXT;
+    if (strcmp(name, "jsonl") == 0 || strcmp(name, "json") == 0) return OUTPUT_FORMAT_JSONL;
+    if (strcmp(name, "cbor") == 0) return OUTPUT_FORMAT_CBOR;
+    raiseException(1,  "Error: Unknown output format %s, expected text, jsonl or cbor\n", name);
+    return OUTPUT_FORMAT_TEXT; // unreachable
+}
+
+// JSON needs to know whether to put a comma before the next value, at each level of nesting
+#define MAX_NESTING 64
+static bool json_needs_comma[MAX_NESTING];
+static int json_depth = 0;
+static bool json_after_key = false;
+
+static void json_before_value() {
+    if (json_after_key) {
+        json_after_key = false;
+        return;
+    }
+    if (json_needs_comma[json_depth]) output_putc(',');
+    json_needs_comma[json_depth] = true;
+}
+
+static void json_open(char bracket) {
+    json_before_value();
+    if (json_depth + 1 >= MAX_NESTING) {
+        raiseException(1,  "Error: Value is nested too deeply to format\n");
+    }
+    output_putc(bracket);
+    json_needs_comma[++json_depth] = false;
+}
+
+static void json_close(char bracket) {
+    json_depth--;
+    output_putc(bracket);
+}
+
+static void json_write_string(const char* str, size_t length) {
+    static const char hex_digits[] = "0123456789abcdef";
+    output_putc('"');
+    size_t run_start = 0;
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)str[i];
+        if (c >= 0x20 && c != '"' && c != '\\' && c < 0x7f) continue;
+        output_write(str + run_start, i - run_start); // write out the plain run before this character in one go
+        run_start = i + 1;
+        switch (c) {
+            case '"': output_puts("\\\""); break;
+            case '\\': output_puts("\\\\"); break;
+            case '\n': output_puts("\\n"); break;
+            case '\r': output_puts("\\r"); break;
+            case '\t': output_puts("\\t"); break;
+            default: { // bytes are mapped to the code point of the same value, like latin-1
+                char escape[6] = {'\\', 'u', '0', '0', hex_digits[c >> 4], hex_digits[c & 0xf]};
+                output_write(escape, sizeof(escape));
+            }
+        }
+    }
+    output_write(str + run_start, length - run_start);
+    output_putc('"');
+}
+
+// CBOR major types
+#define CBOR_UNSIGNED 0
+#define CBOR_NEGATIVE 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_SIMPLE 7
+
+static void cbor_write_head(unsigned char major, uint64_t argument) {
+    unsigned char head[9];
+    size_t length;
+    if (argument < 24) {
+        head[0] = (unsigned char)(major << 5 | argument);
+        length = 1;
+    } else if (argument <= UINT8_MAX) {
+        head[0] = (unsigned char)(major << 5 | 24);
+        length = 2;
+    } else if (argument <= UINT16_MAX) {
+        head[0] = (unsigned char)(major << 5 | 25);
+        length = 3;
+    } else if (argument <= UINT32_MAX) {
+        head[0] = (unsigned char)(major << 5 | 26);
+        length = 5;
+    } else {
+        head[0] = (unsigned char)(major << 5 | 27);
+        length = 9;
+    }
+    for (size_t i = 1; i < length; i++) { // big endian
+        head[i] = (unsigned char)(argument >> (8 * (length - 1 - i)));
+    }
+    output_write((const char*)head, length);
+}
+
+static void write_map_start(size_t entries) {
+    if (current_format == OUTPUT_FORMAT_CBOR) cbor_write_head(CBOR_MAP, entries);
+    else json_open('{');
+}
+
+static void write_map_end() {
+    if (current_format == OUTPUT_FORMAT_JSONL) json_close('}');
+}
+
+static void write_array_start(size_t elements) {
+    if (current_format == OUTPUT_FORMAT_CBOR) cbor_write_head(CBOR_ARRAY, elements);
+    else json_open('[');
+}
+
+static void write_array_end() {
+    if (current_format == OUTPUT_FORMAT_JSONL) json_close(']');
+}
+
+static void write_text(const char* str, size_t length) {
+    if (current_format == OUTPUT_FORMAT_CBOR) {
+        cbor_write_head(CBOR_TEXT, length);
+        output_write(str, length);
+    } else {
+        json_before_value();
+        json_write_string(str, length);
+    }
+}
+
+// raw memory such as char arrays, which isn't necessarily valid utf-8
+static void write_bytes(const char* data, size_t length) {
+    if (current_format == OUTPUT_FORMAT_CBOR) {
+        cbor_write_head(CBOR_BYTES, length);
+        output_write(data, length);
+    } else {
+        json_before_value();
+        json_write_string(data, length);
+    }
+}
+
+static void write_key(const char* key) {
+    write_text(key, strlen(key));
+    if (current_format == OUTPUT_FORMAT_JSONL) {
+        output_putc(':');
+        json_after_key = true;
+    }
+}
+
+static void write_signed(int64_t value) {
+    if (current_format == OUTPUT_FORMAT_CBOR) {
+        if (value >= 0) cbor_write_head(CBOR_UNSIGNED, (uint64_t)value);
+        else cbor_write_head(CBOR_NEGATIVE, (uint64_t)(-(value + 1)));
+    } else {
+        json_before_value();
+        char formatted[NUMBER_FORMAT_BUFFER_SIZE];
+        output_write(formatted, format_int64(value, formatted));
+    }
+}
+
+static void write_unsigned(uint64_t value) {
+    if (current_format == OUTPUT_FORMAT_CBOR) {
+        cbor_write_head(CBOR_UNSIGNED, value);
+    } else {
+        json_before_value();
+        char formatted[NUMBER_FORMAT_BUFFER_SIZE];
+        output_write(formatted, format_uint64(value, formatted));
+    }
+}
+
+static void write_null() {
+    if (current_format == OUTPUT_FORMAT_CBOR) {
+        cbor_write_head(CBOR_SIMPLE, 22);
+    } else {
+        json_before_value();
+        output_puts("null");
+    }
+}
+
+static void write_bool(bool value) {
+    if (current_format == OUTPUT_FORMAT_CBOR) {
+        cbor_write_head(CBOR_SIMPLE, value ? 21 : 20);
+    } else {
+        json_before_value();
+        output_puts(value ? "true" : "false");
+    }
+}
+
+static void write_float(float value) {
+    if (current_format == OUTPUT_FORMAT_CBOR) {
+        uint32_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        unsigned char encoded[5] = {CBOR_SIMPLE << 5 | 26, bits >> 24, bits >> 16, bits >> 8, bits};
+        output_write((const char*)encoded, sizeof(encoded));
+    } else if (!isfinite(value)) {
+        write_null(); // json has no nan or infinity
+    } else {
+        json_before_value();
+        char formatted[NUMBER_FORMAT_BUFFER_SIZE];
+        output_write(formatted, format_float_shortest(value, formatted));
+    }
+}
+
+static void write_double(double value) {
+    if (current_format == OUTPUT_FORMAT_CBOR) {
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        unsigned char encoded[9];
+        encoded[0] = CBOR_SIMPLE << 5 | 27;
+        for (int i = 0; i < 8; i++) encoded[1 + i] = (unsigned char)(bits >> (8 * (7 - i)));
+        output_write((const char*)encoded, sizeof(encoded));
+    } else if (!isfinite(value)) {
+        write_null();
+    } else {
+        json_before_value();
+        char formatted[NUMBER_FORMAT_BUFFER_SIZE];
+        output_write(formatted, format_double_shortest(value, formatted));
+    }
+}
+
+// the structured counterpart of print_arg_value in return_formatter.c
+static void write_scalar_value(const void* value, ArgType type, size_t offset, int pointer_depth) {
+    if (pointer_depth > 0) {
+        value = (const char*)value + offset * sizeof(void*);
+        for (int j = 0; j < pointer_depth; j++) {
+            value = *(void* const*)value;
+            if (value == NULL) {
+                write_null();
+                return;
+            }
+        }
+        offset = 0;
+    }
+    size_t size = typeToSize(type, 0);
+    if (size == 0) {
+        raiseException(1,  "Size of type %s is 0\n", typeToString(type));
+    }
+    // copy it out rather than dereferencing, since the value may be unaligned
+    union {
+        char c; short s; int i; long l;
+        unsigned char uc; unsigned short us; unsigned int ui; unsigned long ul;
+        float f; double d; char* str; void* ptr; bool b;
+    } scalar;
+    memcpy(&scalar, (const char*)value + offset * size, size);
+
+    switch (type) {
+        case TYPE_CHAR: write_bytes(&scalar.c, 1); break;
+        case TYPE_SHORT: write_signed(scalar.s); break;
+        case TYPE_INT: write_signed(scalar.i); break;
+        case TYPE_LONG: write_signed(scalar.l); break;
+        case TYPE_UCHAR: write_unsigned(scalar.uc); break;
+        case TYPE_USHORT: write_unsigned(scalar.us); break;
+        case TYPE_UINT: write_unsigned(scalar.ui); break;
+        case TYPE_ULONG: write_unsigned(scalar.ul); break;
+        case TYPE_FLOAT: write_float(scalar.f); break;
+        case TYPE_DOUBLE: write_double(scalar.d); break;
+        case TYPE_BOOL: write_bool(scalar.b); break;
+        case TYPE_STRING:
+            if (scalar.str == NULL) write_null();
+            else write_text(scalar.str, strlen(scalar.str));
+            break;
+        case TYPE_VOIDPOINTER: write_unsigned((uintptr_t)scalar.ptr); break;
+        default:
+            raiseException(1,  "Cannot format a value of type %s\n", typeToString(type));
+    }
+}
+
+static void write_arg_record(const ArgInfo* arg, int index, const size_t* offset);
+
+static void write_struct_fields(const ArgInfo* arg) {
+    const StructInfo* struct_info = arg->struct_info;
+    unsigned int field_count = struct_info->info.arg_count;
+    size_t offsets[field_count > 0 ? field_count : 1];
+    get_struct_field_offsets(arg, offsets);
+    write_array_start(field_count);
+    for (unsigned int i = 0; i < field_count; i++) {
+        write_arg_record(struct_info->info.args[i], -1, &offsets[i]);
+    }
+    write_array_end();
+}
+
+// the structured counterpart of format_and_print_arg_value
+static void write_arg_value(const ArgInfo* arg) {
+    if (arg->type == TYPE_VOID) {
+        write_null();
+        return;
+    }
+    const void* value = arg->value;
+    for (int j = 0; j < arg->pointer_depth; j++) {
+        value = *(void* const*)value;
+        if (value == NULL) {
+            write_null();
+            return;
+        }
+    }
+    if (!arg->is_array) {
+        write_scalar_value(value, arg->type, 0, 0);
+        return;
+    }
+    value = *(void* const*)value; // because arrays are stored as pointers
+    size_t array_size = get_size_for_arginfo_sized_array(arg);
+    if (value == NULL) {
+        write_null();
+    } else if (arg->type == TYPE_CHAR && arg->array_value_pointer_depth == 0) {
+        write_bytes((const char*)value, array_size);
+    } else if (arg->type == TYPE_UCHAR && arg->array_value_pointer_depth == 0 && current_format == OUTPUT_FORMAT_CBOR) {
+        write_bytes((const char*)value, array_size);
+    } else {
+        write_array_start(array_size);
+        for (size_t i = 0; i < array_size; i++) {
+            write_scalar_value(value, arg->type, i, arg->array_value_pointer_depth);
+        }
+        write_array_end();
+    }
+}
+
+// index is -1 for anything other than function arguments, offset is NULL for anything other than struct fields
+static void write_arg_record(const ArgInfo* arg, int index, const size_t* offset) {
+    write_map_start(2 + (index >= 0) + (offset != NULL));
+    if (index >= 0) {
+        write_key("index");
+        write_signed(index);
+    }
+    if (offset != NULL) {
+        write_key("offset");
+        write_unsigned(*offset);
+    }
+    char type_description[128];
+    size_t type_length = format_arg_type(arg, type_description, sizeof(type_description));
+    write_key("type");
+    write_text(type_description, type_length);
+    if (arg->type == TYPE_STRUCT) {
+        write_key("fields");
+        write_struct_fields(arg);
+    } else {
+        write_key("value");
+        write_arg_value(arg);
+    }
+    write_map_end();
+}
+
+static bool could_have_been_modified(const ArgInfo* arg) {
+    return arg->is_array || arg->pointer_depth > 0;
+}
+
+void structured_print_function_return(const FunctionCallInfo* call_info) {
+    json_depth = 0;
+    json_needs_comma[0] = false;
+    json_after_key = false;
+
+    write_map_start(4);
+    write_key("function");
+    if (call_info->function_name != NULL) write_text(call_info->function_name, strlen(call_info->function_name));
+    else write_null();
+    write_key("library");
+    if (call_info->library_path != NULL) write_text(call_info->library_path, strlen(call_info->library_path));
+    else write_null();
+    write_key("return");
+    write_arg_record(call_info->info.return_var, -1, NULL);
+
+    size_t modifiable_args = 0;
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        if (could_have_been_modified(call_info->info.args[i])) modifiable_args++;
+    }
+    write_key("args");
+    write_array_start(modifiable_args);
+    for (unsigned int i = 0; i < call_info->info.arg_count; i++) {
+        if (could_have_been_modified(call_info->info.args[i])) write_arg_record(call_info->info.args[i], (int)i, NULL);
+    }
+    write_array_end();
+    write_map_end();
+
+    if (current_format == OUTPUT_FORMAT_JSONL) output_putc('\n');
+}
+
+void structured_print_stream_record(uint64_t record, const ArgInfo* return_var) {
+    json_depth = 0;
+    json_needs_comma[0] = false;
+    json_after_key = false;
+
+    write_map_start(2);
+    write_key("record");
+    write_unsigned(record);
+    write_key("return");
+    write_arg_record(return_var, -1, NULL);
+    write_map_end();
+
+    if (current_format == OUTPUT_FORMAT_JSONL) output_putc('\n');
+}
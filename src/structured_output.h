@@ -0,0 +1,31 @@
+#ifndef STRUCTURED_OUTPUT_H
+#define STRUCTURED_OUTPUT_H
+
+#include "types_and_utils.h"
+#include <stdbool.h>
+
+// Machine readable alternatives to the "Function returned: ..." text output.
+// Each call produces one record: a line of JSON for jsonl, or one CBOR data item (so the stream is a CBOR sequence) for cbor.
+// Records look like
+//   {"function": <name>, "library": <path>, "return": <value>, "args": [<value>..]}
+// where each value is {"type": <type description>, "value": <value>} with "index" added for args,
+// and structs are {"type": ..., "fields": [{"offset": <bytes>, "type": ..., "value": ...}..]}.
+// Only args that the function could have modified (arrays and pointers) are included, same as the text output.
+
+typedef enum {
+    OUTPUT_FORMAT_TEXT,
+    OUTPUT_FORMAT_JSONL,
+    OUTPUT_FORMAT_CBOR,
+} OutputFormat;
+
+void set_output_format(OutputFormat format);
+OutputFormat get_output_format();
+bool is_structured_output_format();
+// parses text, jsonl or cbor, raising an exception for anything else
+OutputFormat parse_output_format(const char* name);
+
+void structured_print_function_return(const FunctionCallInfo* call_info);
+// For --stream, which prints a smaller record per input record: {"record": <number from 0>, "return": <value>}
+void structured_print_stream_record(uint64_t record, const ArgInfo* return_var);
+
+#endif // STRUCTURED_OUTPUT_H
@@ -1,95 +1,70 @@
-
+#include "tokenize.h"
+#include "arena.h"
 #include <ctype.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-// adapted from https://stackoverflow.com/a/69808797/10773089
-char** shlex_split(const char* s, int* num_tokens) {
-    char** result = NULL;
-    int capacity = 0;
-    int size = 0;
+// Originally adapted from https://stackoverflow.com/a/69808797/10773089, which built each token up in its own growing buffer.
+// Here each token is written back into the line it came from: the write position never gets ahead of the read position,
+// so plain tokens stay exactly where they are and are just null terminated, and only quotes and escapes shift anything.
+int tokenize_in_place(char* line, size_t length, int* argc, char*** argv) {
+    // every token but an empty "" takes at least one character and one separator, and "" takes two, so this is enough
+    char** tokens = arena_alloc(command_arena(), (length / 2 + 2) * sizeof(char*));
+    int count = 0;
 
-    char* token = NULL;
-    int token_size = 0;
-    int token_capacity = 0;
+    char* read = line;
+    char* end = line + length;
+    char* write = line;
+    char* token = NULL; // where the current token starts, if we're in one
 
     char quote = '\0';
-    int escape = 0;
+    bool escape = false;
 
-    for (const char* p = s; *p != '\0'; p++) {
-        char c = *p;
+    for (; read < end; read++) {
+        char c = *read;
 
         if (escape) {
-            escape = 0;
+            escape = false;
+            if (token == NULL) token = write;
             if (quote && c != '\\' && c != quote) {
-                if (token_size + 1 >= token_capacity) {
-                    token_capacity = (token_capacity == 0) ? 16 : token_capacity * 2;
-                    token = realloc(token, token_capacity);
-                }
-                token[token_size++] = '\\';
-            }
-            if (token_size + 1 >= token_capacity) {
-                token_capacity = (token_capacity == 0) ? 16 : token_capacity * 2;
-                token = realloc(token, token_capacity);
+                *write++ = '\\';
             }
-            token[token_size++] = c;
+            *write++ = c;
         } else if (c == '\\') {
-            escape = 1;
+            escape = true;
         } else if (!quote && (c == '\'' || c == '\"')) {
             quote = c;
         } else if (quote && c == quote) {
             quote = '\0';
-            if (token_size == 0) {
-                if (size + 1 >= capacity) {
-                    capacity = (capacity == 0) ? 16 : capacity * 2;
-                    result = realloc(result, capacity * sizeof(char*));
-                }
-                result[size++] = strdup("");
-            }
-        } else if (!isspace(c) || quote) {
-            if (token_size + 1 >= token_capacity) {
-                token_capacity = (token_capacity == 0) ? 16 : token_capacity * 2;
-                token = realloc(token, token_capacity);
+            if (token == NULL) { // an empty quoted string is a token of its own
+                *write = '\0';
+                tokens[count++] = write++;
+                token = NULL;
             }
-            token[token_size++] = c;
-        } else if (token_size > 0) {
-            if (size + 1 >= capacity) {
-                capacity = (capacity == 0) ? 16 : capacity * 2;
-                result = realloc(result, capacity * sizeof(char*));
-            }
-            token[token_size] = '\0';
-            result[size++] = token;
+        } else if (!isspace((unsigned char)c) || quote) {
+            if (token == NULL) token = write;
+            *write++ = c;
+        } else if (token != NULL) {
+            *write++ = '\0'; // overwrites at most the separator we're looking at
+            tokens[count++] = token;
             token = NULL;
-            token_size = 0;
-            token_capacity = 0;
-        }
-    }
-
-    if (token_size > 0) {
-        if (size + 1 >= capacity) {
-            capacity = (capacity == 0) ? 16 : capacity * 2;
-            result = realloc(result, capacity * sizeof(char*));
         }
-        token[token_size] = '\0';
-        result[size++] = token;
     }
 
-    if (size + 1 >= capacity) {
-        capacity = (capacity == 0) ? 16 : capacity * 2;
-        result = realloc(result, capacity * sizeof(char*));
+    if (token != NULL) {
+        *write = '\0'; // at or before end, which is where the line's own terminator is
+        tokens[count++] = token;
     }
-    result[size] = NULL;
+    tokens[count] = NULL;
 
-    *num_tokens = size;
-    return result;
+    *argc = count;
+    *argv = tokens;
+    return 0;
 }
 
 int tokenize(const char* str, int* argc, char*** argv) {
-    *argv = shlex_split(str, argc);
-    if (*argv == NULL) {
-        fprintf(stderr, "Error: Memory allocation failed.\n");
-        return -1;
-    }
-    return 0;
+    size_t length = strlen(str);
+    return tokenize_in_place(arena_strndup(command_arena(), str, length), length, argc, argv);
 }
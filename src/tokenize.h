@@ -1,6 +1,14 @@
 #ifndef TOKENIZE_H
 #define TOKENIZE_H
 
+#include <stddef.h>
+
+// Splits a command line into a NULL terminated argv the way a shell would, honouring quotes and backslash escapes.
+// The tokens live in the command arena (see arena.h), so they must not be freed and only last until the command finishes.
 int tokenize(const char* str, int* argc, char*** argv);
 
-#endif
\ No newline at end of file
+// The same, but the tokens are cut out of line itself (which must be null terminated at length) and overwrite it. Nothing is copied
+// unless quotes or escapes mean a token has to be shifted down over them. Only argv comes from the command arena.
+int tokenize_in_place(char* line, size_t length, int* argc, char*** argv);
+
+#endif
@@ -10,7 +10,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include "exception_handling.h"
+#include "output_buffer.h"
+#include "arena.h"
+#include "array_parser.h"
+#include "hex_decoder.h"
+#include "structured_output.h"
+
+#if defined(_WIN32) || defined(_WIN64)
+#include <windows.h>
+#endif
 
 
 char* trim_whitespace(char* str)
@@ -43,7 +53,7 @@ char* trim_whitespace(char* str)
 
     if (frontp != str && endp == frontp) {
         // Empty string
-        *(isspace((unsigned char)*endp) ? str : (endp + 1)) = '\0';
+        *(isspace((unsigned char)*endp) || *endp == '\0' ? str : (endp + 1)) = '\0'; // not past the end when it's all whitespace
     } else if (str + len - 1 != endp)
         *(endp + 1) = '\0';
 
@@ -309,22 +319,9 @@ void* hex_string_to_bytes(const char* hexStr) {
     size_t len = strlen(hexStr);
     if (len == 0 || len % 2 != 0) return NULL; // Hex string length must be non-zero and even
 
-    size_t finalLen = len / 2;
-    unsigned char* output = malloc(finalLen);
+    unsigned char* output = malloc(hex_literal_max_decoded_length(len));
     if (!output) return NULL;
-
-    for (size_t i = 0, j = 0; i < len; i += 2, j++) {
-        int val1 = isxdigit(hexStr[i]) ? (isdigit(hexStr[i]) ? hexStr[i] - '0' : toupper(hexStr[i]) - 'A' + 10) : -1;
-        int val2 = isxdigit(hexStr[i + 1]) ? (isdigit(hexStr[i + 1]) ? hexStr[i + 1] - '0' : toupper(hexStr[i + 1]) - 'A' + 10) : -1;
-
-        if (val1 < 0 || val2 < 0) {
-            // free(output); // Cleanup on error
-            raiseException(1,  "Error: Invalid hex character in string: %s\n", hexStr);
-        }
-
-        output[j] = (unsigned char)((val1 << 4) + val2);
-    }
-
+    decode_hex_literal(hexStr, len, output);
     return output;
 }
 
@@ -480,15 +477,31 @@ void handle_array_arginfo_conversion(ArgInfo* arg, const char* argStr) {
 
     // if (arg->is_array==ARRAY_STATIC_SIZE) {
 
+    // @path reads the same literal syntax from a file, where newlines and other whitespace also separate values
+    // (the contents are read into the command arena, and released back to file_start once parsed, or with the command if
+    // that raises)
+    ArenaMark file_start = arena_mark(command_arena());
+    bool from_file = argStr[0] == '@';
+    if (from_file) {
+        const char* path = argStr + 1;
+        size_t file_length;
+        argStr = trim_whitespace(read_array_literal_file(path, &file_length));
+        if (strlen(argStr) == 0) {
+            raiseException(1,  "Error: Array file %s is empty\n", path);
+        }
+    }
+
     if ((strcmp(argStr, "0") == 0 || strcmp(argStr, "NULL") == 0 || strcmp(argStr, "null") == 0)) {
         fprintf(stderr, "Setting an array to NULL this way is deprecated. Please use the newer more flexible syntax, replacing the dash in the type with an N, like Nai4 for a null array of 4 ints");
         if (arg->is_array == ARRAY_STATIC_SIZE) {
             arg->value->ptr_val = calloc(arg->static_or_implied_size, typeToSize(arg->type, arg->array_value_pointer_depth));
+            arena_release(command_arena(), file_start);
             return;
         } else if (arg->is_array == ARRAY_SIZE_AT_ARGNUM) {
             // fprintf(stderr, "Warning: We have not yet implemented initializing null arrays of size pointed to by another argument, so this will be a null pointer for now\n");
             // we've now implemented this in second_pass_arginfo_ptr_sized_null_array_initialization, so we can just return
             arg->value->ptr_val = NULL;
+            arena_release(command_arena(), file_start);
             return;
         } else {
             raiseException(1,  "Error: Argstr %s is interpreted as NULL. We cannot initialize a null array with no sizing info. If you WANT a null pointer you should use the pointer flag instead\n", argStr);
@@ -500,51 +513,49 @@ void handle_array_arginfo_conversion(ArgInfo* arg, const char* argStr) {
     // 2. single value that is a hex string, which is the raw values for the array
     // 3. comma delimitted list of values for the array
 
-    // Step 1: Split string by commas and count substrings
+    // Step 1: Count the elements, so that the array can be allocated once
     size_t array_size_implicit;
+    size_t array_size_allocated;
     void* array_values;
     size_t size_of_type = typeToSize(arg->type, arg->array_value_pointer_depth);
 
-    int count = 1;
-    for (const char* p = argStr; *p; p++) {
-        if (*p == ',') count++;
-    }
+    size_t argStr_length = strlen(argStr);
+    size_t count = count_array_literal_elements(argStr, argStr_length, from_file);
 
-    if (count == 1) {
-        if (isHexFormat(argStr)) {
+    if (count == 1 || (from_file && is_hex_array_literal(argStr))) { // in a file, the whitespace between hex bytes would otherwise count as separating elements
+        if (is_hex_array_literal(argStr)) {
             if (arg->array_value_pointer_depth > 0) {
                 raiseException(1,  "Error: You can't use the hex array initialization method with an array of pointer types");
             }
             // consider argstr to be a hex string containing the raw values for the array (mostly only useful for char arrays)
-            int hexstring_bytes = (strlen(argStr) - 2) / 2;
             if (size_of_type == 0) {
                 raiseException(1,  "Error: Unsupported type for array: %c\n with size of 0", typeToChar(arg->type));
             }
+            // decode straight into the final array, making it big enough for an explicit size up front so it won't need copying again
+            size_t capacity = hex_literal_max_decoded_length(argStr_length);
+            if (arg->is_array == ARRAY_STATIC_SIZE && arg->static_or_implied_size * size_of_type > capacity) {
+                capacity = arg->static_or_implied_size * size_of_type;
+            }
+            array_values = calloc(capacity > 0 ? capacity : 1, 1);
+            if (array_values == NULL) {
+                raiseException(1,  "Error: Failed to allocate memory for hex array of %zu bytes\n", capacity);
+            }
+            size_t hexstring_bytes = decode_hex_literal(argStr, argStr_length, array_values);
             if (hexstring_bytes % size_of_type != 0) {
-                raiseException(1,  "Error: Hex string bytes length %d is not a multiple of the size of the type %zu\n in hex string being converted to array %s", hexstring_bytes, size_of_type, argStr);
+                raiseException(1,  "Error: Hex string bytes length %zu is not a multiple of the size of the type %zu\n in hex string being converted to array %s", hexstring_bytes, size_of_type, argStr);
             }
             array_size_implicit = hexstring_bytes / size_of_type;
-            array_values = hex_string_to_bytes(argStr);
+            array_size_allocated = capacity / size_of_type;
         } else {
-            fprintf(stderr, "Warning: In argstr %s, no valid hex value found, no static or dynamic size found, and no commas found to delimit values. We'll attempt to parse it as a single element array, but that's probably not what you intended.\n", argStr);
+            if (!from_file) fprintf(stderr, "Warning: In argstr %s, no valid hex value found, no static or dynamic size found, and no commas found to delimit values. We'll attempt to parse it as a single element array, but that's probably not what you intended.\n", argStr);
             goto parseascommadelimited;
         }
     } else
     parseascommadelimited: { // if we didn't already parse it as a hex string, then we'll parse it as a comma delimitted list of values
-        array_size_implicit = count;
-        array_values = calloc(count, size_of_type);
-        char* rest = strdup(argStr);
-        for (int i = 0; i < count; i++) {
-            char* token = strtok_r(rest, ",", &rest);
-            if (token == NULL) {
-                raiseException(1,  "Error: Failed to tokenize array string %s, probably an off by one error\n", argStr);
-            }
-            void* convertedValue = convert_to_type(arg->type, token);
-            convertedValue = makePointerLevel(convertedValue, arg->array_value_pointer_depth);
-            memcpy(array_values + (i * size_of_type), convertedValue, size_of_type);
-            free(convertedValue);
-        }
+        array_values = parse_array_literal(argStr, argStr_length, arg->type, arg->array_value_pointer_depth, from_file, &array_size_implicit);
+        array_size_allocated = array_size_implicit;
     }
+    arena_release(command_arena(), file_start);
         if (arg->is_array == ARRAY_STATIC_SIZE_UNSET) {
             arg->is_array = ARRAY_STATIC_SIZE;
             arg->static_or_implied_size = array_size_implicit;
@@ -558,9 +569,13 @@ void handle_array_arginfo_conversion(ArgInfo* arg, const char* argStr) {
                 arg->static_or_implied_size = explicit_size;
             } else if (explicit_size > implicit_size) {
                 fprintf(stderr, "Warning: Array was specified to have size %zu, but the value implies a size of %zu. Filling the rest of the array with null bytes\n", explicit_size, implicit_size);
-                arg->value->ptr_val = calloc(explicit_size, size_of_type);
-                memcpy(arg->value->ptr_val, array_values, implicit_size * size_of_type);
-                free(array_values);
+                if (array_size_allocated >= explicit_size) { // already zero filled
+                    arg->value->ptr_val = array_values;
+                } else {
+                    arg->value->ptr_val = calloc(explicit_size, size_of_type);
+                    memcpy(arg->value->ptr_val, array_values, implicit_size * size_of_type);
+                    free(array_values);
+                }
             } else {
                 arg->value->ptr_val = array_values;
                 arg->static_or_implied_size = explicit_size;
@@ -880,40 +895,41 @@ size_t get_size_for_arginfo_sized_array(const ArgInfo* arg) {
 
 void log_function_call_info(FunctionCallInfo* info) {
     // this should all be fprintf(stderr, ...)
+    if (output_is_quiet() || is_structured_output_format()) return; // keep the structured output parseable
     if (!info) {
-        printf("No function call info to display.\n");
+        output_puts("No function call info to display.\n");
         return;
     }
-    printf("FunctionCallInfo:\n");
-    printf("\tLibrary Path: %s\n", info->library_path);
-    printf("\tFunction Name: %s\n", info->function_name);
-    printf("\tReturn type: ");
+    output_puts("FunctionCallInfo:\n");
+    output_printf("\tLibrary Path: %s\n", info->library_path);
+    output_printf("\tFunction Name: %s\n", info->function_name);
+    output_puts("\tReturn type: ");
     format_and_print_arg_type(info->info.return_var);
-    printf("\n");
-    printf("\tArg Count: %d\n", info->info.arg_count);
+    output_puts("\n");
+    output_printf("\tArg Count: %d\n", info->info.arg_count);
     for (int i = 0; i < info->info.arg_count; i++) {
-        if (info->info.vararg_start == i) printf("\tVarargs start here\n");
-        printf("\tArg %d: %s ", i, info->info.args[i]->explicitType ? "(explicit)" : "(inferred)");
+        if (info->info.vararg_start == i) output_puts("\tVarargs start here\n");
+        output_printf("\tArg %d: %s ", i, info->info.args[i]->explicitType ? "(explicit)" : "(inferred)");
         format_and_print_arg_type(info->info.args[i]); //, format_buffer, buffer_size);
-        printf(" = ");
+        output_puts(" = ");
         format_and_print_arg_value(info->info.args[i]); //, format_buffer, buffer_size);
-        printf("\n");
+        output_puts("\n");
     }
 
     // print as function signature
     format_and_print_arg_type(info->info.return_var);
-    printf(" %s(", info->function_name);
+    output_printf(" %s(", info->function_name);
     for (int i = 0; i < info->info.arg_count; i++) {
         format_and_print_arg_type(info->info.args[i]);
-        printf(" ");
+        output_puts(" ");
         if (info->info.args[i]->is_array) {
-            printf("{...}");
+            output_puts("{...}");
         } else {
             format_and_print_arg_value(info->info.args[i]);
         }
-        if (i < info->info.arg_count - 1) printf(", ");
+        if (i < info->info.arg_count - 1) output_puts(", ");
     }
-    printf(")\n");
+    output_puts(")\n");
 }
 
 
@@ -1237,4 +1253,18 @@ void castArgValueToType(ArgInfo* destinationTypedArg, ArgInfo* sourceValueArg){
 //         free(info->args);
 //         free(info);
 //         }
-//     }
\ No newline at end of file
+//     }
+
+uint64_t now_ns() {
+#if defined(_WIN32) || defined(_WIN64)
+    static LARGE_INTEGER frequency;
+    if (frequency.QuadPart == 0) QueryPerformanceFrequency(&frequency);
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+#endif
+}
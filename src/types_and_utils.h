@@ -83,6 +83,7 @@ typedef struct FunctionCallInfo {
     char* library_path;
     char* function_name;
     // ArgInfo return_var;
+    struct CallSnapshot* arg_snapshot; // the array and pointer args as they were just before the call, if they were captured
 } FunctionCallInfo;
 
 // Function declarations
@@ -97,6 +98,7 @@ bool isFloatingPoint(const char* str);
 void* hex_string_to_bytes(const char* hexStr);
 void infer_arg_type_from_value(ArgInfo* arg, const char* argval);
 void convert_arg_value(ArgInfo* arg, const char* argStr);
+void* convert_to_type(ArgType type, const char* argStr);
 void log_function_call_info(FunctionCallInfo* info);
 size_t typeToSize(ArgType type, int array_value_pointer_depth);
 
@@ -111,5 +113,8 @@ void* dereferencePointerLevels(void* value, int pointer_depth);
 void castArgValueToType(ArgInfo* destinationTypedArg, ArgInfo* sourceValueArg);
 void set_arg_value_nullish(ArgInfo* arg);
 
+// A monotonic clock, for timing things
+uint64_t now_ns();
+
 
 #endif /* ARG_TOOLS_H */
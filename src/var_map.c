@@ -1,4 +1,5 @@
 #include "types_and_utils.h"
+#include "exception_handling.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -62,7 +63,40 @@ void initializeVarMap() {
     globalMap = createVarMap(8);
 }
 
+FunctionCallInfo* lastCall = NULL;
+
+void setLastCall(FunctionCallInfo* call_info) {
+    lastCall = call_info;
+}
+
+// Returns NULL for names that aren't $_ or $argN
+static ArgInfo* getLastCallResult(const char* name) {
+    bool is_return = strcmp(name, "$_") == 0;
+    bool is_arg = strncmp(name, "$arg", 4) == 0 && name[4] != '\0' && isAllDigits(name + 4);
+    if (!is_return && !is_arg) {
+        return NULL;
+    }
+    if (lastCall == NULL) {
+        raiseException(1,  "Error: No function has been called yet for %s to refer to\n", name);
+    }
+    if (is_return) {
+        if (lastCall->info.return_var->type == TYPE_VOID && lastCall->info.return_var->pointer_depth == 0) {
+            raiseException(1,  "Error: $_ has no value, as %s returned void\n", lastCall->function_name);
+        }
+        return lastCall->info.return_var;
+    }
+    unsigned long index = strtoul(name + 4, NULL, 10);
+    if (index >= lastCall->info.arg_count) {
+        raiseException(1,  "Error: %s doesn't exist, as %s was called with %u args\n", name, lastCall->function_name, lastCall->info.arg_count);
+    }
+    return lastCall->info.args[index];
+}
+
 ArgInfo* getVar(const char* name) {
+    if (name[0] == '$') {
+        ArgInfo* result = getLastCallResult(name);
+        if (result != NULL) return result;
+    }
     if (globalMap == NULL) {
         initializeVarMap();
     }
@@ -74,4 +108,11 @@ void setVar(const char* name, ArgInfo* value) {
         initializeVarMap();
     }
     setVarWithMap(globalMap, name, value);
-}
\ No newline at end of file
+}
+
+void forEachVar(void (*visit)(const char* name, ArgInfo* value, void* context), void* context) {
+    if (globalMap == NULL) return;
+    for (int i = 0; i < globalMap->size; i++) {
+        visit(globalMap->entries[i].name, globalMap->entries[i].value, context);
+    }
+}
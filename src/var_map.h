@@ -3,7 +3,16 @@
 
 #include "types_and_utils.h"
 
+// Besides the variables that have been set, getVar also knows $_, the return value of the last function called,
+// and $arg0, $arg1.. its args as they were left by the call. These are the call's own ArgInfos rather than copies,
+// so they can be passed straight on to another call, or bound to a name with set or let.
 ArgInfo* getVar(const char* name);
 void setVar(const char* name, ArgInfo* value);
 
+// Calls visit with each variable that has been set, in the order they were first set
+void forEachVar(void (*visit)(const char* name, ArgInfo* value, void* context), void* context);
+
+// Called after each successful call, which is what $_ and $argN then refer to
+void setLastCall(FunctionCallInfo* call_info);
+
 #endif // VAR_MAP_H
\ No newline at end of file
@@ -0,0 +1,261 @@
+#include "write_tracking.h"
+#include "exception_handling.h"
+#include "main.h"
+#include "memory_search.h"
+#include "output_buffer.h"
+#include "types_and_utils.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define use_mprotect
+#endif
+
+#ifdef use_mprotect
+typedef struct {
+    uintptr_t start; // whole pages
+    uintptr_t end;
+    size_t first_page; // the index of its first page among all those tracked
+} TrackedRegion;
+
+// Everything the fault handler touches, which is mapped after the regions are gathered and left out of them, so that
+// it's never write protected itself
+typedef struct {
+    TrackedRegion* regions; // in order of address
+    size_t count;
+    size_t page_size;
+    size_t page_total;
+    unsigned char* written; // for each page tracked, whether it's been written to
+    uintptr_t* pages; // those written to, in the order they were
+    size_t page_count;
+    size_t faults;
+    unsigned char* copies; // for each page tracked, what it was before it was first written to
+    size_t copies_size;
+    size_t state_size;
+} WriteTracking;
+
+static WriteTracking* volatile tracking = NULL;
+
+static void* map_memory(size_t size) {
+    void* memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return memory != MAP_FAILED ? memory : NULL;
+}
+
+static bool on_access_fault(void* fault_address) {
+    WriteTracking* state = tracking;
+    if (state == NULL) return false;
+    uintptr_t page = (uintptr_t)fault_address & ~(uintptr_t)(state->page_size - 1);
+    size_t low = 0, high = state->count;
+    while (low < high) {
+        size_t middle = (low + high) / 2;
+        if (state->regions[middle].end <= page) low = middle + 1;
+        else high = middle;
+    }
+    if (low == state->count || page < state->regions[low].start) return false;
+    size_t index = state->regions[low].first_page + (page - state->regions[low].start) / state->page_size;
+    __atomic_add_fetch(&state->faults, 1, __ATOMIC_RELAXED);
+    // Another thread that got to the page first may still be copying it, in which case this one faults again until it's done
+    if (__atomic_exchange_n(&state->written[index], 1, __ATOMIC_ACQ_REL) != 0) return true;
+    memcpy(state->copies + index * state->page_size, (const void*)page, state->page_size);
+    state->pages[__atomic_fetch_add(&state->page_count, 1, __ATOMIC_RELAXED)] = page;
+    return mprotect((void*)page, state->page_size, PROT_READ | PROT_WRITE) == 0;
+}
+
+static int compare_regions(const void* a, const void* b) {
+    uintptr_t left = ((const MemoryRegion*)a)->start, right = ((const MemoryRegion*)b)->start;
+    return left < right ? -1 : left > right;
+}
+
+static int compare_pages(const void* a, const void* b) {
+    uintptr_t left = *(const uintptr_t*)a, right = *(const uintptr_t*)b;
+    return left < right ? -1 : left > right;
+}
+
+// The regions, widened to whole pages and merged where that makes them touch
+static size_t widen_to_pages(MemoryRegions* regions, size_t page_size) {
+    qsort(regions->regions, regions->count, sizeof(MemoryRegion), compare_regions);
+    size_t kept = 0, pages = 0;
+    for (size_t i = 0; i < regions->count; i++) {
+        MemoryRegion region = regions->regions[i];
+        region.start &= ~(uintptr_t)(page_size - 1);
+        region.end = (region.end + page_size - 1) & ~(uintptr_t)(page_size - 1);
+        if (kept > 0 && region.start <= regions->regions[kept - 1].end) {
+            if (region.end > regions->regions[kept - 1].end) regions->regions[kept - 1].end = region.end;
+        } else {
+            regions->regions[kept++] = region;
+        }
+    }
+    regions->count = kept;
+    for (size_t i = 0; i < kept; i++) pages += (regions->regions[i].end - regions->regions[i].start) / page_size;
+    return pages;
+}
+
+static WriteTracking* prepare_tracking(const char* where) {
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    MemoryRegions regions = gather_memory_regions(where, true);
+    size_t pages = widen_to_pages(&regions, page_size);
+    if (pages == 0) {
+        free_memory_regions(&regions);
+        raiseException(1,  "Error: There's nothing writable to track in %s\n", where);
+    }
+    // Sized for the regions as gathered, which leaving out the state and copies only makes smaller
+    size_t state_size = sizeof(WriteTracking) + regions.count * sizeof(TrackedRegion) + pages + pages * sizeof(uintptr_t);
+    state_size = (state_size + page_size - 1) & ~(page_size - 1);
+    WriteTracking* state = map_memory(state_size);
+    unsigned char* copies = state != NULL ? map_memory(pages * page_size) : NULL;
+    if (copies == NULL) {
+        if (state != NULL) munmap(state, state_size);
+        free_memory_regions(&regions);
+        raiseException(1,  "Failed to allocate memory for tracking writes.\n");
+    }
+    // The kernel writes to this thread's control block (its rseq area) while delivering the signal, so a range taking
+    // that in would kill the process rather than fault. The static TLS is next to it
+    uintptr_t thread_local = (uintptr_t)&current_exception_buffer, thread_block = (uintptr_t)pthread_self();
+    uintptr_t thread_start = thread_local < thread_block ? thread_local : thread_block;
+    uintptr_t thread_end = (thread_local > thread_block ? thread_local : thread_block) + 2 * page_size;
+    exclude_memory_range(&regions, thread_start & ~(uintptr_t)(page_size - 1), thread_end & ~(uintptr_t)(page_size - 1));
+    exclude_memory_range(&regions, (uintptr_t)state, (uintptr_t)state + state_size);
+    exclude_memory_range(&regions, (uintptr_t)copies, (uintptr_t)copies + pages * page_size);
+    widen_to_pages(&regions, page_size);
+
+    state->regions = (TrackedRegion*)(state + 1);
+    state->count = regions.count;
+    state->page_size = page_size;
+    state->written = (unsigned char*)(state->regions + regions.count);
+    state->pages = (uintptr_t*)(((uintptr_t)(state->written + pages) + sizeof(uintptr_t) - 1) & ~(uintptr_t)(sizeof(uintptr_t) - 1));
+    state->copies = copies;
+    state->copies_size = pages * page_size;
+    state->state_size = state_size;
+    for (size_t i = 0; i < regions.count; i++) {
+        state->regions[i] = (TrackedRegion){regions.regions[i].start, regions.regions[i].end, state->page_total};
+        state->page_total += (regions.regions[i].end - regions.regions[i].start) / page_size;
+    }
+    free_memory_regions(&regions);
+    return state;
+}
+
+static void free_tracking(WriteTracking* state) {
+    munmap(state->copies, state->copies_size);
+    munmap(state, state->state_size);
+}
+
+static void set_protection(const WriteTracking* state, int protection) {
+    for (size_t i = 0; i < state->count; i++) {
+        mprotect((void*)state->regions[i].start, state->regions[i].end - state->regions[i].start, protection);
+    }
+}
+
+static size_t copy_index(const WriteTracking* state, uintptr_t page) {
+    for (size_t i = 0; i < state->count; i++) {
+        if (page >= state->regions[i].start && page < state->regions[i].end) {
+            return state->regions[i].first_page + (page - state->regions[i].start) / state->page_size;
+        }
+    }
+    return 0;
+}
+
+// Where each line of each page written first differs from its copy (or TRACKWRITES_CACHE_LINE if it doesn't), all
+// found before anything is printed, since describing the addresses and printing them write to the pages in a range too
+static unsigned char* find_changed_lines(WriteTracking* state) {
+    qsort(state->pages, state->page_count, sizeof(uintptr_t), compare_pages);
+    size_t lines_per_page = state->page_size / TRACKWRITES_CACHE_LINE;
+    unsigned char* first_changed = map_memory(state->page_count * lines_per_page + 1); // mmap won't map no bytes
+    if (first_changed == NULL) return NULL;
+    for (size_t p = 0; p < state->page_count; p++) {
+        uintptr_t page = state->pages[p];
+        const unsigned char* before = state->copies + copy_index(state, page) * state->page_size;
+        const unsigned char* after = (const unsigned char*)page;
+        for (size_t line = 0; line < lines_per_page; line++) {
+            size_t first = 0, at = line * TRACKWRITES_CACHE_LINE;
+            while (first < TRACKWRITES_CACHE_LINE && before[at + first] == after[at + first]) first++;
+            first_changed[p * lines_per_page + line] = (unsigned char)first;
+        }
+    }
+    return first_changed;
+}
+
+static void print_writes(const WriteTracking* state, const unsigned char* first_changed, uint64_t took_ns) {
+    size_t lines_per_page = state->page_size / TRACKWRITES_CACHE_LINE;
+    size_t lines_changed = 0;
+    char where[512];
+    for (size_t p = 0; p < state->page_count; p++) {
+        uintptr_t page = state->pages[p];
+        const unsigned char* page_changes = first_changed + p * lines_per_page;
+        size_t changed = 0;
+        for (size_t line = 0; line < lines_per_page; line++) {
+            if (page_changes[line] < TRACKWRITES_CACHE_LINE) changed++;
+        }
+        describe_memory_address(page, where, sizeof(where));
+        if (lines_changed < TRACKWRITES_MAX_PRINTED) {
+            output_printf("%p (%s): %zu of %zu lines changed\n", (void*)page, where, changed, lines_per_page);
+        }
+        for (size_t line = 0; line < lines_per_page; line++) {
+            size_t first = page_changes[line];
+            if (first == TRACKWRITES_CACHE_LINE) continue;
+            if (lines_changed++ >= TRACKWRITES_MAX_PRINTED) continue;
+            uintptr_t at = page + line * TRACKWRITES_CACHE_LINE;
+            describe_memory_address(at + first, where, sizeof(where));
+            output_printf("  line %p: %s\n", (void*)at, where);
+        }
+    }
+    if (lines_changed > TRACKWRITES_MAX_PRINTED) output_printf("(only the first %d lines are printed)\n", TRACKWRITES_MAX_PRINTED);
+    output_printf("Wrote to %zu of %zu pages, changing %zu cache lines, with %zu faults, in %.3f ms\n", state->page_count,
+                  state->page_total, lines_changed, state->faults, took_ns / 1e6);
+}
+
+// Runs the call with the pages read only, and returns whether it raised, the pages being writable again either way.
+// Kept apart so that nothing the caller goes on to set lives across the sigsetjmp
+static bool run_tracked(WriteTracking* state, char* command, int argc, char** argv) {
+    tracking = state;
+    setAccessFaultHandler(on_access_fault);
+    set_protection(state, PROT_READ);
+    // Catches anything the call raises, so that the pages are writable again before it's passed on
+    sigjmp_buf* outer_exception_buffer = current_exception_buffer;
+    sigjmp_buf call_exception_buffer;
+    current_exception_buffer = &call_exception_buffer;
+    bool failed = sigsetjmp(call_exception_buffer, 1) != 0;
+    if (!failed) runTokenizedREPLCommand(command, argc, argv, NULL);
+    current_exception_buffer = outer_exception_buffer;
+    set_protection(state, PROT_READ | PROT_WRITE);
+    setAccessFaultHandler(NULL);
+    tracking = NULL;
+    return failed;
+}
+#endif
+
+void run_trackwrites_command(char* command, int argc, char** argv) {
+    if (argc < 2) {
+        raiseException(1,  "Usage: trackwrites <<start>-<end>|library> <library> <return_typeflag> <function_name> [args..]\n");
+    }
+    if (strcmp(argv[0], "heap") == 0 || strcmp(argv[0], "all") == 0) {
+        raiseException(1,  "Error: trackwrites only takes a range or a library, since %s takes in what cliffi and the kernel write to while handling the faults\n", argv[0]);
+    }
+#ifndef use_mprotect
+    (void)command;
+    raiseException(1,  "Error: trackwrites isn't supported on this platform\n");
+#else
+    WriteTracking* state = prepare_tracking(argv[0]);
+    uint64_t started = now_ns();
+    bool failed = run_tracked(state, command, argc - 1, argv + 1);
+    uint64_t took_ns = now_ns() - started;
+    if (failed) {
+        free_tracking(state);
+        siglongjmp(*current_exception_buffer, 1);
+    }
+    unsigned char* first_changed = find_changed_lines(state);
+    size_t changes_size = state->page_count * (state->page_size / TRACKWRITES_CACHE_LINE) + 1;
+    if (first_changed == NULL) {
+        free_tracking(state);
+        raiseException(1,  "Failed to allocate memory for tracking writes.\n");
+    }
+    print_writes(state, first_changed, took_ns);
+    munmap(first_changed, changes_size);
+    free_tracking(state);
+#endif
+}
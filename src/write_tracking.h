@@ -0,0 +1,25 @@
+#ifndef WRITE_TRACKING_H
+#define WRITE_TRACKING_H
+
+// Finds which pages and cache lines of memory a single call writes to:
+//
+//   trackwrites <where> <library> <return_typeflag> <function_name> [args..]
+//
+// where is a range <start>-<end> (its writable parts) or a library (its data and bss), widened to whole pages. The heap
+// isn't taken, since cliffi writes to it while running the call, and the kernel writes to the thread control block in
+// it while delivering the signal, which is left out of ranges for the same reason. Its pages are made read only, and
+// then the call (or any other command) is run. The first write to each page faults, and the fault handler copies the page as it was
+// before making it writable again, so that only the pages written to are ever copied, and the call only slows down
+// by one fault per page. Once the call is over (or has failed) the pages are made writable again, and each page
+// written is compared with its copy a cache line (TRACKWRITES_CACHE_LINE bytes) at a time, all before printing the
+// lines that changed with the library and symbol (or else the mapping) they start in, which writes to memory itself. Writes that left a line as it was show up
+// as a page written to with no lines changed. Up to TRACKWRITES_MAX_PRINTED lines are printed.
+// Writes cliffi itself makes to a range while running the call show up too. Not on Windows.
+
+#define TRACKWRITES_CACHE_LINE 64
+#define TRACKWRITES_MAX_PRINTED 256
+
+// The REPL command, given the args after trackwrites, and the whole line for errors from the call
+void run_trackwrites_command(char* command, int argc, char** argv);
+
+#endif // WRITE_TRACKING_H
@@ -630,6 +630,13 @@ int sum_array(int* arr, int size) {
     return sum;
 }
 
+// Sets arr[start..end) to value, leaving the rest of the array alone
+void set_array_range(int* arr, int start, int end, int value) {
+    for (int i = start; i < end; i++) {
+        arr[i] = value;
+    }
+}
+
 // Function that demonstrates deeper pointer depths
 int increment_at_pointer_pointer(int** pp) {
     if (pp && *pp) {
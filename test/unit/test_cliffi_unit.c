@@ -2,6 +2,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "types_and_utils.h"
+#include "array_parser.h"
+#include "hex_decoder.h"
+#include "number_formatter.h"
+#include "array_stats.h"
+#include "tokenize.h"
+#include "arena.h"
+#include "control_flow.h"
+#include <math.h>
+#include <string.h>
 
 // Declare the function to test
 ArgType infer_arg_type_single(const char* argval);
@@ -44,6 +53,148 @@ void test_infer_arg_type_single_char(void) {
     TEST_ASSERT_EQUAL_INT(TYPE_CHAR, infer_arg_type_single("Z"));
 }
 
+void test_parse_array_literal_ints(void) {
+    const char* literal = "1,-2, 345678901 ,0x10,010,-2147483648";
+    size_t count;
+    int* values = parse_array_literal(literal, strlen(literal), TYPE_INT, 0, false, &count);
+    int expected[] = {1, -2, 345678901, 16, 8, (int)-2147483648LL};
+    TEST_ASSERT_EQUAL_INT(6, (int)count);
+    TEST_ASSERT_EQUAL_INT_ARRAY(expected, values, 6);
+    free(values);
+}
+
+void test_parse_array_literal_doubles_match_strtod(void) {
+    const char* literal = "0.1,-2.5,3,1e22,1.7976931348623157e308,123456789.123456789,4.9e-324,2.5d";
+    size_t count;
+    double* values = parse_array_literal(literal, strlen(literal), TYPE_DOUBLE, 0, false, &count);
+    const char* elements[] = {"0.1", "-2.5", "3", "1e22", "1.7976931348623157e308", "123456789.123456789", "4.9e-324", "2.5"};
+    TEST_ASSERT_EQUAL_INT(8, (int)count);
+    for (size_t i = 0; i < count; i++) {
+        double expected = strtod(elements[i], NULL);
+        TEST_ASSERT_EQUAL_MEMORY(&expected, &values[i], sizeof(double));
+    }
+    free(values);
+}
+
+void test_count_array_literal_elements_from_file(void) {
+    const char* contents = "1, 2\n3\n\n 4,\n";
+    TEST_ASSERT_EQUAL_INT(4, (int)count_array_literal_elements(contents, strlen(contents), true));
+    TEST_ASSERT_EQUAL_INT(3, (int)count_array_literal_elements("1,2,3", 5, false));
+}
+
+void test_decode_hex_literal_long_mixed_case(void) {
+    // long enough to go through the vectorized blocks as well as the scalar tail
+    unsigned char expected[301];
+    char literal[2 + 2 * sizeof(expected) + 1] = "0x";
+    for (size_t i = 0; i < sizeof(expected); i++) {
+        expected[i] = (unsigned char)(i * 37 + 11);
+        sprintf(literal + 2 + 2 * i, i % 3 ? "%02x" : "%02X", expected[i]);
+    }
+    unsigned char decoded[sizeof(expected)];
+    TEST_ASSERT_EQUAL_INT(sizeof(expected), (int)decode_hex_literal(literal, strlen(literal), decoded));
+    TEST_ASSERT_EQUAL_MEMORY(expected, decoded, sizeof(expected));
+}
+
+void test_decode_hex_literal_separators(void) {
+    const char* literals[] = {"0xde ad:be\\xef", "\\xde\\xad\\xbe\\xef", "0xDE:AD:BE:EF"};
+    unsigned char expected[] = {0xde, 0xad, 0xbe, 0xef};
+    for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++) {
+        unsigned char decoded[16];
+        TEST_ASSERT_TRUE(is_hex_array_literal(literals[i]));
+        TEST_ASSERT_EQUAL_INT(4, (int)decode_hex_literal(literals[i], strlen(literals[i]), decoded));
+        TEST_ASSERT_EQUAL_MEMORY(expected, decoded, 4);
+    }
+    TEST_ASSERT_FALSE(is_hex_array_literal("deadbeef"));
+    TEST_ASSERT_FALSE(is_hex_array_literal("0xx1"));
+    TEST_ASSERT_FALSE(is_hex_array_literal("0x0x12"));
+    TEST_ASSERT_FALSE(is_hex_array_literal("0xdeag"));
+    TEST_ASSERT_FALSE(is_hex_array_literal("\\x\\x12"));
+}
+
+static void assert_formats_double_as(double value, const char* expected) {
+    char buffer[NUMBER_FORMAT_BUFFER_SIZE + 1];
+    buffer[format_double_shortest(value, buffer)] = '\0';
+    TEST_ASSERT_EQUAL_STRING(expected, buffer);
+}
+
+void test_format_double_shortest(void) {
+    assert_formats_double_as(3.0, "3.0");
+    assert_formats_double_as(0.5, "0.5");
+    assert_formats_double_as(-2.25, "-2.25");
+    assert_formats_double_as(0.1, "0.1");
+    assert_formats_double_as(0.1 + 0.2, "0.30000000000000004");
+    assert_formats_double_as(1e300, "1e+300");
+    assert_formats_double_as(5e-324, "5e-324");
+}
+
+void test_format_double_shortest_round_trips(void) {
+    char buffer[NUMBER_FORMAT_BUFFER_SIZE + 1];
+    uint64_t bits = 0x3ff0000000000001ULL;
+    for (int i = 0; i < 10000; i++) {
+        bits = bits * 6364136223846793005ULL + 1442695040888963407ULL; // arbitrary bit patterns
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (value != value) continue; // nan
+        buffer[format_double_shortest(value, buffer)] = '\0';
+        TEST_ASSERT_TRUE(strtod(buffer, NULL) == value);
+    }
+}
+
+void test_format_int64(void) {
+    char buffer[NUMBER_FORMAT_BUFFER_SIZE + 1];
+    buffer[format_int64(INT64_MIN, buffer)] = '\0';
+    TEST_ASSERT_EQUAL_STRING("-9223372036854775808", buffer);
+    buffer[format_uint64(0, buffer)] = '\0';
+    TEST_ASSERT_EQUAL_STRING("0", buffer);
+    buffer[format_uint64(1234567, buffer)] = '\0';
+    TEST_ASSERT_EQUAL_STRING("1234567", buffer);
+}
+
+void test_numeric_array_stats_skip_nans(void) {
+    double values[7] = {3.5, NAN, -2.0, 8.25, NAN, 1.0, 0.25}; // odd length so the scalar tail gets used too
+    NumericArrayStats stats = compute_numeric_array_stats(values, TYPE_DOUBLE, 7);
+    TEST_ASSERT_EQUAL_INT(7, (int)stats.count);
+    TEST_ASSERT_EQUAL_INT(2, (int)stats.nan_count);
+    TEST_ASSERT_TRUE(stats.min.d == -2.0);
+    TEST_ASSERT_TRUE(stats.max.d == 8.25);
+    TEST_ASSERT_TRUE(stats.sum == 11.0);
+
+    float floats[5] = {NAN, 1.5f, -4.0f, 2.5f, 16.0f};
+    stats = compute_numeric_array_stats(floats, TYPE_FLOAT, 5);
+    TEST_ASSERT_EQUAL_INT(1, (int)stats.nan_count);
+    TEST_ASSERT_TRUE(stats.min.d == -4.0 && stats.max.d == 16.0 && stats.sum == 16.0);
+
+    short shorts[3] = {-7, 300, 12};
+    stats = compute_numeric_array_stats(shorts, TYPE_SHORT, 3);
+    TEST_ASSERT_TRUE(stats.min.i == -7 && stats.max.i == 300 && stats.sum == 305.0);
+}
+
+void test_tokenize_in_place_quotes_and_escapes(void) {
+    ArenaMark mark = arena_mark(command_arena());
+    char line[] = "lib.so  v \"two words\" '' a\\ b \"q\\\"x\\n\"";
+    int argc;
+    char** argv;
+    tokenize_in_place(line, strlen(line), &argc, &argv);
+    TEST_ASSERT_EQUAL_INT(6, argc);
+    TEST_ASSERT_TRUE(argv[0] == line); // plain tokens aren't moved
+    TEST_ASSERT_EQUAL_STRING("lib.so", argv[0]);
+    TEST_ASSERT_EQUAL_STRING("v", argv[1]);
+    TEST_ASSERT_EQUAL_STRING("two words", argv[2]);
+    TEST_ASSERT_EQUAL_STRING("", argv[3]);
+    TEST_ASSERT_EQUAL_STRING("a b", argv[4]);
+    TEST_ASSERT_EQUAL_STRING("q\"x\\n", argv[5]); // inside quotes an escape that isn't for the quote or a backslash is kept
+    TEST_ASSERT_NULL(argv[6]);
+    arena_release(command_arena(), mark);
+}
+
+void test_block_depth_change_ignores_quotes_and_shell_lines(void) {
+    TEST_ASSERT_EQUAL_INT(1, block_depth_change("for n in 0..3 {"));
+    TEST_ASSERT_EQUAL_INT(0, block_depth_change("} else {"));
+    TEST_ASSERT_EQUAL_INT(-1, block_depth_change("  }"));
+    TEST_ASSERT_EQUAL_INT(0, block_depth_change("lib.so v puts \"{\" '}{' \\{"));
+    TEST_ASSERT_EQUAL_INT(0, block_depth_change("  !echo {"));
+}
+
 int main(void) {
     UNITY_BEGIN();
     RUN_TEST(test_infer_arg_type_single_int);
@@ -52,5 +203,16 @@ int main(void) {
     RUN_TEST(test_infer_arg_type_single_bool);
     RUN_TEST(test_infer_arg_type_single_string);
     RUN_TEST(test_infer_arg_type_single_char);
+    RUN_TEST(test_parse_array_literal_ints);
+    RUN_TEST(test_parse_array_literal_doubles_match_strtod);
+    RUN_TEST(test_count_array_literal_elements_from_file);
+    RUN_TEST(test_decode_hex_literal_long_mixed_case);
+    RUN_TEST(test_decode_hex_literal_separators);
+    RUN_TEST(test_format_double_shortest);
+    RUN_TEST(test_format_double_shortest_round_trips);
+    RUN_TEST(test_format_int64);
+    RUN_TEST(test_numeric_array_stats_skip_nans);
+    RUN_TEST(test_tokenize_in_place_quotes_and_escapes);
+    RUN_TEST(test_block_depth_change_ignores_quotes_and_shell_lines);
     return UNITY_END();
 } 
\ No newline at end of file